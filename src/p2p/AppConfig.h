@@ -63,6 +63,215 @@ public:
         return 8081;
     }
 
+    /**
+     * @brief UdpTunnel接收缓存初始大小，kcp收到的数据在这里拼成完整消息
+     * @return
+     */
+    static size_t getUdpTunnelRecvBufferSize() {
+        return 64 * 1024;
+    }
+
+    /**
+     * @brief UdpTunnel接收缓存最大大小，超过后数据留在kcp接收队列中，不再调用ikcp_recv
+     * @return
+     */
+    static size_t getUdpTunnelRecvBufferMaxSize() {
+        return 16 * 1024 * 1024;
+    }
+
+    /**
+     * @brief UdpTunnel是否使用recvmmsg/sendmmsg批量收发，仅Linux上有效
+     * @return
+     */
+    static bool getUdpBatchIoEnabled() {
+        return false;
+    }
+
+    /**
+     * @brief UdpTunnel是否启用UDP GSO/GRO，仅在启用批量收发时有效，内核不支持时自动关闭；启用前向纠错时只启用GSO
+     * @return
+     */
+    static bool getUdpOffloadEnabled() {
+        return false;
+    }
+
+    /**
+     * @brief 默认的kcp调优参数，见KcpProfile::Type，可通过JZSDK_SetKcpProfile修改
+     * @return
+     */
+    static int getKcpProfile() {
+        return 0;
+    }
+
+    /**
+     * @brief UdpTunnel是否探测路径MTU并调整kcp的mtu，对端不响应时保持KcpProfile中的mtu
+     * @return
+     */
+    static bool getUdpMtuProbeEnabled() {
+        return true;
+    }
+
+    /**
+     * @brief UdpTunnel是否启用前向纠错，需要设备端同时支持
+     * @return
+     */
+    static bool getUdpFecEnabled() {
+        return false;
+    }
+
+    /**
+     * @brief 前向纠错每组的数据包数
+     * @return
+     */
+    static size_t getUdpFecDataShards() {
+        return 10;
+    }
+
+    /**
+     * @brief 前向纠错每组最多的校验包数，实际数量按丢包率调整
+     * @return
+     */
+    static size_t getUdpFecMaxParityShards() {
+        return 5;
+    }
+
+    /**
+     * @brief UdpTunnel是否按代理连接的优先级调度发送，关闭时按写入顺序发送
+     * @return
+     */
+    static bool getUdpStreamSchedulerEnabled() {
+        return true;
+    }
+
+    /**
+     * @brief 隧道发送积压的高水位，超过后暂停读取写入数据的本地连接
+     * @return
+     */
+    static size_t getProxyBackpressureHighWatermark() {
+        return 1024 * 1024;
+    }
+
+    /**
+     * @brief 隧道发送积压的低水位，低于后恢复读取所有暂停的本地连接
+     * @return
+     */
+    static size_t getProxyBackpressureLowWatermark() {
+        return 256 * 1024;
+    }
+
+    /**
+     * @brief 是否启用每个连接的接收窗口（TcpInit中带window，写给本地App后发送WindowUpdate），需要设备端同时支持
+     * @return
+     */
+    static bool getStreamFlowControlEnabled() {
+        return false;
+    }
+
+    /**
+     * @brief 每个连接的接收窗口，设备端最多发出这么多字节未确认的数据；本地App读走一半后归还额度
+     * @return
+     */
+    static uint32_t getStreamReceiveWindow() {
+        return 256 * 1024;
+    }
+
+    /**
+     * @brief 中继隧道的tcp连接数，大于1时需要中继服务器支持同一order_id的多条连接
+     * @return
+     */
+    static size_t getRelayConnectionNum() {
+        return 1;
+    }
+
+    /**
+     * @brief 是否启用连接迁移：p2p隧道可用后，已走中继的连接迁移到p2p，需要设备端同时支持
+     * @return
+     */
+    static bool getStreamMigrationEnabled() {
+        return false;
+    }
+
+    /**
+     * @brief 迁移等待旧隧道剩余数据的超时时间，毫秒，超时后关闭本地连接
+     * @return
+     */
+    static uint32_t getStreamMigrationTimeout() {
+        return 10 * 1000;
+    }
+
+    /**
+     * @brief 是否启用首包对冲：两条隧道都可用时，新连接的TcpInit和前几KB数据同时从中继和p2p发出，需要设备端同时支持
+     * @return
+     */
+    static bool getStreamHedgingEnabled() {
+        return false;
+    }
+
+    /**
+     * @brief 对冲期间每条隧道最多发出的字节数，超过后还没有响应时留在p2p隧道
+     * @return
+     */
+    static size_t getStreamHedgingLimit() {
+        return 16 * 1024;
+    }
+
+    /**
+     * @brief 是否按隧道质量（rtt、丢包率、可用带宽）为新连接选择隧道；不启用时p2p可用就走p2p
+     * @return
+     */
+    static bool getTunnelQualitySelectionEnabled() {
+        return true;
+    }
+
+    /**
+     * @brief 是否按device_token缓存上次会话胜出的路径，下次会话先探测上次直连成功的ip、跳过失效的ip
+     * @return
+     */
+    static bool getPathCacheEnabled() {
+        return true;
+    }
+
+    /**
+     * @brief 保留p2p隧道的设备数（含当前设备），切回这些设备时不用重新打洞；为1时只复用同一设备的隧道
+     * @return
+     */
+    static uint32_t getWarmTunnelNum() {
+        return 4;
+    }
+
+    /**
+     * @brief 预热的p2p隧道多久没有使用后断开，毫秒
+     * @return
+     */
+    static uint32_t getWarmTunnelIdleTimeout() {
+        return 10 * 60 * 1000;
+    }
+
+    /**
+     * @brief 同时打开的设备会话数，会话n的本地代理监听getLocalHttpProxyPort() + n
+     * @return
+     */
+    static uint32_t getMaxSessionNum() {
+        return 16;
+    }
+
+    /**
+     * @brief 所有设备会话的下行总带宽，字节/秒，按会话权重分配；0表示不限制
+     * @return
+     */
+    static uint32_t getSessionBandwidthLimit() {
+        return 0;
+    }
+
+    /**
+     * @brief 本地代理的I/O线程数，所有会话共用，本地连接按连接数均分到这些线程；0表示在隧道loop线程中处理
+     * @note 第一个会话打开时启动，线程数不随会话数增加
+     * @return
+     */
+    static int getProxyThreadNum() {
+        return 2;
+    }
+
 };
 
 #endif //SRC_APP_CONFIG_H
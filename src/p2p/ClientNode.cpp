@@ -1,10 +1,13 @@
+#include <cstdio>
+#include <ctime>
+#include <future>
 #include <set>
 #include <string>
 #include "ClientNode.h"
-#include "hv/requests.h"
 #include "hv/hlog.h"
+#include "hv/htime.h"
 #include "AppConfig.h"
-#include "UdpTunnel.h"
+#include "UdpTunnelPool.h"
 #include "RelayTunnel.h"
 #include "ProxyServer.h"
 
@@ -14,16 +17,16 @@ using namespace std;
 // #define DISABLE_RELAY_TUNNEL    //关闭中断，仅用于测试，正式上线后不可关闭
 // #define DEBUG_CLIENT_NODE
 
-enum TunnelId {
-    kInvalidTunnel = 0,
-    kUdpTunnel = 100,
-    kRelayTunnel = 101,
-};
-
 ClientNode::ClientNode()
-    : run_(true), relay_tunnel_(hv::TcpClient::loop()), udp_tunnel_(hv::TcpClient::loop()),
-      proxy_server_(hv::TcpClient::loop())
-{}
+    : run_(true), hedging_(AppConfig::getStreamHedgingLimit()), current_session_(-1),
+      bandwidth_(AppConfig::getSessionBandwidthLimit()), bandwidth_time_(0),
+      proxy_workers_(AppConfig::getProxyThreadNum()), udp_tunnel_pool_(hv::TcpClient::loop())
+{
+    for (uint32_t i = 0; i < AppConfig::getMaxSessionNum(); i++) {
+        sessions_.emplace_back(new DeviceSession(hv::TcpClient::loop(), i));
+        sessions_.back()->proxy_server.setSink(this);
+    }
+}
 
 // ClientNode::ClientNode(const ClientNode &) {
 // }
@@ -45,6 +48,12 @@ int ClientNode::init(const std::string &user_token)
             std::string log_file = run_dir + "/" + "client_node.log";
             hlog_set_file(log_file.c_str());
         }
+        if (AppConfig::getPathCacheEnabled() && !run_dir.empty()) {
+            // 缓存不可用时每次会话都完整探测
+            if (0 != path_cache_.init(run_dir + "/" + "path_cache.dat")) {
+                LOG_WARN("ClientNode::init failed in PathCache::init");
+            }
+        }
         hlog_set_level(LOG_LEVEL_DEBUG);
         hlog_set_format("%y-%m-%d %H:%M:%S.%z %L %s");
 
@@ -95,11 +104,53 @@ int ClientNode::init(const std::string &user_token)
 
         this->loop()->setInterval(10 * 1000, [this](hv::TimerID timerID) {
             // LOG_DEBUG("Heartbeat Timer");
+            udp_tunnel_pool_.expire(AppConfig::getWarmTunnelIdleTimeout());
             if (this->channel->isConnected()) {
                 _sendUserHeartbeatMsg();
             }
         });
 
+        if (AppConfig::getTunnelQualitySelectionEnabled()) {
+            this->loop()->setInterval(1000, [this](hv::TimerID timerID) {
+                for (auto &session : sessions_) {
+                    if (session->isOpen()) {
+                        _updateTunnelSelection(*session);
+                    }
+                }
+            });
+        }
+
+        if (bandwidth_.isEnabled()) {
+            bandwidth_time_ = gettick_ms();
+            this->loop()->setInterval(1000, [this](hv::TimerID timerID) {
+                _scheduleBandwidth();
+            });
+        }
+
+        // p2p打通后记录路径，会话上已经走中继的连接迁移过去
+        udp_tunnel_pool_.onTunnelReady = [this](UdpTunnel *tunnel) {
+            DeviceSession *session = _findSession(tunnel->getDeviceToken());
+            if (nullptr == session) {
+                return;
+            }
+            _savePath(*session, PathCache::kPathUdp);
+            if (AppConfig::getStreamMigrationEnabled()) {
+                _migrateStreams(*session, kUdpTunnel);
+            }
+        };
+        for (auto &session : sessions_) {
+            DeviceSession *raw = session.get();
+            session->lan_probe.onProbeFailed = [this, raw](const std::string &ip) {
+                _onLanProbeFailed(*raw, ip);
+            };
+        }
+
+        if (AppConfig::getStreamMigrationEnabled()) {
+            this->loop()->setInterval(1000, [this](hv::TimerID timerID) {
+                _expireMigrations();
+            });
+        }
+
         {
             unpack_setting_t setting;
             memset(&setting, 0, sizeof(unpack_setting_t));
@@ -121,11 +172,6 @@ int ClientNode::init(const std::string &user_token)
         withTLS();
         hv::TcpClient::start();
 
-        if (0 != _initProxyServer()) {
-            LOG_ERROR("ServerNode::init failed in _initProxyServer");
-            return -1;
-        }
-
         return 0;
     } catch (...) {
         LOG_ERROR("ClientNode::init exception");
@@ -138,6 +184,7 @@ int ClientNode::fini()
     _finiProxyServer();
     _finiUdpTunnel();
     stop();
+    path_cache_.fini();
     return 0;
 }
 
@@ -160,14 +207,114 @@ int ClientNode::stop()
 
 int ClientNode::startSession(std::string device_token)
 {
-    return _sendUserP2PConnectMsg(device_token);
+    if (device_token.empty()) {
+        LOG_ERROR("ClientNode::startSession failed:invalid input.");
+        return -1;
+    }
+    if (!loop()->isRunning() || user_token_.empty()) {
+        // loop没有运行时等不到结果
+        LOG_ERROR("ClientNode::startSession failed:not running.");
+        return -1;
+    }
+
+    // 先在loop线程中取得会话的p2p隧道，UserP2PConnect带上该隧道的出口地址；
+    // 上一个设备的会话关闭，其p2p隧道留在池中预热
+    std::promise<int> promise;
+    std::future<int> future = promise.get_future();
+    loop()->runInLoop([this, device_token, &promise]() {
+        if (current_session_ >= 0) {
+            DeviceSession &current = *sessions_[current_session_];
+            if (current.isOpen() && (current.device_token != device_token)) {
+                _closeSession(current);
+            }
+        }
+
+        DeviceSession *session = _openSession(device_token);
+        if (nullptr == session) {
+            LOG_ERROR("ClientNode::startSession failed in _openSession. device_token:" << device_token);
+            current_session_ = -1;
+            promise.set_value(-1);
+            return;
+        }
+        current_session_ = (int)session->id;
+        promise.set_value(_sendUserP2PConnectMsg(*session));
+    });
+    return future.get();
 }
 
 int ClientNode::stopSession()
 {
-    // TODO 需要释放哪些资源？
+    loop()->runInLoop([this]() {
+        if (current_session_ >= 0) {
+            _closeSession(*sessions_[current_session_]);
+            current_session_ = -1;
+        }
+    });
+    return 0;
+}
+
+int ClientNode::openSession(const std::string &device_token)
+{
+    if (device_token.empty()) {
+        LOG_ERROR("ClientNode::openSession failed:invalid input.");
+        return -1;
+    }
+    if (!loop()->isRunning() || user_token_.empty()) {
+        // loop没有运行时等不到分配结果
+        LOG_ERROR("ClientNode::openSession failed:not running.");
+        return -1;
+    }
+
+    // 会话状态只在loop线程中修改，在loop线程中分配会话并等待结果
+    std::promise<int> promise;
+    std::future<int> future = promise.get_future();
+    loop()->runInLoop([this, device_token, &promise]() {
+        DeviceSession *session = _openSession(device_token);
+        if (nullptr != session) {
+            _sendUserP2PConnectMsg(*session);
+        }
+        promise.set_value((nullptr == session) ? -1 : (int)session->id);
+    });
+    return future.get();
+}
+
+int ClientNode::closeSession(uint32_t session_id)
+{
+    if (session_id >= sessions_.size()) {
+        LOG_ERROR("ClientNode::closeSession failed:invalid session_id. session_id:" << session_id);
+        return -1;
+    }
+
+    loop()->runInLoop([this, session_id]() {
+        _closeSession(*sessions_[session_id]);
+        if ((int)session_id == current_session_) {
+            current_session_ = -1;
+        }
+    });
+    return 0;
+}
+
+int ClientNode::setSessionWeight(uint32_t session_id, uint32_t weight)
+{
+    if (session_id >= sessions_.size()) {
+        LOG_ERROR("ClientNode::setSessionWeight failed:invalid session_id. session_id:" << session_id);
+        return -1;
+    }
+    if ((weight <= 0) || (weight > SessionBandwidth::kMaxWeight)) {
+        LOG_ERROR("ClientNode::setSessionWeight failed:invalid weight. weight:" << weight);
+        return -1;
+    }
+
+    loop()->runInLoop([this, session_id, weight]() {
+        bandwidth_.setWeight(session_id, weight);
+    });
+    return 0;
+}
+
+int ClientNode::onProxyConnected(uint32_t session_id, uint32_t proxy_id)
+{
+    proxy_session_map_[proxy_id] = session_id;
     return 0;
-    // return P2PSession::instance().stopSession();
 }
 
 int ClientNode::onProxyData(uint32_t proxy_id, char *buffer, uint32_t length)
@@ -177,55 +324,57 @@ int ClientNode::onProxyData(uint32_t proxy_id, char *buffer, uint32_t length)
         return -1;
     }
 
+    DeviceSession *session = _getSession(proxy_id);
+    if ((nullptr == session) || !session->isOpen()) {
+        LOG_ERROR("ClientNode::onProxyData failed:session not open. proxy_id:" << proxy_id << " length:" << length);
+        return -1;
+    }
+
     bool new_proxy = false;
-    uint32_t tunnel_id = _getTunnelId(proxy_id, new_proxy);
+    uint32_t tunnel_id = _getTunnelId(*session, proxy_id, new_proxy);
     if (kInvalidTunnel == tunnel_id) {
         LOG_ERROR("ClientNode::onProxyData failed:invalid tunnel. proxy_id:" << proxy_id << " length:" << length);
         return -1;
     }
-
-    switch (tunnel_id) {
-        case kUdpTunnel: {
-            LOG_DEBUG("ClientNode::onProxyData. udp tunnel. length:" << length << " new:" << new_proxy);
-            if (new_proxy) {
-                if (0 != udp_tunnel_.onProxyData(
-                             kTunnelMsgTypeTcpInit, proxy_id, _getTcpInitJson(AppConfig::getDeviceApiPort()))) {
-                    LOG_ERROR("ClientNode::onProxyData failed in sendData."
-                              << " proxy_id:" << proxy_id << " length:" << length);
-                    return -1;
-                }
-            }
-            if (0 != udp_tunnel_.onProxyData(kTunnelMsgTypeTcpData, proxy_id, buffer, length)) {
-                LOG_ERROR("ClientNode::onProxyData failed in sendData."
-                          << " proxy_id:" << proxy_id << " length:" << length);
-                return -1;
-            }
-
-            return 0;
+    if ((kUdpTunnel != tunnel_id) && (kRelayTunnel != tunnel_id)) {
+        LOG_ERROR("ClientNode::onProxyData failed:invalid tunnel id."
+                  << " proxy_id:" << proxy_id << " length:" << length << " tunnel:" << tunnel_id);
+        return -1;
+    }
+    LOG_DEBUG("ClientNode::onProxyData. session:" << session->id << " tunnel:" << tunnel_id << " proxy_id:" << proxy_id
+              << " length:" << length << " new:" << new_proxy);
+
+    if (new_proxy) {
+        // 两条隧道都可用时，新连接的首包同时从两条隧道发出
+        bool hedged = AppConfig::getStreamHedgingEnabled() && session->isUdpReady() && session->relay_tunnel.isReady();
+        uint32_t secondary = (kUdpTunnel == tunnel_id) ? kRelayTunnel : kUdpTunnel;
+        hedging_.onStreamStart(proxy_id, hedged, tunnel_id, secondary, gettick_ms());
+
+        std::string json = _getTcpInitJson(AppConfig::getDeviceApiPort(), hedged);
+        if (0 != _sendToTunnel(tunnel_id, kTunnelMsgTypeTcpInit, proxy_id, json.c_str(), (uint32_t)json.length())) {
+            LOG_ERROR("ClientNode::onProxyData failed in sendData."
+                      << " proxy_id:" << proxy_id << " length:" << length);
+            return -1;
         }
-
-        case kRelayTunnel: {
-            LOG_DEBUG("ClientNode::onProxyData. relay tunnel. proxy_id:" << proxy_id << " length:" << length);
-            if (new_proxy) {
-                if (0 != relay_tunnel_.onProxyData(
-                             kTunnelMsgTypeTcpInit, proxy_id, _getTcpInitJson(AppConfig::getDeviceApiPort()))) {
-                    LOG_ERROR("ClientNode::onProxyData failed in sendData."
-                              << " proxy_id:" << proxy_id << " length:" << length);
-                    return -1;
-                }
-            }
-            if (0 != relay_tunnel_.onProxyData(kTunnelMsgTypeTcpData, proxy_id, buffer, length)) {
-                LOG_ERROR("ClientNode::onProxyData failed in sendData."
-                          << " proxy_id:" << proxy_id << " length:" << length);
-                return -1;
-            }
-            return 0;
+        if (hedged
+            && (0 != _sendToTunnel(secondary, kTunnelMsgTypeTcpInit, proxy_id, json.c_str(), (uint32_t)json.length()))) {
+            LOG_WARN("ClientNode::onProxyData. hedged TcpInit failed. proxy_id:" << proxy_id << " tunnel:" << secondary);
+            hedging_.commit(proxy_id, tunnel_id);
         }
     }
+    if (0 != _sendToTunnel(tunnel_id, kTunnelMsgTypeTcpData, proxy_id, buffer, length)) {
+        LOG_ERROR("ClientNode::onProxyData failed in sendData."
+                  << " proxy_id:" << proxy_id << " length:" << length);
+        return -1;
+    }
+    if (AppConfig::getStreamMigrationEnabled()) {
+        migration_.onSent(proxy_id, length);
+    }
+    if (hedging_.isHedging(proxy_id)) {
+        _sendHedgedData(proxy_id, tunnel_id, buffer, length);
+    }
 
-    LOG_ERROR("ClientNode::onProxyData failed:invalid tunnel id."
-              << " proxy_id:" << proxy_id << " length:" << length << " tunnel:" << tunnel_id);
-    return -1;
+    return 0;
 }
 
 int ClientNode::delProxy(uint32_t proxy_id)
@@ -235,45 +384,198 @@ int ClientNode::delProxy(uint32_t proxy_id)
         return -1;
     }
 
-    bool new_proxy = false;
-    uint32_t tunnel_id = _getTunnelId(proxy_id, new_proxy);
+    uint32_t tunnel_id = kInvalidTunnel;
+    auto it = proxy_tunnel_map_.find(proxy_id);
+    if (proxy_tunnel_map_.end() != it) {
+        tunnel_id = it->second;
+    }
     if (kInvalidTunnel == tunnel_id) {
         LOG_DEBUG("ClientNode::delProxy failed:invalid tunnel. proxy_id:" << proxy_id);
         return 0;
     }
 
-    switch (tunnel_id) {
-        case kUdpTunnel: {
-            if (0 != udp_tunnel_.onProxyData(kTunnelMsgTypeTcpFini, proxy_id)) {
-                LOG_ERROR("ClientNode::delProxy failed in sendData. proxy_id:" << proxy_id);
-                return -1;
-            }
-            return 0;
-        }
+    if (0 != _sendToTunnel(tunnel_id, kTunnelMsgTypeTcpFini, proxy_id, nullptr, 0)) {
+        LOG_ERROR("ClientNode::delProxy failed in sendData. proxy_id:" << proxy_id << " tunnel:" << tunnel_id);
+        return -1;
+    }
+    return 0;
+}
 
-        case kRelayTunnel: {
-            if (0 != relay_tunnel_.onProxyData(kTunnelMsgTypeTcpFini, proxy_id)) {
-                LOG_ERROR("ClientNode::delProxy failed in sendData. proxy_id:" << proxy_id);
-                return -1;
-            }
-            return 0;
+int ClientNode::onProxyWindowUpdate(uint32_t proxy_id, uint32_t increment)
+{
+    uint32_t tunnel_id = kInvalidTunnel;
+    auto it = proxy_tunnel_map_.find(proxy_id);
+    if (proxy_tunnel_map_.end() != it) {
+        tunnel_id = it->second;
+    }
+    if (kInvalidTunnel == tunnel_id) {
+        // 连接还没有发出TcpInit，对端不会发来数据
+        return 0;
+    }
+
+    TunnelWindowUpdate update;
+    update.increment = increment;
+    return _sendToTunnel(tunnel_id, kTunnelMsgTypeWindowUpdate, proxy_id, (const char *)&update, sizeof(update));
+}
+
+int ClientNode::onProxyClosed(uint32_t proxy_id)
+{
+    DeviceSession *session = _getSession(proxy_id);
+    uint32_t tunnel_id = kInvalidTunnel;
+    auto it = proxy_tunnel_map_.find(proxy_id);
+    if (proxy_tunnel_map_.end() != it) {
+        tunnel_id = it->second;
+        proxy_tunnel_map_.erase(it);
+    }
+    proxy_session_map_.erase(proxy_id);
+
+    if ((kRelayTunnel == tunnel_id) && (nullptr != session)) {
+        session->relay_tunnel.releaseProxy(proxy_id);
+    }
+    if ((nullptr != session) && (nullptr != session->udp_tunnel)) {
+        // 优先级可能设置在udp隧道上，不管连接走哪条隧道都要删除
+        session->udp_tunnel->removeProxy(proxy_id);
+    }
+    migration_.remove(proxy_id);
+    hedging_.remove(proxy_id);
+    return 0;
+}
+
+int ClientNode::onTunnelData(uint32_t tunnel_id, uint32_t proxy_id, char *data, uint32_t length)
+{
+    uint32_t winner = 0;
+    if (StreamHedging::kDrop == hedging_.onData(proxy_id, tunnel_id, gettick_ms(), winner)) {
+        // 落选隧道上重复的数据
+        return 0;
+    }
+    if (0 != winner) {
+        _commitHedge(proxy_id, winner);
+    }
+
+    ProxyServer *proxy_server = getProxyServer(proxy_id);
+    if (nullptr == proxy_server) {
+        LOG_ERROR("ClientNode::onTunnelData failed:proxy not found. tunnel_id:" << tunnel_id << " proxy_id:" << proxy_id);
+        return -1;
+    }
+    if (!AppConfig::getStreamMigrationEnabled()) {
+        return proxy_server->sendDataToProxy(proxy_id, data, length);
+    }
+
+    int ret = migration_.onData(proxy_id, tunnel_id, data, length,
+                                [proxy_server](uint32_t id, char *buffer, uint32_t size) {
+        return proxy_server->sendDataToProxy(id, buffer, size);
+    });
+    return _onMigrationResult(proxy_id, ret);
+}
+
+int ClientNode::onTunnelFini(uint32_t tunnel_id, uint32_t proxy_id)
+{
+    uint32_t winner = 0;
+    if (StreamHedging::kDrop == hedging_.onFini(proxy_id, tunnel_id, winner)) {
+        if (0 != winner) {
+            proxy_tunnel_map_[proxy_id] = winner;
         }
+        return 0;
+    }
+    if (AppConfig::getStreamMigrationEnabled()
+        && (StreamMigration::kDeferred == migration_.onFini(proxy_id, tunnel_id))) {
+        // 旧隧道上还有数据没收完，收完后再关闭
+        LOG_DEBUG("ClientNode::onTunnelFini. deferred. tunnel_id:" << tunnel_id << " proxy_id:" << proxy_id);
+        return 0;
     }
 
-    LOG_ERROR("ClientNode::delProxy failed:invalid tunnel id."
-              << " proxy_id:" << proxy_id << " tunnel:" << tunnel_id);
-    return -1;
+    ProxyServer *proxy_server = getProxyServer(proxy_id);
+    return (nullptr == proxy_server) ? -1 : proxy_server->delProxy(proxy_id);
 }
 
-ProxyServer &ClientNode::getProxyServer()
+int ClientNode::onTunnelMigrate(uint32_t tunnel_id, uint32_t proxy_id, uint64_t offset)
 {
-    return proxy_server_;
+    if (!AppConfig::getStreamMigrationEnabled()) {
+        LOG_WARN("ClientNode::onTunnelMigrate. migration disabled. tunnel_id:" << tunnel_id << " proxy_id:" << proxy_id);
+        return 0;
+    }
+    LOG_DEBUG("ClientNode::onTunnelMigrate. tunnel_id:" << tunnel_id << " proxy_id:" << proxy_id << " offset:" << offset);
+
+    if (!migration_.isMigrating(proxy_id) && (0 != _migrateProxy(proxy_id, tunnel_id))) {
+        // 对端发起的迁移，本端无法跟随
+        LOG_ERROR("ClientNode::onTunnelMigrate failed in _migrateProxy. tunnel_id:" << tunnel_id
+                  << " proxy_id:" << proxy_id);
+        _closeProxy(proxy_id);
+        return -1;
+    }
+
+    ProxyServer *proxy_server = getProxyServer(proxy_id);
+    if (nullptr == proxy_server) {
+        LOG_ERROR("ClientNode::onTunnelMigrate failed:proxy not found. tunnel_id:" << tunnel_id
+                  << " proxy_id:" << proxy_id);
+        return -1;
+    }
+    int ret = migration_.onPeerMigrate(proxy_id, tunnel_id, offset,
+                                       [proxy_server](uint32_t id, char *buffer, uint32_t size) {
+        return proxy_server->sendDataToProxy(id, buffer, size);
+    });
+    return _onMigrationResult(proxy_id, ret);
+}
+
+int ClientNode::setProxyPriority(uint16_t local_port, int priority)
+{
+    if ((priority < StreamScheduler::kHigh) || (priority >= StreamScheduler::kPriorityNum)) {
+        LOG_ERROR("ClientNode::setProxyPriority failed:invalid priority. priority:" << priority);
+        return -1;
+    }
+    if (!loop()->isRunning()) {
+        LOG_ERROR("ClientNode::setProxyPriority failed:not running.");
+        return -1;
+    }
+
+    // 连接表和调度器只在loop线程中使用，在loop线程中查找连接并等待结果
+    std::promise<int> promise;
+    std::future<int> future = promise.get_future();
+    loop()->runInLoop([this, local_port, priority, &promise]() {
+        for (auto &session : sessions_) {
+            uint32_t proxy_id = session->proxy_server.getProxyId(local_port);
+            if (0 == proxy_id) {
+                continue;
+            }
+            // 只有p2p隧道按优先级调度，连接还没有数据时先记录下来
+            if (nullptr != session->udp_tunnel) {
+                session->udp_tunnel->setProxyPriority(proxy_id, priority);
+            }
+            promise.set_value(0);
+            return;
+        }
+        LOG_ERROR("ClientNode::setProxyPriority failed:proxy not found. local_port:" << local_port);
+        promise.set_value(-1);
+    });
+    return future.get();
+}
+
+ProxyServer *ClientNode::getProxyServer(uint32_t proxy_id)
+{
+    DeviceSession *session = _getSession(proxy_id);
+    return (nullptr == session) ? nullptr : &session->proxy_server;
 }
 
 const char *ClientNode::getUrlPrefix()
 {
-    LOG_DEBUG("ClientNode::getUrlPrefix. url_prefix:" << url_prefix_);
-    return url_prefix_.c_str();
+    // 兼容单设备接口，调用方不检查空指针
+    int session_id = current_session_;
+    const char *url_prefix = (session_id < 0) ? nullptr : getSessionUrlPrefix((uint32_t)session_id);
+    return (nullptr == url_prefix) ? "" : url_prefix;
+}
+
+const char *ClientNode::getSessionUrlPrefix(uint32_t session_id)
+{
+    if (session_id >= sessions_.size()) {
+        LOG_ERROR("ClientNode::getSessionUrlPrefix failed:invalid session_id. session_id:" << session_id);
+        return nullptr;
+    }
+
+    // 返回会话自己的缓存，会话关闭或url前缀变化后指针仍然有效
+    std::lock_guard<std::mutex> lock(url_prefix_mutex_);
+    const char *url_prefix = sessions_[session_id]->url_prefix;
+    LOG_DEBUG("ClientNode::getSessionUrlPrefix. session_id:" << session_id << " url_prefix:" << url_prefix);
+    return ('\0' == url_prefix[0]) ? nullptr : url_prefix;
 }
 
 int ClientNode::_onConnected(const hv::SocketChannelPtr &channel)
@@ -355,14 +657,24 @@ int ClientNode::_onMessageUserP2PConnect(JsonHelper &json_helper)
     LOG_DEBUG("ClientNode::_onMessageUserP2PConnect. json:" + json_helper.json());
 
     /*
-     * 1、测试能否直连
-     * 2、测试p2p是否通；
-     * 3、测试中继是否通
-     * 4、启动代理
+     * 1、同时探测所有局域网ip能否直连，不等待结果；按路径缓存跳过最近失效的ip
+     * 2、启动中继
+     * 3、启动p2p
+     * 4、先通过代理访问，直连探测成功后切换到直连
      */
+    DeviceSession *session = _findSession(device_token);
+    if (nullptr == session) {
+        // 不是本客户端发起的会话
+        session = _openSession(device_token);
+        if (nullptr == session) {
+            // 会话都在使用中，不影响与服务器的连接
+            LOG_WARN("ClientNode::_onMessageUserP2PConnect. no free session. device_token:" << device_token);
+            return 0;
+        }
+    }
+    PathCache::setString(session->path_record.public_addr, sizeof(session->path_record.public_addr),
+                         device_public_addr);
 
-    // 测试是否可以直连，需要1秒
-    // TODO 测试中继，暂时关闭直连
 #ifdef DISABLE_DIRECT_CONNECT
     LOG_DEBUG("ClientNode::_onMessageUserP2PConnect. DIRECT CONNECTION DISABLED.");
 #else
@@ -392,36 +704,41 @@ int ClientNode::_onMessageUserP2PConnect(JsonHelper &json_helper)
         }
     }
 
-    for (auto it = ip_set.begin(); it != ip_set.end(); it++) {
-        if (_directConnect(*it)) {
-            LOG_DEBUG("ClientNode::_onMessageUserP2PConnect. connect directly. url_prefix:" + url_prefix_);
-            return 0;
+    if (!session->direct_ip.empty() && (ip_set.count(session->direct_ip) > 0)) {
+        // 按路径缓存提前探测的ip已经直连成功
+        LOG_DEBUG("ClientNode::_onMessageUserP2PConnect. already connected directly. ip:" << session->direct_ip);
+    } else {
+        if (!session->direct_ip.empty()) {
+            session->direct_ip.clear();
+            _setUrlPrefix(*session,
+                          "http://127.0.0.1:" + std::to_string(AppConfig::getLocalHttpProxyPort() + session->id) + "/");
         }
+        session->lan_probe.start(_filterDeadIps(*session, ip_set), [this, session](const std::string &ip) {
+            _onDirectConnect(*session, ip);
+        });
     }
 
 #endif  // DISABLE_DIRECT_CONNECT
 #ifdef DISABLE_RELAY_TUNNEL
     LOG_WARN("ClientNode::_onMessageUserP2PConnect. RELAY TUNNEL DISABLED.");
 #else
-    if (0 != relay_tunnel_.init(relay_server_addr, order_id, user_token_)) {
+    if (0 != session->relay_tunnel.init(relay_server_addr, order_id, user_token_)) {
         // 中继不可用也需要尝试p2p
         LOG_WARN("ClientNode::_onMessageUserP2PConnect failed in RelayTunnel::init");
     }
 #endif  // DISABLE_RELAY_TUNNEL
-    if (0 != udp_tunnel_.startP2P(order_id, device_token, device_public_addr)) {
+    if (0 != session->udp_tunnel->startP2P(order_id, device_token, device_public_addr)) {
         LOG_ERROR("ClientNode::_onMessageUserP2PConnect failed in UdpTunnel::startP2P");
         return -1;
     }
 
-    url_prefix_ = "http://127.0.0.1:" + std::to_string(AppConfig::getLocalHttpProxyPort()) + "/";
-
     return 0;
 }
 
-int ClientNode::_sendUserP2PConnectMsg(const std::string &device_token)
+int ClientNode::_sendUserP2PConnectMsg(DeviceSession &session)
 {
-    if (device_token.empty()) {
-        LOG_ERROR("ClientNode::_sendUserP2PConnectMsg failed:invalid input.");
+    if (!session.isOpen()) {
+        LOG_ERROR("ClientNode::_sendUserP2PConnectMsg failed:session not open. session_id:" << session.id);
         return -1;
     }
     if (user_token_.empty()) {
@@ -429,7 +746,7 @@ int ClientNode::_sendUserP2PConnectMsg(const std::string &device_token)
         return -1;
     }
 
-    std::string user_public_addr = udp_tunnel_.getPublicAddr();
+    std::string user_public_addr = (nullptr == session.udp_tunnel) ? "" : session.udp_tunnel->getPublicAddr();
     if (user_public_addr.empty()) {
         LOG_ERROR("ClientNode::_sendUserP2PConnectMsg failed:invalid user public addr");
         return -1;
@@ -437,7 +754,7 @@ int ClientNode::_sendUserP2PConnectMsg(const std::string &device_token)
 
     std::map<std::string, std::string> str_map;
     str_map["user_token"] = user_token_;
-    str_map["device_token"] = device_token;
+    str_map["device_token"] = session.device_token;
     str_map["user_public_addr"] = user_public_addr;
 
     std::string msg = JsonMsg::getJsonMsg(kJsonMsgTypeUserP2PConnect, str_map);
@@ -448,7 +765,8 @@ int ClientNode::_sendUserP2PConnectMsg(const std::string &device_token)
         return -1;
     }
 
-    LOG_DEBUG("ClientNode::_sendUserP2PConnectMsg");
+    LOG_DEBUG("ClientNode::_sendUserP2PConnectMsg. session_id:" << session.id << " user_public_addr:"
+              << user_public_addr);
     return 0;
 }
 
@@ -482,81 +800,273 @@ int ClientNode::_sendUserHeartbeatMsg()
     return 0;
 }
 
-bool ClientNode::_directConnect(const std::string &device_local_ip)
+void ClientNode::_onDirectConnect(DeviceSession &session, const std::string &device_local_ip)
+{
+    if (device_local_ip.empty()) {
+        if (!session.skipped_ips.empty()) {
+            // 缓存中失效的ip可能已经恢复，其他ip都失败时再探测一次
+            std::set<std::string> ip_set;
+            ip_set.swap(session.skipped_ips);
+            LOG_DEBUG("ClientNode::_onDirectConnect. probe skipped ips. num:" << ip_set.size());
+            DeviceSession *raw = &session;
+            session.lan_probe.start(ip_set, [this, raw](const std::string &ip) {
+                _onDirectConnect(*raw, ip);
+            });
+            return;
+        }
+        LOG_DEBUG("ClientNode::_onDirectConnect. no reachable local ip, use tunnels. session_id:" << session.id);
+        return;
+    }
+
+    // 有ip直连成功，说明在同一个局域网，之前失败的ip记为失效
+    uint32_t now = (uint32_t)time(nullptr);
+    session.direct_ip = device_local_ip;
+    PathCache::setString(session.path_record.lan_ip, sizeof(session.path_record.lan_ip), device_local_ip);
+    PathCache::removeDeadIp(session.path_record, device_local_ip);
+    for (const auto &ip : session.failed_ips) {
+        PathCache::addDeadIp(session.path_record, ip, now);
+    }
+    _savePath(session, PathCache::kPathDirect);
+
+    // 之后的请求直接访问设备，已经通过隧道的连接不受影响
+    _setUrlPrefix(session, "http://" + device_local_ip + ":" + std::to_string(AppConfig::getDeviceApiPort()) + "/");
+    LOG_DEBUG("ClientNode::_onDirectConnect. connect directly. session_id:" << session.id << " url_prefix:"
+              << session.url_prefix << " elapsed:" << (gettick_ms() - session.start_time) << "ms");
+}
+
+DeviceSession *ClientNode::_openSession(const std::string &device_token)
+{
+    DeviceSession *session = _findSession(device_token);
+    if (nullptr == session) {
+        for (auto &it : sessions_) {
+            if (!it->isOpen()) {
+                session = it.get();
+                break;
+            }
+        }
+    }
+    if (nullptr == session) {
+        LOG_ERROR("ClientNode::_openSession failed:no free session. device_token:" << device_token
+                  << " max:" << sessions_.size());
+        return nullptr;
+    }
+
+    if (0 != _startSession(*session, device_token)) {
+        LOG_ERROR("ClientNode::_openSession failed in _startSession. device_token:" << device_token);
+        return nullptr;
+    }
+    return session;
+}
+
+int ClientNode::_startSession(DeviceSession &session, const std::string &device_token)
+{
+    if (session.device_token != device_token) {
+        _closeSession(session);
+        session.udp_tunnel = udp_tunnel_pool_.acquire(device_token);
+        if (nullptr == session.udp_tunnel) {
+            LOG_ERROR("ClientNode::_startSession failed in UdpTunnelPool::acquire. device_token:" << device_token);
+            return -1;
+        }
+    }
+
+    // 本地代理带有I/O线程，会话第一次打开时才启动，之后一直保留
+    if (0 != _initProxyServer(session)) {
+        LOG_WARN("ClientNode::_startSession failed in _initProxyServer. session_id:" << session.id);
+    }
+
+    session.device_token = device_token;
+    session.path = PathCache::kPathNone;
+    session.start_time = gettick_ms();
+    session.direct_ip.clear();
+    session.failed_ips.clear();
+    session.skipped_ips.clear();
+    _setUrlPrefix(session, "http://127.0.0.1:" + std::to_string(AppConfig::getLocalHttpProxyPort() + session.id) + "/");
+    LOG_DEBUG("ClientNode::_startSession. session_id:" << session.id << " device_token:" << device_token);
+
+    if (path_cache_.get(device_token, (uint32_t)time(nullptr), session.path_record)) {
+        LOG_DEBUG("ClientNode::_startSession. cached path:" << session.path_record.path
+                  << " lan_ip:" << session.path_record.lan_ip << " public_addr:" << session.path_record.public_addr
+                  << " setup_time:" << session.path_record.setup_time << "ms");
+    } else {
+        PathCache::initRecord(session.path_record, device_token);
+    }
+    if (session.isUdpReady()) {
+        // 预热的隧道，不用等待打洞
+        LOG_DEBUG("ClientNode::_startSession. warm udp tunnel. tunnel_id:" << session.udp_tunnel->getTunnelId());
+        _savePath(session, PathCache::kPathUdp);
+    }
+
+#ifndef DISABLE_DIRECT_CONNECT
+    if ('\0' != session.path_record.lan_ip[0]) {
+        // 不等待服务器回复，先探测上次直连成功的ip
+        std::set<std::string> ip_set;
+        ip_set.insert(session.path_record.lan_ip);
+        DeviceSession *raw = &session;
+        session.lan_probe.start(ip_set, [this, raw](const std::string &ip) {
+            _onDirectConnect(*raw, ip);
+        });
+    }
+#endif  // DISABLE_DIRECT_CONNECT
+    return 0;
+}
+
+int ClientNode::_closeSession(DeviceSession &session)
 {
-    std::string url = "http://" + device_local_ip + ":" + std::to_string(AppConfig::getDeviceApiPort()) +
-                      AppConfig::getDeviceApiUri();
-    LOG_DEBUG(url);
-    cout << "try. url:" << url << endl;
+    if (!session.isOpen()) {
+        return 0;
+    }
+    LOG_DEBUG("ClientNode::_closeSession. session_id:" << session.id << " device_token:" << session.device_token);
+
+    // 连接属于该设备，不能留给下一个使用该会话的设备
+    _closeSessionProxies(session);
+    session.lan_probe.cancel();
+    session.relay_tunnel.fini();
+    if (nullptr != session.udp_tunnel) {
+        session.udp_tunnel->setReceiveRate(0);
+        udp_tunnel_pool_.release(session.udp_tunnel);
+        session.udp_tunnel = nullptr;
+    }
+    session.device_token.clear();
+    session.tunnel_selector = TunnelSelector(kUdpTunnel, kRelayTunnel);
+    bandwidth_.remove(session.id);
+    _setUrlPrefix(session, "");
+    return 0;
+}
 
-    // http client
-    HttpRequest req;
-    req.method = HTTP_GET;
-    req.url = url;
-    req.timeout = 1;
+void ClientNode::_setUrlPrefix(DeviceSession &session, const std::string &url_prefix)
+{
+    std::lock_guard<std::mutex> lock(url_prefix_mutex_);
+    snprintf(session.url_prefix, sizeof(session.url_prefix), "%s", url_prefix.c_str());
+}
 
-    HttpResponse resp;
-    hv::HttpClient http_client;
-    if (0 != http_client.send(&req, &resp)) {
-        LOG_ERROR("ClientNode::_directConnect failed in http send."
-                  << " device_local_ip:" << device_local_ip << " url:" + url);
-        return false;
+DeviceSession *ClientNode::_findSession(const std::string &device_token)
+{
+    if (device_token.empty()) {
+        return nullptr;
+    }
+    for (auto &session : sessions_) {
+        if (device_token == session->device_token) {
+            return session.get();
+        }
     }
-    if (200 != resp.status_code) {
-        LOG_ERROR("ClientNode::_directConnect failed: invalid resp."
-                  << " device_local_ip:" << device_local_ip << " url:" << url << " status_code:" << resp.status_code);
-        return false;
+    return nullptr;
+}
+
+DeviceSession *ClientNode::_getSession(uint32_t proxy_id)
+{
+    auto it = proxy_session_map_.find(proxy_id);
+    if ((proxy_session_map_.end() == it) || (it->second >= sessions_.size())) {
+        return nullptr;
     }
+    return sessions_[it->second].get();
+}
 
-    std::string json = resp.body;
-    rapidjson::Document doc;
-    doc.Parse(json.c_str());
-    if (doc.HasParseError()) {
-        // 解析错误
-        LOG_ERROR("ClientNode::_directConnect failed: invalid json."
-                  << " device_local_ip:" << device_local_ip << " url:" << url << " status_code:" << resp.status_code);
-        return false;
+std::set<std::string> ClientNode::_filterDeadIps(DeviceSession &session, const std::set<std::string> &ip_set)
+{
+    uint32_t now = (uint32_t)time(nullptr);
+    std::set<std::string> alive_ips;
+    session.skipped_ips.clear();
+    for (const auto &ip : ip_set) {
+        if (PathCache::isDeadIp(session.path_record, ip, now)) {
+            session.skipped_ips.insert(ip);
+        } else {
+            alive_ips.insert(ip);
+        }
     }
 
-    // 正常返回json就认为可以直连，后需根据需要对返回数据进行校验
-    url_prefix_ = "http://" + device_local_ip + ":" + std::to_string(AppConfig::getDeviceApiPort()) + "/";
-    LOG_DEBUG("ClientNode::_directConnect. connect directly. url_prefix:" + url_prefix_);
-    return true;
+    if (alive_ips.empty()) {
+        session.skipped_ips.clear();
+        return ip_set;
+    }
+    if (!session.skipped_ips.empty()) {
+        LOG_DEBUG("ClientNode::_filterDeadIps. skip dead ips. num:" << session.skipped_ips.size());
+    }
+    return alive_ips;
 }
 
-uint32_t ClientNode::_getTunnelId(uint32_t proxy_id, bool &new_proxy)
+void ClientNode::_onLanProbeFailed(DeviceSession &session, const std::string &ip)
+{
+    session.failed_ips.insert(ip);
+    if (session.direct_ip.empty() || (ip == session.direct_ip)) {
+        // 都失败时可能只是不在同一个局域网，不能记为失效
+        return;
+    }
+
+    PathCache::addDeadIp(session.path_record, ip, (uint32_t)time(nullptr));
+    path_cache_.put(session.path_record);
+}
+
+int ClientNode::_savePath(DeviceSession &session, uint32_t path)
+{
+    if (!path_cache_.isOpen() || ('\0' == session.path_record.device_token[0])) {
+        return 0;
+    }
+    if ((path == session.path) || (PathCache::kPathDirect == session.path)) {
+        // 直连成功后不再记录隧道
+        return 0;
+    }
+
+    session.path = path;
+    session.path_record.path = path;
+    session.path_record.tunnel_id = (nullptr == session.udp_tunnel) ? 0 : session.udp_tunnel->getTunnelId();
+    session.path_record.setup_time = (uint32_t)(gettick_ms() - session.start_time);
+    session.path_record.update_time = (uint32_t)time(nullptr);
+    LOG_DEBUG("ClientNode::_savePath. device_token:" << session.path_record.device_token << " path:" << path
+              << " setup_time:" << session.path_record.setup_time << "ms");
+    return path_cache_.put(session.path_record);
+}
+
+uint32_t ClientNode::_getTunnelId(DeviceSession &session, uint32_t proxy_id, bool &new_proxy)
 {
     if (proxy_id <= 0) {
         LOG_ERROR("ClientNode::_getTunnelId failed:invalid proxy_id. proxy_id:" << proxy_id);
         return kInvalidTunnel;
     }
 
-    std::lock_guard<std::recursive_mutex> lock(proxy_tunnel_map_mutex_);
     auto it = proxy_tunnel_map_.find(proxy_id);
     if (proxy_tunnel_map_.end() != it) {
         new_proxy = false;
         return it->second;
     }
 
-    uint32_t tunnel_id = kInvalidTunnel;
-    if (udp_tunnel_.isReady()) {
-        new_proxy = true;
-        proxy_tunnel_map_[proxy_id] = kUdpTunnel;
-        return kUdpTunnel;
-    } else if (relay_tunnel_.isReady()) {
-        new_proxy = true;
-        proxy_tunnel_map_[proxy_id] = kRelayTunnel;
-        return kRelayTunnel;
-    } else {
+    bool udp_ready = session.isUdpReady();
+    bool relay_ready = session.relay_tunnel.isReady();
+    uint32_t tunnel_id = session.tunnel_selector.getPreferred();
+    bool preferred_ready = ((kUdpTunnel == tunnel_id) && udp_ready) || ((kRelayTunnel == tunnel_id) && relay_ready);
+    if (!preferred_ready) {
+        // 还没有评估隧道质量或首选隧道刚断开时，优先p2p
+        tunnel_id = udp_ready ? kUdpTunnel : (relay_ready ? kRelayTunnel : kInvalidTunnel);
+    }
+    if (kInvalidTunnel == tunnel_id) {
         return kInvalidTunnel;
     }
+
+    new_proxy = true;
+    proxy_tunnel_map_[proxy_id] = tunnel_id;
+    return tunnel_id;
 }
 
-int ClientNode::_initProxyServer()
+int ClientNode::_initProxyServer(DeviceSession &session)
 {
+    if (session.proxy_server.isRunning()) {
+        return 0;
+    }
+
     // LOG_DEBUG("ClientNode::_initProxyServer");
-    if (0 != proxy_server_.init(AppConfig::getLocalHttpProxyPort())) {
-        LOG_ERROR("ClientNode::_initProxyServer failed in ProxyServer::init");
+    std::vector<hv::EventLoopPtr> worker_loops;
+    int thread_num = proxy_workers_.threadNum();
+    if (thread_num > 0) {
+        // 只启动一次，之后打开的会话共用
+        proxy_workers_.start(true);
+        for (int i = 0; i < thread_num; i++) {
+            worker_loops.push_back(proxy_workers_.loop(i));
+        }
+    }
+
+    uint16_t port = (uint16_t)(AppConfig::getLocalHttpProxyPort() + session.id);
+    if (0 != session.proxy_server.init(port, worker_loops)) {
+        LOG_ERROR("ClientNode::_initProxyServer failed in ProxyServer::init. port:" << port);
+        return -1;
     }
 
     return 0;
@@ -565,16 +1075,271 @@ int ClientNode::_initProxyServer()
 int ClientNode::_finiProxyServer()
 {
     LOG_DEBUG("ClientNode::_finiProxyServer");
-    proxy_server_.fini();
+    for (auto &session : sessions_) {
+        session->proxy_server.fini();
+    }
+    // 各会话已关闭其上的连接
+    proxy_workers_.stop(true);
     return 0;
 }
 
-std::string ClientNode::_getTcpInitJson(uint16_t port)
+std::string ClientNode::_getTcpInitJson(uint16_t port, bool hedged)
 {
-    std::string json = "{\"port\":" + std::to_string(port) + "}";
+    std::string json = "{\"port\":" + std::to_string(port);
+    if (hedged) {
+        // 对端会从两条隧道收到同一个连接，按字节序号去重
+        json += ",\"hedge\":1";
+    }
+    if (AppConfig::getStreamFlowControlEnabled()) {
+        // 对端按window限制该连接未确认的数据量，本端通过kTunnelMsgTypeWindowUpdate归还
+        json += ",\"window\":" + std::to_string(AppConfig::getStreamReceiveWindow());
+    }
+    json += "}";
     return json;
 }
 
+int ClientNode::_sendToTunnel(uint32_t tunnel_id, uint32_t type, uint32_t proxy_id, const char *data, uint32_t length)
+{
+    DeviceSession *session = _getSession(proxy_id);
+    if (nullptr == session) {
+        LOG_ERROR("ClientNode::_sendToTunnel failed:session not found. tunnel:" << tunnel_id
+                  << " type:" << type << " proxy_id:" << proxy_id);
+        return -1;
+    }
+
+    switch (tunnel_id) {
+        case kUdpTunnel: {
+            UdpTunnel *udp_tunnel = session->udp_tunnel;
+            if (nullptr == udp_tunnel) {
+                LOG_ERROR("ClientNode::_sendToTunnel failed:no udp tunnel. type:" << type << " proxy_id:" << proxy_id);
+                return -1;
+            }
+            return (nullptr == data) ? udp_tunnel->onProxyData(type, proxy_id)
+                                     : udp_tunnel->onProxyData(type, proxy_id, data, length);
+        }
+
+        case kRelayTunnel: {
+            return (nullptr == data) ? session->relay_tunnel.onProxyData(type, proxy_id)
+                                     : session->relay_tunnel.onProxyData(type, proxy_id, data, length);
+        }
+
+        default: {
+            LOG_ERROR("ClientNode::_sendToTunnel failed:invalid tunnel id. tunnel:" << tunnel_id
+                      << " type:" << type << " proxy_id:" << proxy_id);
+            return -1;
+        }
+    }
+}
+
+int ClientNode::_sendHedgedData(uint32_t proxy_id, uint32_t primary, const char *data, uint32_t length)
+{
+    uint32_t secondary = (kUdpTunnel == primary) ? kRelayTunnel : kUdpTunnel;
+    if (0 != _sendToTunnel(secondary, kTunnelMsgTypeTcpData, proxy_id, data, length)) {
+        LOG_WARN("ClientNode::_sendHedgedData failed in _sendToTunnel. proxy_id:" << proxy_id << " tunnel:" << secondary);
+        return _commitHedge(proxy_id, primary);
+    }
+    if (hedging_.onSent(proxy_id, length)) {
+        // 数据已超过对冲上限还没有响应，两条隧道上的数据相同，留在首选隧道
+        return _commitHedge(proxy_id, primary);
+    }
+
+    return 0;
+}
+
+int ClientNode::_commitHedge(uint32_t proxy_id, uint32_t tunnel_id)
+{
+    uint32_t loser = hedging_.commit(proxy_id, tunnel_id);
+    if (0 == loser) {
+        return 0;
+    }
+
+    proxy_tunnel_map_[proxy_id] = tunnel_id;
+    // 对冲的连接收到一条路径的TcpFini只关闭该路径
+    if (0 != _sendToTunnel(loser, kTunnelMsgTypeTcpFini, proxy_id, nullptr, 0)) {
+        LOG_WARN("ClientNode::_commitHedge failed in _sendToTunnel. proxy_id:" << proxy_id << " tunnel:" << loser);
+    }
+    LOG_DEBUG("ClientNode::_commitHedge. proxy_id:" << proxy_id << " tunnel:" << tunnel_id << " loser:" << loser);
+    return 0;
+}
+
+int ClientNode::_migrateProxy(uint32_t proxy_id, uint32_t tunnel_id)
+{
+    DeviceSession *session = _getSession(proxy_id);
+    uint32_t source = kInvalidTunnel;
+    auto it = proxy_tunnel_map_.find(proxy_id);
+    if ((nullptr == session) || (proxy_tunnel_map_.end() == it)) {
+        LOG_WARN("ClientNode::_migrateProxy failed:proxy not found. proxy_id:" << proxy_id);
+        return -1;
+    }
+    source = it->second;
+    if (migration_.isMigrating(proxy_id) || hedging_.isHedging(proxy_id)) {
+        LOG_WARN("ClientNode::_migrateProxy failed:already migrating. proxy_id:" << proxy_id);
+        return -1;
+    }
+    bool ready = (kUdpTunnel == tunnel_id) ? session->isUdpReady() : session->relay_tunnel.isReady();
+    if (!ready) {
+        LOG_WARN("ClientNode::_migrateProxy failed:tunnel not ready. proxy_id:" << proxy_id << " tunnel:" << tunnel_id);
+        return -1;
+    }
+
+    // 新隧道上先发迁移消息，之后的数据都走新隧道，对端按offset衔接两条隧道上的数据
+    TunnelStreamMigrate migrate;
+    migrate.offset = migration_.getSentOffset(proxy_id);
+    if (0 != _sendToTunnel(tunnel_id, kTunnelMsgTypeTcpMigrate, proxy_id, (const char *)&migrate, sizeof(migrate))) {
+        LOG_ERROR("ClientNode::_migrateProxy failed in _sendToTunnel. proxy_id:" << proxy_id << " tunnel:" << tunnel_id);
+        return -1;
+    }
+    proxy_tunnel_map_[proxy_id] = tunnel_id;
+    if ((kRelayTunnel == source) && (kRelayTunnel != tunnel_id)) {
+        session->relay_tunnel.releaseProxy(proxy_id);
+    }
+    migration_.start(proxy_id, source, tunnel_id, gettick_ms());
+
+    LOG_INFO("ClientNode::_migrateProxy. proxy_id:" << proxy_id << " source:" << source << " target:" << tunnel_id
+             << " offset:" << migrate.offset);
+    return 0;
+}
+
+int ClientNode::_updateTunnelSelection(DeviceSession &session)
+{
+    if (nullptr == session.udp_tunnel) {
+        return 0;
+    }
+
+    bool udp_ready = session.udp_tunnel->isReady();
+    bool relay_ready = session.relay_tunnel.isReady();
+    const TunnelQuality &udp_quality = session.udp_tunnel->updateQuality();
+    const TunnelQuality &relay_quality = session.relay_tunnel.updateQuality();
+    if (!session.tunnel_selector.update(udp_ready, udp_quality, relay_ready, relay_quality)) {
+        return 0;
+    }
+
+    uint32_t preferred = session.tunnel_selector.getPreferred();
+    LOG_INFO("ClientNode::_updateTunnelSelection. session_id:" << session.id << " preferred:" << preferred
+             << " udp:" << udp_quality.toString() << " relay:" << relay_quality.toString());
+    if (kInvalidTunnel != preferred) {
+        _savePath(session, (kUdpTunnel == preferred) ? PathCache::kPathUdp : PathCache::kPathRelay);
+    }
+    if (AppConfig::getStreamMigrationEnabled() && udp_ready && relay_ready) {
+        // 两条隧道都可用时才能无损迁移，滞回保证不会来回切换
+        _migrateStreams(session, preferred);
+    }
+    return 0;
+}
+
+int ClientNode::_migrateStreams(DeviceSession &session, uint32_t tunnel_id)
+{
+    std::vector<uint32_t> proxies;
+    for (const auto &it : proxy_tunnel_map_) {
+        auto session_it = proxy_session_map_.find(it.first);
+        if ((proxy_session_map_.end() == session_it) || (session_it->second != session.id)) {
+            continue;
+        }
+        if ((it.second != tunnel_id) && !migration_.isMigrating(it.first) && !hedging_.isHedging(it.first)) {
+            proxies.push_back(it.first);
+        }
+    }
+
+    int count = 0;
+    for (uint32_t proxy_id : proxies) {
+        if (0 == _migrateProxy(proxy_id, tunnel_id)) {
+            count++;
+        }
+    }
+    if (!proxies.empty()) {
+        LOG_INFO("ClientNode::_migrateStreams. session_id:" << session.id << " tunnel:" << tunnel_id
+                 << " migrated:" << count << "/" << proxies.size());
+    }
+    return count;
+}
+
+int ClientNode::_scheduleBandwidth()
+{
+    uint64_t now = gettick_ms();
+    uint32_t interval = (uint32_t)(now - bandwidth_time_);
+    bandwidth_time_ = now;
+
+    // 只有p2p隧道能通过接收窗口限速，中继上的流量不参与分配
+    for (auto &session : sessions_) {
+        if (session->isOpen() && session->isUdpReady()) {
+            bandwidth_.update(session->id, session->udp_tunnel->getRecvBytes(), interval);
+        }
+    }
+
+    std::map<uint32_t, uint32_t> limits = bandwidth_.allocate();
+    for (const auto &it : limits) {
+        DeviceSession &session = *sessions_[it.first];
+        if (nullptr != session.udp_tunnel) {
+            session.udp_tunnel->setReceiveRate(it.second);
+        }
+#ifdef DEBUG_CLIENT_NODE
+        LOG_DEBUG("ClientNode::_scheduleBandwidth. session_id:" << it.first << " limit:" << it.second);
+#endif  // DEBUG_CLIENT_NODE
+    }
+    return 0;
+}
+
+int ClientNode::_expireMigrations()
+{
+    std::vector<uint32_t> expired = migration_.expire(gettick_ms(), AppConfig::getStreamMigrationTimeout());
+    for (uint32_t proxy_id : expired) {
+        _closeProxy(proxy_id);
+    }
+    return 0;
+}
+
+int ClientNode::_onMigrationResult(uint32_t proxy_id, int result)
+{
+    switch (result) {
+        case StreamMigration::kOk: {
+            return 0;
+        }
+
+        case StreamMigration::kClosed: {
+            // 迁移完成时对端已关闭
+            ProxyServer *proxy_server = getProxyServer(proxy_id);
+            return (nullptr == proxy_server) ? -1 : proxy_server->delProxy(proxy_id);
+        }
+
+        default: {
+            if (migration_.isMigrating(proxy_id)) {
+                _closeProxy(proxy_id);
+            }
+            return -1;
+        }
+    }
+}
+
+int ClientNode::_closeProxy(uint32_t proxy_id)
+{
+    LOG_WARN("ClientNode::_closeProxy. proxy_id:" << proxy_id);
+    delProxy(proxy_id);
+    migration_.remove(proxy_id);
+    DeviceSession *session = _getSession(proxy_id);
+    if ((nullptr != session) && (nullptr != session->udp_tunnel)) {
+        // 找不到ProxyServer时不会回调onProxyClosed
+        session->udp_tunnel->removeProxy(proxy_id);
+    }
+    ProxyServer *proxy_server = getProxyServer(proxy_id);
+    return (nullptr == proxy_server) ? -1 : proxy_server->delProxy(proxy_id);
+}
+
+int ClientNode::_closeSessionProxies(DeviceSession &session)
+{
+    std::vector<uint32_t> proxies;
+    for (const auto &it : proxy_session_map_) {
+        if (it.second == session.id) {
+            proxies.push_back(it.first);
+        }
+    }
+
+    for (uint32_t proxy_id : proxies) {
+        _closeProxy(proxy_id);
+        hedging_.remove(proxy_id);
+    }
+    return 0;
+}
+
 int ClientNode::_initUdpTunnel(const std::string &stun_server_addr)
 {
     if (stun_server_addr.empty()) {
@@ -583,8 +1348,8 @@ int ClientNode::_initUdpTunnel(const std::string &stun_server_addr)
     }
 
     // LOG_DEBUG("ClientNode::_initUdpTunnel. stun_server_addr:" << stun_server_addr);
-    if (0 != udp_tunnel_.init(user_token_, stun_server_addr)) {
-        LOG_ERROR("ClientNode::_initUdpTunnel failed in UdpTunnel::init. stun_server_addr" << stun_server_addr);
+    if (0 != udp_tunnel_pool_.init(user_token_, stun_server_addr)) {
+        LOG_ERROR("ClientNode::_initUdpTunnel failed in UdpTunnelPool::init. stun_server_addr" << stun_server_addr);
         return -1;
     }
 
@@ -594,7 +1359,7 @@ int ClientNode::_initUdpTunnel(const std::string &stun_server_addr)
 int ClientNode::_finiUdpTunnel()
 {
     LOG_DEBUG("ClientNode::_finiUdpTunnel");
-    udp_tunnel_.fini();
+    udp_tunnel_pool_.fini();
     return 0;
 }
 
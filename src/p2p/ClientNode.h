@@ -4,17 +4,23 @@
 #include <cstdint>
 #include <string>
 #include <map>
+#include <set>
 #include <memory>
 #include <mutex>
+#include <vector>
 #include "hv/TcpClient.h"
-#include "UdpTunnel.h"
-#include "RelayTunnel.h"
+#include "DeviceSession.h"
+#include "UdpTunnelPool.h"
 #include "x/JsonHelper.h"
 #include "ProxyServer.h"
+#include "PathCache.h"
+#include "SessionBandwidth.h"
+#include "StreamHedging.h"
+#include "StreamMigration.h"
 
 // #define DEBUG_CLIENT_NODE
 
-class ClientNode : public hv::TcpClient {
+class ClientNode : public hv::TcpClient, public ProxySink {
 public:
     ClientNode();
 
@@ -28,22 +34,102 @@ public:
 
     int stop();
 
+    /**
+     * @brief 单设备接口：关闭上一个设备的会话，打开或重新启动device_token的会话
+     * @return 0：成功；-1：没有运行、没有可用的会话或发送UserP2PConnect失败；
+     * @note 在loop线程中打开会话，等待结果后返回
+     */
     int startSession(std::string device_token);
 
     /**
-     * @brief
+     * @brief 关闭startSession打开的会话
      * @return
      */
     int stopSession();
 
-    int onProxyData(uint32_t proxy_id, char *buffer, uint32_t length);
+    /**
+     * @brief 打开与device_token的会话，设备已有会话时重新启动该会话
+     * @return 会话id；-1：失败，没有空闲的会话或还没有初始化；
+     * @note 在loop线程中分配会话，调用线程等待分配结果
+     */
+    int openSession(const std::string &device_token);
+
+    /**
+     * @brief 关闭会话，关闭会话上的所有连接，p2p隧道留在池中预热
+     * @return 0：成功；-1：会话id无效；
+     */
+    int closeSession(uint32_t session_id);
+
+    /**
+     * @brief 设置会话分配下行带宽的权重，会话关闭后恢复默认
+     * @param weight 1~SessionBandwidth::kMaxWeight
+     * @return 0：成功；-1：失败；
+     */
+    int setSessionWeight(uint32_t session_id, uint32_t weight);
+
+    /**
+     * @brief 会话的本地代理有新连接，记录连接所属的会话
+     */
+    int onProxyConnected(uint32_t session_id, uint32_t proxy_id) override;
+
+    int onProxyData(uint32_t proxy_id, char *buffer, uint32_t length) override;
 
     int delProxy(uint32_t proxy_id);
 
-    ProxyServer &getProxyServer();
+    /**
+     * @brief 设置本地连接在p2p隧道中的发送优先级
+     * @param local_port App一侧socket的端口
+     * @param priority StreamScheduler::Priority
+     * @return 0：成功；-1：失败；
+     */
+    int setProxyPriority(uint16_t local_port, int priority);
+
+    /**
+     * @brief 本地App读走了proxy_id的数据，通过该连接所在的隧道归还接收窗口
+     * @param increment 字节数
+     * @return 0：成功；-1：失败；
+     */
+    int onProxyWindowUpdate(uint32_t proxy_id, uint32_t increment) override;
+
+    /**
+     * @brief 本地连接已关闭，清理该连接的隧道状态
+     */
+    int onProxyClosed(uint32_t proxy_id) override;
+
+    /**
+     * @brief 隧道收到对端发来的数据，迁移中的连接按序号交付
+     * @param tunnel_id TunnelId
+     * @return 0：成功；-1：失败，本地连接已不存在或迁移失败；
+     */
+    int onTunnelData(uint32_t tunnel_id, uint32_t proxy_id, char *data, uint32_t length);
+
+    /**
+     * @brief 隧道收到对端的TcpFini
+     */
+    int onTunnelFini(uint32_t tunnel_id, uint32_t proxy_id);
+
+    /**
+     * @brief 隧道收到对端的kTunnelMsgTypeTcpMigrate
+     * @param offset 对端在该隧道上第一个字节的序号
+     */
+    int onTunnelMigrate(uint32_t tunnel_id, uint32_t proxy_id, uint64_t offset);
+
+    /**
+     * @brief 连接所在会话的本地代理
+     * @return 连接不存在时返回nullptr
+     */
+    ProxyServer *getProxyServer(uint32_t proxy_id);
 
+    /**
+     * @brief startSession打开的会话的url前缀
+     */
     const char *getUrlPrefix();
 
+    /**
+     * @return 会话id无效或会话没有打开时返回nullptr
+     */
+    const char *getSessionUrlPrefix(uint32_t session_id);
+
 private:
     int _onConnected(const hv::SocketChannelPtr &channel);
 
@@ -53,21 +139,134 @@ private:
 
     int _onMessageUserP2PConnect(JsonHelper &json_helper);
 
-    int _sendUserP2PConnectMsg(const std::string &device_token);
+    /**
+     * @brief 带上p2p隧道的出口地址，所有隧道共用一个udp socket
+     */
+    int _sendUserP2PConnectMsg(DeviceSession &session);
 
     int _sendUserLoginMsg();
 
     int _sendUserHeartbeatMsg();
 
-    bool _directConnect(const std::string &device_local_ip);
+    /**
+     * @brief 局域网直连探测结果
+     * @param device_local_ip 可以直连的ip，为空表示都不能直连
+     */
+    void _onDirectConnect(DeviceSession &session, const std::string &device_local_ip);
 
-    uint32_t _getTunnelId(uint32_t proxy_id, bool &new_proxy);
+    /**
+     * @brief 取得device_token的会话，没有时使用空闲的会话，并(重新)开始会话
+     * @return 没有空闲的会话时返回nullptr
+     */
+    DeviceSession *_openSession(const std::string &device_token);
 
-    int _initProxyServer();
+    /**
+     * @brief 在loop线程中开始会话：取得p2p隧道，读取路径缓存，上次直连成功时不等待服务器回复先探测该ip
+     * @return 0：成功；-1：没有可用的p2p隧道；
+     */
+    int _startSession(DeviceSession &session, const std::string &device_token);
+
+    int _closeSession(DeviceSession &session);
+
+    /**
+     * @brief 在url_prefix_mutex_保护下修改会话的url前缀，url_prefix为空表示会话关闭
+     */
+    void _setUrlPrefix(DeviceSession &session, const std::string &url_prefix);
+
+    /**
+     * @return 没有打开的会话时返回nullptr
+     */
+    DeviceSession *_findSession(const std::string &device_token);
+
+    /**
+     * @brief 连接所属的会话
+     * @return 连接不存在时返回nullptr
+     */
+    DeviceSession *_getSession(uint32_t proxy_id);
+
+    /**
+     * @brief 从设备的局域网ip中去掉最近探测失败的ip，去掉的ip记录在skipped_ips中
+     */
+    std::set<std::string> _filterDeadIps(DeviceSession &session, const std::set<std::string> &ip_set);
+
+    /**
+     * @brief 局域网ip探测失败，有其他ip直连成功时记为失效
+     */
+    void _onLanProbeFailed(DeviceSession &session, const std::string &ip);
+
+    /**
+     * @brief 记录本次会话胜出的路径，直连优先于隧道
+     * @param path PathCache::Path
+     */
+    int _savePath(DeviceSession &session, uint32_t path);
+
+    uint32_t _getTunnelId(DeviceSession &session, uint32_t proxy_id, bool &new_proxy);
+
+    /**
+     * @brief 启动会话的本地代理，监听AppConfig::getLocalHttpProxyPort() + session_id，连接交给proxy_workers_
+     */
+    int _initProxyServer(DeviceSession &session);
 
     int _finiProxyServer();
 
-    std::string _getTcpInitJson(uint16_t port);
+    std::string _getTcpInitJson(uint16_t port, bool hedged = false);
+
+    /**
+     * @brief 通过连接所属会话的tunnel_id发送消息
+     */
+    int _sendToTunnel(uint32_t tunnel_id, uint32_t type, uint32_t proxy_id, const char *data, uint32_t length);
+
+    /**
+     * @brief 对冲中的连接，数据在另一条隧道上再发一份，达到上限时确定为primary
+     */
+    int _sendHedgedData(uint32_t proxy_id, uint32_t primary, const char *data, uint32_t length);
+
+    /**
+     * @brief 对冲的连接确定走tunnel_id，落选隧道上发TcpFini
+     */
+    int _commitHedge(uint32_t proxy_id, uint32_t tunnel_id);
+
+    /**
+     * @brief 已建立的连接迁移到tunnel_id
+     * @return 0：成功或已在该隧道；-1：失败；
+     */
+    int _migrateProxy(uint32_t proxy_id, uint32_t tunnel_id);
+
+    /**
+     * @brief 采样会话两条隧道的质量，更新新连接的首选隧道
+     */
+    int _updateTunnelSelection(DeviceSession &session);
+
+    /**
+     * @brief 会话上所有不在tunnel_id上的连接迁移过去
+     */
+    int _migrateStreams(DeviceSession &session, uint32_t tunnel_id);
+
+    /**
+     * @brief 按各会话p2p隧道的下行速率分配总带宽，通过kcp接收窗口生效
+     */
+    int _scheduleBandwidth();
+
+    /**
+     * @brief 关闭超时未完成迁移的连接
+     */
+    int _expireMigrations();
+
+    /**
+     * @brief 处理StreamMigration的返回值
+     * @return 0：成功；-1：失败；
+     */
+    int _onMigrationResult(uint32_t proxy_id, int result);
+
+    /**
+     * @brief 迁移失败，关闭本地连接并通知对端
+     */
+    int _closeProxy(uint32_t proxy_id);
+
+    /**
+     * @brief 关闭会话上的所有连接
+     */
+    int _closeSessionProxies(DeviceSession &session);
 
     /**
      * @brief
@@ -83,20 +282,29 @@ private:
     std::string user_token_;
 
     // 直连
-    std::string url_prefix_;
+    std::mutex url_prefix_mutex_;   //App线程读取各会话的url_prefix，loop线程在直连探测成功后修改
 
-    // proxy_id - tunnel_id
+    // proxy_id - tunnel_id，仅在loop线程中使用，本地代理的I/O线程通过队列交给loop线程
     std::map<uint32_t, uint32_t> proxy_tunnel_map_;
-    std::recursive_mutex proxy_tunnel_map_mutex_;
+    // proxy_id - session_id，proxy_id在进程内唯一，仅在loop线程中使用
+    std::map<uint32_t, uint32_t> proxy_session_map_;
+    StreamMigration migration_;     //连接迁移状态，仅在loop线程中使用
+    StreamHedging hedging_;         //新连接的首包对冲和TTFB统计，仅在loop线程中使用
 
-    //
-    RelayTunnel relay_tunnel_;
+    // 设备会话，按AppConfig::getMaxSessionNum()预先创建，下标即session_id
+    std::vector<std::unique_ptr<DeviceSession>> sessions_;
+    volatile int current_session_;  //startSession打开的会话，-1表示没有
+    SessionBandwidth bandwidth_;    //仅在loop线程中使用
+    uint64_t bandwidth_time_;       //上次分配带宽的时间，毫秒
 
-    //
-    UdpTunnel udp_tunnel_;
+    // 所有会话的本地代理共用的I/O线程，AppConfig::getProxyThreadNum()个，第一个会话打开时启动
+    hv::EventLoopThreadPool proxy_workers_;
 
     //
-    ProxyServer proxy_server_;
+    UdpTunnelPool udp_tunnel_pool_;
+
+    // 路径缓存，仅在loop线程中使用
+    PathCache path_cache_;
 };
 
 //
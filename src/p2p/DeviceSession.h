@@ -0,0 +1,66 @@
+#ifndef SRC_DEVICE_SESSION_H
+#define SRC_DEVICE_SESSION_H
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include "hv/EventLoop.h"
+#include "LanProbe.h"
+#include "PathCache.h"
+#include "ProxyServer.h"
+#include "RelayTunnelPool.h"
+#include "TunnelSelector.h"
+#include "UdpTunnel.h"
+
+enum TunnelId {
+    kInvalidTunnel = 0,
+    kUdpTunnel = 100,
+    kRelayTunnel = 101,
+};
+
+/**
+ * @brief 与一台设备的会话：本地代理端口、中继、p2p隧道、直连探测和路径记录
+ * @note ClientNode按会话数预先创建，每个会话的本地代理监听不同的端口，App按各自的url前缀访问；
+ *       p2p隧道从UdpTunnelPool取得，共用一个udp socket，按设备地址和tunnel_id区分；
+ *       proxy_id在进程内唯一，迁移、对冲等按proxy_id记录的状态仍由ClientNode统一管理
+ *       除url_prefix外仅在loop线程中使用
+ */
+struct DeviceSession {
+    static const size_t kUrlPrefixLength = 64;  // "http://255.255.255.255:65535/"
+
+    DeviceSession(hv::EventLoopPtr loop, uint32_t session_id)
+        : id(session_id), udp_tunnel(nullptr), relay_tunnel(loop), proxy_server(loop, session_id), lan_probe(loop),
+          tunnel_selector(kUdpTunnel, kRelayTunnel), path_record(), path(PathCache::kPathNone), start_time(0),
+          url_prefix()
+    {}
+
+    bool isOpen() const {
+        return !device_token.empty();
+    }
+
+    bool isUdpReady() const {
+        return (nullptr != udp_tunnel) && udp_tunnel->isReady();
+    }
+
+    const uint32_t id;
+    std::string device_token;           //为空表示空闲
+    UdpTunnel *udp_tunnel;              //会话关闭后留在UdpTunnelPool中预热
+    RelayTunnelPool relay_tunnel;
+    ProxyServer proxy_server;           //监听AppConfig::getLocalHttpProxyPort() + id
+    LanProbe lan_probe;
+    TunnelSelector tunnel_selector;     //按隧道质量选择新连接的隧道
+
+
+    // 路径缓存
+    PathCache::Record path_record;      //该设备的记录
+    uint32_t path;                      //本次会话已记录的路径
+    uint64_t start_time;                //会话开始的时间，毫秒
+    std::string direct_ip;              //本次会话直连成功的ip
+    std::set<std::string> failed_ips;   //本次会话探测失败的ip
+    std::set<std::string> skipped_ips;  //按缓存跳过的ip，其他ip都失败时再探测
+
+    // App线程读取，返回给App的指针一直有效；由ClientNode::url_prefix_mutex_保护，为空表示会话没有打开
+    char url_prefix[kUrlPrefixLength];
+};
+
+#endif  // SRC_DEVICE_SESSION_H
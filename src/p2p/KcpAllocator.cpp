@@ -0,0 +1,233 @@
+#include "KcpAllocator.h"
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+#include "kcp/ikcp.h"
+#include "kcp/KcpConfig.h"
+#include "x/Logger.h"
+
+namespace {
+
+const size_t kSizeClassNum = 3;
+const size_t kBlocksPerSlab = 64;
+const uint32_t kHeapClass = 0xffffffff;  // 直接从堆上分配的块
+
+/**
+ * @brief 块头，记录所属的块大小，保证返回给kcp的指针按max_align_t对齐
+ */
+union BlockHeader {
+    uint32_t size_class;
+    std::max_align_t align;
+};
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+struct SizeClass {
+    size_t block_size;      // 不含块头
+    FreeBlock *free_list;
+};
+
+struct Pool {
+    Pool() : installed(false), max_pool_bytes(0), stats() {
+        for (auto &size_class : classes) {
+            size_class.block_size = 0;
+            size_class.free_list = nullptr;
+        }
+    }
+
+    bool installed;
+    size_t max_pool_bytes;
+    SizeClass classes[kSizeClassNum];
+    std::vector<char *> slabs;
+    KcpAllocator::Stats stats;
+    std::mutex mutex;
+};
+
+Pool &getPool()
+{
+    static Pool pool;
+    return pool;
+}
+
+void *allocFromHeap(Pool &pool, size_t size)
+{
+    auto *header = (BlockHeader *)malloc(sizeof(BlockHeader) + size);
+    if (nullptr == header) {
+        return nullptr;
+    }
+    header->size_class = kHeapClass;
+    pool.stats.heap_in_use++;
+    return header + 1;
+}
+
+/**
+ * @brief 申请一个slab并切分到空闲链表
+ */
+bool growSizeClass(Pool &pool, SizeClass &size_class)
+{
+    size_t stride = sizeof(BlockHeader) + size_class.block_size;
+    size_t slab_bytes = stride * kBlocksPerSlab;
+    if ((pool.stats.pool_bytes + slab_bytes) > pool.max_pool_bytes) {
+        return false;
+    }
+
+    char *slab = (char *)malloc(slab_bytes);
+    if (nullptr == slab) {
+        return false;
+    }
+    pool.slabs.push_back(slab);
+    pool.stats.pool_bytes += slab_bytes;
+    pool.stats.slabs++;
+
+    for (size_t i = 0; i < kBlocksPerSlab; i++) {
+        auto *block = (FreeBlock *)(slab + i * stride + sizeof(BlockHeader));
+        block->next = size_class.free_list;
+        size_class.free_list = block;
+    }
+
+    return true;
+}
+
+}  // namespace
+
+int KcpAllocator::install(uint32_t mtu, size_t max_pool_bytes)
+{
+    if ((mtu <= kcpOverhead) || (max_pool_bytes <= 0)) {
+        LOG_ERROR("KcpAllocator::install failed:invalid input. mtu:" << mtu << " max_pool_bytes:" << max_pool_bytes);
+        return -1;
+    }
+
+    Pool &pool = getPool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (pool.installed) {
+        LOG_DEBUG("KcpAllocator::install. already installed.");
+        return 0;
+    }
+
+    // 数据段最大为mss，流模式下合并的段也不超过mss，小包（ack后的尾段、TcpFini等）使用较小的块
+    size_t mss = mtu - kcpOverhead;
+    pool.classes[0].block_size = sizeof(IKCPSEG) + mss / 8;
+    pool.classes[1].block_size = sizeof(IKCPSEG) + mss / 2;
+    pool.classes[2].block_size = sizeof(IKCPSEG) + mss;
+    for (auto &size_class : pool.classes) {
+        // 保持块头对齐
+        size_t align = sizeof(BlockHeader);
+        size_class.block_size = (size_class.block_size + align - 1) / align * align;
+        size_class.free_list = nullptr;
+    }
+    pool.max_pool_bytes = max_pool_bytes;
+    pool.installed = true;
+
+    ikcp_allocator(KcpAllocator::_malloc, KcpAllocator::_free);
+    LOG_DEBUG("KcpAllocator::install. mtu:" << mtu << " max_pool_bytes:" << max_pool_bytes);
+    return 0;
+}
+
+int KcpAllocator::uninstall()
+{
+    Pool &pool = getPool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (!pool.installed) {
+        return 0;
+    }
+    if ((pool.stats.in_use > 0) || (pool.stats.heap_in_use > 0)) {
+        LOG_WARN("KcpAllocator::uninstall failed:blocks in use. in_use:" << pool.stats.in_use
+                 << " heap_in_use:" << pool.stats.heap_in_use);
+        return -1;
+    }
+
+    ikcp_allocator(nullptr, nullptr);
+    for (auto slab : pool.slabs) {
+        free(slab);
+    }
+    pool.slabs.clear();
+    for (auto &size_class : pool.classes) {
+        size_class.free_list = nullptr;
+    }
+    pool.stats.pool_bytes = 0;
+    pool.installed = false;
+    return 0;
+}
+
+KcpAllocator::Stats KcpAllocator::getStats()
+{
+    Pool &pool = getPool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    return pool.stats;
+}
+
+std::string KcpAllocator::statsToString()
+{
+    Stats stats = getStats();
+    std::string str;
+    str += " allocs:" + std::to_string(stats.allocs);
+    str += " misses:" + std::to_string(stats.misses);
+    str += " oversizes:" + std::to_string(stats.oversizes);
+    str += " slabs:" + std::to_string(stats.slabs);
+    str += " in_use:" + std::to_string(stats.in_use);
+    str += " heap_in_use:" + std::to_string(stats.heap_in_use);
+    str += " high_water:" + std::to_string(stats.high_water);
+    str += " pool_bytes:" + std::to_string(stats.pool_bytes);
+    return str;
+}
+
+void *KcpAllocator::_malloc(size_t size)
+{
+    Pool &pool = getPool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+
+    uint32_t index = 0;
+    for (; index < kSizeClassNum; index++) {
+        if (size <= pool.classes[index].block_size) {
+            break;
+        }
+    }
+    if (index >= kSizeClassNum) {
+        pool.stats.oversizes++;
+        return allocFromHeap(pool, size);
+    }
+
+    SizeClass &size_class = pool.classes[index];
+    if ((nullptr == size_class.free_list) && !growSizeClass(pool, size_class)) {
+        pool.stats.misses++;
+        return allocFromHeap(pool, size);
+    }
+
+    FreeBlock *block = size_class.free_list;
+    size_class.free_list = block->next;
+
+    auto *header = (BlockHeader *)block - 1;
+    header->size_class = index;
+
+    pool.stats.allocs++;
+    pool.stats.in_use++;
+    if (pool.stats.in_use > pool.stats.high_water) {
+        pool.stats.high_water = pool.stats.in_use;
+    }
+
+    return block;
+}
+
+void KcpAllocator::_free(void *ptr)
+{
+    if (nullptr == ptr) {
+        return;
+    }
+
+    auto *header = (BlockHeader *)ptr - 1;
+    Pool &pool = getPool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (kHeapClass == header->size_class) {
+        pool.stats.heap_in_use--;
+        free(header);
+        return;
+    }
+
+    SizeClass &size_class = pool.classes[header->size_class];
+    auto *block = (FreeBlock *)ptr;
+    block->next = size_class.free_list;
+    size_class.free_list = block;
+    pool.stats.in_use--;
+}
@@ -0,0 +1,56 @@
+#ifndef SRC_KCP_ALLOCATOR_H
+#define SRC_KCP_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief kcp内存池，通过ikcp_allocator安装，替换ikcp内部的malloc/free
+ * @note 按mtu划分几个固定大小的块，每次从堆上申请一整块slab后切分，释放的块挂回空闲链表，不归还给堆；
+ *       超过最大块的申请（如ikcpcb、kcp->buffer、acklist）直接走堆
+ */
+class KcpAllocator {
+public:
+    /**
+     * @brief 内存池统计
+     */
+    struct Stats {
+        uint64_t allocs;        // 从内存池分配的次数
+        uint64_t misses;        // 内存池已达上限，改为从堆上分配的次数
+        uint64_t oversizes;     // 超过最大块大小，直接从堆上分配的次数
+        uint64_t slabs;         // 向堆申请slab的次数
+        size_t in_use;          // 当前使用中的块数
+        size_t heap_in_use;     // 当前使用中的从堆上分配的块数
+        size_t high_water;      // 使用中的块数的最大值
+        size_t pool_bytes;      // slab占用的内存
+    };
+
+    /**
+     * @brief 初始化内存池并安装到kcp，需在任何ikcp_create之前调用
+     * @param mtu kcp的mtu，用于划分块大小
+     * @param max_pool_bytes slab占用内存上限
+     * @return 0：成功；-1：失败；
+     */
+    static int install(uint32_t mtu, size_t max_pool_bytes = kDefaultMaxPoolBytes);
+
+    /**
+     * @brief 恢复kcp默认分配器并释放内存池，需在所有kcp对象释放之后调用
+     * @note 从堆上分配的块同样带块头，只能由本分配器释放，因此仍有任何块在使用中时不卸载
+     * @return 0：成功；-1：失败（仍有块在使用中）；
+     */
+    static int uninstall();
+
+    static Stats getStats();
+
+    static std::string statsToString();
+
+    static const size_t kDefaultMaxPoolBytes = 32 * 1024 * 1024;
+
+private:
+    static void *_malloc(size_t size);
+
+    static void _free(void *ptr);
+};
+
+#endif  // SRC_KCP_ALLOCATOR_H
@@ -0,0 +1,371 @@
+#include "KcpCongestion.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// kcp段头：conv(4) cmd(1) frg(1) wnd(2) ts(4) sn(4) una(4) len(4)，小端
+const int kSegmentHeaderLength = 24;
+const uint8_t kCmdPush = 81;
+const uint8_t kCmdAck = 82;
+
+struct Segment {
+    uint8_t cmd;
+    uint32_t ts;
+    uint32_t sn;
+    uint32_t una;
+    uint32_t len;
+};
+
+/**
+ * @brief 解析一个kcp包中的所有段
+ */
+template <typename Func>
+void forEachSegment(const char *data, int length, Func func)
+{
+    while (length >= kSegmentHeaderLength) {
+        Segment segment;
+        segment.cmd = (uint8_t)data[4];
+        memcpy(&segment.ts, data + 8, sizeof(uint32_t));
+        memcpy(&segment.sn, data + 12, sizeof(uint32_t));
+        memcpy(&segment.una, data + 16, sizeof(uint32_t));
+        memcpy(&segment.len, data + 20, sizeof(uint32_t));
+        if (segment.len > (uint32_t)(length - kSegmentHeaderLength)) {
+            return;
+        }
+        func(segment);
+        data += kSegmentHeaderLength + segment.len;
+        length -= kSegmentHeaderLength + (int)segment.len;
+    }
+}
+
+const double kHighGain = 2.885;     // 2/ln2，STARTUP中每轮翻倍
+const double kDrainGain = 1.0 / kHighGain;
+const double kCwndGain = 2.0;
+const double kRtoMargin = 0.5;
+const double kPacingGainCycle[] = {1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0};
+const uint32_t kPacingGainCycleLength = sizeof(kPacingGainCycle) / sizeof(kPacingGainCycle[0]);
+const double kFullBwThreshold = 1.25;
+const uint32_t kFullBwRounds = 3;
+
+}  // namespace
+
+std::unique_ptr<KcpCongestion> KcpCongestion::create(int type, uint32_t mss)
+{
+    switch (type) {
+        case kBbr: {
+            return std::unique_ptr<KcpCongestion>(new KcpBbr(mss));
+        }
+
+        default: {
+            return nullptr;
+        }
+    }
+}
+
+bool KcpCongestion::hasData(const char *data, int length)
+{
+    bool has_data = false;
+    forEachSegment(data, length, [&](const Segment &segment) {
+        if (kCmdPush == segment.cmd) {
+            has_data = true;
+        }
+    });
+    return has_data;
+}
+
+void KcpCongestion::onPacketSent(uint32_t now, const char *data, int length, bool app_limited)
+{
+    forEachSegment(data, length, [&](const Segment &segment) {
+        if (kCmdPush == segment.cmd) {
+            onSegmentSent(now, segment.sn, segment.len, app_limited);
+        }
+    });
+}
+
+void KcpCongestion::onPacketReceived(uint32_t now, const char *data, int length)
+{
+    uint32_t una = 0;
+    bool has_una = false;
+    forEachSegment(data, length, [&](const Segment &segment) {
+        if (kCmdAck == segment.cmd) {
+            onSegmentAcked(now, segment.sn, segment.ts);
+        }
+        una = segment.una;
+        has_una = true;
+    });
+    if (has_una) {
+        onUna(now, una);
+    }
+}
+
+KcpBbr::KcpBbr(uint32_t mss)
+    : KcpCongestion(mss), records_(new SentRecord[kSentRecords]), mode_(kStartup), pacing_gain_(kHighGain),
+      cwnd_gain_(kHighGain), cwnd_(kInitialCwnd), pacing_rate_(0), inflight_(0), una_(0), delivered_(0),
+      delivered_time_(0), bw_samples_(), round_count_(0), next_round_delivered_(0), round_start_(false),
+      min_rtt_(0), min_rtt_stamp_(0), min_rtt_expired_(false), probe_rtt_done_stamp_(0), full_bw_(0),
+      full_bw_count_(0), filled_pipe_(false), cycle_index_(0), cycle_stamp_(0)
+{
+    for (size_t i = 0; i < kSentRecords; i++) {
+        records_[i].sn = 0;
+        records_[i].acked = true;
+    }
+    _updateControl();
+}
+
+uint32_t KcpBbr::getCwnd() const
+{
+    return cwnd_;
+}
+
+uint64_t KcpBbr::getPacingRate() const
+{
+    return pacing_rate_;
+}
+
+uint32_t KcpBbr::getMinRto() const
+{
+    // 在途数据（网络中加pacing队列中）不超过cwnd，排队后的rtt不超过kCwndGain倍min_rtt
+    return (0 != min_rtt_) ? (uint32_t)(min_rtt_ * (kCwndGain + kRtoMargin)) : 0;
+}
+
+std::string KcpBbr::toString() const
+{
+    static const char *kModeNames[] = {"STARTUP", "DRAIN", "PROBE_BW", "PROBE_RTT"};
+    std::string str;
+    str += "mode:" + std::string(kModeNames[mode_]);
+    str += " bw:" + std::to_string(_getBandwidth());
+    str += " min_rtt:" + std::to_string(min_rtt_);
+    str += " cwnd:" + std::to_string(cwnd_);
+    str += " pacing_rate:" + std::to_string(pacing_rate_);
+    str += " inflight:" + std::to_string(inflight_);
+    return str;
+}
+
+void KcpBbr::onSegmentSent(uint32_t now, uint32_t sn, uint32_t bytes, bool app_limited)
+{
+    if ((int32_t)(sn - una_) < 0) {
+        // 已经通过una确认的段，在pacing队列中排队时又被重传
+        return;
+    }
+    if (0 == inflight_) {
+        // 空闲后重新开始，不把空闲时间算进交付速率
+        delivered_time_ = now;
+    }
+
+    SentRecord &record = records_[sn % kSentRecords];
+    if ((record.sn != sn) || record.acked) {
+        inflight_++;
+    }
+    record.sn = sn;
+    record.bytes = bytes;
+    record.delivered = delivered_;
+    record.delivered_time = delivered_time_;
+    record.app_limited = app_limited;
+    record.acked = false;
+}
+
+bool KcpBbr::_onDelivered(uint32_t now, uint32_t sn)
+{
+    SentRecord &record = records_[sn % kSentRecords];
+    if ((record.sn != sn) || record.acked) {
+        return false;
+    }
+
+    record.acked = true;
+    if (inflight_ > 0) {
+        inflight_--;
+    }
+    delivered_ += record.bytes;
+    delivered_time_ = now;
+    return true;
+}
+
+void KcpBbr::onSegmentAcked(uint32_t now, uint32_t sn, uint32_t ts)
+{
+    if (!_onDelivered(now, sn)) {
+        return;
+    }
+    const SentRecord &record = records_[sn % kSentRecords];
+
+    // rtt：ack带回的是这一次发送的时间戳，重传也不会混淆
+    uint32_t rtt = now - ts;
+    if ((int32_t)rtt >= 0) {
+        rtt = std::max<uint32_t>(rtt, 1);
+        min_rtt_expired_ = (0 != min_rtt_) && ((uint32_t)(now - min_rtt_stamp_) > kMinRttWindow);
+        if ((0 == min_rtt_) || (rtt <= min_rtt_) || min_rtt_expired_) {
+            min_rtt_ = rtt;
+            min_rtt_stamp_ = now;
+        }
+    }
+
+    // 发送时已交付的数据都确认后，进入新的一轮
+    round_start_ = false;
+    if (record.delivered >= next_round_delivered_) {
+        next_round_delivered_ = delivered_;
+        round_count_++;
+        round_start_ = true;
+        bw_samples_[round_count_ % kBwWindowRounds] = 0;
+    }
+
+    uint32_t interval = std::max<uint32_t>(now - record.delivered_time, 1);
+    uint64_t rate = (delivered_ - record.delivered) * 1000 / interval;
+    _updateBandwidth(rate, record.app_limited);
+
+    _checkFullBandwidth();
+    _updateMode(now);
+    _updateControl();
+}
+
+void KcpBbr::onUna(uint32_t now, uint32_t una)
+{
+    if ((int32_t)(una - una_) <= 0) {
+        return;
+    }
+
+    // ack丢失时，只能通过una确认，不产生rtt和速率样本
+    uint32_t begin = una_;
+    if ((una - begin) > kSentRecords) {
+        begin = una - kSentRecords;
+    }
+    for (uint32_t sn = begin; sn != una; sn++) {
+        _onDelivered(now, sn);
+    }
+    una_ = una;
+}
+
+uint64_t KcpBbr::_getBandwidth() const
+{
+    uint64_t bw = 0;
+    for (uint64_t sample : bw_samples_) {
+        bw = std::max(bw, sample);
+    }
+    return bw;
+}
+
+uint64_t KcpBbr::_getBdp(double gain) const
+{
+    uint32_t rtt = (0 != min_rtt_) ? min_rtt_ : kDefaultRtt;
+    return (uint64_t)(gain * _getBandwidth() * rtt / 1000);
+}
+
+void KcpBbr::_updateBandwidth(uint64_t rate, bool app_limited)
+{
+    // 受应用数据量限制的样本偏小，只在更大时采用
+    if (app_limited && (rate <= _getBandwidth())) {
+        return;
+    }
+
+    uint64_t &sample = bw_samples_[round_count_ % kBwWindowRounds];
+    sample = std::max(sample, rate);
+}
+
+void KcpBbr::_checkFullBandwidth()
+{
+    if (filled_pipe_ || !round_start_) {
+        return;
+    }
+
+    uint64_t bw = _getBandwidth();
+    if (bw >= (uint64_t)(full_bw_ * kFullBwThreshold)) {
+        full_bw_ = bw;
+        full_bw_count_ = 0;
+        return;
+    }
+
+    // 连续几轮带宽没有明显增长，认为已经填满瓶颈
+    if (++full_bw_count_ >= kFullBwRounds) {
+        filled_pipe_ = true;
+    }
+}
+
+void KcpBbr::_enterProbeBw(uint32_t now)
+{
+    mode_ = kProbeBw;
+    cwnd_gain_ = kCwndGain;
+    // 随机选择起始阶段，但不从降速阶段开始
+    cycle_index_ = now % kPacingGainCycleLength;
+    if (1 == cycle_index_) {
+        cycle_index_ = 2;
+    }
+    pacing_gain_ = kPacingGainCycle[cycle_index_];
+    cycle_stamp_ = now;
+}
+
+void KcpBbr::_updateMode(uint32_t now)
+{
+    switch (mode_) {
+        case kStartup: {
+            if (filled_pipe_) {
+                mode_ = kDrain;
+                pacing_gain_ = kDrainGain;
+                cwnd_gain_ = kHighGain;
+            }
+            break;
+        }
+
+        case kDrain: {
+            if ((uint64_t)inflight_ * mss_ <= _getBdp(1.0)) {
+                _enterProbeBw(now);
+            }
+            break;
+        }
+
+        case kProbeBw: {
+            if ((uint32_t)(now - cycle_stamp_) > std::max<uint32_t>(min_rtt_, 1)) {
+                cycle_index_ = (cycle_index_ + 1) % kPacingGainCycleLength;
+                pacing_gain_ = kPacingGainCycle[cycle_index_];
+                cycle_stamp_ = now;
+            }
+            break;
+        }
+
+        case kProbeRtt: {
+            if ((0 == probe_rtt_done_stamp_) && (inflight_ <= kMinCwnd)) {
+                probe_rtt_done_stamp_ = std::max<uint32_t>(now + kProbeRttTime, 1);
+            } else if ((0 != probe_rtt_done_stamp_) && ((int32_t)(now - probe_rtt_done_stamp_) >= 0)) {
+                min_rtt_stamp_ = now;
+                if (filled_pipe_) {
+                    _enterProbeBw(now);
+                } else {
+                    mode_ = kStartup;
+                    pacing_gain_ = kHighGain;
+                    cwnd_gain_ = kHighGain;
+                }
+            }
+            break;
+        }
+    }
+
+    if ((kProbeRtt != mode_) && min_rtt_expired_) {
+        // 最小rtt太久没有更新，减少在途数据重新测量
+        mode_ = kProbeRtt;
+        pacing_gain_ = 1.0;
+        cwnd_gain_ = 1.0;
+        probe_rtt_done_stamp_ = 0;
+    }
+    min_rtt_expired_ = false;
+}
+
+void KcpBbr::_updateControl()
+{
+    uint64_t bw = _getBandwidth();
+    uint32_t mss = std::max<uint32_t>(mss_, 1);
+    if (0 == bw) {
+        // 还没有速率样本，按初始窗口每个rtt发完估计
+        uint32_t rtt = (0 != min_rtt_) ? min_rtt_ : kDefaultRtt;
+        pacing_rate_ = (uint64_t)(kHighGain * kInitialCwnd * mss * 1000 / rtt);
+        cwnd_ = kInitialCwnd;
+        return;
+    }
+
+    pacing_rate_ = (uint64_t)(pacing_gain_ * bw);
+    uint64_t cwnd = (_getBdp(cwnd_gain_) + mss - 1) / mss;
+    if (!filled_pipe_) {
+        cwnd = std::max<uint64_t>(cwnd, kInitialCwnd);
+    }
+    if (kProbeRtt == mode_) {
+        cwnd = kMinCwnd;
+    }
+    cwnd_ = (uint32_t)std::min<uint64_t>(std::max<uint64_t>(cwnd, kMinCwnd), 0xffff);
+}
@@ -0,0 +1,194 @@
+#ifndef SRC_KCP_CONGESTION_H
+#define SRC_KCP_CONGESTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/**
+ * @brief kcp拥塞控制接口，替代kcp内置的拥塞控制（nocwnd固定为1）
+ * @note 不修改ikcp：解析kcp发出的数据段和收到的ack段获得rtt和交付速率，
+ *       计算结果通过kcp->snd_wnd限制在途段数，通过UdpPacer控制发送速率
+ */
+class KcpCongestion {
+public:
+    /**
+     * @brief 拥塞控制算法
+     */
+    enum Type {
+        kNone = 0,      // 不额外控制，由KcpProfile中的nc决定是否使用kcp内置的拥塞控制
+        kBbr = 1,       // 类BBR：估计瓶颈带宽和最小rtt
+    };
+
+    virtual ~KcpCongestion() {}
+
+    /**
+     * @brief 创建拥塞控制对象
+     * @return kNone或type无效时返回nullptr
+     */
+    static std::unique_ptr<KcpCongestion> create(int type, uint32_t mss);
+
+    /**
+     * @brief kcp包中是否包含数据段，只有ack、窗口探测的包不需要pacing
+     */
+    static bool hasData(const char *data, int length);
+
+    /**
+     * @brief kcp包实际发出时调用，经过pacing的包在离开发送队列时才计入在途
+     * @param now 毫秒，与kcp->current一致
+     * @param app_limited 发送队列已空，本次发送受应用数据量限制
+     */
+    void onPacketSent(uint32_t now, const char *data, int length, bool app_limited);
+
+    /**
+     * @brief 收到一个kcp包时调用
+     */
+    void onPacketReceived(uint32_t now, const char *data, int length);
+
+    /**
+     * @brief 拥塞窗口，段数
+     */
+    virtual uint32_t getCwnd() const = 0;
+
+    /**
+     * @brief 发送速率，字节/秒
+     */
+    virtual uint64_t getPacingRate() const = 0;
+
+    /**
+     * @brief kcp最小rto的下限，毫秒
+     * @note kcp的时间戳在ikcp_flush时写入，rtt包含pacing排队时间；毫秒精度下rttvar经常为0，
+     *       rto只比srtt多一个interval，带宽探测时排队稍有增加就会触发大量无效重传
+     */
+    virtual uint32_t getMinRto() const = 0;
+
+    virtual std::string toString() const = 0;
+
+    void setMss(uint32_t mss) {
+        mss_ = mss;
+    }
+
+protected:
+    explicit KcpCongestion(uint32_t mss) : mss_(mss) {}
+
+    virtual void onSegmentSent(uint32_t now, uint32_t sn, uint32_t bytes, bool app_limited) = 0;
+
+    /**
+     * @param ts ack中带回的数据段发送时间
+     */
+    virtual void onSegmentAcked(uint32_t now, uint32_t sn, uint32_t ts) = 0;
+
+    /**
+     * @brief 对端的una，小于una的段都已收到（ack可能丢失）
+     */
+    virtual void onUna(uint32_t now, uint32_t una) = 0;
+
+    uint32_t mss_;
+};
+
+/**
+ * @brief 类BBR拥塞控制：STARTUP -> DRAIN -> PROBE_BW，最小rtt过期时进入PROBE_RTT
+ * @note kcp的时间戳精度为毫秒，rtt小于1毫秒时按1毫秒计算
+ */
+class KcpBbr : public KcpCongestion {
+public:
+    explicit KcpBbr(uint32_t mss);
+
+    uint32_t getCwnd() const override;
+
+    uint64_t getPacingRate() const override;
+
+    uint32_t getMinRto() const override;
+
+    std::string toString() const override;
+
+    static const uint32_t kInitialCwnd = 32;
+    static const uint32_t kMinCwnd = 4;
+    static const uint32_t kBwWindowRounds = 10;
+    static const uint32_t kMinRttWindow = 10000;    // 毫秒
+    static const uint32_t kProbeRttTime = 200;      // 毫秒
+    static const uint32_t kDefaultRtt = 100;        // 还没有rtt样本时使用，毫秒
+    static const size_t kSentRecords = 16384;       // 不小于最大发送窗口
+
+protected:
+    void onSegmentSent(uint32_t now, uint32_t sn, uint32_t bytes, bool app_limited) override;
+
+    void onSegmentAcked(uint32_t now, uint32_t sn, uint32_t ts) override;
+
+    void onUna(uint32_t now, uint32_t una) override;
+
+private:
+    enum Mode {
+        kStartup,
+        kDrain,
+        kProbeBw,
+        kProbeRtt,
+    };
+
+    /**
+     * @brief 每个数据段发送时的交付状态，用于计算交付速率
+     */
+    struct SentRecord {
+        uint32_t sn;
+        uint32_t bytes;
+        uint64_t delivered;         // 发送时已交付的字节数
+        uint32_t delivered_time;    // 发送时最近一次交付的时间
+        bool app_limited;
+        bool acked;
+    };
+
+    /**
+     * @brief 数据段被确认：更新交付状态，返回是否为首次确认
+     */
+    bool _onDelivered(uint32_t now, uint32_t sn);
+
+    uint64_t _getBandwidth() const;
+
+    uint64_t _getBdp(double gain) const;
+
+    void _updateBandwidth(uint64_t rate, bool app_limited);
+
+    void _checkFullBandwidth();
+
+    void _updateMode(uint32_t now);
+
+    void _enterProbeBw(uint32_t now);
+
+    void _updateControl();
+
+    std::unique_ptr<SentRecord[]> records_;
+
+    Mode mode_;
+    double pacing_gain_;
+    double cwnd_gain_;
+    uint32_t cwnd_;
+    uint64_t pacing_rate_;
+
+    // 交付速率
+    uint32_t inflight_;             // 已发出未确认的段数
+    uint32_t una_;
+    uint64_t delivered_;
+    uint32_t delivered_time_;
+    uint64_t bw_samples_[kBwWindowRounds];  // 最近几轮中每轮的最大交付速率，字节/秒
+    uint64_t round_count_;
+    uint64_t next_round_delivered_;
+    bool round_start_;
+
+    // 最小rtt
+    uint32_t min_rtt_;
+    uint32_t min_rtt_stamp_;
+    bool min_rtt_expired_;
+    uint32_t probe_rtt_done_stamp_;
+
+    // STARTUP
+    uint64_t full_bw_;
+    uint32_t full_bw_count_;
+    bool filled_pipe_;
+
+    // PROBE_BW
+    uint32_t cycle_index_;
+    uint32_t cycle_stamp_;
+};
+
+#endif  // SRC_KCP_CONGESTION_H
@@ -0,0 +1,135 @@
+#include "KcpProfile.h"
+#include <mutex>
+#include "kcp/ikcp.h"
+#include "kcp/KcpConfig.h"
+#include "x/Logger.h"
+#include "AppConfig.h"
+#include "KcpCongestion.h"
+
+namespace {
+
+/**
+ * @brief 预置参数，顺序与KcpProfile::Type一致
+ */
+const KcpProfile kPresets[] = {
+    // 原来在ikcp_nodelay之后固定设置了fastresend = 1，这里保持实际生效的值
+    {KcpProfile::kDefault, kcpSendWindowSize, kcpRecvWindowSize, kcpNodeNoDelay, kcpNodeInterval, 1, kcpNodeNc,
+     kcpRxMinRto, kcpMtu, KcpCongestion::kNone, 0},
+    {KcpProfile::kInteractive, 256, 256, 1, 1, 1, 1, 10, kcpMtu, KcpCongestion::kBbr, 0},
+    {KcpProfile::kBulkVideo, 8192, 8192, 1, 5, 2, 1, 30, kcpMtu, KcpCongestion::kBbr, 0},
+    // 按流量计费，不让探测把包变大
+    {KcpProfile::kMetered, 1024, 1024, 0, 10, 0, 0, 100, 1200, KcpCongestion::kNone, 1200},
+};
+
+const int kPresetNum = sizeof(kPresets) / sizeof(kPresets[0]);
+
+struct CurrentProfile {
+    CurrentProfile() : is_set(false), profile() {}
+
+    bool is_set;
+    KcpProfile profile;
+    std::mutex mutex;
+};
+
+CurrentProfile &getCurrentProfile()
+{
+    static CurrentProfile current;
+    return current;
+}
+
+}  // namespace
+
+bool KcpProfile::isValid() const
+{
+    return (send_window > 0) && (recv_window > 0) && (interval > 0) && (resend >= 0) && (min_rto > 0)
+           && (mtu >= kMinMtu) && (mtu <= kcpMaxMtu)
+           && ((0 == max_mtu) || ((max_mtu >= mtu) && (max_mtu <= kcpMaxMtu)))
+           && ((KcpCongestion::kNone == congestion) || (KcpCongestion::kBbr == congestion));
+}
+
+std::string KcpProfile::toString() const
+{
+    std::string str;
+    str += "type:" + std::to_string(type);
+    str += " wnd:" + std::to_string(send_window) + "/" + std::to_string(recv_window);
+    str += " nodelay:" + std::to_string(nodelay);
+    str += " interval:" + std::to_string(interval);
+    str += " resend:" + std::to_string(resend);
+    str += " nc:" + std::to_string(nc);
+    str += " min_rto:" + std::to_string(min_rto);
+    str += " mtu:" + std::to_string(mtu);
+    str += " congestion:" + std::to_string(congestion);
+    str += " max_mtu:" + std::to_string(max_mtu);
+    return str;
+}
+
+int KcpProfile::apply(IKCPCB *kcp) const
+{
+    if ((nullptr == kcp) || !isValid()) {
+        LOG_ERROR("KcpProfile::apply failed:invalid input. " << toString());
+        return -1;
+    }
+
+    if (0 != ikcp_setmtu(kcp, mtu)) {
+        LOG_ERROR("KcpProfile::apply failed in ikcp_setmtu. mtu:" << mtu);
+        return -1;
+    }
+    ikcp_wndsize(kcp, send_window, recv_window);
+    ikcp_nodelay(kcp, nodelay, interval, resend, nc);
+    kcp->rx_minrto = min_rto;
+
+    return 0;
+}
+
+int KcpProfile::getPreset(int type, KcpProfile &profile)
+{
+    if ((type < 0) || (type >= kPresetNum)) {
+        return -1;
+    }
+
+    profile = kPresets[type];
+    return 0;
+}
+
+KcpProfile KcpProfile::getCurrent()
+{
+    CurrentProfile &current = getCurrentProfile();
+    {
+        std::lock_guard<std::mutex> lock(current.mutex);
+        if (current.is_set) {
+            return current.profile;
+        }
+    }
+
+    KcpProfile profile;
+    if (0 != getPreset(AppConfig::getKcpProfile(), profile)) {
+        getPreset(kDefault, profile);
+    }
+    return profile;
+}
+
+int KcpProfile::setCurrent(int type)
+{
+    KcpProfile profile;
+    if (0 != getPreset(type, profile)) {
+        LOG_ERROR("KcpProfile::setCurrent failed:invalid type. type:" << type);
+        return -1;
+    }
+
+    return setCurrent(profile);
+}
+
+int KcpProfile::setCurrent(const KcpProfile &profile)
+{
+    if (!profile.isValid()) {
+        LOG_ERROR("KcpProfile::setCurrent failed:invalid profile. " << profile.toString());
+        return -1;
+    }
+
+    CurrentProfile &current = getCurrentProfile();
+    std::lock_guard<std::mutex> lock(current.mutex);
+    current.profile = profile;
+    current.is_set = true;
+    LOG_INFO("KcpProfile::setCurrent. " << profile.toString());
+    return 0;
+}
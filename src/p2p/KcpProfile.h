@@ -0,0 +1,73 @@
+#ifndef SRC_KCP_PROFILE_H
+#define SRC_KCP_PROFILE_H
+
+#include <cstdint>
+#include <string>
+
+struct IKCPCB;
+
+/**
+ * @brief kcp调优参数，替代KcpConfig.h中编译期固定的宏，可以在运行时按网络切换
+ * @note 只在UdpTunnel::_initKcp中生效，修改后对下一个kcp连接起作用
+ */
+struct KcpProfile {
+    /**
+     * @brief 预置的参数组合
+     */
+    enum Type {
+        kDefault = 0,       // 与原KcpConfig.h一致，大窗口、不限流
+        kInteractive = 1,   // 低时延交互：小窗口减少排队，rto更激进，BBR
+        kBulkVideo = 2,     // 大流量视频：大窗口，放宽interval和rto，减少无效重传，BBR限速避免突发
+        kMetered = 3,       // 计费/蜂窝网络：开启流控，关闭快速重传，较小的mtu
+        kCustom = 4,        // 通过setCurrent(const KcpProfile &)设置
+    };
+
+    int type;
+    int send_window;        // ikcp_wndsize
+    int recv_window;
+    int nodelay;            // ikcp_nodelay
+    int interval;
+    int resend;
+    int nc;
+    int min_rto;            // kcp->rx_minrto
+    int mtu;                // ikcp_setmtu的初始值，不超过kcpMaxMtu（内存池按kcpMaxMtu划分块大小），路径MTU探测后会调整
+    int congestion;         // KcpCongestion::Type，不为kNone时忽略nc，send_window为拥塞窗口的上限
+    int max_mtu;            // 路径MTU探测结果的上限，0表示不超过kcpMaxMtu；不为0时不小于mtu
+
+    bool isValid() const;
+
+    std::string toString() const;
+
+    /**
+     * @brief 把参数应用到kcp对象
+     * @return 0：成功；-1：失败；
+     */
+    int apply(IKCPCB *kcp) const;
+
+    /**
+     * @brief 获取预置参数
+     * @return 0：成功；-1：type无效；
+     */
+    static int getPreset(int type, KcpProfile &profile);
+
+    /**
+     * @brief 当前使用的参数，未设置时为AppConfig::getKcpProfile()对应的预置参数
+     */
+    static KcpProfile getCurrent();
+
+    /**
+     * @brief 切换到预置参数
+     * @return 0：成功；-1：失败；
+     */
+    static int setCurrent(int type);
+
+    /**
+     * @brief 使用自定义参数
+     * @return 0：成功；-1：参数无效；
+     */
+    static int setCurrent(const KcpProfile &profile);
+
+    static const int kMinMtu = 576;
+};
+
+#endif  // SRC_KCP_PROFILE_H
@@ -0,0 +1,92 @@
+#include "LanProbe.h"
+#include "hv/htime.h"
+#include "rapidjson/document.h"
+#include "x/Logger.h"
+#include "AppConfig.h"
+
+LanProbe::LanProbe(hv::EventLoopPtr loop) : client_(loop), round_(0), pending_(0), done_(true)
+{}
+
+int LanProbe::start(const std::set<std::string> &ips, const ResultCallback &cb)
+{
+    cancel();
+    if (ips.empty()) {
+        return -1;
+    }
+
+    round_++;
+    pending_ = ips.size();
+    done_ = false;
+    cb_ = cb;
+
+    uint32_t round = round_;
+    uint64_t start_time = gettick_ms();
+    for (const auto &ip : ips) {
+        auto req = std::make_shared<HttpRequest>();
+        req->method = HTTP_GET;
+        req->url = "http://" + ip + ":" + std::to_string(AppConfig::getDeviceApiPort()) + AppConfig::getDeviceApiUri();
+        req->timeout = kProbeTimeout;
+        req->connect_timeout = kProbeTimeout;
+        LOG_DEBUG("LanProbe::start. url:" << req->url);
+
+        client_.send(req, [this, round, ip, start_time](const HttpResponsePtr &resp) {
+            _onResponse(round, ip, resp, start_time);
+        });
+    }
+
+    return 0;
+}
+
+void LanProbe::cancel()
+{
+    if (!done_) {
+        LOG_DEBUG("LanProbe::cancel. round:" << round_ << " pending:" << pending_);
+    }
+    round_++;
+    done_ = true;
+    cb_ = nullptr;
+}
+
+void LanProbe::_onResponse(uint32_t round, const std::string &ip, const HttpResponsePtr &resp, uint64_t start_time)
+{
+    if (round != round_) {
+        return;
+    }
+
+    uint32_t elapsed = (uint32_t)(gettick_ms() - start_time);
+    pending_--;
+    if (_isValidResponse(resp)) {
+        if (done_) {
+            return;
+        }
+        LOG_DEBUG("LanProbe::_onResponse. connect directly. ip:" << ip << " elapsed:" << elapsed << "ms");
+        done_ = true;
+        ResultCallback cb = std::move(cb_);
+        cb_ = nullptr;
+        cb(ip);
+        return;
+    }
+
+    LOG_WARN("LanProbe::_onResponse failed. ip:" << ip << " status_code:" << (resp ? (int)resp->status_code : 0)
+             << " elapsed:" << elapsed << "ms");
+    if (onProbeFailed) {
+        onProbeFailed(ip);
+    }
+    if ((0 == pending_) && !done_) {
+        done_ = true;
+        ResultCallback cb = std::move(cb_);
+        cb_ = nullptr;
+        cb("");
+    }
+}
+
+bool LanProbe::_isValidResponse(const HttpResponsePtr &resp)
+{
+    if ((nullptr == resp) || (200 != resp->status_code)) {
+        return false;
+    }
+
+    rapidjson::Document doc;
+    doc.Parse(resp->body.c_str());
+    return !doc.HasParseError();
+}
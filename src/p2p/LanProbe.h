@@ -0,0 +1,60 @@
+#ifndef SRC_LAN_PROBE_H
+#define SRC_LAN_PROBE_H
+
+#include <cstdint>
+#include <functional>
+#include <set>
+#include <string>
+#include "hv/AsyncHttpClient.h"
+#include "hv/EventLoop.h"
+
+/**
+ * @brief 局域网直连探测：同时向设备的所有局域网ip发送设备API请求，第一个正常响应的ip胜出
+ * @note 请求在ClientNode的事件循环中以非阻塞方式发出，不会阻塞隧道和代理；
+ *       失效的ip只占用各自的超时时间，不再逐个等待
+ *       仅在loop线程中使用
+ */
+class LanProbe {
+public:
+    /**
+     * @param ip 胜出的ip；为空表示所有ip都失败
+     */
+    typedef std::function<void(const std::string &ip)> ResultCallback;
+
+    explicit LanProbe(hv::EventLoopPtr loop);
+
+    /**
+     * @brief 开始新一轮探测，取消上一轮还没有结束的探测
+     * @param cb 只回调一次
+     * @return 0：成功；-1：没有可探测的ip；
+     */
+    int start(const std::set<std::string> &ips, const ResultCallback &cb);
+
+    /**
+     * @brief 取消探测，之后的响应都忽略
+     */
+    void cancel();
+
+    /**
+     * @brief 每个失败的ip回调一次，包括已经有ip胜出之后才超时的ip，用于记录失效的ip
+     */
+    std::function<void(const std::string &ip)> onProbeFailed;
+
+    static const int kProbeTimeout = 1;     // 每个ip的超时时间，秒
+
+private:
+    void _onResponse(uint32_t round, const std::string &ip, const HttpResponsePtr &resp, uint64_t start_time);
+
+    /**
+     * @brief 设备API正常返回json就认为可以直连
+     */
+    static bool _isValidResponse(const HttpResponsePtr &resp);
+
+    hv::AsyncHttpClient client_;    // 使用ClientNode的事件循环
+    uint32_t round_;                // 探测轮次，用于忽略已取消轮次的响应
+    size_t pending_;                // 本轮还没有响应的ip数
+    bool done_;                     // 本轮已回调
+    ResultCallback cb_;
+};
+
+#endif  // SRC_LAN_PROBE_H
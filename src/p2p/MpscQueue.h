@@ -0,0 +1,70 @@
+#ifndef SRC_MPSC_QUEUE_H
+#define SRC_MPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+/**
+ * @brief 无锁多生产者单消费者队列（Vyukov MPSC链表）
+ * @note push在任意线程中调用，只有一次原子交换，不会阻塞；pop只能在一个消费者线程中调用
+ *       消费者看到的顺序与各生产者各自push的顺序一致
+ *       队列本身不负责唤醒消费者，ProxyServer用一个标志位保证每批只投递一次事件
+ */
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head_(new Node()), tail_(head_.load(std::memory_order_relaxed))
+    {}
+
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value)) {
+        }
+        delete tail_;
+    }
+
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+
+    void push(T &&value)
+    {
+        Node *node = new Node(std::move(value));
+        Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+        // prev到node之间短暂断开，消费者此时看到的是空队列，之后的push不受影响
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @return false：队列为空
+     */
+    bool pop(T &value)
+    {
+        Node *tail = tail_;
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (nullptr == next) {
+            return false;
+        }
+
+        value = std::move(next->value);
+        tail_ = next;
+        delete tail;
+        return true;
+    }
+
+private:
+    struct Node {
+        Node() : value(), next(nullptr) {}
+
+        explicit Node(T &&v) : value(std::move(v)), next(nullptr) {}
+
+        T value;
+        std::atomic<Node *> next;
+    };
+
+    std::atomic<Node *> head_;  // 生产者一侧，最后push的节点
+    Node *tail_;                // 消费者一侧，已经取出的节点（哨兵）
+};
+
+#endif  // SRC_MPSC_QUEUE_H
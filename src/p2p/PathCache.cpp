@@ -0,0 +1,181 @@
+#include "PathCache.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "x/Logger.h"
+
+PathCache::PathCache() : header_(nullptr), records_(nullptr), size_(0)
+{}
+
+PathCache::~PathCache()
+{
+    fini();
+}
+
+int PathCache::init(const std::string &file)
+{
+    fini();
+
+    int fd = open(file.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        LOG_ERROR("PathCache::init failed in open. file:" << file << " errno:" << errno);
+        return -1;
+    }
+
+    size_t size = sizeof(Header) + kRecordNum * sizeof(Record);
+    if (0 != ftruncate(fd, (off_t)size)) {
+        LOG_ERROR("PathCache::init failed in ftruncate. file:" << file << " errno:" << errno);
+        close(fd);
+        return -1;
+    }
+
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == addr) {
+        LOG_ERROR("PathCache::init failed in mmap. file:" << file << " errno:" << errno);
+        return -1;
+    }
+
+    header_ = (Header *)addr;
+    records_ = (Record *)(header_ + 1);
+    size_ = size;
+    if ((kMagic != header_->magic) || (kVersion != header_->version) || (sizeof(Record) != header_->record_size) ||
+        (kRecordNum != header_->record_num)) {
+        LOG_INFO("PathCache::init. reset cache file:" << file);
+        memset(addr, 0, size);
+        header_->magic = kMagic;
+        header_->version = kVersion;
+        header_->record_size = sizeof(Record);
+        header_->record_num = kRecordNum;
+    }
+
+    LOG_DEBUG("PathCache::init. file:" << file);
+    return 0;
+}
+
+void PathCache::fini()
+{
+    if (nullptr != header_) {
+        msync(header_, size_, MS_ASYNC);
+        munmap(header_, size_);
+    }
+    header_ = nullptr;
+    records_ = nullptr;
+    size_ = 0;
+}
+
+bool PathCache::isOpen() const
+{
+    return nullptr != header_;
+}
+
+bool PathCache::get(const std::string &device_token, uint32_t now, Record &record) const
+{
+    int index = _find(device_token);
+    if (index < 0) {
+        return false;
+    }
+
+    const Record &found = records_[index];
+    if ((kPathNone == found.path) || (now - found.update_time > kRecordTtl)) {
+        return false;
+    }
+
+    record = found;
+    return true;
+}
+
+int PathCache::put(const Record &record)
+{
+    if (!isOpen()) {
+        return -1;
+    }
+
+    if ('\0' == record.device_token[0]) {
+        LOG_ERROR("PathCache::put failed:invalid device_token.");
+        return -1;
+    }
+
+    int index = _find(record.device_token);
+    if (index < 0) {
+        // 空的记录update_time为0，先被替换
+        index = 0;
+        for (size_t i = 1; i < kRecordNum; i++) {
+            if (records_[i].update_time < records_[index].update_time) {
+                index = (int)i;
+            }
+        }
+    }
+
+    records_[index] = record;
+    msync(header_, size_, MS_ASYNC);
+    return 0;
+}
+
+void PathCache::initRecord(Record &record, const std::string &device_token)
+{
+    memset(&record, 0, sizeof(record));
+    setString(record.device_token, sizeof(record.device_token), device_token);
+}
+
+void PathCache::setString(char *dst, size_t size, const std::string &src)
+{
+    size_t length = (src.length() < size) ? src.length() : (size - 1);
+    memcpy(dst, src.data(), length);
+    memset(dst + length, 0, size - length);
+}
+
+bool PathCache::isDeadIp(const Record &record, const std::string &ip, uint32_t now)
+{
+    for (size_t i = 0; i < kDeadIpNum; i++) {
+        if ((ip == record.dead_ips[i]) && (now - record.dead_times[i] <= kDeadIpTtl)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PathCache::addDeadIp(Record &record, const std::string &ip, uint32_t now)
+{
+    size_t index = 0;
+    for (size_t i = 0; i < kDeadIpNum; i++) {
+        if (ip == record.dead_ips[i]) {
+            index = i;
+            break;
+        }
+        if (record.dead_times[i] < record.dead_times[index]) {
+            index = i;
+        }
+    }
+
+    setString(record.dead_ips[index], sizeof(record.dead_ips[index]), ip);
+    record.dead_times[index] = now;
+}
+
+void PathCache::removeDeadIp(Record &record, const std::string &ip)
+{
+    for (size_t i = 0; i < kDeadIpNum; i++) {
+        if (ip == record.dead_ips[i]) {
+            memset(record.dead_ips[i], 0, sizeof(record.dead_ips[i]));
+            record.dead_times[i] = 0;
+        }
+    }
+}
+
+int PathCache::_find(const std::string &device_token) const
+{
+    if (!isOpen() || device_token.empty()) {
+        return -1;
+    }
+
+    // 写入时按kTokenLength截断
+    std::string key = device_token.substr(0, kTokenLength - 1);
+    for (size_t i = 0; i < kRecordNum; i++) {
+        if (key == records_[i].device_token) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,119 @@
+#ifndef SRC_PATH_CACHE_H
+#define SRC_PATH_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief 按device_token记录上一次会话胜出的路径，文件映射到内存，App重启后仍然有效
+ * @note 同一个摄像头一天内会反复打开，每次StartSession都要重新探测局域网、连接中继、打洞；
+ *       有缓存时先探测上次直连成功的ip（不等待服务器回复），并跳过最近探测失败的ip
+ *       固定大小的记录表，写满后替换最久没有更新的记录
+ *       仅在loop线程中使用
+ */
+class PathCache {
+public:
+    /**
+     * @brief 胜出的路径
+     */
+    enum Path {
+        kPathNone = 0,
+        kPathDirect = 1,    // 局域网直连
+        kPathUdp = 2,       // p2p
+        kPathRelay = 3,     // 中继
+    };
+
+    static const size_t kTokenLength = 64;
+    static const size_t kIpLength = 16;         // "255.255.255.255"
+    static const size_t kAddrLength = 32;       // "255.255.255.255:65535"
+    static const size_t kDeadIpNum = 4;
+    static const size_t kRecordNum = 64;
+    static const uint32_t kRecordTtl = 7 * 24 * 3600;   // 记录的有效期，秒
+    static const uint32_t kDeadIpTtl = 24 * 3600;       // 失败的ip在这段时间内不再探测，秒
+
+    /**
+     * @brief 一个设备的记录，直接保存在映射文件中，只能包含定长字段
+     */
+    struct Record {
+        char device_token[kTokenLength];
+        uint32_t path;                      // Path
+        uint32_t tunnel_id;                 // p2p隧道的tunnel_id
+        uint32_t setup_time;                // 从收到UserP2PConnect到该路径可用的时间，毫秒
+        uint32_t update_time;               // 更新时间，unix秒
+        char lan_ip[kIpLength];             // 直连成功的ip
+        char public_addr[kAddrLength];      // 设备的公网地址
+        char dead_ips[kDeadIpNum][kIpLength];
+        uint32_t dead_times[kDeadIpNum];    // 探测失败的时间，unix秒
+    };
+
+    PathCache();
+
+    ~PathCache();
+
+    /**
+     * @brief 打开或创建缓存文件，格式不匹配时清空
+     * @return 0：成功；-1：失败，之后的读写都忽略；
+     */
+    int init(const std::string &file);
+
+    void fini();
+
+    bool isOpen() const;
+
+    /**
+     * @brief 查找设备的记录，过期的记录视为不存在
+     * @return true：找到；false：没有记录；
+     */
+    bool get(const std::string &device_token, uint32_t now, Record &record) const;
+
+    /**
+     * @brief 写入记录，设备没有记录时替换最久没有更新的记录
+     * @return 0：成功；-1：失败；
+     */
+    int put(const Record &record);
+
+    /**
+     * @brief 清空record并填入device_token
+     */
+    static void initRecord(Record &record, const std::string &device_token);
+
+    /**
+     * @brief 按长度截断后复制，保证以'\0'结尾
+     */
+    static void setString(char *dst, size_t size, const std::string &src);
+
+    /**
+     * @brief ip在kDeadIpTtl内探测失败过
+     */
+    static bool isDeadIp(const Record &record, const std::string &ip, uint32_t now);
+
+    /**
+     * @brief 记录探测失败的ip，满了替换最早的
+     */
+    static void addDeadIp(Record &record, const std::string &ip, uint32_t now);
+
+    static void removeDeadIp(Record &record, const std::string &ip);
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t record_size;
+        uint32_t record_num;
+    };
+
+    static const uint32_t kMagic = 0x4350415a;     // "ZAPC"
+    static const uint32_t kVersion = 1;
+
+    /**
+     * @return 设备记录的下标；-1：没有记录；
+     */
+    int _find(const std::string &device_token) const;
+
+    Header *header_;        // 映射的起始地址
+    Record *records_;
+    size_t size_;           // 映射的长度
+};
+
+#endif  // SRC_PATH_CACHE_H
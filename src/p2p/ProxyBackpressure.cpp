@@ -0,0 +1,62 @@
+#include "ProxyBackpressure.h"
+#include "AppConfig.h"
+#include "ClientNode.h"
+#include "x/Logger.h"
+
+ProxyBackpressure::ProxyBackpressure(const std::string &name) : name_(name)
+{}
+
+void ProxyBackpressure::onSent(uint32_t proxy_id, size_t backlog)
+{
+    if (backlog < AppConfig::getProxyBackpressureHighWatermark()) {
+        return;
+    }
+    if (paused_.count(proxy_id) > 0) {
+        return;
+    }
+
+    ClientNode *client_node = getClientNode();
+    if (nullptr == client_node) {
+        return;
+    }
+    ProxyServer *proxy_server = client_node->getProxyServer(proxy_id);
+    if ((nullptr == proxy_server) || (0 != proxy_server->pauseProxy(proxy_id))) {
+        return;
+    }
+    paused_.insert(proxy_id);
+#ifdef DEBUG_PROXY_BACKPRESSURE
+    LOG_DEBUG("ProxyBackpressure::onSent. pause. tunnel:" << name_ << " proxy_id:" << proxy_id << " backlog:" << backlog);
+#endif  // DEBUG_PROXY_BACKPRESSURE
+}
+
+void ProxyBackpressure::onDrained(size_t backlog)
+{
+    if (paused_.empty() || (backlog > AppConfig::getProxyBackpressureLowWatermark())) {
+        return;
+    }
+
+#ifdef DEBUG_PROXY_BACKPRESSURE
+    LOG_DEBUG("ProxyBackpressure::onDrained. resume. tunnel:" << name_ << " proxies:" << paused_.size()
+              << " backlog:" << backlog);
+#endif  // DEBUG_PROXY_BACKPRESSURE
+    reset();
+}
+
+void ProxyBackpressure::reset()
+{
+    if (paused_.empty()) {
+        return;
+    }
+
+    ClientNode *client_node = getClientNode();
+    if (nullptr != client_node) {
+        for (uint32_t proxy_id : paused_) {
+            // 连接可能已经关闭，找不到时忽略
+            ProxyServer *proxy_server = client_node->getProxyServer(proxy_id);
+            if (nullptr != proxy_server) {
+                proxy_server->resumeProxy(proxy_id);
+            }
+        }
+    }
+    paused_.clear();
+}
@@ -0,0 +1,43 @@
+#ifndef SRC_PROXY_BACKPRESSURE_H
+#define SRC_PROXY_BACKPRESSURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+
+/**
+ * @brief 隧道发送积压时暂停读取本地代理连接，积压消化后恢复
+ * @note 每个隧道一个：隧道积压超过高水位时，暂停刚写入数据的连接（hio_read_stop），
+ *       低于低水位时恢复所有暂停的连接；仅在loop线程中使用
+ */
+class ProxyBackpressure {
+public:
+    explicit ProxyBackpressure(const std::string &name);
+
+    /**
+     * @brief 隧道写入proxy_id的数据后调用
+     * @param backlog 隧道当前积压的字节数
+     */
+    void onSent(uint32_t proxy_id, size_t backlog);
+
+    /**
+     * @brief 隧道积压减少后调用
+     */
+    void onDrained(size_t backlog);
+
+    /**
+     * @brief 隧道断开或重置时调用，恢复所有暂停的连接
+     */
+    void reset();
+
+    bool isPaused() const {
+        return !paused_.empty();
+    }
+
+private:
+    std::string name_;
+    std::set<uint32_t> paused_;    // 暂停读取的proxy_id
+};
+
+#endif  // SRC_PROXY_BACKPRESSURE_H
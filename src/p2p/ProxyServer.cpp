@@ -1,10 +1,15 @@
 #include "ProxyServer.h"
+#include <algorithm>
+#include <future>
 #include "x/Logger.h"
-#include "ClientNode.h"
+#include "AppConfig.h"
 
 //#define DEBUG_PROXY_SERVER
 
-ProxyServer::ProxyServer(hv::EventLoopPtr loop) : run_(false), hv::TcpServer(loop) {
+ProxyServer::ProxyServer(hv::EventLoopPtr loop, uint32_t session_id)
+        : hv::TcpServer(loop), run_(false), session_id_(session_id), sink_(nullptr), tunnel_loop_(loop),
+          shared_workers_(false),
+          outbox_scheduled_(false) {
 }
 
 ProxyServer::~ProxyServer() {
@@ -14,25 +19,43 @@ ProxyServer::~ProxyServer() {
     fini();
 }
 
-int ProxyServer::init(uint16_t port) {
+void ProxyServer::setSink(ProxySink *sink) {
+    sink_ = sink;
+}
+
+int ProxyServer::init(uint16_t port, const std::vector<hv::EventLoopPtr> &worker_loops) {
+    if (run_) {
+        return 0;
+    }
     LOG_DEBUG("ProxyServer::init. port:" << port);
     if (createsocket(port, "127.0.0.1") < 0) {
         LOG_ERROR("ProxyServer::init failed in createsocket");
         return -1;
     }
     onConnection = [this](const hv::SocketChannelPtr &channel) {
-        if (channel->isConnected()) {
-            _addChannel(channel);
-        } else {
-            _delChannel(channel->id());
-        }
+        this->_onConnection(channel);
     };
     onMessage = [this](const hv::SocketChannelPtr &channel, hv::Buffer *buf) {
         this->_onMessage(channel, buf);
     };
-    //tcp_server_.setThreadNum(4);
-    //tcp_server_.setLoadBalance(LB_LeastConnections);
-    startAccept();
+    if (AppConfig::getStreamFlowControlEnabled()) {
+        onWriteComplete = [this](const hv::SocketChannelPtr &channel, hv::Buffer *buf) {
+            this->_onWriteComplete(channel, buf);
+        };
+    }
+
+    // 不使用TcpServer自己的线程池，新连接在隧道loop中accept后由_dispatchConnection转到共用的worker loop
+    setThreadNum(0);
+    hv::TcpServerEventLoopTmpl<hv::SocketChannel>::start(true);
+
+    // 在隧道loop线程中调用，accept要等本轮事件处理完，worker在新连接到来之前就绪
+    workers_.clear();
+    shared_workers_ = !worker_loops.empty();
+    for (size_t i = 0; i < std::max<size_t>(worker_loops.size(), 1); i++) {
+        std::unique_ptr<Worker> worker(new Worker());
+        worker->loop = shared_workers_ ? worker_loops[i] : tunnel_loop_;
+        workers_.push_back(std::move(worker));
+    }
     run_ = true;
 
     return 0;
@@ -46,11 +69,37 @@ int ProxyServer::fini() {
         run_ = false;
         stopAccept();
         closesocket();
+        hv::TcpServerEventLoopTmpl<hv::SocketChannel>::stop(true);
+        if (!shared_workers_) {
+            return 0;
+        }
+
+        // worker loop由其他会话共用，不会退出，关闭本会话的连接后再返回
+        for (auto &worker : workers_) {
+            if (!worker->loop->isRunning()) {
+                continue;
+            }
+            Worker *raw = worker.get();
+            std::promise<void> closed;
+            worker->loop->runInLoop([raw, &closed]() {
+                // close时回调_onConnection，会修改channels
+                std::map<uint32_t, hv::SocketChannelPtr> channels = raw->channels;
+                for (auto &it : channels) {
+                    it.second->close();
+                }
+                closed.set_value();
+            });
+            closed.get_future().wait();
+        }
     }
 
     return 0;
 }
 
+bool ProxyServer::isRunning() const {
+    return run_;
+}
+
 int ProxyServer::sendDataToProxy(uint32_t proxy_id, char *buffer, uint32_t length) {
     if ((nullptr == buffer) || (length <= 0)) {
         LOG_ERROR("ProxyServer::sendDataToProxy failed:invalid input. proxy_id:" << proxy_id << " length:" << length);
@@ -60,74 +109,342 @@ int ProxyServer::sendDataToProxy(uint32_t proxy_id, char *buffer, uint32_t lengt
     LOG_DEBUG("ProxyServer::sendDataToProxy. proxy_id:" << proxy_id << " length:" << length);
 #endif//DEBUG_PROXY_SERVER
 
-    std::lock_guard<std::recursive_mutex> lock(channel_map_mutex_);
-    auto it = channel_map_.find(proxy_id);
-    if (channel_map_.end() == it) {
+    auto it = proxies_.find(proxy_id);
+    if (proxies_.end() == it) {
         LOG_ERROR("ProxyServer::sendDataToProxy failed: channel not found. proxy_id:" << proxy_id);
         return -1;
     }
 
-    it->second->write((void *) buffer, (int) length);
+    Worker &worker = *workers_[it->second.worker];
+    if (worker.loop->isInLoopThread()) {
+        // 连接就在隧道loop中，不拷贝
+        auto channel_it = worker.channels.find(proxy_id);
+        if (worker.channels.end() == channel_it) {
+            LOG_ERROR("ProxyServer::sendDataToProxy failed: channel closed. proxy_id:" << proxy_id);
+            return -1;
+        }
+        channel_it->second->write((void *) buffer, (int) length);
+        return 0;
+    }
 
-    return 0;
+    Frame frame(Frame::kData, proxy_id, 0);
+    frame.data.assign(buffer, length);
+    return _postToWorker(proxy_id, std::move(frame));
 }
 
 int ProxyServer::delProxy(uint32_t proxy_id) {
 #ifdef DEBUG_PROXY_SERVER
     LOG_DEBUG("ProxyServer::delProxy. proxy_id:" << proxy_id);
 #endif//DEBUG_PROXY_SERVER
-    _delChannel(proxy_id);
+    // 之后的数据不再发给该连接，worker关闭连接后回调onProxyClosed
+    _postToWorker(proxy_id, Frame(Frame::kClose, proxy_id, 0));
+    proxies_.erase(proxy_id);
 
     return 0;
 }
 
-int ProxyServer::_onMessage(const hv::SocketChannelPtr &channel, hv::Buffer *buf) {
-    if ((nullptr == buf) || buf->isNull()) {
-        LOG_ERROR("ProxyServer::_onMessage failed:invalid buf");
+uint32_t ProxyServer::getProxyId(uint16_t local_port) {
+    for (const auto &it : proxies_) {
+        if (it.second.local_port == local_port) {
+            return it.first;
+        }
+    }
+
+    return 0;
+}
+
+int ProxyServer::pauseProxy(uint32_t proxy_id) {
+#ifdef DEBUG_PROXY_SERVER
+    LOG_DEBUG("ProxyServer::pauseProxy. proxy_id:" << proxy_id);
+#endif//DEBUG_PROXY_SERVER
+    return _postToWorker(proxy_id, Frame(Frame::kPause, proxy_id, 0));
+}
+
+int ProxyServer::resumeProxy(uint32_t proxy_id) {
+#ifdef DEBUG_PROXY_SERVER
+    LOG_DEBUG("ProxyServer::resumeProxy. proxy_id:" << proxy_id);
+#endif//DEBUG_PROXY_SERVER
+    return _postToWorker(proxy_id, Frame(Frame::kResume, proxy_id, 0));
+}
+
+int ProxyServer::_onConnection(const hv::SocketChannelPtr &channel) {
+    if (channel->isConnected() && shared_workers_ && tunnel_loop_->isInLoopThread()) {
+        // 刚在隧道loop中accept
+        return _dispatchConnection(channel);
+    }
+
+    uint32_t index = _getCurrentWorker();
+    if (index >= workers_.size()) {
+        LOG_ERROR("ProxyServer::_onConnection failed:not in worker loop. channel_id:" << channel->id());
         return -1;
     }
+    Worker &worker = *workers_[index];
+
+    if (channel->isConnected()) {
+        return _addConnection(index, channel);
+    } else {
 #ifdef DEBUG_PROXY_SERVER
-    LOG_DEBUG("ProxyServer::_onMessage. channel_id:" << channel->id() << " length:" << buf->size());
+        LOG_DEBUG("ProxyServer:_onConnection. disconnected. id:" << channel->id());
 #endif//DEBUG_PROXY_SERVER
+        worker.channels.erase(channel->id());
+        worker.window_consumed.erase(channel->id());
+        _postToTunnel(Frame(Frame::kClosed, channel->id(), 0));
+    }
+
+    return 0;
+}
 
-    ClientNode *client_node = getClientNode();
-    if (nullptr == client_node) {
+int ProxyServer::_addConnection(uint32_t index, const hv::SocketChannelPtr &channel) {
+#ifdef DEBUG_PROXY_SERVER
+    LOG_DEBUG("ProxyServer:_addConnection. connected. id:" << channel->id() << " worker:" << index);
+#endif//DEBUG_PROXY_SERVER
+    if (!run_) {
+        // 转到worker的途中fini
+        channel->close();
         return -1;
     }
-    int ret = client_node->onProxyData(channel->id(), (char *) buf->data(), buf->size());
-    if (-1 == ret) {
-        LOG_ERROR("ProxyServer::_onMessage failed in sendDataToProxy."
-                          << " channel_id:" << channel->id() << " length:" << buf->size());
+
+    workers_[index]->channels[channel->id()] = channel;
+    auto *peer_addr = (sockaddr_u *) hio_peeraddr(channel->io());
+    Frame frame(Frame::kConnected, channel->id(), (nullptr == peer_addr) ? 0 : sockaddr_port(peer_addr));
+    frame.worker = index;
+    _postToTunnel(std::move(frame));
+    return 0;
+}
+
+int ProxyServer::_dispatchConnection(const hv::SocketChannelPtr &channel) {
+    uint32_t index = 0;
+    for (uint32_t i = 1; i < workers_.size(); i++) {
+        if (workers_[i]->loop->connectionNum < workers_[index]->loop->connectionNum) {
+            index = i;
+        }
+    }
+    hv::EventLoopPtr loop = workers_[index]->loop;
+    if (!loop->isRunning()) {
+        LOG_ERROR("ProxyServer::_dispatchConnection failed:worker not running. channel_id:" << channel->id());
+        channel->close();
         return -1;
     }
 
+    // 与libhv的onAccept相同：从隧道loop摘下，在worker loop中挂上后再开始读；
+    // 关闭时在worker loop中减少连接数
+    channel->stopRead();
+    hio_detach(channel->io());
+    --tunnel_loop_->connectionNum;
+    ++loop->connectionNum;
+    loop->runInLoop([this, index, loop, channel]() {
+        hio_attach(loop->loop(), channel->io());
+        channel->startRead();
+        _addConnection(index, channel);
+    });
     return 0;
 }
 
-int ProxyServer::_addChannel(const hv::SocketChannelPtr &channel) {
+int ProxyServer::_onMessage(const hv::SocketChannelPtr &channel, hv::Buffer *buf) {
+    if ((nullptr == buf) || buf->isNull()) {
+        LOG_ERROR("ProxyServer::_onMessage failed:invalid buf");
+        return -1;
+    }
 #ifdef DEBUG_PROXY_SERVER
-    LOG_DEBUG("ProxyServer:_addChannel. id:" << channel->id());
+    LOG_DEBUG("ProxyServer::_onMessage. channel_id:" << channel->id() << " length:" << buf->size());
 #endif//DEBUG_PROXY_SERVER
-    std::lock_guard<std::recursive_mutex> lock(channel_map_mutex_);
-    channel_map_[channel->id()] = channel;
 
+    if (tunnel_loop_->isInLoopThread()) {
+        // 连接就在隧道loop中，不拷贝
+        Frame frame(Frame::kData, channel->id(), 0);
+        _onTunnelFrame(frame, (char *) buf->data(), (uint32_t) buf->size());
+        return 0;
+    }
+
+    Frame frame(Frame::kData, channel->id(), 0);
+    frame.data.assign((const char *) buf->data(), buf->size());
+    _postToTunnel(std::move(frame));
     return 0;
 }
 
-int ProxyServer::_delChannel(const uint32_t channel_id) {
+int ProxyServer::_onWriteComplete(const hv::SocketChannelPtr &channel, hv::Buffer *buf) {
+    if (nullptr == buf) {
+        return -1;
+    }
+    uint32_t index = _getCurrentWorker();
+    if (index >= workers_.size()) {
+        return -1;
+    }
+
+    uint32_t &consumed = workers_[index]->window_consumed[channel->id()];
+    consumed += (uint32_t) buf->size();
+    if (consumed < AppConfig::getStreamReceiveWindow() / 2) {
+        return 0;
+    }
+    uint32_t increment = consumed;
+    consumed = 0;
 #ifdef DEBUG_PROXY_SERVER
-    LOG_DEBUG("ProxyServer::_delChannel. id:" << channel_id);
+    LOG_DEBUG("ProxyServer::_onWriteComplete. window update. channel_id:" << channel->id() << " increment:" << increment);
 #endif//DEBUG_PROXY_SERVER
-    std::lock_guard<std::recursive_mutex> lock(channel_map_mutex_);
-    auto it = channel_map_.find(channel_id);
-    if (channel_map_.end() == it) {
-        return 0;
+
+    _postToTunnel(Frame(Frame::kWindowUpdate, channel->id(), increment));
+    return 0;
+}
+
+uint32_t ProxyServer::_getCurrentWorker() const {
+    for (size_t i = 0; i < workers_.size(); i++) {
+        if (workers_[i]->loop->isInLoopThread()) {
+            return (uint32_t) i;
+        }
     }
 
-    if (it->second->isConnected()) {
-        it->second->close();
+    return (uint32_t) workers_.size();
+}
+
+void ProxyServer::_postToTunnel(Frame &&frame) {
+    if (tunnel_loop_->isInLoopThread()) {
+        _onTunnelFrame(frame, &frame.data[0], (uint32_t) frame.data.size());
+        return;
     }
-    channel_map_.erase(it);
 
+    outbox_.push(std::move(frame));
+    if (!outbox_scheduled_.exchange(true)) {
+        tunnel_loop_->queueInLoop([this]() {
+            _drainOutbox();
+        });
+    }
+}
+
+void ProxyServer::_drainInbox(Worker &worker) {
+    // 先清标志再取，之后push的消息会重新投递事件，不会遗漏
+    worker.scheduled.store(false);
+    Frame frame;
+    while (worker.inbox.pop(frame)) {
+        _onWorkerFrame(worker, frame);
+    }
+}
+
+void ProxyServer::_onWorkerFrame(Worker &worker, Frame &frame) {
+    auto it = worker.channels.find(frame.proxy_id);
+    if (worker.channels.end() == it) {
+        // 连接已关闭，隧道loop还没有收到kClosed
+        return;
+    }
+    hv::SocketChannelPtr channel = it->second;
+
+    switch (frame.type) {
+        case Frame::kData: {
+            channel->write(frame.data.data(), (int) frame.data.size());
+            break;
+        }
+
+        case Frame::kClose: {
+            worker.channels.erase(it);
+            worker.window_consumed.erase(frame.proxy_id);
+            if (channel->isConnected()) {
+                channel->close();
+            }
+            break;
+        }
+
+        case Frame::kPause: {
+            channel->stopRead();
+            break;
+        }
+
+        case Frame::kResume: {
+            if (channel->isConnected()) {
+                channel->startRead();
+            }
+            break;
+        }
+
+        default: {
+            LOG_ERROR("ProxyServer::_onWorkerFrame failed:invalid type. type:" << frame.type
+                              << " proxy_id:" << frame.proxy_id);
+            break;
+        }
+    }
+}
+
+int ProxyServer::_postToWorker(uint32_t proxy_id, Frame &&frame) {
+    auto it = proxies_.find(proxy_id);
+    if (proxies_.end() == it) {
+        return -1;
+    }
+
+    Worker &worker = *workers_[it->second.worker];
+    if (worker.loop->isInLoopThread()) {
+        _onWorkerFrame(worker, frame);
+        return 0;
+    }
+
+    worker.inbox.push(std::move(frame));
+    if (!worker.scheduled.exchange(true)) {
+        Worker *raw = &worker;
+        worker.loop->queueInLoop([this, raw]() {
+            _drainInbox(*raw);
+        });
+    }
     return 0;
 }
+
+void ProxyServer::_drainOutbox() {
+    // 每次最多处理kMaxDrainFrames条，其余的重新投递，不长时间占用隧道loop
+    const int kMaxDrainFrames = 256;
+    outbox_scheduled_.store(false);
+    Frame frame;
+    for (int i = 0; i < kMaxDrainFrames; i++) {
+        if (!outbox_.pop(frame)) {
+            return;
+        }
+        _onTunnelFrame(frame, &frame.data[0], (uint32_t) frame.data.size());
+    }
+
+    if (!outbox_scheduled_.exchange(true)) {
+        tunnel_loop_->queueInLoop([this]() {
+            _drainOutbox();
+        });
+    }
+}
+
+void ProxyServer::_onTunnelFrame(Frame &frame, char *data, uint32_t length) {
+    if (nullptr == sink_) {
+        return;
+    }
+
+    switch (frame.type) {
+        case Frame::kConnected: {
+            Proxy proxy;
+            proxy.worker = frame.worker;
+            proxy.local_port = (uint16_t) frame.value;
+            proxies_[frame.proxy_id] = proxy;
+            sink_->onProxyConnected(session_id_, frame.proxy_id);
+            break;
+        }
+
+        case Frame::kData: {
+            if (proxies_.count(frame.proxy_id) <= 0) {
+                // delProxy之后还在路上的数据
+                break;
+            }
+            if (-1 == sink_->onProxyData(frame.proxy_id, data, length)) {
+                LOG_ERROR("ProxyServer::_onTunnelFrame failed in onProxyData."
+                                  << " channel_id:" << frame.proxy_id << " length:" << length);
+            }
+            break;
+        }
+
+        case Frame::kWindowUpdate: {
+            sink_->onProxyWindowUpdate(frame.proxy_id, frame.value);
+            break;
+        }
+
+        case Frame::kClosed: {
+            proxies_.erase(frame.proxy_id);
+            sink_->onProxyClosed(frame.proxy_id);
+            break;
+        }
+
+        default: {
+            LOG_ERROR("ProxyServer::_onTunnelFrame failed:invalid type. type:" << frame.type
+                              << " proxy_id:" << frame.proxy_id);
+            break;
+        }
+    }
+}
@@ -1,39 +1,185 @@
 #ifndef SRC_PROXY_SERVER_H
 #define SRC_PROXY_SERVER_H
 
+#include <atomic>
 #include <cstdint>
 #include <string>
 #include <map>
 #include <memory>
-#include <mutex>
+#include <vector>
 #include "hv/TcpServer.h"
+#include "MpscQueue.h"
 
+/**
+ * @brief 本地连接的事件，在隧道loop线程中回调
+ * @note 由ClientNode实现，基准测试中替换为只统计字节数的实现
+ */
+class ProxySink {
+public:
+    virtual ~ProxySink() {}
+
+    virtual int onProxyConnected(uint32_t session_id, uint32_t proxy_id) = 0;
+
+    virtual int onProxyData(uint32_t proxy_id, char *buffer, uint32_t length) = 0;
+
+    virtual int onProxyWindowUpdate(uint32_t proxy_id, uint32_t increment) = 0;
+
+    virtual int onProxyClosed(uint32_t proxy_id) = 0;
+};
+
+/**
+ * @brief App访问设备的本地代理
+ * @note 本地连接的读写分散在ClientNode中所有会话共用的I/O线程（worker loop）上，隧道和ClientNode在隧道loop线程中；
+ *       新连接在隧道loop中accept后，转到连接数最少的worker loop；
+ *       两个方向的数据都通过无锁MPSC队列交给对方的loop，每个连接只在所在的worker中访问，不需要加锁；
+ *       线程数为0时连接就在隧道loop中，直接调用，不经过队列
+ *       init/fini之外的公有接口都在隧道loop线程中调用
+ */
 class ProxyServer : public hv::TcpServer {
 public:
-    explicit ProxyServer(hv::EventLoopPtr loop);
+    /**
+     * @param loop 隧道loop，同时用于accept
+     * @param session_id 所属的设备会话，新连接按会话选择隧道
+     */
+    explicit ProxyServer(hv::EventLoopPtr loop, uint32_t session_id = 0);
 
     ~ProxyServer();
 
-    int init(uint16_t port);
+    /**
+     * @brief 在init之前设置，未设置时丢弃本地连接的事件
+     */
+    void setSink(ProxySink *sink);
+
+    /**
+     * @brief 在隧道loop线程中调用
+     * @param worker_loops 所有会话共用的I/O线程，为空时连接在隧道loop中处理
+     */
+    int init(uint16_t port, const std::vector<hv::EventLoopPtr> &worker_loops);
 
     int fini();
 
+    bool isRunning() const;
+
     int sendDataToProxy(uint32_t proxy_id, char *buffer, uint32_t length);
 
     int delProxy(uint32_t proxy_id);
 
+    /**
+     * @brief 按本地连接的端口（App一侧socket的端口）查找proxy_id
+     * @return proxy_id，未找到时返回0
+     */
+    uint32_t getProxyId(uint16_t local_port);
+
+    /**
+     * @brief 暂停/恢复读取本地连接，隧道发送积压时使用
+     * @return 0：成功；-1：连接不存在；
+     */
+    int pauseProxy(uint32_t proxy_id);
+
+    int resumeProxy(uint32_t proxy_id);
+
 private:
+    /**
+     * @brief worker和隧道loop之间传递的消息
+     */
+    struct Frame {
+        enum Type {
+            kConnected = 1,     // worker -> 隧道loop，value为App一侧的端口
+            kData = 2,          // 双向
+            kWindowUpdate = 3,  // worker -> 隧道loop，value为归还的字节数
+            kClosed = 4,        // worker -> 隧道loop
+            kClose = 5,         // 隧道loop -> worker
+            kPause = 6,         // 隧道loop -> worker
+            kResume = 7,        // 隧道loop -> worker
+        };
+
+        Frame() : type(0), proxy_id(0), value(0), worker(0) {}
+
+        Frame(uint32_t t, uint32_t id, uint32_t v) : type(t), proxy_id(id), value(v), worker(0) {}
+
+        uint32_t type;
+        uint32_t proxy_id;
+        uint32_t value;
+        uint32_t worker;        // kConnected时为连接所在的worker
+        std::string data;
+    };
+
+    /**
+     * @brief 一个I/O线程：收件队列和该线程上的连接，channels和window_consumed只在该线程中访问
+     */
+    struct Worker {
+        Worker() : scheduled(false) {}
+
+        hv::EventLoopPtr loop;
+        MpscQueue<Frame> inbox;
+        std::atomic<bool> scheduled;    // 已投递处理inbox的事件，每批只投递一次
+        std::map<uint32_t, hv::SocketChannelPtr> channels;
+        std::map<uint32_t, uint32_t> window_consumed;   //已写给本地App、还未归还的字节数
+    };
+
+    /**
+     * @brief 隧道loop中记录的连接
+     */
+    struct Proxy {
+        uint32_t worker;        // workers_下标
+        uint16_t local_port;    // App一侧socket的端口
+    };
+
+    // 以下在worker线程中调用
+    int _onConnection(const hv::SocketChannelPtr &channel);
+
+    /**
+     * @brief 记录worker上的新连接，通知隧道loop
+     */
+    int _addConnection(uint32_t index, const hv::SocketChannelPtr &channel);
 
     int _onMessage(const hv::SocketChannelPtr &channel, hv::Buffer *buf);
 
-    int _addChannel(const hv::SocketChannelPtr &channel);
+    /**
+     * @brief 数据已写给本地App，累计超过接收窗口的一半后归还额度
+     */
+    int _onWriteComplete(const hv::SocketChannelPtr &channel, hv::Buffer *buf);
+
+    /**
+     * @return 当前线程的worker，不是worker线程时返回workers_.size()
+     */
+    uint32_t _getCurrentWorker() const;
+
+    /**
+     * @brief 交给隧道loop，在隧道loop线程中时直接处理
+     */
+    void _postToTunnel(Frame &&frame);
+
+    void _drainInbox(Worker &worker);
+
+    void _onWorkerFrame(Worker &worker, Frame &frame);
+
+    // 以下在隧道loop线程中调用
+    /**
+     * @brief 刚accept的连接从隧道loop转到连接数最少的worker loop，连接数按所有会话一起统计
+     */
+    int _dispatchConnection(const hv::SocketChannelPtr &channel);
+
+    /**
+     * @brief 交给连接所在的worker，worker就是隧道loop时直接处理
+     * @return 0：成功；-1：连接不存在；
+     */
+    int _postToWorker(uint32_t proxy_id, Frame &&frame);
+
+    void _drainOutbox();
 
-    int _delChannel(uint32_t channel_id);
+    void _onTunnelFrame(Frame &frame, char *data, uint32_t length);
 
 private:
     volatile bool run_;
-    std::map<uint32_t, hv::SocketChannelPtr> channel_map_;
-    std::recursive_mutex channel_map_mutex_;
+    const uint32_t session_id_;
+    ProxySink *sink_;                               //仅在隧道loop中回调
+    hv::EventLoopPtr tunnel_loop_;
+    std::vector<std::unique_ptr<Worker>> workers_;  //init后不变，loop由所有会话共用
+    bool shared_workers_;                           //worker loop不是隧道loop，新连接需要转过去
+    MpscQueue<Frame> outbox_;                       //worker -> 隧道loop
+    std::atomic<bool> outbox_scheduled_;
+    std::map<uint32_t, Proxy> proxies_;             //proxy_id - 所在的worker，仅在隧道loop中使用
 };
 
 #endif //SRC_PROXY_SERVER_H
@@ -0,0 +1,371 @@
+#include "ReedSolomon.h"
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RS_X86
+#elif defined(__aarch64__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RS_NEON
+#endif
+
+namespace {
+
+typedef void (*MulAddFunc)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length);
+
+const uint16_t kPolynomial = 0x11d;     // x^8 + x^4 + x^3 + x^2 + 1
+
+/**
+ * @brief GF(2^8)运算表和mulAdd实现，首次使用时初始化
+ */
+struct Galois {
+    Galois();
+
+    uint8_t mul(uint8_t a, uint8_t b) const {
+        return mul_table[a][b];
+    }
+
+    uint8_t inv(uint8_t a) const {
+        return exp_table[255 - log_table[a]];
+    }
+
+    /**
+     * @brief 选择mulAdd实现
+     * @return false：当前CPU不支持
+     */
+    bool selectKernel(const char *name);
+
+    uint8_t exp_table[512];
+    uint8_t log_table[256];
+    uint8_t mul_table[256][256];
+    MulAddFunc mul_add;
+    const char *kernel_name;
+};
+
+Galois &getMutableGalois()
+{
+    static Galois galois;
+    return galois;
+}
+
+const Galois &getGalois()
+{
+    return getMutableGalois();
+}
+
+void mulAddScalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length)
+{
+    const uint8_t *row = getGalois().mul_table[c];
+    for (size_t i = 0; i < length; i++) {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+/**
+ * @brief c * x = c * (x & 0x0f) ^ c * (x & 0xf0)，两个16字节的表可以用一次shuffle查完
+ */
+void getNibbleTables(uint8_t c, uint8_t *low, uint8_t *high)
+{
+    const uint8_t *row = getGalois().mul_table[c];
+    for (int i = 0; i < 16; i++) {
+        low[i] = row[i];
+        high[i] = row[i << 4];
+    }
+}
+
+#if defined(RS_X86)
+__attribute__((target("ssse3"))) void mulAddSsse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length)
+{
+    alignas(16) uint8_t low[16];
+    alignas(16) uint8_t high[16];
+    getNibbleTables(c, low, high);
+    const __m128i table_low = _mm_load_si128((const __m128i *)low);
+    const __m128i table_high = _mm_load_si128((const __m128i *)high);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_shuffle_epi8(table_low, _mm_and_si128(x, mask));
+        __m128i hi = _mm_shuffle_epi8(table_high, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(d, _mm_xor_si128(lo, hi)));
+    }
+    mulAddScalar(dst + i, src + i, c, length - i);
+}
+
+__attribute__((target("avx2"))) void mulAddAvx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length)
+{
+    alignas(16) uint8_t low[16];
+    alignas(16) uint8_t high[16];
+    getNibbleTables(c, low, high);
+    const __m256i table_low = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)low));
+    const __m256i table_high = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)high));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i lo = _mm256_shuffle_epi8(table_low, _mm256_and_si256(x, mask));
+        __m256i hi = _mm256_shuffle_epi8(table_high, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(d, _mm256_xor_si256(lo, hi)));
+    }
+    mulAddSsse3(dst + i, src + i, c, length - i);
+}
+#endif  // RS_X86
+
+#if defined(RS_NEON)
+void mulAddNeon(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length)
+{
+    uint8_t low[16];
+    uint8_t high[16];
+    getNibbleTables(c, low, high);
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+
+    size_t i = 0;
+#if defined(__aarch64__)
+    const uint8x16_t table_low = vld1q_u8(low);
+    const uint8x16_t table_high = vld1q_u8(high);
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t x = vld1q_u8(src + i);
+        uint8x16_t lo = vqtbl1q_u8(table_low, vandq_u8(x, mask));
+        uint8x16_t hi = vqtbl1q_u8(table_high, vshrq_n_u8(x, 4));
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), veorq_u8(lo, hi)));
+    }
+#else
+    // ARMv7没有16字节查表指令，拆成两个8字节的vtbl2
+    const uint8x8x2_t table_low = {{vld1_u8(low), vld1_u8(low + 8)}};
+    const uint8x8x2_t table_high = {{vld1_u8(high), vld1_u8(high + 8)}};
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t x = vld1q_u8(src + i);
+        uint8x16_t index_low = vandq_u8(x, mask);
+        uint8x16_t index_high = vshrq_n_u8(x, 4);
+        uint8x16_t lo = vcombine_u8(vtbl2_u8(table_low, vget_low_u8(index_low)),
+                                    vtbl2_u8(table_low, vget_high_u8(index_low)));
+        uint8x16_t hi = vcombine_u8(vtbl2_u8(table_high, vget_low_u8(index_high)),
+                                    vtbl2_u8(table_high, vget_high_u8(index_high)));
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), veorq_u8(lo, hi)));
+    }
+#endif
+    mulAddScalar(dst + i, src + i, c, length - i);
+}
+#endif  // RS_NEON
+
+Galois::Galois() : mul_add(mulAddScalar), kernel_name("scalar")
+{
+    uint16_t x = 1;
+    for (int i = 0; i < 255; i++) {
+        exp_table[i] = (uint8_t)x;
+        log_table[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= kPolynomial;
+        }
+    }
+    for (int i = 255; i < 512; i++) {
+        exp_table[i] = exp_table[i - 255];
+    }
+    log_table[0] = 0;
+
+    for (int a = 0; a < 256; a++) {
+        for (int b = 0; b < 256; b++) {
+            mul_table[a][b] = ((0 == a) || (0 == b)) ? 0 : exp_table[log_table[a] + log_table[b]];
+        }
+    }
+
+    if (!selectKernel("avx2") && !selectKernel("ssse3")) {
+        selectKernel("neon");
+    }
+}
+
+bool Galois::selectKernel(const char *name)
+{
+    MulAddFunc func = nullptr;
+    if (0 == strcmp(name, "scalar")) {
+        func = mulAddScalar;
+    }
+#if defined(RS_X86)
+    __builtin_cpu_init();
+    if ((0 == strcmp(name, "avx2")) && __builtin_cpu_supports("avx2")) {
+        func = mulAddAvx2;
+    } else if ((0 == strcmp(name, "ssse3")) && __builtin_cpu_supports("ssse3")) {
+        func = mulAddSsse3;
+    }
+#elif defined(RS_NEON)
+    if (0 == strcmp(name, "neon")) {
+        func = mulAddNeon;
+    }
+#endif
+    if (nullptr == func) {
+        return false;
+    }
+
+    mul_add = func;
+    kernel_name = name;
+    return true;
+}
+
+/**
+ * @brief 校验矩阵第i行第j列：1 / (x_i + y_j)，x_i = 128 + i，y_j = j，互不相同，任意方阵子式可逆
+ */
+uint8_t getCauchy(size_t i, size_t j)
+{
+    return getGalois().inv((uint8_t)((128 + i) ^ j));
+}
+
+/**
+ * @brief 高斯-约当消元求逆
+ * @return 0：成功；-1：不可逆；
+ */
+int invertMatrix(uint8_t *matrix, uint8_t *inverse, size_t n)
+{
+    const Galois &gf = getGalois();
+    memset(inverse, 0, n * n);
+    for (size_t i = 0; i < n; i++) {
+        inverse[i * n + i] = 1;
+    }
+
+    for (size_t col = 0; col < n; col++) {
+        size_t pivot = col;
+        while ((pivot < n) && (0 == matrix[pivot * n + col])) {
+            pivot++;
+        }
+        if (pivot >= n) {
+            return -1;
+        }
+        if (pivot != col) {
+            for (size_t k = 0; k < n; k++) {
+                uint8_t t = matrix[col * n + k];
+                matrix[col * n + k] = matrix[pivot * n + k];
+                matrix[pivot * n + k] = t;
+                t = inverse[col * n + k];
+                inverse[col * n + k] = inverse[pivot * n + k];
+                inverse[pivot * n + k] = t;
+            }
+        }
+
+        uint8_t scale = gf.inv(matrix[col * n + col]);
+        for (size_t k = 0; k < n; k++) {
+            matrix[col * n + k] = gf.mul(matrix[col * n + k], scale);
+            inverse[col * n + k] = gf.mul(inverse[col * n + k], scale);
+        }
+
+        for (size_t row = 0; row < n; row++) {
+            uint8_t factor = matrix[row * n + col];
+            if ((row == col) || (0 == factor)) {
+                continue;
+            }
+            for (size_t k = 0; k < n; k++) {
+                matrix[row * n + k] ^= gf.mul(factor, matrix[col * n + k]);
+                inverse[row * n + k] ^= gf.mul(factor, inverse[col * n + k]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+}  // namespace
+
+int ReedSolomon::encode(const uint8_t *const *data, size_t n, uint8_t *const *parity, size_t m, size_t length)
+{
+    if ((nullptr == data) || (nullptr == parity) || (n <= 0) || (n > kMaxDataShards) || (m > kMaxParityShards)) {
+        return -1;
+    }
+
+    const Galois &gf = getGalois();
+    for (size_t i = 0; i < m; i++) {
+        memset(parity[i], 0, length);
+        for (size_t j = 0; j < n; j++) {
+            gf.mul_add(parity[i], data[j], getCauchy(i, j), length);
+        }
+    }
+
+    return 0;
+}
+
+int ReedSolomon::reconstruct(uint8_t *const *shards, const bool *present, size_t n, size_t m, size_t length)
+{
+    if ((nullptr == shards) || (nullptr == present) || (n <= 0) || (n > kMaxDataShards) || (m > kMaxParityShards)) {
+        return -1;
+    }
+
+    // 选出n个收到的分片，数据分片对应单位行，校验分片对应Cauchy行
+    size_t rows[kMaxDataShards];
+    size_t count = 0;
+    size_t missing[kMaxDataShards];
+    size_t missing_count = 0;
+    for (size_t j = 0; j < n; j++) {
+        if (present[j]) {
+            rows[count++] = j;
+        } else {
+            missing[missing_count++] = j;
+        }
+    }
+    if (0 == missing_count) {
+        return 0;
+    }
+    for (size_t i = 0; (i < m) && (count < n); i++) {
+        if (present[n + i]) {
+            rows[count++] = n + i;
+        }
+    }
+    if (count < n) {
+        return -1;
+    }
+
+    uint8_t matrix[kMaxDataShards * kMaxDataShards];
+    uint8_t inverse[kMaxDataShards * kMaxDataShards];
+    for (size_t r = 0; r < n; r++) {
+        for (size_t j = 0; j < n; j++) {
+            if (rows[r] < n) {
+                matrix[r * n + j] = (rows[r] == j) ? 1 : 0;
+            } else {
+                matrix[r * n + j] = getCauchy(rows[r] - n, j);
+            }
+        }
+    }
+    if (0 != invertMatrix(matrix, inverse, n)) {
+        return -1;
+    }
+
+    // 缺失的数据分片 = 逆矩阵对应行 * 收到的分片
+    const Galois &gf = getGalois();
+    for (size_t k = 0; k < missing_count; k++) {
+        size_t j = missing[k];
+        memset(shards[j], 0, length);
+        for (size_t r = 0; r < n; r++) {
+            uint8_t c = inverse[j * n + r];
+            if (0 != c) {
+                gf.mul_add(shards[j], shards[rows[r]], c, length);
+            }
+        }
+    }
+
+    return 0;
+}
+
+void ReedSolomon::mulAdd(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length)
+{
+    getGalois().mul_add(dst, src, c, length);
+}
+
+const char *ReedSolomon::getKernelName()
+{
+    return getGalois().kernel_name;
+}
+
+int ReedSolomon::setKernel(const char *name)
+{
+    if (nullptr == name) {
+        return -1;
+    }
+
+    static const char *const kKernelNames[] = {"scalar", "ssse3", "avx2", "neon"};
+    for (const char *kernel_name : kKernelNames) {
+        if (0 == strcmp(name, kernel_name)) {
+            return getMutableGalois().selectKernel(kernel_name) ? 0 : -1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,51 @@
+#ifndef SRC_REED_SOLOMON_H
+#define SRC_REED_SOLOMON_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief GF(2^8)上的系统Reed-Solomon编码，校验矩阵为Cauchy矩阵，任意n个分片可恢复n个数据分片
+ * @note 核心运算dst ^= c * src按CPU选择实现：x86上AVX2/SSSE3，ARM上NEON，其他平台查表
+ */
+class ReedSolomon {
+public:
+    static const size_t kMaxDataShards = 32;
+    static const size_t kMaxParityShards = 16;
+
+    /**
+     * @brief 计算校验分片
+     * @param data n个数据分片
+     * @param parity m个校验分片的输出缓存
+     * @param length 每个分片的长度
+     * @return 0：成功；-1：失败；
+     */
+    static int encode(const uint8_t *const *data, size_t n, uint8_t *const *parity, size_t m, size_t length);
+
+    /**
+     * @brief 恢复缺失的数据分片
+     * @param shards n+m个分片，前n个为数据分片，缺失的数据分片也需要提供缓存，恢复结果写入其中
+     * @param present 分片是否收到
+     * @return 0：成功；-1：收到的分片不足n个或参数无效；
+     */
+    static int reconstruct(uint8_t *const *shards, const bool *present, size_t n, size_t m, size_t length);
+
+    /**
+     * @brief dst ^= c * src
+     */
+    static void mulAdd(uint8_t *dst, const uint8_t *src, uint8_t c, size_t length);
+
+    /**
+     * @brief 当前使用的mulAdd实现
+     */
+    static const char *getKernelName();
+
+    /**
+     * @brief 指定mulAdd实现，用于测试各实现：scalar、ssse3、avx2、neon
+     * @return 0：成功；-1：名称无效或当前CPU不支持；
+     * @note 不是线程安全的，只在没有编解码时调用
+     */
+    static int setKernel(const char *name);
+};
+
+#endif  // SRC_REED_SOLOMON_H
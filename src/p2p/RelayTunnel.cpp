@@ -1,15 +1,19 @@
 #include "RelayTunnel.h"
 #include "ClientNode.h"
 
-RelayTunnel::RelayTunnel(hv::EventLoopPtr loop) : hv::TcpClient(loop) {
+RelayTunnel::RelayTunnel(hv::EventLoopPtr loop)
+    : hv::TcpClient(loop), conn_index_(0), conn_num_(1), backpressure_("relay"), flush_pending_(false), sent_bytes_(0),
+      quality_sent_bytes_(0), quality_retrans_(0) {
 }
 
 RelayTunnel::~RelayTunnel() {
     fini();
 }
 
-int RelayTunnel::init(const std::string &server_addr, const std::string &order_id, const std::string &user_token) {
-    std::string input = " server_addr:" + server_addr + " order_id:" + order_id + " user_token:" + user_token;
+int RelayTunnel::init(const std::string &server_addr, const std::string &order_id, const std::string &user_token,
+                      uint32_t conn_index, uint32_t conn_num) {
+    std::string input = " server_addr:" + server_addr + " order_id:" + order_id + " user_token:" + user_token
+                        + " conn:" + std::to_string(conn_index) + "/" + std::to_string(conn_num);
     if (server_addr.empty() || order_id.empty() || user_token.empty()) {
         LOG_ERROR("RelayTunnel::init failed:invalid input." + input);
         return -1;
@@ -23,6 +27,8 @@ int RelayTunnel::init(const std::string &server_addr, const std::string &order_i
     }
     order_id_ = order_id;
     user_token_ = user_token;
+    conn_index_ = conn_index;
+    conn_num_ = conn_num;
     LOG_DEBUG("RelayTunnel::init." + input);
 
     if (createsocket(port, ip.c_str()) < 0) {
@@ -52,6 +58,12 @@ int RelayTunnel::init(const std::string &server_addr, const std::string &order_i
         }
     };
 
+    onWriteComplete = [this](const hv::SocketChannelPtr &, hv::Buffer *) {
+        if (backpressure_.isPaused()) {
+            backpressure_.onDrained(getSendBacklog());
+        }
+    };
+
     {
         unpack_setting_t setting;
         memset(&setting, 0, sizeof(unpack_setting_t));
@@ -99,7 +111,7 @@ int RelayTunnel::onProxyData(const uint32_t type, const uint32_t proxy_id) {
         return -1;
     }
 
-    send((char *) &tunnel_msg_header, sizeof(tunnel_msg_header));
+    _send(tunnel_msg_header, nullptr, 0);
     LOG_DEBUG("RelayTunnel::sendData. type:" << type << " proxy_id:" << proxy_id);
     return 0;
 }
@@ -131,21 +143,91 @@ int RelayTunnel::onProxyData(const uint32_t type, const uint32_t proxy_id, const
         return -1;
     }
 
-    send((char *) &tunnel_msg_header, sizeof(tunnel_msg_header));
-    send(data, (int)length);
+    _send(tunnel_msg_header, data, length);
     LOG_DEBUG("RelayTunnel::sendData. "
                       << " type:" << type
                       << " proxy_id:" << proxy_id
                       << " length:" << length);
+    if (kTunnelMsgTypeTcpData == type) {
+        backpressure_.onSent(proxy_id, getSendBacklog());
+    }
     return 0;
 }
 
+size_t RelayTunnel::getSendBacklog() {
+    if ((nullptr == channel) || !channel->isConnected()) {
+        return 0;
+    }
+
+    return channel->writeBufsize() + send_batch_.size();
+}
+
+int RelayTunnel::_send(const TcpTunnelMsgHeader &header, const char *data, size_t length) {
+    if (send_batch_.append((const char *) &header, sizeof(header), data, length)) {
+        return _flushSendBatch();
+    }
+
+    if (!flush_pending_) {
+        // 同一轮事件循环中的其他帧（其他连接的数据、TcpFini等）合并到一次写中
+        flush_pending_ = true;
+        loop()->queueInLoop([this]() {
+            flush_pending_ = false;
+            _flushSendBatch();
+        });
+    }
+    return 0;
+}
+
+int RelayTunnel::_flushSendBatch() {
+    return send_batch_.flush([this](const char *data, size_t length) {
+        if (send(data, (int) length) < 0) {
+            LOG_ERROR("RelayTunnel::_flushSendBatch failed in send. length:" << length);
+            return -1;
+        }
+        sent_bytes_ += length;
+        return 0;
+    });
+}
+
 int RelayTunnel::onProxyData(const uint32_t proxy_id, char *data, size_t length) {
     return onProxyData(kTunnelMsgTypeTcpData, proxy_id, data, length);
 }
 
+const TunnelQuality &RelayTunnel::updateQuality() {
+    if (!isReady()) {
+        quality_.reset();
+        return quality_;
+    }
+
+#ifdef TCP_INFO
+    struct tcp_info info;
+    memset(&info, 0, sizeof(info));
+    socklen_t len = sizeof(info);
+    if (0 != getsockopt(channel->fd(), IPPROTO_TCP, TCP_INFO, &info, &len)) {
+        return quality_;
+    }
+
+    // 按mss折算发出的段数，重传数取内核的累计值
+    uint32_t mss = (info.tcpi_snd_mss > 0) ? info.tcpi_snd_mss : 1;
+    uint64_t segments = (sent_bytes_ - quality_sent_bytes_) / mss;
+    uint32_t retransmitted = info.tcpi_total_retrans - quality_retrans_;
+    quality_sent_bytes_ = sent_bytes_;
+    quality_retrans_ = info.tcpi_total_retrans;
+    double loss = ((segments + retransmitted) > 0) ? (double) retransmitted / (segments + retransmitted) : -1;
+
+    uint32_t rtt = (info.tcpi_rtt + 999) / 1000;
+    uint64_t bandwidth = (rtt > 0) ? ((uint64_t) info.tcpi_snd_cwnd * mss * 1000 / rtt) : 0;
+    quality_.update(rtt, loss, bandwidth);
+#endif
+    return quality_;
+}
+
 int RelayTunnel::_onConnected(const hv::SocketChannelPtr &channel) {
     std::string peeraddr = channel->peeraddr();
+    // 新连接的内核计数从0开始
+    quality_.reset();
+    quality_sent_bytes_ = sent_bytes_;
+    quality_retrans_ = 0;
     LOG_DEBUG("RelayTunnel::_onConnected. connected. peeraddr:" << peeraddr << " channel_id:" << channel->id());
     return onProxyData(kTunnelMsgTypeTunnelInit, 0, _getTunnelInitMsg());
 
@@ -154,8 +236,11 @@ int RelayTunnel::_onConnected(const hv::SocketChannelPtr &channel) {
 
 int RelayTunnel::_onDisconnected(const hv::SocketChannelPtr &channel) {
     LOG_WARN("RelayTunnel::_onDisconnected. channel_id:" << channel->id());
-    LOG_WARN("RelayTunnel::_onDisconnected. cleanup required. todo");
-    //todo cleanup
+    backpressure_.reset();
+    send_batch_.reset();
+    if (onTunnelDisconnected) {
+        onTunnelDisconnected(this);
+    }
     return 0;
 }
 
@@ -209,6 +294,11 @@ int RelayTunnel::_onMessage(const hv::SocketChannelPtr &channel, hv::Buffer *buf
             break;
         }
 
+        case kTunnelMsgTypeTcpMigrate: {
+            return _onMessageTcpMigrate(header, data, length);
+            break;
+        }
+
         default: {
             LOG_DEBUG("RelayTunnel::_onMessage. ignore. " << header->toString());
             return 0;
@@ -228,7 +318,7 @@ int RelayTunnel::_onMessageTcpData(TcpTunnelMsgHeader *header, char *data, size_
     if (nullptr == client_node) {
         return -1;
     }
-    if (0 != client_node->getProxyServer().sendDataToProxy(header->proxy_id, data, length)) {
+    if (0 != client_node->onTunnelData(kRelayTunnel, header->proxy_id, data, (uint32_t) length)) {
         LOG_ERROR("RelayTunnel::_onMessageTcpData failed:invalid pointer or length." << header->toString()
                                                                                      << " length:" << length);
         return -1;
@@ -244,12 +334,15 @@ int RelayTunnel::_onMessageTcpFini(TcpTunnelMsgHeader *header) {
         return -1;
     }
     LOG_DEBUG("RelayTunnel::_onMessageTcpFini." << header->toString());
+    if (onProxyFini) {
+        onProxyFini(header->proxy_id);
+    }
 
     ClientNode *client_node = getClientNode();
     if (nullptr == client_node) {
         return -1;
     }
-    if (0 != client_node->getProxyServer().delProxy(header->proxy_id)) {
+    if (0 != client_node->onTunnelFini(kRelayTunnel, header->proxy_id)) {
         LOG_ERROR("RelayTunnel::_onMessageTcpFini failed in delProxy." << header->toString());
         return -1;
     } else {
@@ -257,10 +350,31 @@ int RelayTunnel::_onMessageTcpFini(TcpTunnelMsgHeader *header) {
     }
 }
 
+int RelayTunnel::_onMessageTcpMigrate(TcpTunnelMsgHeader *header, char *data, size_t length) {
+    if ((nullptr == header) || (nullptr == data) || (kTunnelStreamMigrateLength != length)) {
+        LOG_ERROR("RelayTunnel::_onMessageTcpMigrate failed:invalid input. length:" << length);
+        return -1;
+    }
+    LOG_DEBUG("RelayTunnel::_onMessageTcpMigrate." << header->toString());
+
+    ClientNode *client_node = getClientNode();
+    if (nullptr == client_node) {
+        return -1;
+    }
+    auto *migrate = (TunnelStreamMigrate *) data;
+    client_node->onTunnelMigrate(kRelayTunnel, header->proxy_id, migrate->offset);
+    return 0;
+}
+
 std::string RelayTunnel::_getTunnelInitMsg() {
     std::map<std::string, std::string> data_map;
     data_map["order_id"] = order_id_;
     data_map["user_token"] = user_token_;
+    if (conn_num_ > 1) {
+        // 同一order_id的多条中继连接，服务器按proxy_id转发
+        data_map["conn_index"] = std::to_string(conn_index_);
+        data_map["conn_num"] = std::to_string(conn_num_);
+    }
 
     return JsonMsg::getJsonString(data_map);
 }
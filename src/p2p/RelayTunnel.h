@@ -2,6 +2,7 @@
 #define SRC_RELAY_TUNNEL_H_
 
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <map>
 #include <memory>
@@ -12,6 +13,9 @@
 #include "JsonMsg.h"
 #include "TunnelMsgHeader.h"
 #include "ProxyServer.h"
+#include "ProxyBackpressure.h"
+#include "TcpFrameBatch.h"
+#include "TunnelQuality.h"
 
 class RelayTunnel : public hv::TcpClient {
 public:
@@ -19,7 +23,12 @@ public:
 
     ~RelayTunnel();
 
-    int init(const std::string &server_addr, const std::string &order_id, const std::string &user_token);
+    /**
+     * @param conn_index 多连接中继时本连接的序号
+     * @param conn_num 多连接中继的连接数，为1时TunnelInit与单连接相同
+     */
+    int init(const std::string &server_addr, const std::string &order_id, const std::string &user_token,
+             uint32_t conn_index = 0, uint32_t conn_num = 1);
 
     int fini();
 
@@ -33,6 +42,27 @@ public:
 
     int onProxyData(uint32_t type, uint32_t proxy_id, const char *data, uint32_t length);
 
+    /**
+     * @brief 发送积压的字节数，即libhv写缓存中未写出的数据
+     */
+    size_t getSendBacklog();
+
+    /**
+     * @brief 用TCP_INFO的rtt、累计重传数和拥塞窗口采样一次隧道质量，未连接时清空
+     * @note 中继服务器不回应心跳，rtt取内核的平滑rtt
+     */
+    const TunnelQuality &updateQuality();
+
+    /**
+     * @brief 连接断开时回调，RelayTunnelPool用于关闭该连接上的代理连接
+     */
+    std::function<void(RelayTunnel *tunnel)> onTunnelDisconnected;
+
+    /**
+     * @brief 中继服务器发来TcpFini时回调
+     */
+    std::function<void(uint32_t proxy_id)> onProxyFini;
+
 private:
 
     int _onConnected(const hv::SocketChannelPtr &channel);
@@ -45,11 +75,29 @@ private:
 
     int _onMessageTcpFini(TcpTunnelMsgHeader *header);
 
+    int _onMessageTcpMigrate(TcpTunnelMsgHeader *header, char *data, size_t length);
+
     std::string _getTunnelInitMsg();
 
+    /**
+     * @brief 消息头和数据加入发送合并缓存，本轮事件循环结束时一次写出
+     */
+    int _send(const TcpTunnelMsgHeader &header, const char *data, size_t length);
+
+    int _flushSendBatch();
+
 private:
     std::string order_id_;
     std::string user_token_;
+    uint32_t conn_index_;
+    uint32_t conn_num_;
+    ProxyBackpressure backpressure_;    //发送积压时暂停读取本地连接
+    TcpFrameBatch send_batch_;          //发送合并缓存，仅在loop线程中使用
+    bool flush_pending_;                //已投递flush任务
+    uint64_t sent_bytes_;               //写入socket的字节数
+    TunnelQuality quality_;
+    uint64_t quality_sent_bytes_;       //上次采样时的sent_bytes_
+    uint32_t quality_retrans_;          //上次采样时的tcpi_total_retrans
 };
 
 #endif //SRC_RELAY_TUNNEL_H_
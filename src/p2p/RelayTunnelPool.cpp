@@ -0,0 +1,178 @@
+#include "RelayTunnelPool.h"
+#include "AppConfig.h"
+#include "ClientNode.h"
+#include "x/Logger.h"
+
+RelayTunnelPool::RelayTunnelPool(hv::EventLoopPtr loop)
+{
+    size_t conn_num = std::max<size_t>(AppConfig::getRelayConnectionNum(), 1);
+    for (size_t i = 0; i < conn_num; i++) {
+        std::unique_ptr<RelayTunnel> tunnel(new RelayTunnel(loop));
+        tunnel->onTunnelDisconnected = [this](RelayTunnel *disconnected) {
+            _onTunnelDisconnected(disconnected);
+        };
+        tunnel->onProxyFini = [this](uint32_t proxy_id) {
+            releaseProxy(proxy_id);
+        };
+        tunnels_.push_back(std::move(tunnel));
+    }
+    proxy_count_.resize(conn_num, 0);
+}
+
+RelayTunnelPool::~RelayTunnelPool()
+{
+    fini();
+}
+
+int RelayTunnelPool::init(const std::string &server_addr, const std::string &order_id, const std::string &user_token)
+{
+    int succeeded = 0;
+    for (size_t i = 0; i < tunnels_.size(); i++) {
+        if (0 != tunnels_[i]->init(server_addr, order_id, user_token, (uint32_t)i, (uint32_t)tunnels_.size())) {
+            LOG_WARN("RelayTunnelPool::init failed in RelayTunnel::init. index:" << i);
+            continue;
+        }
+        succeeded++;
+    }
+
+    return (succeeded > 0) ? 0 : -1;
+}
+
+int RelayTunnelPool::fini()
+{
+    for (auto &tunnel : tunnels_) {
+        tunnel->fini();
+    }
+    proxy_tunnel_map_.clear();
+    std::fill(proxy_count_.begin(), proxy_count_.end(), 0);
+    return 0;
+}
+
+bool RelayTunnelPool::isReady()
+{
+    for (auto &tunnel : tunnels_) {
+        if (tunnel->isReady()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int RelayTunnelPool::onProxyData(uint32_t type, uint32_t proxy_id)
+{
+    RelayTunnel *tunnel = _getTunnel(proxy_id);
+    if (nullptr == tunnel) {
+        LOG_ERROR("RelayTunnelPool::onProxyData failed:no tunnel. type:" << type << " proxy_id:" << proxy_id);
+        return -1;
+    }
+
+    int ret = tunnel->onProxyData(type, proxy_id);
+    if (kTunnelMsgTypeTcpFini == type) {
+        releaseProxy(proxy_id);
+    }
+    return ret;
+}
+
+int RelayTunnelPool::onProxyData(uint32_t type, uint32_t proxy_id, const std::string &data)
+{
+    return onProxyData(type, proxy_id, data.c_str(), (uint32_t)data.length());
+}
+
+int RelayTunnelPool::onProxyData(uint32_t type, uint32_t proxy_id, const char *data, uint32_t length)
+{
+    RelayTunnel *tunnel = _getTunnel(proxy_id);
+    if (nullptr == tunnel) {
+        LOG_ERROR("RelayTunnelPool::onProxyData failed:no tunnel. type:" << type << " proxy_id:" << proxy_id
+                  << " length:" << length);
+        return -1;
+    }
+
+    return tunnel->onProxyData(type, proxy_id, data, length);
+}
+
+RelayTunnel *RelayTunnelPool::_getTunnel(uint32_t proxy_id)
+{
+    auto it = proxy_tunnel_map_.find(proxy_id);
+    if (proxy_tunnel_map_.end() != it) {
+        return tunnels_[it->second].get();
+    }
+
+    size_t best = tunnels_.size();
+    size_t best_backlog = 0;
+    for (size_t i = 0; i < tunnels_.size(); i++) {
+        if (!tunnels_[i]->isReady()) {
+            continue;
+        }
+        size_t backlog = tunnels_[i]->getSendBacklog();
+        if ((best == tunnels_.size()) || (proxy_count_[i] < proxy_count_[best])
+            || ((proxy_count_[i] == proxy_count_[best]) && (backlog < best_backlog))) {
+            best = i;
+            best_backlog = backlog;
+        }
+    }
+    if (best == tunnels_.size()) {
+        return nullptr;
+    }
+
+    proxy_tunnel_map_[proxy_id] = best;
+    proxy_count_[best]++;
+    LOG_DEBUG("RelayTunnelPool::_getTunnel. proxy_id:" << proxy_id << " index:" << best
+              << " proxies:" << proxy_count_[best]);
+    return tunnels_[best].get();
+}
+
+const TunnelQuality &RelayTunnelPool::updateQuality()
+{
+    const TunnelQuality *best = &empty_quality_;
+    for (auto &tunnel : tunnels_) {
+        const TunnelQuality &quality = tunnel->updateQuality();
+        if (tunnel->isReady() && (!best->isValid() || (quality.getCost() < best->getCost()))) {
+            best = &quality;
+        }
+    }
+    return *best;
+}
+
+void RelayTunnelPool::releaseProxy(uint32_t proxy_id)
+{
+    auto it = proxy_tunnel_map_.find(proxy_id);
+    if (proxy_tunnel_map_.end() == it) {
+        return;
+    }
+
+    if (proxy_count_[it->second] > 0) {
+        proxy_count_[it->second]--;
+    }
+    proxy_tunnel_map_.erase(it);
+}
+
+void RelayTunnelPool::_onTunnelDisconnected(RelayTunnel *tunnel)
+{
+    size_t index = 0;
+    for (; index < tunnels_.size(); index++) {
+        if (tunnels_[index].get() == tunnel) {
+            break;
+        }
+    }
+    if ((index >= tunnels_.size()) || (0 == proxy_count_[index])) {
+        return;
+    }
+
+    // 连接上未送达的数据已丢失，关闭对应的本地连接
+    std::vector<uint32_t> proxies;
+    for (const auto &it : proxy_tunnel_map_) {
+        if (it.second == index) {
+            proxies.push_back(it.first);
+        }
+    }
+    LOG_WARN("RelayTunnelPool::_onTunnelDisconnected. index:" << index << " proxies:" << proxies.size());
+
+    ClientNode *client_node = getClientNode();
+    for (uint32_t proxy_id : proxies) {
+        releaseProxy(proxy_id);
+        ProxyServer *proxy_server = (nullptr != client_node) ? client_node->getProxyServer(proxy_id) : nullptr;
+        if (nullptr != proxy_server) {
+            proxy_server->delProxy(proxy_id);
+        }
+    }
+}
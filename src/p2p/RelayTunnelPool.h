@@ -0,0 +1,69 @@
+#ifndef SRC_RELAY_TUNNEL_POOL_H_
+#define SRC_RELAY_TUNNEL_POOL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "hv/EventLoop.h"
+#include "RelayTunnel.h"
+
+/**
+ * @brief 多连接中继：同一order_id建立多条到中继服务器的tcp连接，每个proxy_id固定在一条连接上
+ * @note 单条tcp连接丢一个分段会阻塞所有代理连接，长rtt下吞吐也受单条连接的拥塞窗口限制；
+ *       新的代理连接放到代理数最少（相同时积压最少）的连接上；
+ *       某条连接断开时，其上代理连接的数据已经丢失，关闭这些本地连接由App重试，
+ *       之后的代理连接放到其他连接上，断开的连接重连后重新参与分配
+ *       连接数为1时与单连接中继相同；仅在loop线程中使用
+ */
+class RelayTunnelPool {
+public:
+    explicit RelayTunnelPool(hv::EventLoopPtr loop);
+
+    ~RelayTunnelPool();
+
+    int init(const std::string &server_addr, const std::string &order_id, const std::string &user_token);
+
+    int fini();
+
+    /**
+     * @brief 至少有一条连接可用
+     */
+    bool isReady();
+
+    int onProxyData(uint32_t type, uint32_t proxy_id);
+
+    int onProxyData(uint32_t type, uint32_t proxy_id, const std::string &data);
+
+    int onProxyData(uint32_t type, uint32_t proxy_id, const char *data, uint32_t length);
+
+    /**
+     * @brief 释放proxy_id占用的连接，连接关闭或迁移到p2p隧道时调用
+     */
+    void releaseProxy(uint32_t proxy_id);
+
+    /**
+     * @brief 所有连接采样一次质量，返回可用连接中预计耗时最小的，新连接只会放在一条连接上
+     */
+    const TunnelQuality &updateQuality();
+
+private:
+    /**
+     * @brief 获取proxy_id所在的连接，新的proxy_id选择负载最小的可用连接
+     * @return 没有可用连接时返回nullptr
+     */
+    RelayTunnel *_getTunnel(uint32_t proxy_id);
+
+    void _onTunnelDisconnected(RelayTunnel *tunnel);
+
+private:
+    std::vector<std::unique_ptr<RelayTunnel>> tunnels_;
+    std::vector<size_t> proxy_count_;               //每条连接上的代理连接数
+    std::map<uint32_t, size_t> proxy_tunnel_map_;   //proxy_id - 连接序号
+    TunnelQuality empty_quality_;                   //没有可用连接时返回
+};
+
+#endif  // SRC_RELAY_TUNNEL_POOL_H_
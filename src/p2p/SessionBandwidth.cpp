@@ -0,0 +1,109 @@
+#include "SessionBandwidth.h"
+#include <algorithm>
+#include <vector>
+#include "x/Logger.h"
+
+SessionBandwidth::SessionBandwidth(uint32_t limit) : limit_(limit)
+{}
+
+bool SessionBandwidth::isEnabled() const
+{
+    return limit_ > 0;
+}
+
+int SessionBandwidth::setWeight(uint32_t session_id, uint32_t weight)
+{
+    if ((weight <= 0) || (weight > kMaxWeight)) {
+        LOG_ERROR("SessionBandwidth::setWeight failed:invalid weight. session_id:" << session_id
+                  << " weight:" << weight);
+        return -1;
+    }
+
+    sessions_[session_id].weight = weight;
+    return 0;
+}
+
+uint32_t SessionBandwidth::getWeight(uint32_t session_id) const
+{
+    auto it = sessions_.find(session_id);
+    return (sessions_.end() == it) ? kDefaultWeight : it->second.weight;
+}
+
+void SessionBandwidth::update(uint32_t session_id, uint64_t recv_bytes, uint32_t interval)
+{
+    Session &session = sessions_[session_id];
+    uint64_t delta = (recv_bytes >= session.recv_bytes) ? (recv_bytes - session.recv_bytes) : 0;
+    session.rate = (interval > 0) ? (uint32_t)(delta * 1000 / interval) : 0;
+    session.recv_bytes = recv_bytes;
+    session.updated = true;
+}
+
+void SessionBandwidth::remove(uint32_t session_id)
+{
+    sessions_.erase(session_id);
+}
+
+std::map<uint32_t, uint32_t> SessionBandwidth::allocate()
+{
+    std::map<uint32_t, uint32_t> limits;
+    if (!isEnabled()) {
+        return limits;
+    }
+
+    // 需求：用不满上次限额的会话按实际用量留余量，其他会话不限
+    std::vector<uint32_t> unsatisfied;
+    std::map<uint32_t, uint64_t> demands;
+    for (auto &it : sessions_) {
+        Session &session = it.second;
+        if (!session.updated) {
+            continue;
+        }
+        session.updated = false;
+        if ((0 == session.limit) || ((uint64_t)session.rate * 10 >= (uint64_t)session.limit * 9)) {
+            demands[it.first] = UINT64_MAX;
+        } else {
+            demands[it.first] = std::max<uint64_t>((uint64_t)session.rate * 5 / 4, kMinRate);
+        }
+        unsatisfied.push_back(it.first);
+    }
+
+    // 水位填充：需求低于份额的会话按需求满足，剩余的按权重重新分配，直到所有会话都拿到份额
+    uint64_t remaining = limit_;
+    bool changed = true;
+    while (changed && !unsatisfied.empty()) {
+        changed = false;
+        uint64_t total_weight = 0;
+        for (uint32_t id : unsatisfied) {
+            total_weight += sessions_[id].weight;
+        }
+
+        std::vector<uint32_t> next;
+        uint64_t next_remaining = remaining;
+        for (uint32_t id : unsatisfied) {
+            uint64_t share = remaining * sessions_[id].weight / total_weight;
+            if (demands[id] <= share) {
+                limits[id] = (uint32_t)demands[id];
+                next_remaining -= demands[id];
+                changed = true;
+            } else {
+                next.push_back(id);
+            }
+        }
+        unsatisfied.swap(next);
+        remaining = next_remaining;
+    }
+
+    uint64_t total_weight = 0;
+    for (uint32_t id : unsatisfied) {
+        total_weight += sessions_[id].weight;
+    }
+    for (uint32_t id : unsatisfied) {
+        uint64_t share = remaining * sessions_[id].weight / total_weight;
+        limits[id] = (uint32_t)std::max<uint64_t>(share, kMinRate);
+    }
+
+    for (const auto &it : limits) {
+        sessions_[it.first].limit = it.second;
+    }
+    return limits;
+}
@@ -0,0 +1,68 @@
+#ifndef SRC_SESSION_BANDWIDTH_H
+#define SRC_SESSION_BANDWIDTH_H
+
+#include <cstdint>
+#include <map>
+
+/**
+ * @brief 多设备会话之间的下行带宽分配：总限额按权重加权水位填充（weighted max-min）分给各会话
+ * @note 多路直播同时拉流时手机下行是共同的瓶颈，没有分配时各会话的kcp互相抢占，画面一起卡顿；
+ *       用不满份额的会话只分到实际用量的1.25倍，剩余的份额按权重分给其他会话；
+ *       已经用满上次限额的会话视为需求不限，下一轮才能增长
+ *       分配结果通过p2p隧道的kcp接收窗口生效，中继隧道不受限制
+ *       仅在loop线程中使用
+ */
+class SessionBandwidth {
+public:
+    /**
+     * @param limit 所有会话的下行总限额，字节/秒；0表示不限制
+     */
+    explicit SessionBandwidth(uint32_t limit);
+
+    bool isEnabled() const;
+
+    /**
+     * @brief 设置会话的权重，默认kDefaultWeight
+     * @return 0：成功；-1：权重无效；
+     */
+    int setWeight(uint32_t session_id, uint32_t weight);
+
+    uint32_t getWeight(uint32_t session_id) const;
+
+    /**
+     * @brief 记录会话累计收到的字节数，和上次记录的差值作为本周期的速率
+     * @param interval 距离上次记录的时间，毫秒
+     */
+    void update(uint32_t session_id, uint64_t recv_bytes, uint32_t interval);
+
+    /**
+     * @brief 会话关闭，删除状态，权重恢复默认
+     */
+    void remove(uint32_t session_id);
+
+    /**
+     * @brief 按权重分配总限额，只分配给update过的会话
+     * @return session_id - 限额，字节/秒
+     */
+    std::map<uint32_t, uint32_t> allocate();
+
+    static const uint32_t kDefaultWeight = 1;
+    static const uint32_t kMaxWeight = 100;
+    static const uint32_t kMinRate = 32 * 1024;     // 每个会话的最低限额，字节/秒
+
+private:
+    struct Session {
+        Session() : weight(kDefaultWeight), recv_bytes(0), rate(0), limit(0), updated(false) {}
+
+        uint32_t weight;
+        uint64_t recv_bytes;    // 上次记录的累计字节数
+        uint32_t rate;          // 本周期的速率
+        uint32_t limit;         // 上次分配的限额，0表示还没有分配
+        bool updated;           // 本周期有记录
+    };
+
+    uint32_t limit_;
+    std::map<uint32_t, Session> sessions_;
+};
+
+#endif  // SRC_SESSION_BANDWIDTH_H
@@ -0,0 +1,158 @@
+#include "StreamHedging.h"
+#include <algorithm>
+#include "x/Logger.h"
+
+StreamHedging::StreamHedging(size_t limit) : limit_(limit), ttfb_pos_(), stats_()
+{}
+
+void StreamHedging::onStreamStart(uint32_t proxy_id, bool hedged, uint32_t primary, uint32_t secondary, uint64_t now)
+{
+    Stream &stream = streams_[proxy_id];
+    stream = Stream();
+    stream.hedged = hedged;
+    stream.hedging = hedged;
+    stream.primary = primary;
+    stream.secondary = secondary;
+    stream.start_time = now;
+    if (hedged) {
+        stats_.hedged++;
+    }
+}
+
+bool StreamHedging::isHedging(uint32_t proxy_id) const
+{
+    auto it = streams_.find(proxy_id);
+    return (streams_.end() != it) && it->second.hedging;
+}
+
+bool StreamHedging::onSent(uint32_t proxy_id, size_t length)
+{
+    auto it = streams_.find(proxy_id);
+    if ((streams_.end() == it) || !it->second.hedging) {
+        return false;
+    }
+
+    it->second.sent += length;
+    if (it->second.sent < limit_) {
+        return false;
+    }
+
+    stats_.limit_reached++;
+    return true;
+}
+
+uint32_t StreamHedging::commit(uint32_t proxy_id, uint32_t tunnel_id)
+{
+    auto it = streams_.find(proxy_id);
+    if ((streams_.end() == it) || !it->second.hedging) {
+        return 0;
+    }
+
+    Stream &stream = it->second;
+    stream.hedging = false;
+    stream.loser = (tunnel_id == stream.primary) ? stream.secondary : stream.primary;
+    LOG_DEBUG("StreamHedging::commit. proxy_id:" << proxy_id << " tunnel:" << tunnel_id << " loser:" << stream.loser
+              << " sent:" << stream.sent);
+    return stream.loser;
+}
+
+int StreamHedging::onData(uint32_t proxy_id, uint32_t tunnel_id, uint64_t now, uint32_t &winner)
+{
+    winner = 0;
+    auto it = streams_.find(proxy_id);
+    if (streams_.end() == it) {
+        return kDeliver;
+    }
+
+    Stream &stream = it->second;
+    if ((0 != stream.loser) && (tunnel_id == stream.loser)) {
+        stats_.dropped++;
+        return kDrop;
+    }
+    if (stream.hedging) {
+        winner = tunnel_id;
+        if (tunnel_id == stream.primary) {
+            stats_.won_primary++;
+        } else {
+            stats_.won_secondary++;
+        }
+    }
+    if (!stream.first_byte) {
+        stream.first_byte = true;
+        _addTtfbSample(stream.hedged, (uint32_t)(now - stream.start_time));
+    }
+    return kDeliver;
+}
+
+int StreamHedging::onFini(uint32_t proxy_id, uint32_t tunnel_id, uint32_t &winner)
+{
+    winner = 0;
+    auto it = streams_.find(proxy_id);
+    if (streams_.end() == it) {
+        return kDeliver;
+    }
+
+    Stream &stream = it->second;
+    if (stream.hedging) {
+        // 对端只关闭了一条路径，连接在另一条隧道上继续
+        stream.hedging = false;
+        stream.loser = tunnel_id;
+        winner = (tunnel_id == stream.primary) ? stream.secondary : stream.primary;
+        LOG_DEBUG("StreamHedging::onFini. path closed. proxy_id:" << proxy_id << " tunnel:" << tunnel_id
+                  << " winner:" << winner);
+        return kDrop;
+    }
+    if ((0 != stream.loser) && (tunnel_id == stream.loser)) {
+        return kDrop;
+    }
+    return kDeliver;
+}
+
+void StreamHedging::remove(uint32_t proxy_id)
+{
+    streams_.erase(proxy_id);
+}
+
+void StreamHedging::reset()
+{
+    streams_.clear();
+}
+
+StreamHedging::Stats StreamHedging::getStats() const
+{
+    return stats_;
+}
+
+uint32_t StreamHedging::getTtfbPercentile(bool hedged, double percent) const
+{
+    std::vector<uint32_t> samples = ttfb_[hedged ? 1 : 0];
+    if (samples.empty()) {
+        return 0;
+    }
+
+    size_t index = (size_t)(percent / 100.0 * (samples.size() - 1) + 0.5);
+    index = std::min(index, samples.size() - 1);
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+size_t StreamHedging::getTtfbSampleNum(bool hedged) const
+{
+    return ttfb_[hedged ? 1 : 0].size();
+}
+
+void StreamHedging::_addTtfbSample(bool hedged, uint32_t ttfb)
+{
+    int kind = hedged ? 1 : 0;
+    std::vector<uint32_t> &samples = ttfb_[kind];
+    if (samples.size() < kTtfbSamples) {
+        samples.push_back(ttfb);
+    } else {
+        samples[ttfb_pos_[kind]] = ttfb;
+    }
+    ttfb_pos_[kind] = (ttfb_pos_[kind] + 1) % kTtfbSamples;
+    if (0 == (ttfb_pos_[kind] % kTtfbReportInterval)) {
+        LOG_INFO("StreamHedging. ttfb hedged:" << hedged << " samples:" << samples.size()
+                 << " p50:" << getTtfbPercentile(hedged, 50) << " p99:" << getTtfbPercentile(hedged, 99));
+    }
+}
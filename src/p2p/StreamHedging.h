@@ -0,0 +1,120 @@
+#ifndef SRC_STREAM_HEDGING_H
+#define SRC_STREAM_HEDGING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/**
+ * @brief 新连接的首包对冲：TcpInit和前几KB数据同时从中继和p2p隧道发出，先收到响应的隧道胜出
+ * @note 刚打通的p2p隧道可能还在丢包，只走一条隧道时首字节时间（TTFB）取决于选中的隧道；
+ *       对冲期间两条隧道上发出完全相同的数据，对端按每条隧道的字节序号去重；
+ *       收到第一个字节或发出的数据超过对冲上限时确定隧道，另一条隧道发TcpFini，
+ *       对端只关闭该路径，之后另一条隧道上收到的数据和TcpFini直接丢弃；
+ *       同时统计对冲和不对冲连接的TTFB
+ *       仅在loop线程中使用
+ */
+class StreamHedging {
+public:
+    /**
+     * @brief 统计
+     */
+    struct Stats {
+        uint64_t hedged;            // 对冲的连接
+        uint64_t won_primary;       // 首选隧道先响应
+        uint64_t won_secondary;     // 另一条隧道先响应
+        uint64_t limit_reached;     // 没有响应，发出的数据超过上限，确定为首选隧道
+        uint64_t dropped;           // 丢弃的落选隧道上的消息
+    };
+
+    /**
+     * @brief onData/onFini的返回值
+     */
+    enum Result {
+        kDeliver = 0,   // 交付给本地连接
+        kDrop = 1,      // 落选隧道上的数据，丢弃
+    };
+
+    explicit StreamHedging(size_t limit = kDefaultLimit);
+
+    /**
+     * @brief 新连接发出TcpInit
+     * @param hedged 是否同时从primary和secondary发出
+     * @param now 毫秒
+     */
+    void onStreamStart(uint32_t proxy_id, bool hedged, uint32_t primary, uint32_t secondary, uint64_t now);
+
+    bool isHedging(uint32_t proxy_id) const;
+
+    /**
+     * @brief 记录发出的数据，对冲中的数据需要两条隧道都发
+     * @return true：发出的数据达到上限，调用方需要调用commit
+     */
+    bool onSent(uint32_t proxy_id, size_t length);
+
+    /**
+     * @brief 结束对冲，确定隧道
+     * @return 落选的隧道，没有在对冲时返回0
+     */
+    uint32_t commit(uint32_t proxy_id, uint32_t tunnel_id);
+
+    /**
+     * @brief 收到数据，第一个字节记录TTFB
+     * @param winner 对冲中首次收到数据时为胜出的隧道，调用方需要调用commit；否则为0
+     * @return Result
+     */
+    int onData(uint32_t proxy_id, uint32_t tunnel_id, uint64_t now, uint32_t &winner);
+
+    /**
+     * @brief 收到TcpFini
+     * @param winner 对冲中一条路径被对端关闭时为另一条隧道，调用方改用该隧道；否则为0
+     * @return kDrop：只关闭了一条路径，忽略；kDeliver：关闭本地连接；
+     */
+    int onFini(uint32_t proxy_id, uint32_t tunnel_id, uint32_t &winner);
+
+    void remove(uint32_t proxy_id);
+
+    void reset();
+
+    Stats getStats() const;
+
+    /**
+     * @brief 最近kTtfbSamples个连接TTFB的百分位
+     * @param percent 0~100
+     * @return 毫秒，没有样本时返回0
+     */
+    uint32_t getTtfbPercentile(bool hedged, double percent) const;
+
+    size_t getTtfbSampleNum(bool hedged) const;
+
+    static const size_t kDefaultLimit = 16 * 1024;  // 对冲期间每条隧道最多发出的字节数
+    static const size_t kTtfbSamples = 1024;        // 每种连接保留的TTFB样本数
+    static const size_t kTtfbReportInterval = 64;   // 每多少个样本打印一次百分位
+
+private:
+    struct Stream {
+        Stream()
+            : hedged(false), hedging(false), primary(0), secondary(0), loser(0), sent(0), start_time(0),
+              first_byte(false) {}
+
+        bool hedged;            // 发出时是否对冲，用于TTFB分类
+        bool hedging;           // 还没有确定隧道
+        uint32_t primary;
+        uint32_t secondary;
+        uint32_t loser;         // 落选的隧道
+        size_t sent;
+        uint64_t start_time;
+        bool first_byte;        // 已收到第一个字节
+    };
+
+    void _addTtfbSample(bool hedged, uint32_t ttfb);
+
+    size_t limit_;
+    std::map<uint32_t, Stream> streams_;
+    std::vector<uint32_t> ttfb_[2];     // 0：不对冲；1：对冲；环形缓存
+    size_t ttfb_pos_[2];
+    Stats stats_;
+};
+
+#endif  // SRC_STREAM_HEDGING_H
@@ -0,0 +1,169 @@
+#include "StreamMigration.h"
+#include "x/Logger.h"
+
+StreamMigration::StreamMigration() : stats_()
+{}
+
+void StreamMigration::onSent(uint32_t proxy_id, size_t length)
+{
+    streams_[proxy_id].sent += length;
+}
+
+uint64_t StreamMigration::getSentOffset(uint32_t proxy_id) const
+{
+    auto it = streams_.find(proxy_id);
+    return (streams_.end() == it) ? 0 : it->second.sent;
+}
+
+bool StreamMigration::isMigrating(uint32_t proxy_id) const
+{
+    auto it = streams_.find(proxy_id);
+    return (streams_.end() != it) && it->second.migrating;
+}
+
+int StreamMigration::start(uint32_t proxy_id, uint32_t source, uint32_t target, uint64_t now)
+{
+    Stream &stream = streams_[proxy_id];
+    if (stream.migrating) {
+        LOG_WARN("StreamMigration::start failed:already migrating. proxy_id:" << proxy_id << " target:"
+                 << stream.target);
+        return -1;
+    }
+
+    stream.migrating = true;
+    stream.source = source;
+    stream.target = target;
+    stream.peer_switched = false;
+    stream.peer_offset = 0;
+    stream.fini = false;
+    stream.start_time = now;
+    stream.buffer.clear();
+    stats_.started++;
+    LOG_DEBUG("StreamMigration::start. proxy_id:" << proxy_id << " source:" << source << " target:" << target
+              << " sent:" << stream.sent << " received:" << stream.received);
+    return 0;
+}
+
+int StreamMigration::onPeerMigrate(uint32_t proxy_id, uint32_t tunnel_id, uint64_t offset, const DeliverCallback &cb)
+{
+    auto it = streams_.find(proxy_id);
+    if ((streams_.end() == it) || !it->second.migrating || (tunnel_id != it->second.target)) {
+        LOG_ERROR("StreamMigration::onPeerMigrate failed:unexpected migration. proxy_id:" << proxy_id
+                  << " tunnel_id:" << tunnel_id << " offset:" << offset);
+        stats_.failed++;
+        return kFailed;
+    }
+
+    Stream &stream = it->second;
+    if (stream.received > offset) {
+        LOG_ERROR("StreamMigration::onPeerMigrate failed:invalid offset. proxy_id:" << proxy_id
+                  << " offset:" << offset << " received:" << stream.received);
+        stats_.failed++;
+        return kFailed;
+    }
+
+    stream.peer_switched = true;
+    stream.peer_offset = offset;
+    return _tryComplete(proxy_id, stream, cb);
+}
+
+int StreamMigration::onData(uint32_t proxy_id, uint32_t tunnel_id, char *data, uint32_t length,
+                            const DeliverCallback &cb)
+{
+    Stream &stream = streams_[proxy_id];
+    if (!stream.migrating) {
+        stream.received += length;
+        return (0 == cb(proxy_id, data, length)) ? kOk : kFailed;
+    }
+
+    if (tunnel_id == stream.target) {
+        // 对端的迁移消息在新隧道上先于数据到达，旧隧道的数据收完前不能交付
+        stream.buffer.append(data, length);
+        if (stream.buffer.length() > stats_.max_buffered) {
+            stats_.max_buffered = stream.buffer.length();
+        }
+        if (stream.buffer.length() > kMaxBufferLength) {
+            LOG_ERROR("StreamMigration::onData failed:buffer overflow. proxy_id:" << proxy_id
+                      << " buffered:" << stream.buffer.length() << " received:" << stream.received);
+            stats_.failed++;
+            return kFailed;
+        }
+        return kOk;
+    }
+
+    if (stream.peer_switched && ((stream.received + length) > stream.peer_offset)) {
+        LOG_ERROR("StreamMigration::onData failed:data beyond offset. proxy_id:" << proxy_id
+                  << " tunnel_id:" << tunnel_id << " received:" << stream.received << " length:" << length
+                  << " offset:" << stream.peer_offset);
+        stats_.failed++;
+        return kFailed;
+    }
+    stream.received += length;
+    if (0 != cb(proxy_id, data, length)) {
+        return kFailed;
+    }
+
+    return _tryComplete(proxy_id, stream, cb);
+}
+
+int StreamMigration::onFini(uint32_t proxy_id, uint32_t tunnel_id)
+{
+    auto it = streams_.find(proxy_id);
+    if ((streams_.end() == it) || !it->second.migrating || (tunnel_id != it->second.target)) {
+        return kClosed;
+    }
+
+    it->second.fini = true;
+    return kDeferred;
+}
+
+void StreamMigration::remove(uint32_t proxy_id)
+{
+    streams_.erase(proxy_id);
+}
+
+std::vector<uint32_t> StreamMigration::expire(uint64_t now, uint64_t timeout)
+{
+    std::vector<uint32_t> expired;
+    for (const auto &it : streams_) {
+        if (it.second.migrating && ((now - it.second.start_time) >= timeout)) {
+            LOG_WARN("StreamMigration::expire. proxy_id:" << it.first << " peer_switched:" << it.second.peer_switched
+                     << " received:" << it.second.received << " offset:" << it.second.peer_offset);
+            expired.push_back(it.first);
+            stats_.failed++;
+        }
+    }
+    return expired;
+}
+
+void StreamMigration::reset()
+{
+    streams_.clear();
+}
+
+StreamMigration::Stats StreamMigration::getStats() const
+{
+    return stats_;
+}
+
+int StreamMigration::_tryComplete(uint32_t proxy_id, Stream &stream, const DeliverCallback &cb)
+{
+    if (!stream.peer_switched || (stream.received < stream.peer_offset)) {
+        return kOk;
+    }
+
+    stream.migrating = false;
+    stats_.completed++;
+    LOG_DEBUG("StreamMigration::_tryComplete. proxy_id:" << proxy_id << " target:" << stream.target
+              << " offset:" << stream.peer_offset << " buffered:" << stream.buffer.length());
+    if (!stream.buffer.empty()) {
+        std::string buffer;
+        buffer.swap(stream.buffer);
+        stream.received += buffer.length();
+        if (0 != cb(proxy_id, &buffer[0], (uint32_t)buffer.length())) {
+            return kFailed;
+        }
+    }
+
+    return stream.fini ? kClosed : kOk;
+}
@@ -0,0 +1,135 @@
+#ifndef SRC_STREAM_MIGRATION_H
+#define SRC_STREAM_MIGRATION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 代理连接在中继和p2p隧道之间迁移，按字节序号保证本地连接上的数据不乱序、不丢失
+ * @note 每个连接记录两个方向已发出/已交付的字节数；
+ *       迁移时本端在新隧道上先发kTunnelMsgTypeTcpMigrate（带本端已发出的字节数），之后的数据都走新隧道；
+ *       对端切换后也在新隧道上发来迁移消息，本端从旧隧道收满其中的字节数之前，新隧道上的数据先缓存；
+ *       旧隧道在超时前没有送达剩余数据时，迁移失败，关闭本地连接
+ *       仅在loop线程中使用
+ */
+class StreamMigration {
+public:
+    /**
+     * @brief 统计
+     */
+    struct Stats {
+        uint64_t started;       // 开始的迁移
+        uint64_t completed;     // 完成的迁移
+        uint64_t failed;        // 序号不一致、缓存超限或超时
+        size_t max_buffered;    // 等待旧隧道时缓存的最大字节数
+    };
+
+    /**
+     * @return 0：成功；-1：失败；
+     */
+    typedef std::function<int(uint32_t proxy_id, char *data, uint32_t length)> DeliverCallback;
+
+    /**
+     * @brief onData/onPeerMigrate/onFini的返回值
+     */
+    enum Result {
+        kFailed = -1,   // 迁移失败，需要关闭连接
+        kOk = 0,
+        kClosed = 1,    // 对端已关闭且数据都已交付，需要关闭本地连接
+        kDeferred = 2,  // 对端关闭时旧隧道的数据还没收完，等待
+    };
+
+    StreamMigration();
+
+    /**
+     * @brief 记录本端在该连接上发出的数据
+     */
+    void onSent(uint32_t proxy_id, size_t length);
+
+    /**
+     * @brief 本端已发出的字节数，即新隧道上第一个字节的序号
+     */
+    uint64_t getSentOffset(uint32_t proxy_id) const;
+
+    bool isMigrating(uint32_t proxy_id) const;
+
+    /**
+     * @brief 本端已切换到target，source上的数据继续接收
+     * @param now 毫秒
+     * @return 0：成功；-1：已在迁移中；
+     */
+    int start(uint32_t proxy_id, uint32_t source, uint32_t target, uint64_t now);
+
+    /**
+     * @brief 收到对端从tunnel_id发来的迁移消息
+     * @param offset 对端在tunnel_id上第一个字节的序号
+     * @return Result
+     */
+    int onPeerMigrate(uint32_t proxy_id, uint32_t tunnel_id, uint64_t offset, const DeliverCallback &cb);
+
+    /**
+     * @brief 收到数据，按序交付或缓存
+     * @return Result
+     */
+    int onData(uint32_t proxy_id, uint32_t tunnel_id, char *data, uint32_t length, const DeliverCallback &cb);
+
+    /**
+     * @brief 对端关闭连接
+     * @return kClosed：立即关闭；kDeferred：新隧道上的关闭早于旧隧道的数据，数据收完后由onData返回kClosed；
+     */
+    int onFini(uint32_t proxy_id, uint32_t tunnel_id);
+
+    /**
+     * @brief 删除连接的状态
+     */
+    void remove(uint32_t proxy_id);
+
+    /**
+     * @brief 超时未完成的迁移
+     * @param timeout 毫秒
+     * @return 需要关闭的连接
+     */
+    std::vector<uint32_t> expire(uint64_t now, uint64_t timeout);
+
+    /**
+     * @brief 清空所有状态
+     */
+    void reset();
+
+    Stats getStats() const;
+
+    static const size_t kMaxBufferLength = 4 * 1024 * 1024;    // 每个连接等待旧隧道时最多缓存的字节数
+
+private:
+    struct Stream {
+        Stream()
+            : sent(0), received(0), migrating(false), source(0), target(0), peer_switched(false), peer_offset(0),
+              fini(false), start_time(0) {}
+
+        uint64_t sent;          // 本端发出的字节数
+        uint64_t received;      // 已交付给本地连接的字节数
+        bool migrating;
+        uint32_t source;        // 旧隧道
+        uint32_t target;        // 新隧道
+        bool peer_switched;     // 已收到对端的迁移消息
+        uint64_t peer_offset;   // 对端在新隧道上第一个字节的序号
+        bool fini;              // 新隧道上已收到对端的关闭
+        uint64_t start_time;
+        std::string buffer;     // 新隧道上等待交付的数据
+    };
+
+    /**
+     * @brief 旧隧道的数据已收满时交付缓存，结束迁移
+     * @return Result
+     */
+    int _tryComplete(uint32_t proxy_id, Stream &stream, const DeliverCallback &cb);
+
+    std::map<uint32_t, Stream> streams_;
+    Stats stats_;
+};
+
+#endif  // SRC_STREAM_MIGRATION_H
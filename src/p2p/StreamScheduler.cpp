@@ -0,0 +1,192 @@
+#include "StreamScheduler.h"
+#include "x/Logger.h"
+
+StreamScheduler::StreamScheduler() : head_granted_(false), queued_(0), stats_()
+{}
+
+bool StreamScheduler::empty() const
+{
+    return active_.empty();
+}
+
+size_t StreamScheduler::queued() const
+{
+    return queued_;
+}
+
+int StreamScheduler::push(uint32_t proxy_id, const char *header, size_t header_length, const char *data,
+                          size_t length, bool last)
+{
+    if ((nullptr == header) || (header_length <= 0) || ((nullptr == data) && (length > 0))) {
+        LOG_ERROR("StreamScheduler::push failed:invalid input. proxy_id:" << proxy_id << " length:" << length);
+        return -1;
+    }
+
+    Stream &stream = streams_[proxy_id];
+    if (stream.closed) {
+        LOG_WARN("StreamScheduler::push failed:stream closed. proxy_id:" << proxy_id);
+        stats_.dropped++;
+        return -1;
+    }
+
+    std::string message;
+    message.reserve(header_length + length);
+    message.append(header, header_length);
+    if (length > 0) {
+        message.append(data, length);
+    }
+    stream.messages.push_back(std::move(message));
+    stream.closed = last;
+    if (!stream.active) {
+        stream.active = true;
+        active_.push_back(proxy_id);
+    }
+
+    queued_ += header_length + length;
+    if (queued_ > stats_.max_queued) {
+        stats_.max_queued = queued_;
+    }
+    return 0;
+}
+
+int StreamScheduler::setPriority(uint32_t proxy_id, int priority)
+{
+    if ((priority < kHigh) || (priority >= kPriorityNum)) {
+        LOG_ERROR("StreamScheduler::setPriority failed:invalid priority. proxy_id:" << proxy_id
+                  << " priority:" << priority);
+        return -1;
+    }
+
+    auto it = streams_.find(proxy_id);
+    if (streams_.end() == it) {
+        if (kNormal != priority) {
+            streams_[proxy_id].priority = priority;
+        }
+        return 0;
+    }
+
+    it->second.priority = priority;
+    if ((kNormal == priority) && !it->second.active) {
+        // 没有排队的数据，默认优先级不需要保存
+        streams_.erase(it);
+    }
+    return 0;
+}
+
+int StreamScheduler::getPriority(uint32_t proxy_id) const
+{
+    auto it = streams_.find(proxy_id);
+    return (streams_.end() == it) ? kNormal : it->second.priority;
+}
+
+int StreamScheduler::remove(uint32_t proxy_id)
+{
+    auto it = streams_.find(proxy_id);
+    if (streams_.end() == it) {
+        return 0;
+    }
+
+    for (const auto &message : it->second.messages) {
+        queued_ -= message.length();
+        stats_.dropped++;
+    }
+    if (it->second.active) {
+        if (active_.front() == proxy_id) {
+            head_granted_ = false;
+        }
+        active_.remove(proxy_id);
+    }
+    streams_.erase(it);
+    return 0;
+}
+
+int StreamScheduler::release(uint32_t proxy_id)
+{
+    auto it = streams_.find(proxy_id);
+    if (streams_.end() == it) {
+        return 0;
+    }
+
+    if (!it->second.active) {
+        streams_.erase(it);
+        return 0;
+    }
+    // 由_deactivate删除，之后的消息被丢弃
+    it->second.closed = true;
+    return 0;
+}
+
+int StreamScheduler::schedule(size_t budget, const SendCallback &cb)
+{
+    int count = 0;
+    while ((budget > 0) && !active_.empty()) {
+        uint32_t proxy_id = active_.front();
+        auto it = streams_.find(proxy_id);
+        Stream &stream = it->second;
+        if (!head_granted_) {
+            stream.deficit += getQuantum(stream.priority);
+            head_granted_ = true;
+        }
+
+        while ((budget > 0) && !stream.messages.empty()) {
+            const std::string &message = stream.messages.front();
+            size_t length = message.length();
+            if (length > stream.deficit) {
+                break;
+            }
+
+            if (0 != cb(message.data(), length)) {
+                LOG_ERROR("StreamScheduler::schedule failed in send. proxy_id:" << proxy_id << " length:" << length);
+                stats_.dropped++;
+            } else {
+                stats_.scheduled++;
+                count++;
+            }
+            stream.deficit -= length;
+            budget = (budget > length) ? (budget - length) : 0;
+            queued_ -= length;
+            stream.messages.pop_front();
+        }
+
+        if (stream.messages.empty()) {
+            _deactivate(it);
+        } else if (stream.messages.front().length() > stream.deficit) {
+            // 本轮的quantum用完，轮到下一个连接
+            active_.pop_front();
+            active_.push_back(proxy_id);
+            head_granted_ = false;
+        }
+    }
+
+    return count;
+}
+
+int StreamScheduler::reset()
+{
+    streams_.clear();
+    active_.clear();
+    head_granted_ = false;
+    queued_ = 0;
+    return 0;
+}
+
+StreamScheduler::Stats StreamScheduler::getStats() const
+{
+    return stats_;
+}
+
+size_t StreamScheduler::getQuantum(int priority)
+{
+    return kBaseQuantum << (2 * (kLow - priority));
+}
+
+void StreamScheduler::_deactivate(std::map<uint32_t, Stream>::iterator it)
+{
+    active_.pop_front();
+    head_granted_ = false;
+    it->second.active = false;
+    it->second.deficit = 0;
+    if (it->second.closed || (kNormal == it->second.priority)) {
+        streams_.erase(it);
+    }
+}
@@ -0,0 +1,143 @@
+#ifndef SRC_STREAM_SCHEDULER_H
+#define SRC_STREAM_SCHEDULER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+
+/**
+ * @brief kcp之上的多路流调度：每个proxy_id一个发送队列，按优先级加权轮询（DRR）写入kcp
+ * @note 所有代理连接共用一个流模式的kcp会话，ikcp_send按先进先出排队，大文件下载会挡住小的接口请求；
+ *       调度器只在kcp发送队列快空时才写入，排队的数据留在各自的队列中，
+ *       高优先级的请求最多等待其他活跃连接各发完一个quantum
+ *       仅在loop线程中使用
+ */
+class StreamScheduler {
+public:
+    /**
+     * @brief 优先级，数值越小权重越大
+     */
+    enum Priority {
+        kHigh = 0,      // 交互请求
+        kNormal = 1,    // 默认
+        kLow = 2,       // 录像下载等大流量
+        kPriorityNum,
+    };
+
+    /**
+     * @brief 统计
+     */
+    struct Stats {
+        uint64_t direct;        // 没有排队直接写入kcp的消息
+        uint64_t scheduled;     // 排队后调度写入kcp的消息
+        uint64_t dropped;       // 连接已关闭，丢弃的消息
+        size_t max_queued;      // 排队字节数的最大值
+    };
+
+    /**
+     * @return 0：成功；-1：失败（消息被丢弃）；
+     */
+    typedef std::function<int(const char *data, size_t length)> SendCallback;
+
+    StreamScheduler();
+
+    /**
+     * @brief 没有排队的消息时，调用方可以直接写入kcp
+     */
+    bool empty() const;
+
+    /**
+     * @brief 排队的字节数
+     */
+    size_t queued() const;
+
+    /**
+     * @brief 消息加入proxy_id的队列
+     * @param last 连接的最后一条消息（TcpFini），发出后删除该连接的状态
+     * @return 0：成功；-1：失败；
+     */
+    int push(uint32_t proxy_id, const char *header, size_t header_length, const char *data, size_t length,
+             bool last = false);
+
+    /**
+     * @brief 设置连接的优先级，连接还没有数据时先记录下来
+     * @param priority Priority
+     * @return 0：成功；-1：优先级无效；
+     */
+    int setPriority(uint32_t proxy_id, int priority);
+
+    int getPriority(uint32_t proxy_id) const;
+
+    /**
+     * @brief 对端已关闭连接，丢弃排队的数据
+     */
+    int remove(uint32_t proxy_id);
+
+    /**
+     * @brief 本端连接已关闭：没有排队的消息时立即删除状态，否则排队的消息发完后删除
+     */
+    int release(uint32_t proxy_id);
+
+    /**
+     * @brief 保存状态的连接数
+     */
+    size_t size() const {
+        return streams_.size();
+    }
+
+    /**
+     * @brief 按DRR依次发出排队的消息
+     * @param budget 本次最多发出的字节数，最后一条消息可以超出
+     * @return 发出的消息数
+     */
+    int schedule(size_t budget, const SendCallback &cb);
+
+    /**
+     * @brief 清空所有队列和优先级
+     */
+    int reset();
+
+    /**
+     * @brief 记录一条直接写入kcp的消息
+     */
+    void onDirectSend() {
+        stats_.direct++;
+    }
+
+    Stats getStats() const;
+
+    /**
+     * @brief 每轮可以发出的字节数
+     */
+    static size_t getQuantum(int priority);
+
+    static const size_t kBaseQuantum = 4 * 1024;   // 低优先级每轮的字节数，高一级乘以4
+
+private:
+    struct Stream {
+        Stream() : priority(kNormal), deficit(0), active(false), closed(false) {}
+
+        int priority;
+        size_t deficit;
+        bool active;                        // 在active_中
+        bool closed;                        // 最后一条消息已排队
+        std::deque<std::string> messages;   // 消息头和数据
+    };
+
+    /**
+     * @brief 队列已空：从轮询中移除，连接已关闭或使用默认优先级时删除状态
+     */
+    void _deactivate(std::map<uint32_t, Stream>::iterator it);
+
+    std::map<uint32_t, Stream> streams_;
+    std::list<uint32_t> active_;    // 有排队消息的连接，按轮询顺序
+    bool head_granted_;             // active_队首本轮已经加过quantum
+    size_t queued_;
+    Stats stats_;
+};
+
+#endif  // SRC_STREAM_SCHEDULER_H
@@ -0,0 +1,51 @@
+#include "TcpFrameBatch.h"
+
+TcpFrameBatch::TcpFrameBatch(size_t max_bytes) : max_bytes_(max_bytes), stats_()
+{
+    buffer_.reserve(max_bytes_);
+}
+
+bool TcpFrameBatch::append(const char *header, size_t header_length, const char *data, size_t length)
+{
+    if ((nullptr != header) && (header_length > 0)) {
+        buffer_.append(header, header_length);
+    }
+    if ((nullptr != data) && (length > 0)) {
+        buffer_.append(data, length);
+    }
+    stats_.frames++;
+
+    return buffer_.size() >= max_bytes_;
+}
+
+int TcpFrameBatch::flush(const WriteCallback &cb)
+{
+    if (buffer_.empty()) {
+        return 0;
+    }
+
+    int ret = cb(buffer_.data(), buffer_.size());
+    stats_.flushes++;
+    stats_.bytes += buffer_.size();
+    if (buffer_.size() > stats_.max_batch) {
+        stats_.max_batch = buffer_.size();
+    }
+    buffer_.clear();
+    if (buffer_.capacity() > (max_bytes_ * 4)) {
+        // 偶尔的大帧扩充了缓存，释放掉
+        std::string().swap(buffer_);
+        buffer_.reserve(max_bytes_);
+    }
+
+    return ret;
+}
+
+void TcpFrameBatch::reset()
+{
+    buffer_.clear();
+}
+
+TcpFrameBatch::Stats TcpFrameBatch::getStats() const
+{
+    return stats_;
+}
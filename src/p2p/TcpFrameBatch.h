@@ -0,0 +1,68 @@
+#ifndef SRC_TCP_FRAME_BATCH_H
+#define SRC_TCP_FRAME_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+/**
+ * @brief 中继隧道的发送合并：消息头和数据拼成一帧，同一轮事件循环中的多帧合并后一次写出
+ * @note 原来每帧调用两次send，每次都可能单独成为一个tcp分段；合并后一轮只有一次写系统调用
+ *       仅在loop线程中使用
+ */
+class TcpFrameBatch {
+public:
+    /**
+     * @brief 统计
+     */
+    struct Stats {
+        uint64_t frames;        // 加入的帧数
+        uint64_t flushes;       // 写出的次数
+        uint64_t bytes;         // 写出的字节数
+        size_t max_batch;       // 一次写出的最大字节数
+    };
+
+    /**
+     * @return 0：成功；-1：失败（数据已丢弃）；
+     */
+    typedef std::function<int(const char *data, size_t length)> WriteCallback;
+
+    explicit TcpFrameBatch(size_t max_bytes = kDefaultMaxBytes);
+
+    /**
+     * @brief 加入一帧
+     * @return true：已达到max_bytes，调用方应立即flush
+     */
+    bool append(const char *header, size_t header_length, const char *data, size_t length);
+
+    /**
+     * @brief 一次写出所有缓存的帧
+     * @return 0：成功或没有数据；-1：失败；
+     */
+    int flush(const WriteCallback &cb);
+
+    bool empty() const {
+        return buffer_.empty();
+    }
+
+    size_t size() const {
+        return buffer_.size();
+    }
+
+    /**
+     * @brief 丢弃缓存的帧，连接断开时调用
+     */
+    void reset();
+
+    Stats getStats() const;
+
+    static const size_t kDefaultMaxBytes = 64 * 1024;
+
+private:
+    size_t max_bytes_;
+    std::string buffer_;
+    Stats stats_;
+};
+
+#endif  // SRC_TCP_FRAME_BATCH_H
@@ -17,8 +17,26 @@ typedef enum _tunnel_msg_type {
     kTunnelMsgTypeTcpInit = 10,         // tcp连接初始化
     kTunnelMsgTypeTcpData = 11,         // tcp连接数据
     kTunnelMsgTypeTcpFini = 12,         // tcp连接结束
+    kTunnelMsgTypeWindowUpdate = 13,    // tcp连接的接收窗口更新，数据为TunnelWindowUpdate
+    kTunnelMsgTypeTcpMigrate = 14,      // tcp连接迁移到发送该消息的隧道，数据为TunnelStreamMigrate
 } TunnelMsgType;
 
+/// 接收窗口更新：TcpInit的json中带window字段时，对端每个连接最多发出window字节未确认的TcpData，
+/// 本端把数据写给本地App后，通过该消息归还额度
+typedef struct tunnel_window_update_ {
+    uint32_t increment;     // 归还的字节数
+}__attribute__ ((packed)) TunnelWindowUpdate;
+
+const size_t kTunnelWindowUpdateLength = sizeof(TunnelWindowUpdate);
+
+/// 连接迁移：在新隧道上先发该消息，之后该连接的数据都走新隧道；
+/// offset为本端在该连接上已发出的字节数，对端从旧隧道收满offset字节后再交付新隧道上的数据
+typedef struct tunnel_stream_migrate_ {
+    uint64_t offset;        // 新隧道上第一个字节在该连接中的序号
+}__attribute__ ((packed)) TunnelStreamMigrate;
+
+const size_t kTunnelStreamMigrateLength = sizeof(TunnelStreamMigrate);
+
 /// 消息头定义
 typedef struct tcp_tunnel_msg_header_ {
     tcp_tunnel_msg_header_() {
@@ -66,6 +84,14 @@ typedef struct tcp_tunnel_msg_header_ {
                 return ((proxy_id > 0) && (0 == length));
             };
 
+            case kTunnelMsgTypeWindowUpdate: {
+                return ((proxy_id > 0) && (kTunnelWindowUpdateLength == length));
+            };
+
+            case kTunnelMsgTypeTcpMigrate: {
+                return ((proxy_id > 0) && (kTunnelStreamMigrateLength == length));
+            };
+
             default: {
                 return false;
             }
@@ -89,6 +115,12 @@ typedef struct tcp_tunnel_msg_header_ {
             case kTunnelMsgTypeTcpFini: {
                 return "kTunnelMsgTypeTcpFini";
             }
+            case kTunnelMsgTypeWindowUpdate: {
+                return "kTunnelMsgTypeWindowUpdate";
+            }
+            case kTunnelMsgTypeTcpMigrate: {
+                return "kTunnelMsgTypeTcpMigrate";
+            }
 
             default : {
                 return "UNKNOWN_TYPE. type:" + std::to_string(type);
@@ -110,6 +142,15 @@ typedef struct tcp_tunnel_msg_header_ {
 #define TCP_TUNNEL_MSG_HEADER_LENGTH_FIELD_OFFSET 6     //type:2bytes + id:4bytes;
 #define TCP_TUNNEL_MSG_HEADER_LENGTH_FIELD_BYTES 4      //length:4bytes;
 
+/// 路径MTU探测，放在心跳消息头之后，探测包用0补齐到size
+typedef struct udp_mtu_probe_ {
+    uint32_t probe_id;      // 探测轮次，响应中原样带回
+    uint16_t size;          // 探测包的udp载荷长度，包括消息头
+    uint8_t reply;          // 0：探测；1：响应（不补齐）
+}__attribute__ ((packed)) UdpMtuProbe;
+
+const size_t kUdpMtuProbeLength = sizeof(UdpMtuProbe);
+
 /// 消息头定义
 typedef struct udp_tunnel_msg_header_ {
     udp_tunnel_msg_header_() {
@@ -144,7 +185,8 @@ typedef struct udp_tunnel_msg_header_ {
     bool isTypeValid() const {
         switch (type) {
             case kTunnelMsgTypeHeartbeat: {
-                return ((0 == tunnel_id) && (0 == proxy_id) && (0 == length));
+                //length不为0时为路径MTU探测，proxy_id为tunnel_id
+                return ((0 == tunnel_id) && (((0 == proxy_id) && (0 == length)) || (length >= kUdpMtuProbeLength)));
             }
 
             case kTunnelMsgTypeTunnelInit: {
@@ -165,6 +207,14 @@ typedef struct udp_tunnel_msg_header_ {
                 return ((tunnel_id > 0) && (proxy_id > 0) && (0 == length));
             };
 
+            case kTunnelMsgTypeWindowUpdate: {
+                return ((tunnel_id > 0) && (proxy_id > 0) && (kTunnelWindowUpdateLength == length));
+            };
+
+            case kTunnelMsgTypeTcpMigrate: {
+                return ((tunnel_id > 0) && (proxy_id > 0) && (kTunnelStreamMigrateLength == length));
+            };
+
             default: {
                 return false;
             }
@@ -188,6 +238,12 @@ typedef struct udp_tunnel_msg_header_ {
             case kTunnelMsgTypeTcpFini: {
                 return "kTunnelMsgTypeTcpFini";
             }
+            case kTunnelMsgTypeWindowUpdate: {
+                return "kTunnelMsgTypeWindowUpdate";
+            }
+            case kTunnelMsgTypeTcpMigrate: {
+                return "kTunnelMsgTypeTcpMigrate";
+            }
 
             default : {
                 return "UNKNOWN_TYPE. type:" + std::to_string(type);
@@ -0,0 +1,91 @@
+#include "TunnelQuality.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const double kAlpha = 0.25;     // 滑动平均中新采样的权重
+const size_t kSegmentSize = 1400;
+const int kMaxRounds = 10;
+
+double ewma(double average, double sample, bool &initialized)
+{
+    if (!initialized) {
+        initialized = true;
+        return sample;
+    }
+    return average + kAlpha * (sample - average);
+}
+
+}  // namespace
+
+TunnelQuality::TunnelQuality()
+    : rtt_(0), loss_(0), bandwidth_(0), has_rtt_(false), has_loss_(false), has_bandwidth_(false)
+{}
+
+void TunnelQuality::update(uint32_t rtt, double loss, uint64_t bandwidth)
+{
+    if (rtt > 0) {
+        rtt_ = ewma(rtt_, rtt, has_rtt_);
+    }
+    if (loss >= 0) {
+        loss_ = ewma(loss_, std::min(loss, 1.0), has_loss_);
+    }
+    if (bandwidth > 0) {
+        bandwidth_ = ewma(bandwidth_, (double)bandwidth, has_bandwidth_);
+    }
+}
+
+void TunnelQuality::reset()
+{
+    *this = TunnelQuality();
+}
+
+bool TunnelQuality::isValid() const
+{
+    return has_rtt_;
+}
+
+uint32_t TunnelQuality::getRtt() const
+{
+    return (uint32_t)rtt_;
+}
+
+double TunnelQuality::getLoss() const
+{
+    return loss_;
+}
+
+uint64_t TunnelQuality::getBandwidth() const
+{
+    return (uint64_t)bandwidth_;
+}
+
+uint32_t TunnelQuality::getCost() const
+{
+    if (!has_rtt_) {
+        return UINT32_MAX;
+    }
+
+    // 参考请求的所有段都送达需要的额外重传轮数：sum(P(第k轮后仍有段丢失))，每轮按一个rtt计
+    double segments = (double)kReferenceBytes / kSegmentSize;
+    double rounds = 0;
+    double loss_k = loss_;
+    for (int k = 1; (k <= kMaxRounds) && (loss_k > 0); k++) {
+        rounds += 1.0 - std::pow(1.0 - loss_k, segments);
+        loss_k *= loss_;
+    }
+    double cost = rtt_ * (1.0 + rounds);
+    double goodput = bandwidth_ * (1.0 - loss_);
+    if (has_bandwidth_ && (goodput > 0)) {
+        cost += kReferenceBytes * 1000.0 / goodput;
+    }
+    return (uint32_t)std::min(cost, (double)(UINT32_MAX - 1));
+}
+
+std::string TunnelQuality::toString() const
+{
+    int loss = (int)(loss_ * 1000);     // 千分比，打印一位小数的百分比
+    return "rtt:" + std::to_string(getRtt()) + "ms loss:" + std::to_string(loss / 10) + "." + std::to_string(loss % 10)
+           + "% bandwidth:" + std::to_string(getBandwidth() / 1024) + "KB/s cost:" + std::to_string(getCost()) + "ms";
+}
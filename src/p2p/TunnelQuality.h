@@ -0,0 +1,57 @@
+#ifndef SRC_TUNNEL_QUALITY_H
+#define SRC_TUNNEL_QUALITY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief 隧道质量：rtt、丢包率和可用带宽的滑动平均，折算成传输一个参考请求的预计耗时
+ * @note UdpTunnel用kcp的rx_srtt、重传次数和发送窗口采样，RelayTunnel用TCP_INFO采样；
+ *       ClientNode按预计耗时为新连接选择隧道
+ */
+class TunnelQuality {
+public:
+    TunnelQuality();
+
+    /**
+     * @brief 加入一次采样
+     * @param rtt 毫秒，0表示没有采样
+     * @param loss 丢包率0~1，小于0表示没有采样
+     * @param bandwidth 可用带宽，字节/秒，0表示没有采样
+     */
+    void update(uint32_t rtt, double loss, uint64_t bandwidth);
+
+    void reset();
+
+    /**
+     * @brief 至少有一次rtt采样
+     */
+    bool isValid() const;
+
+    uint32_t getRtt() const;
+
+    double getLoss() const;
+
+    uint64_t getBandwidth() const;
+
+    /**
+     * @brief 传输kReferenceBytes的预计耗时，毫秒，越小越好；没有采样时返回UINT32_MAX
+     * @note 按丢包率估算所有段都送达需要的重传轮数，每轮计一个rtt；有效带宽为可用带宽扣除丢包
+     */
+    uint32_t getCost() const;
+
+    std::string toString() const;
+
+    static const size_t kReferenceBytes = 128 * 1024;   // 参考请求的大小，兼顾接口请求和视频分片
+
+private:
+    double rtt_;
+    double loss_;
+    double bandwidth_;
+    bool has_rtt_;
+    bool has_loss_;
+    bool has_bandwidth_;
+};
+
+#endif  // SRC_TUNNEL_QUALITY_H
@@ -0,0 +1,47 @@
+#include "TunnelSelector.h"
+#include "x/Logger.h"
+
+constexpr double TunnelSelector::kSwitchMargin;
+
+TunnelSelector::TunnelSelector(uint32_t primary, uint32_t secondary)
+    : primary_(primary), secondary_(secondary), preferred_(0), pending_(0)
+{}
+
+bool TunnelSelector::update(bool primary_ready, const TunnelQuality &primary, bool secondary_ready,
+                            const TunnelQuality &secondary)
+{
+    uint32_t previous = preferred_;
+    if (!primary_ready || !secondary_ready) {
+        // 可用性变化直接生效
+        preferred_ = primary_ready ? primary_ : (secondary_ready ? secondary_ : 0);
+        pending_ = 0;
+        return previous != preferred_;
+    }
+    if (0 == preferred_) {
+        preferred_ = primary_;
+        pending_ = 0;
+        return true;
+    }
+
+    const TunnelQuality &current = (primary_ == preferred_) ? primary : secondary;
+    const TunnelQuality &other = (primary_ == preferred_) ? secondary : primary;
+    if (other.isValid() && current.isValid() && (other.getCost() < current.getCost() * (1.0 - kSwitchMargin))) {
+        pending_++;
+    } else {
+        pending_ = 0;
+    }
+    if (pending_ < kConfirmations) {
+        return false;
+    }
+
+    preferred_ = (primary_ == preferred_) ? secondary_ : primary_;
+    pending_ = 0;
+    LOG_INFO("TunnelSelector::update. switch to:" << preferred_ << " current:" << current.toString()
+             << " other:" << other.toString());
+    return true;
+}
+
+uint32_t TunnelSelector::getPreferred() const
+{
+    return preferred_;
+}
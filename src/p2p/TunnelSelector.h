@@ -0,0 +1,39 @@
+#ifndef SRC_TUNNEL_SELECTOR_H
+#define SRC_TUNNEL_SELECTOR_H
+
+#include <cstdint>
+#include "TunnelQuality.h"
+
+/**
+ * @brief 按隧道质量选择新连接使用的隧道，带滞回避免在两条隧道之间来回切换
+ * @note 只有一条隧道可用时直接选它；两条都可用时默认选primary（p2p），
+ *       另一条隧道的预计耗时连续kConfirmations次比当前隧道少kSwitchMargin以上才切换
+ *       仅在loop线程中使用
+ */
+class TunnelSelector {
+public:
+    TunnelSelector(uint32_t primary, uint32_t secondary);
+
+    /**
+     * @brief 定期调用，更新首选隧道
+     * @return true：首选隧道发生变化
+     */
+    bool update(bool primary_ready, const TunnelQuality &primary, bool secondary_ready,
+                const TunnelQuality &secondary);
+
+    /**
+     * @return 首选隧道，都不可用时返回0
+     */
+    uint32_t getPreferred() const;
+
+    static constexpr double kSwitchMargin = 0.3;    // 预计耗时至少少30%才切换
+    static const uint32_t kConfirmations = 3;       // 连续满足的次数
+
+private:
+    uint32_t primary_;
+    uint32_t secondary_;
+    uint32_t preferred_;
+    uint32_t pending_;      // 另一条隧道连续更好的次数
+};
+
+#endif  // SRC_TUNNEL_SELECTOR_H
@@ -0,0 +1,364 @@
+#include "UdpBatchIo.h"
+#include <cerrno>
+#include <cstring>
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#endif
+#include "x/Logger.h"
+
+#if defined(__linux__)
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+UdpBatchIo::UdpBatchIo()
+    : fd_(-1), batch_size_(0), packet_size_(0), send_count_(0), recv_batch_size_(0), recv_packet_size_(0),
+      gso_(false), gro_(false), stats_()
+{}
+
+UdpBatchIo::~UdpBatchIo()
+{
+    fini();
+}
+
+bool UdpBatchIo::isSupported()
+{
+#if defined(__linux__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+int UdpBatchIo::init(int fd, size_t batch_size, size_t packet_size)
+{
+    if ((fd < 0) || (batch_size <= 0) || (packet_size <= 0)) {
+        LOG_ERROR("UdpBatchIo::init failed:invalid input. fd:" << fd << " batch_size:" << batch_size
+                                                               << " packet_size:" << packet_size);
+        return -1;
+    }
+    if (!isSupported()) {
+        LOG_WARN("UdpBatchIo::init failed:not supported on this platform.");
+        return -1;
+    }
+
+    fd_ = fd;
+    batch_size_ = batch_size;
+    packet_size_ = packet_size;
+    send_buffer_.resize(batch_size * packet_size);
+    send_length_.resize(batch_size);
+    send_addr_.resize(batch_size);
+    send_addr_len_.resize(batch_size);
+    send_count_ = 0;
+    send_msg_first_.resize(batch_size + 1);
+    gso_ = false;
+    gro_ = false;
+#if defined(__linux__)
+    send_msgs_.resize(batch_size);
+    send_iovs_.resize(batch_size);
+    send_control_.resize(batch_size * CMSG_SPACE(sizeof(uint16_t)));
+#endif
+    _initRecvBuffer(batch_size, packet_size);
+    memset(&stats_, 0, sizeof(stats_));
+
+    return 0;
+}
+
+int UdpBatchIo::fini()
+{
+#if defined(__linux__)
+    if ((fd_ >= 0) && gro_) {
+        int off = 0;
+        setsockopt(fd_, SOL_UDP, UDP_GRO, &off, sizeof(off));
+    }
+#endif
+    fd_ = -1;
+    send_count_ = 0;
+    gso_ = false;
+    gro_ = false;
+    send_buffer_.clear();
+    recv_buffer_.clear();
+    return 0;
+}
+
+bool UdpBatchIo::isEnabled() const
+{
+    return (fd_ >= 0);
+}
+
+int UdpBatchIo::enableOffload(bool gso, bool gro)
+{
+    if (!isEnabled()) {
+        return -1;
+    }
+
+#if defined(__linux__)
+    if (gso) {
+        // 设置为0不改变发送行为，只用来探测内核是否支持UDP_SEGMENT，段长通过每个消息的cmsg指定
+        int gso_size = 0;
+        gso_ = (0 == setsockopt(fd_, SOL_UDP, UDP_SEGMENT, &gso_size, sizeof(gso_size)));
+        if (!gso_) {
+            LOG_WARN("UdpBatchIo::enableOffload. gso not supported. errno:" << errno);
+        }
+    }
+    if (gro) {
+        int on = 1;
+        gro_ = (0 == setsockopt(fd_, SOL_UDP, UDP_GRO, &on, sizeof(on)));
+        if (gro_) {
+            // 合并包最大64KB，包数少一些，总内存与普通模式相当
+            _initRecvBuffer(kGroBatchSize, kGroPacketSize);
+        } else {
+            LOG_WARN("UdpBatchIo::enableOffload. gro not supported. errno:" << errno);
+        }
+    }
+    LOG_DEBUG("UdpBatchIo::enableOffload. gso:" << gso_ << " gro:" << gro_);
+#endif
+
+    return (gso_ || gro_) ? 0 : -1;
+}
+
+bool UdpBatchIo::isGsoEnabled() const
+{
+    return gso_;
+}
+
+bool UdpBatchIo::isGroEnabled() const
+{
+    return gro_;
+}
+
+int UdpBatchIo::append(const char *data, int length, const struct sockaddr *addr, socklen_t addr_len)
+{
+    if ((nullptr == data) || (length <= 0) || (nullptr == addr) || (addr_len > sizeof(struct sockaddr_storage))) {
+        LOG_ERROR("UdpBatchIo::append failed:invalid input. length:" << length);
+        return -1;
+    }
+    if (!isEnabled()) {
+        return -1;
+    }
+    if ((size_t)length > packet_size_) {
+        LOG_ERROR("UdpBatchIo::append failed:packet too large. length:" << length << " max:" << packet_size_);
+        return -1;
+    }
+
+    if (send_count_ >= batch_size_) {
+        flush();
+    }
+
+    memcpy(send_buffer_.data() + send_count_ * packet_size_, data, length);
+    send_length_[send_count_] = length;
+    memcpy(&send_addr_[send_count_], addr, addr_len);
+    send_addr_len_[send_count_] = addr_len;
+    send_count_++;
+
+    return 0;
+}
+
+size_t UdpBatchIo::_buildSendMsgs(size_t first)
+{
+#if defined(__linux__)
+    size_t count = 0;
+    size_t i = first;
+    while (i < send_count_) {
+        send_iovs_[i].iov_base = send_buffer_.data() + i * packet_size_;
+        send_iovs_[i].iov_len = send_length_[i];
+
+        // GSO要求同一地址，除最后一段外长度都等于段长，最后一段可以更短
+        size_t segment_size = send_length_[i];
+        size_t segments = 1;
+        size_t bytes = segment_size;
+        size_t next = i + 1;
+        while (gso_ && (next < send_count_) && ((size_t)send_length_[next - 1] == segment_size)
+               && ((size_t)send_length_[next] <= segment_size) && (segments < kMaxGsoSegments)
+               && ((bytes + send_length_[next]) <= kMaxGsoBytes) && (send_addr_len_[next] == send_addr_len_[i])
+               && (0 == memcmp(&send_addr_[next], &send_addr_[i], send_addr_len_[i]))) {
+            send_iovs_[next].iov_base = send_buffer_.data() + next * packet_size_;
+            send_iovs_[next].iov_len = send_length_[next];
+            bytes += send_length_[next];
+            segments++;
+            next++;
+        }
+
+        struct msghdr &hdr = send_msgs_[count].msg_hdr;
+        memset(&send_msgs_[count], 0, sizeof(struct mmsghdr));
+        hdr.msg_name = &send_addr_[i];
+        hdr.msg_namelen = send_addr_len_[i];
+        hdr.msg_iov = &send_iovs_[i];
+        hdr.msg_iovlen = segments;
+        if (segments > 1) {
+            char *control = send_control_.data() + count * CMSG_SPACE(sizeof(uint16_t));
+            memset(control, 0, CMSG_SPACE(sizeof(uint16_t)));
+            hdr.msg_control = control;
+            hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t value = (uint16_t)segment_size;
+            memcpy(CMSG_DATA(cmsg), &value, sizeof(value));
+        }
+
+        send_msg_first_[count] = i;
+        count++;
+        i = next;
+    }
+    send_msg_first_[count] = send_count_;
+    return count;
+#else
+    (void)first;
+    return 0;
+#endif
+}
+
+int UdpBatchIo::flush()
+{
+    if (!isEnabled() || (0 == send_count_)) {
+        return 0;
+    }
+
+#if defined(__linux__)
+    struct mmsghdr *msgs = send_msgs_.data();
+    size_t msg_count = _buildSendMsgs(0);
+    size_t sent_msgs = 0;
+    size_t sent = 0;
+    while (sent_msgs < msg_count) {
+        int ret = sendmmsg(fd_, msgs + sent_msgs, (unsigned int)(msg_count - sent_msgs), MSG_DONTWAIT);
+        stats_.send_calls++;
+        if (ret < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (gso_ && ((EIO == errno) || (EINVAL == errno) || (EOPNOTSUPP == errno))) {
+                // 网卡或路径不支持GSO，关闭后把剩余的包逐个重发
+                LOG_WARN("UdpBatchIo::flush. gso send failed, disabled. errno:" << errno);
+                gso_ = false;
+                msg_count = _buildSendMsgs(send_msg_first_[sent_msgs]);
+                sent_msgs = 0;
+                continue;
+            }
+            // EAGAIN等，剩余的包丢弃，由kcp重传
+            LOG_WARN("UdpBatchIo::flush. sendmmsg failed. errno:" << errno << " dropped:" << (send_count_ - sent));
+            break;
+        }
+        for (int i = 0; i < ret; i++) {
+            size_t packets = send_msg_first_[sent_msgs + i + 1] - send_msg_first_[sent_msgs + i];
+            if (packets > 1) {
+                stats_.gso_sends++;
+            }
+            stats_.send_bytes += msgs[sent_msgs + i].msg_len;
+            stats_.send_packets += packets;
+            sent += packets;
+        }
+        sent_msgs += ret;
+    }
+
+    send_count_ = 0;
+    return (int)sent;
+#else
+    send_count_ = 0;
+    return -1;
+#endif
+}
+
+int UdpBatchIo::recv(const RecvCallback &cb, int max_rounds)
+{
+    if (!isEnabled() || !cb) {
+        return 0;
+    }
+
+#if defined(__linux__)
+    struct mmsghdr *msgs = recv_msgs_.data();
+    struct iovec *iovs = recv_iovs_.data();
+    const size_t control_size = CMSG_SPACE(sizeof(int));
+    int total = 0;
+    for (int round = 0; round < max_rounds; round++) {
+        for (size_t i = 0; i < recv_batch_size_; i++) {
+            iovs[i].iov_base = recv_buffer_.data() + i * recv_packet_size_;
+            iovs[i].iov_len = recv_packet_size_;
+            memset(&msgs[i], 0, sizeof(struct mmsghdr));
+            msgs[i].msg_hdr.msg_name = &recv_addr_[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            if (gro_) {
+                msgs[i].msg_hdr.msg_control = recv_control_.data() + i * control_size;
+                msgs[i].msg_hdr.msg_controllen = control_size;
+            }
+        }
+
+        int ret = recvmmsg(fd_, msgs, (unsigned int)recv_batch_size_, MSG_DONTWAIT, nullptr);
+        stats_.recv_calls++;
+        if (ret <= 0) {
+            // EAGAIN：socket中已没有数据
+            break;
+        }
+
+        for (int i = 0; i < ret; i++) {
+            char *data = (char *)iovs[i].iov_base;
+            size_t length = msgs[i].msg_len;
+            const struct sockaddr *addr = (const struct sockaddr *)&recv_addr_[i];
+            stats_.recv_bytes += length;
+
+            // GRO合并的包按段长拆开，每段是对端发出的一个包
+            size_t segment_size = length;
+            if (gro_) {
+                for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); nullptr != cmsg;
+                     cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                    if ((SOL_UDP == cmsg->cmsg_level) && (UDP_GRO == cmsg->cmsg_type)) {
+                        int value = 0;
+                        memcpy(&value, CMSG_DATA(cmsg), sizeof(value));
+                        if (value > 0) {
+                            segment_size = value;
+                        }
+                    }
+                }
+            }
+            if (segment_size < length) {
+                stats_.gro_recvs++;
+            }
+
+            for (size_t offset = 0; offset < length; offset += segment_size) {
+                size_t segment = ((length - offset) < segment_size) ? (length - offset) : segment_size;
+                cb(data + offset, (int)segment, addr);
+                stats_.recv_packets++;
+                total++;
+            }
+        }
+
+        if ((size_t)ret < recv_batch_size_) {
+            break;
+        }
+    }
+
+    return total;
+#else
+    return 0;
+#endif
+}
+
+UdpBatchIo::Stats UdpBatchIo::getStats() const
+{
+    return stats_;
+}
+
+int UdpBatchIo::_initRecvBuffer(size_t batch_size, size_t packet_size)
+{
+    recv_batch_size_ = batch_size;
+    recv_packet_size_ = packet_size;
+    recv_buffer_.resize(batch_size * packet_size);
+    recv_addr_.resize(batch_size);
+#if defined(__linux__)
+    recv_msgs_.resize(batch_size);
+    recv_iovs_.resize(batch_size);
+    recv_control_.resize(batch_size * CMSG_SPACE(sizeof(int)));
+#endif
+    return 0;
+}
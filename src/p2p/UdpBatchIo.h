@@ -0,0 +1,142 @@
+#ifndef SRC_UDP_BATCH_IO_H_
+#define SRC_UDP_BATCH_IO_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#endif
+#if defined(__linux__)
+#include <sys/uio.h>
+#endif
+
+/**
+ * @brief UDP批量收发，Linux上使用recvmmsg/sendmmsg，一次系统调用收发多个包
+ * @note 只操作fd，不接管libhv的读事件：libhv读到第一个包后，再用recvmmsg把socket中剩余的包一次读完；
+ *       发送时先缓存一次ikcp_flush输出的所有包，再用sendmmsg一次发出
+ *       其他平台isSupported()返回false，调用方应继续使用libhv的sendto
+ *       可选启用UDP GSO/GRO：发往同一地址、长度相同的连续包合并成一个UDP_SEGMENT发送；
+ *       接收时按UDP_GRO给出的段长拆分后再回调。内核不支持时自动退回普通收发
+ */
+class UdpBatchIo {
+public:
+    /**
+     * @brief 收发统计，calls为系统调用次数
+     */
+    struct Stats {
+        uint64_t send_calls;
+        uint64_t send_packets;
+        uint64_t send_bytes;
+        uint64_t recv_calls;
+        uint64_t recv_packets;
+        uint64_t recv_bytes;
+        uint64_t gso_sends;         // 使用GSO发送的合并包数
+        uint64_t gro_recvs;         // 收到的GRO合并包数
+    };
+
+    typedef std::function<void(char *data, int length, const struct sockaddr *addr)> RecvCallback;
+
+    UdpBatchIo();
+
+    ~UdpBatchIo();
+
+    static bool isSupported();
+
+    /**
+     * @brief 初始化
+     * @param fd 非阻塞的udp socket
+     * @param batch_size 每次系统调用最多收发的包数
+     * @param packet_size 单个包的最大长度
+     * @return 0：成功；-1：失败或不支持；
+     */
+    int init(int fd, size_t batch_size = kDefaultBatchSize, size_t packet_size = kDefaultPacketSize);
+
+    int fini();
+
+    bool isEnabled() const;
+
+    /**
+     * @brief 启用UDP GSO/GRO，需在init之后调用
+     * @return 0：至少启用了一项；-1：都不支持
+     */
+    int enableOffload(bool gso, bool gro);
+
+    bool isGsoEnabled() const;
+
+    bool isGroEnabled() const;
+
+    /**
+     * @brief 缓存一个待发送的包，缓存满时自动flush
+     * @return 0：成功；-1：失败；
+     */
+    int append(const char *data, int length, const struct sockaddr *addr, socklen_t addr_len);
+
+    /**
+     * @brief 发送所有缓存的包
+     * @return 发出的包数，-1：失败（未发出的包已丢弃，由kcp重传）
+     */
+    int flush();
+
+    /**
+     * @brief 读完socket中所有的包，每个包回调一次
+     * @param max_rounds 最多调用recvmmsg的次数，避免长时间占用loop
+     * @return 收到的包数
+     */
+    int recv(const RecvCallback &cb, int max_rounds = kDefaultRecvRounds);
+
+    Stats getStats() const;
+
+    static const size_t kDefaultBatchSize = 64;
+    static const size_t kDefaultPacketSize = 1500;
+    static const int kDefaultRecvRounds = 8;
+    static const size_t kMaxGsoSegments = 64;       // 内核UDP_MAX_SEGMENTS
+    static const size_t kMaxGsoBytes = 65000;       // 合并后不超过一个IP包
+    static const size_t kGroPacketSize = 65536;     // GRO合并包的最大长度
+    static const size_t kGroBatchSize = 8;
+
+private:
+    /**
+     * @brief 从第first个包开始构造sendmmsg的消息，启用GSO时合并包
+     * @return 消息数
+     */
+    size_t _buildSendMsgs(size_t first);
+
+    int _initRecvBuffer(size_t batch_size, size_t packet_size);
+
+    int fd_;
+    size_t batch_size_;
+    size_t packet_size_;
+
+    // 发送缓存，每个包固定占用packet_size_
+    std::vector<char> send_buffer_;
+    std::vector<int> send_length_;
+    std::vector<struct sockaddr_storage> send_addr_;
+    std::vector<socklen_t> send_addr_len_;
+    size_t send_count_;
+
+    // 接收缓存
+    std::vector<char> recv_buffer_;
+    std::vector<struct sockaddr_storage> recv_addr_;
+    size_t recv_batch_size_;
+    size_t recv_packet_size_;
+
+    // GSO/GRO
+    bool gso_;
+    bool gro_;
+    std::vector<char> send_control_;
+    std::vector<char> recv_control_;
+    std::vector<size_t> send_msg_first_;    // 每个消息的第一个包
+
+#if defined(__linux__)
+    std::vector<struct mmsghdr> send_msgs_;
+    std::vector<struct iovec> send_iovs_;
+    std::vector<struct mmsghdr> recv_msgs_;
+    std::vector<struct iovec> recv_iovs_;
+#endif
+
+    Stats stats_;
+};
+
+#endif  // SRC_UDP_BATCH_IO_H_
@@ -0,0 +1,400 @@
+#include "UdpFec.h"
+#include <cmath>
+#include <cstring>
+#include "x/Logger.h"
+#include "TunnelMsgHeader.h"
+
+namespace {
+
+/**
+ * @brief fec包头，之后是数据分片（kcp包）或校验分片
+ */
+struct UdpFecHeader {
+    uint32_t marker;            // kKcpConvReserved
+    uint32_t group_id;
+    uint8_t index;              // 分片序号，小于data_shards为数据分片
+    uint8_t data_shards;        // 数据分片为0（发出时组还没有结束），校验分片为该组的数据分片数
+    uint8_t parity_shards;
+    uint8_t loss;               // 发送方测得的接收丢包率，0~255
+}__attribute__ ((packed));
+
+const size_t kMaxShards = ReedSolomon::kMaxDataShards + ReedSolomon::kMaxParityShards;
+const double kRedundancy = 2.0;     // 校验包数 = 数据包数 * 丢包率 * kRedundancy
+
+}  // namespace
+
+UdpFec::UdpFec()
+    : enabled_(false), data_shards_(0), max_parity_shards_(0), shard_capacity_(0), send_group_id_(0),
+      send_count_(0), send_shard_length_(0), send_group_begin_(0), groups_(), local_loss_(0), peer_loss_(0),
+      stats_()
+{}
+
+UdpFec::~UdpFec()
+{
+    fini();
+}
+
+int UdpFec::init(size_t data_shards, size_t max_parity_shards, size_t max_packet_size, const PacketCallback &output)
+{
+    static_assert(sizeof(UdpFecHeader) == kHeaderLength, "invalid UdpFecHeader");
+    if ((data_shards <= 0) || (data_shards > ReedSolomon::kMaxDataShards)
+        || (max_parity_shards > ReedSolomon::kMaxParityShards) || (max_packet_size <= 0)
+        || (max_packet_size > 0xffff) || !output) {
+        LOG_ERROR("UdpFec::init failed:invalid input. data_shards:" << data_shards << " max_parity_shards:"
+                  << max_parity_shards << " max_packet_size:" << max_packet_size);
+        return -1;
+    }
+
+    data_shards_ = data_shards;
+    max_parity_shards_ = max_parity_shards;
+    shard_capacity_ = max_packet_size + 2;
+    output_ = output;
+
+    send_shards_.assign((data_shards + max_parity_shards) * shard_capacity_, 0);
+    send_packet_.assign(kHeaderLength + shard_capacity_, 0);
+    recv_shards_.assign(kGroupSlots * kMaxShards * shard_capacity_, 0);
+    reset();
+    memset(&stats_, 0, sizeof(stats_));
+    enabled_ = true;
+
+    LOG_DEBUG("UdpFec::init. data_shards:" << data_shards << " max_parity_shards:" << max_parity_shards
+              << " kernel:" << ReedSolomon::getKernelName());
+    return 0;
+}
+
+int UdpFec::fini()
+{
+    enabled_ = false;
+    output_ = nullptr;
+    send_shards_.clear();
+    send_packet_.clear();
+    recv_shards_.clear();
+    return 0;
+}
+
+int UdpFec::reset()
+{
+    send_group_id_ = 0;
+    send_count_ = 0;
+    send_shard_length_ = 0;
+    for (auto &group : groups_) {
+        group.used = false;
+    }
+    local_loss_ = 0;
+    peer_loss_ = 0;
+    return 0;
+}
+
+bool UdpFec::isEnabled() const
+{
+    return enabled_;
+}
+
+bool UdpFec::isFecPacket(const char *data, int length)
+{
+    if ((nullptr == data) || (length <= (int)kHeaderLength)) {
+        return false;
+    }
+
+    uint32_t marker = 0;
+    memcpy(&marker, data, sizeof(marker));
+    return (kKcpConvReserved == marker);
+}
+
+int UdpFec::send(const char *data, int length, uint32_t current)
+{
+    if (!enabled_) {
+        return -1;
+    }
+    if ((nullptr == data) || (length <= 0) || ((size_t)length + 2 > shard_capacity_)) {
+        LOG_ERROR("UdpFec::send failed:invalid input. length:" << length);
+        return -1;
+    }
+
+    if (0 == send_count_) {
+        send_group_begin_ = current;
+    }
+
+    // 数据包立即发出
+    auto *header = (UdpFecHeader *)send_packet_.data();
+    header->marker = kKcpConvReserved;
+    header->group_id = send_group_id_;
+    header->index = (uint8_t)send_count_;
+    header->data_shards = 0;
+    header->parity_shards = 0;
+    header->loss = getLocalLoss();
+    memcpy(send_packet_.data() + kHeaderLength, data, length);
+    output_((const char *)send_packet_.data(), (int)kHeaderLength + length);
+    stats_.data_sent++;
+
+    // 保存为[长度][数据]，用于计算校验分片
+    uint8_t *shard = send_shards_.data() + send_count_ * shard_capacity_;
+    uint16_t shard_length = (uint16_t)length;
+    memcpy(shard, &shard_length, sizeof(shard_length));
+    memcpy(shard + 2, data, length);
+    if ((size_t)length + 2 > send_shard_length_) {
+        send_shard_length_ = length + 2;
+    }
+    send_count_++;
+
+    if (send_count_ >= data_shards_) {
+        return _closeGroup();
+    }
+
+    return 0;
+}
+
+int UdpFec::flush(uint32_t current)
+{
+    if (!enabled_ || (0 == send_count_)) {
+        return 0;
+    }
+    if ((uint32_t)(current - send_group_begin_) < kGroupTimeout) {
+        return 0;
+    }
+
+    return _closeGroup();
+}
+
+size_t UdpFec::_getParityShards(size_t data_shards) const
+{
+    if (0 == peer_loss_) {
+        return 0;
+    }
+
+    double loss = peer_loss_ / 255.0;
+    size_t parity_shards = (size_t)std::ceil(data_shards * loss * kRedundancy);
+    if (parity_shards < 1) {
+        parity_shards = 1;
+    }
+    if (parity_shards > max_parity_shards_) {
+        parity_shards = max_parity_shards_;
+    }
+    return parity_shards;
+}
+
+int UdpFec::_closeGroup()
+{
+    size_t data_shards = send_count_;
+    size_t parity_shards = _getParityShards(data_shards);
+    if (parity_shards > 0) {
+        const uint8_t *data[ReedSolomon::kMaxDataShards];
+        uint8_t *parity[ReedSolomon::kMaxParityShards];
+        for (size_t i = 0; i < data_shards; i++) {
+            uint8_t *shard = send_shards_.data() + i * shard_capacity_;
+            uint16_t length = 0;
+            memcpy(&length, shard, sizeof(length));
+            // 补齐到同一长度
+            memset(shard + 2 + length, 0, send_shard_length_ - 2 - length);
+            data[i] = shard;
+        }
+        for (size_t i = 0; i < parity_shards; i++) {
+            parity[i] = send_shards_.data() + (data_shards_ + i) * shard_capacity_;
+        }
+        ReedSolomon::encode(data, data_shards, parity, parity_shards, send_shard_length_);
+
+        auto *header = (UdpFecHeader *)send_packet_.data();
+        for (size_t i = 0; i < parity_shards; i++) {
+            header->marker = kKcpConvReserved;
+            header->group_id = send_group_id_;
+            header->index = (uint8_t)(data_shards + i);
+            header->data_shards = (uint8_t)data_shards;
+            header->parity_shards = (uint8_t)parity_shards;
+            header->loss = getLocalLoss();
+            memcpy(send_packet_.data() + kHeaderLength, parity[i], send_shard_length_);
+            output_((const char *)send_packet_.data(), (int)(kHeaderLength + send_shard_length_));
+            stats_.parity_sent++;
+        }
+    }
+
+    send_group_id_++;
+    send_count_ = 0;
+    send_shard_length_ = 0;
+    return 0;
+}
+
+uint8_t *UdpFec::_getShard(size_t slot, size_t index)
+{
+    return recv_shards_.data() + (slot * kMaxShards + index) * shard_capacity_;
+}
+
+void UdpFec::_resetGroup(Group &group, uint32_t group_id)
+{
+    group.group_id = group_id;
+    group.used = true;
+    group.done = false;
+    group.data_shards = 0;
+    group.parity_shards = 0;
+    group.data_seen = 0;
+    group.data_recv = 0;
+    group.parity_recv = 0;
+    group.shard_length = 0;
+    memset(group.present, 0, sizeof(group.present));
+}
+
+UdpFec::Group &UdpFec::_getGroup(uint32_t group_id, bool &stale)
+{
+    stale = false;
+    Group &group = groups_[group_id % kGroupSlots];
+    if (!group.used) {
+        _resetGroup(group, group_id);
+    } else if (group.group_id != group_id) {
+        if ((int32_t)(group_id - group.group_id) < 0) {
+            // 该组的位置已被更新的组占用
+            stale = true;
+            return group;
+        }
+        _updateLoss(group);
+        _resetGroup(group, group_id);
+    }
+
+    return group;
+}
+
+void UdpFec::_updateLoss(const Group &group)
+{
+    // 收到过校验包时以其中的数据包数为准，否则只能按收到的最大序号估计
+    size_t expected = (group.data_shards > 0) ? group.data_shards : group.data_seen;
+    if ((0 == expected) || (group.data_recv > expected)) {
+        return;
+    }
+
+    uint32_t sample = (uint32_t)((expected - group.data_recv) * 65536 / expected);
+    local_loss_ = local_loss_ - (local_loss_ >> 3) + (sample >> 3);
+    if (!group.done && (group.data_recv < expected)) {
+        stats_.unrecoverable++;
+    }
+}
+
+int UdpFec::input(const char *data, int length, const PacketCallback &cb)
+{
+    if (!enabled_ || !isFecPacket(data, length) || !cb) {
+        return -1;
+    }
+
+    UdpFecHeader header;
+    memcpy(&header, data, kHeaderLength);
+    const char *payload = data + kHeaderLength;
+    size_t payload_length = length - kHeaderLength;
+    peer_loss_ = header.loss;
+
+    bool is_data = (0 == header.data_shards);
+    if (is_data) {
+        if ((header.index >= ReedSolomon::kMaxDataShards) || (payload_length + 2 > shard_capacity_)) {
+            LOG_ERROR("UdpFec::input failed:invalid data shard. index:" << (int)header.index
+                      << " length:" << payload_length);
+            return -1;
+        }
+    } else {
+        if ((header.data_shards > ReedSolomon::kMaxDataShards)
+            || (header.parity_shards > ReedSolomon::kMaxParityShards)
+            || (header.index < header.data_shards) || (header.index >= header.data_shards + header.parity_shards)
+            || (payload_length > shard_capacity_)) {
+            LOG_ERROR("UdpFec::input failed:invalid parity shard. index:" << (int)header.index
+                      << " data_shards:" << (int)header.data_shards << " length:" << payload_length);
+            return -1;
+        }
+    }
+
+    bool stale = false;
+    Group &group = _getGroup(header.group_id, stale);
+    size_t slot = header.group_id % kGroupSlots;
+    if (stale || group.present[header.index]) {
+        // 过期或重复，数据包仍交给kcp，由kcp去重
+        if (is_data) {
+            stats_.data_recv++;
+            cb(payload, (int)payload_length);
+        }
+        return 0;
+    }
+
+    uint8_t *shard = _getShard(slot, header.index);
+    group.present[header.index] = true;
+    if (is_data) {
+        stats_.data_recv++;
+        uint16_t shard_length = (uint16_t)payload_length;
+        memcpy(shard, &shard_length, sizeof(shard_length));
+        memcpy(shard + 2, payload, payload_length);
+        group.lengths[header.index] = shard_length;
+        group.data_recv++;
+        if ((size_t)header.index + 1 > group.data_seen) {
+            group.data_seen = header.index + 1;
+        }
+        cb(payload, (int)payload_length);
+    } else {
+        stats_.parity_recv++;
+        memcpy(shard, payload, payload_length);
+        group.data_shards = header.data_shards;
+        group.parity_shards = header.parity_shards;
+        group.shard_length = payload_length;
+        group.parity_recv++;
+    }
+
+    if (!group.done && (group.data_shards > 0)) {
+        if (group.data_recv >= group.data_shards) {
+            group.done = true;
+        } else if ((group.data_recv + group.parity_recv) >= group.data_shards) {
+            _recover(group, slot, cb);
+        }
+    }
+
+    return 0;
+}
+
+int UdpFec::_recover(Group &group, size_t slot, const PacketCallback &cb)
+{
+    group.done = true;
+
+    size_t data_shards = group.data_shards;
+    size_t total = data_shards + group.parity_shards;
+    uint8_t *shards[kMaxShards];
+    bool present[kMaxShards];
+    for (size_t i = 0; i < total; i++) {
+        shards[i] = _getShard(slot, i);
+        present[i] = group.present[i];
+        if (present[i] && (i < data_shards)) {
+            size_t used = group.lengths[i] + 2;
+            if (used > group.shard_length) {
+                LOG_ERROR("UdpFec::_recover failed:invalid shard length. group_id:" << group.group_id);
+                return -1;
+            }
+            memset(shards[i] + used, 0, group.shard_length - used);
+        }
+    }
+
+    if (0 != ReedSolomon::reconstruct(shards, present, data_shards, group.parity_shards, group.shard_length)) {
+        LOG_ERROR("UdpFec::_recover failed in reconstruct. group_id:" << group.group_id);
+        return -1;
+    }
+
+    for (size_t i = 0; i < data_shards; i++) {
+        if (present[i]) {
+            continue;
+        }
+        uint16_t length = 0;
+        memcpy(&length, shards[i], sizeof(length));
+        if ((0 == length) || ((size_t)length + 2 > group.shard_length)) {
+            LOG_ERROR("UdpFec::_recover failed:invalid recovered length. length:" << length);
+            continue;
+        }
+        stats_.recovered++;
+        cb((const char *)shards[i] + 2, length);
+    }
+
+    return 0;
+}
+
+uint8_t UdpFec::getLocalLoss() const
+{
+    return (uint8_t)((local_loss_ * 255) >> 16);
+}
+
+uint8_t UdpFec::getPeerLoss() const
+{
+    return peer_loss_;
+}
+
+UdpFec::Stats UdpFec::getStats() const
+{
+    return stats_;
+}
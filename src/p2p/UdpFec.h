@@ -0,0 +1,150 @@
+#ifndef SRC_UDP_FEC_H
+#define SRC_UDP_FEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "ReedSolomon.h"
+
+/**
+ * @brief 位于kcp输出和udp socket之间的前向纠错，每n个kcp包为一组，额外发送m个Reed-Solomon校验包
+ * @note 数据包加上fec包头后立即发出，不增加时延；丢包时收到任意n个包即可恢复，不必等kcp超时重传
+ *       m按对端测得的丢包率自适应：每个fec包头带上本端测得的对端丢包率，没有丢包时不发校验包
+ *       fec包的前4字节为kKcpConvReserved，与kcp包、tunnel消息区分，双方都启用时才能使用
+ */
+class UdpFec {
+public:
+    /**
+     * @brief 统计
+     */
+    struct Stats {
+        uint64_t data_sent;         // 发出的数据包
+        uint64_t parity_sent;       // 发出的校验包
+        uint64_t data_recv;         // 收到的数据包
+        uint64_t parity_recv;       // 收到的校验包
+        uint64_t recovered;         // 恢复出的数据包
+        uint64_t unrecoverable;     // 分片不足，无法恢复的组
+    };
+
+    typedef std::function<void(const char *data, int length)> PacketCallback;
+
+    UdpFec();
+
+    ~UdpFec();
+
+    /**
+     * @brief 初始化
+     * @param data_shards 每组数据包数n
+     * @param max_parity_shards 每组最多的校验包数
+     * @param max_packet_size kcp包的最大长度
+     * @param output 发送回调，参数为带fec包头的udp包
+     * @return 0：成功；-1：失败；
+     */
+    int init(size_t data_shards, size_t max_parity_shards, size_t max_packet_size, const PacketCallback &output);
+
+    int fini();
+
+    /**
+     * @brief 清空收发状态，更换对端时调用
+     */
+    int reset();
+
+    bool isEnabled() const;
+
+    /**
+     * @brief 发送一个kcp包，凑满一组时同时发出校验包
+     * @param current 当前时间，毫秒
+     * @return 0：成功；-1：失败；
+     */
+    int send(const char *data, int length, uint32_t current);
+
+    /**
+     * @brief 当前组未满但已超过kGroupTimeout时结束该组并发出校验包，每次ikcp_flush之后调用
+     */
+    int flush(uint32_t current);
+
+    /**
+     * @brief 处理收到的fec包，数据包和恢复出的包依次回调
+     * @return 0：成功；-1：无效的包；
+     */
+    int input(const char *data, int length, const PacketCallback &cb);
+
+    static bool isFecPacket(const char *data, int length);
+
+    /**
+     * @brief 本端测得的丢包率，0~255
+     */
+    uint8_t getLocalLoss() const;
+
+    /**
+     * @brief 对端测得的本端发出的包的丢包率，0~255
+     */
+    uint8_t getPeerLoss() const;
+
+    Stats getStats() const;
+
+    static const size_t kHeaderLength = 12;
+    static const size_t kOverhead = kHeaderLength + 2;  // fec包头，以及校验分片中的包长
+    static const uint32_t kGroupTimeout = 20;           // 毫秒
+    static const size_t kGroupSlots = 8;                // 接收端同时缓存的组数
+
+private:
+    /**
+     * @brief 接收端的一组分片，按分片序号存放，数据分片为[长度(2字节)][kcp包]
+     */
+    struct Group {
+        uint32_t group_id;
+        bool used;
+        bool done;                  // 已完整或已恢复
+        size_t data_shards;         // 收到校验包之前为0
+        size_t parity_shards;
+        size_t data_seen;           // 收到的最大数据分片序号+1
+        size_t data_recv;
+        size_t parity_recv;
+        size_t shard_length;        // 校验分片长度
+        bool present[ReedSolomon::kMaxDataShards + ReedSolomon::kMaxParityShards];
+        uint16_t lengths[ReedSolomon::kMaxDataShards];
+    };
+
+    int _closeGroup();
+
+    size_t _getParityShards(size_t data_shards) const;
+
+    Group &_getGroup(uint32_t group_id, bool &stale);
+
+    void _resetGroup(Group &group, uint32_t group_id);
+
+    /**
+     * @brief 组被淘汰时统计丢包
+     */
+    void _updateLoss(const Group &group);
+
+    int _recover(Group &group, size_t slot, const PacketCallback &cb);
+
+    uint8_t *_getShard(size_t slot, size_t index);
+
+    bool enabled_;
+    size_t data_shards_;
+    size_t max_parity_shards_;
+    size_t shard_capacity_;         // max_packet_size + 2
+    PacketCallback output_;
+
+    // 发送
+    uint32_t send_group_id_;
+    size_t send_count_;
+    size_t send_shard_length_;
+    uint32_t send_group_begin_;
+    std::vector<uint8_t> send_shards_;      // 数据分片和校验分片
+    std::vector<uint8_t> send_packet_;      // fec包头 + 分片
+
+    // 接收
+    Group groups_[kGroupSlots];
+    std::vector<uint8_t> recv_shards_;
+    uint32_t local_loss_;                   // 丢包率 * 65536，指数平均
+    uint8_t peer_loss_;
+
+    Stats stats_;
+};
+
+#endif  // SRC_UDP_FEC_H
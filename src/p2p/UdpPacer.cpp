@@ -0,0 +1,121 @@
+#include "UdpPacer.h"
+#include <algorithm>
+#include <cstring>
+#include "x/Logger.h"
+
+UdpPacer::UdpPacer() : rate_(0), tokens_(0), last_time_(0), stats_() {}
+
+int UdpPacer::init(size_t max_queue_bytes)
+{
+    if (0 != queue_.init(RingBuffer::kMinSize, max_queue_bytes)) {
+        LOG_ERROR("UdpPacer::init failed in queue init. max_queue_bytes:" << max_queue_bytes);
+        return -1;
+    }
+
+    memset(&stats_, 0, sizeof(stats_));
+    return reset();
+}
+
+int UdpPacer::fini()
+{
+    queue_.fini();
+    return 0;
+}
+
+int UdpPacer::reset()
+{
+    queue_.reset();
+    queue_.shrink();
+    tokens_ = kMinBurst;
+    last_time_ = 0;
+    return 0;
+}
+
+void UdpPacer::setRate(uint64_t bytes_per_second)
+{
+    rate_ = bytes_per_second;
+}
+
+uint64_t UdpPacer::getRate() const
+{
+    return rate_;
+}
+
+void UdpPacer::_refill(uint64_t now)
+{
+    if (0 == last_time_) {
+        last_time_ = now;
+        return;
+    }
+    if (now <= last_time_) {
+        return;
+    }
+
+    double burst = std::max<double>(rate_ * kBurstTime / 1000000.0, kMinBurst);
+    tokens_ = std::min(burst, tokens_ + rate_ * (now - last_time_) / 1000000.0);
+    last_time_ = now;
+}
+
+int UdpPacer::send(const char *data, int length, uint64_t now, const SendCallback &cb)
+{
+    if ((nullptr == data) || (length <= 0) || (length > 0xffff)) {
+        LOG_ERROR("UdpPacer::send failed:invalid input. length:" << length);
+        return -1;
+    }
+
+    _refill(now);
+    if (0 == rate_) {
+        stats_.direct++;
+        cb(data, length);
+        return 0;
+    }
+    if ((0 == queue_.used()) && (tokens_ >= length)) {
+        tokens_ -= length;
+        stats_.direct++;
+        cb(data, length);
+        return 0;
+    }
+
+    uint16_t packet_length = (uint16_t)length;
+    if (0 != queue_.reserve(sizeof(packet_length) + length)) {
+        stats_.dropped++;
+        return -1;
+    }
+    queue_.write((const char *)&packet_length, sizeof(packet_length));
+    queue_.write(data, length);
+    stats_.max_queued = std::max(stats_.max_queued, queue_.used());
+    return 0;
+}
+
+int UdpPacer::drain(uint64_t now, const SendCallback &cb)
+{
+    _refill(now);
+    while (queue_.used() > 0) {
+        uint16_t length = 0;
+        memcpy(&length, queue_.read_ptr(), sizeof(length));
+        if ((0 != rate_) && (tokens_ < length)) {
+            // 等到令牌足够
+            uint64_t wait = (uint64_t)((length - tokens_) * 1000 / rate_) + 1;
+            return (int)std::min<uint64_t>(wait, 1000);
+        }
+
+        if (0 != rate_) {
+            tokens_ -= length;
+        }
+        stats_.paced++;
+        cb(queue_.read_ptr() + sizeof(length), length);
+        queue_.advance(sizeof(length) + length);
+    }
+
+    return -1;
+}
+
+size_t UdpPacer::queued() const
+{
+    return queue_.used();
+}
+
+UdpPacer::Stats UdpPacer::getStats() const
+{
+    return stats_;
+}
@@ -0,0 +1,76 @@
+#ifndef SRC_UDP_PACER_H
+#define SRC_UDP_PACER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include "x/RingBuffer.h"
+
+/**
+ * @brief 令牌桶发送速率控制，把一次ikcp_flush输出的大量包均匀分散发出，避免突发挤满NAT和运营商缓存
+ * @note 仅在loop线程中使用；排队的包存放在RingBuffer中，格式为[长度(2字节)][数据]
+ */
+class UdpPacer {
+public:
+    /**
+     * @brief 统计
+     */
+    struct Stats {
+        uint64_t direct;        // 令牌足够，直接发出的包
+        uint64_t paced;         // 排队后发出的包
+        uint64_t dropped;       // 队列满丢弃的包，由kcp重传
+        size_t max_queued;      // 排队字节数的最大值
+    };
+
+    typedef std::function<void(const char *data, int length)> SendCallback;
+
+    UdpPacer();
+
+    int init(size_t max_queue_bytes = RingBuffer::kDefaultMaxSize);
+
+    int fini();
+
+    /**
+     * @brief 清空队列和令牌
+     */
+    int reset();
+
+    /**
+     * @brief 设置发送速率
+     * @param bytes_per_second 0表示不限速
+     */
+    void setRate(uint64_t bytes_per_second);
+
+    uint64_t getRate() const;
+
+    /**
+     * @brief 令牌足够且没有排队时直接发出，否则排队
+     * @param now 微秒
+     * @return 0：成功；-1：队列满，已丢弃；
+     */
+    int send(const char *data, int length, uint64_t now, const SendCallback &cb);
+
+    /**
+     * @brief 按令牌发出排队的包
+     * @return 下一个包需要等待的毫秒数，队列为空时返回-1
+     */
+    int drain(uint64_t now, const SendCallback &cb);
+
+    size_t queued() const;
+
+    Stats getStats() const;
+
+    static const uint64_t kBurstTime = 2000;    // 令牌桶容量，微秒
+    static const size_t kMinBurst = 4 * 1500;   // 至少能发出几个完整的包
+
+private:
+    void _refill(uint64_t now);
+
+    RingBuffer queue_;
+    uint64_t rate_;
+    double tokens_;
+    uint64_t last_time_;
+    Stats stats_;
+};
+
+#endif  // SRC_UDP_PACER_H
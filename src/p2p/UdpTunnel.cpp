@@ -1,4 +1,5 @@
 #include "UdpTunnel.h"
+#include "UdpTunnelMux.h"
 #include "hv/htime.h"
 #include "x/IPv4Utils.h"
 #include "x/Logger.h"
@@ -7,9 +8,49 @@
 #include "ProxyServer.h"
 #include "kcp/KcpConfig.h"
 #include "ClientNode.h"
+#include "AppConfig.h"
+#include "KcpProfile.h"
 
 // #define DEBUG_UDP_TUNNEL
 
+namespace {
+
+// 路径MTU探测的udp载荷长度，从大到小：以太网、PPPoE、常见的运营商隧道、IPv6最小MTU等
+const uint16_t kMtuProbeSizes[] = {kcpMaxMtu, 1452, 1432, 1400, 1372, 1280, 1200, 1024, 576};
+const int kMtuProbeTimeout = 1000;
+const int kMtuProbeRetries = 3;
+const size_t kMtuProbeNum = sizeof(kMtuProbeSizes) / sizeof(kMtuProbeSizes[0]);
+const uint32_t kMtuProbeInterval = 10 * 60 * 1000;
+
+/**
+ * @brief 读取/设置socket的IP_MTU_DISCOVER，探测包需要设置DF，否则超过路径MTU的包会被分片后送达
+ * @return 0：成功；-1：失败或不支持（此时不探测）；
+ */
+int getPmtuDiscover(int fd, int &value)
+{
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+    socklen_t len = sizeof(value);
+    return getsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &value, &len);
+#else
+    (void)fd;
+    (void)value;
+    return -1;
+#endif
+}
+
+int setPmtuDiscover(int fd, int value)
+{
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+    return setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value));
+#else
+    (void)fd;
+    (void)value;
+    return -1;
+#endif
+}
+
+}  // namespace
+
 int kcp_send_callback(const char *data, int size, ikcpcb *kcp, void *user)
 {
     if ((nullptr == data) || (size <= 0) || (nullptr == kcp) || (nullptr == user)) {
@@ -22,52 +63,30 @@ int kcp_send_callback(const char *data, int size, ikcpcb *kcp, void *user)
     return 0;
 }
 
-UdpTunnel::UdpTunnel(hv::EventLoopPtr loop)
-    : device_port_(0), tunnel_id_(0), is_ready_(false), hv::UdpClient(loop), kcp_(nullptr)
-{}
+UdpTunnel::UdpTunnel(hv::EventLoopPtr loop, UdpTunnelMux *mux)
+    : loop_(loop), mux_(mux), device_port_(0), tunnel_id_(0), is_ready_(false), kcp_(nullptr),
+      kcp_timer_id_(INVALID_TIMER_ID), kcp_timer_deadline_(0), kcp_input_pending_(false),
+      backpressure_("udp"), kcp_send_window_(0), kcp_min_rto_(0), kcp_recv_window_(0), receive_rate_(0),
+      recv_bytes_(0), pacer_timer_id_(INVALID_TIMER_ID), quality_snd_nxt_(0), quality_xmit_(0),
+      mtu_probe_timer_id_(INVALID_TIMER_ID), mtu_probe_id_(0), mtu_probe_acked_(0), mtu_probe_retries_(0),
+      mtu_probe_time_(0), kcp_mtu_limit_(0), udp_mtu_(0)
+{
+    data_recv_.init(AppConfig::getUdpTunnelRecvBufferSize(), AppConfig::getUdpTunnelRecvBufferMaxSize());
+    pacer_.init();
+}
 
 UdpTunnel::~UdpTunnel()
 {
     fini();
 }
 
-int UdpTunnel::init(const std::string &user_token, const std::string &stun_server_addr)
+int UdpTunnel::init()
 {
-#ifdef DEBUG_UDP_TUNNEL
-    LOG_DEBUG("UdpTunnel::init. user_token:" << user_token << " stun_server_addr:" << stun_server_addr);
-#endif  // DEBUG_UDP_TUNNEL
-    if (user_token.empty() || stun_server_addr.empty()) {
-        LOG_ERROR("UdpTunnel::init failed:invalid user_token."
-                  << "  user_token:" << user_token << " stun_server_addr:" << stun_server_addr);
-        return -1;
-    }
-    if ((user_token_ == user_token) && (stun_server_addr_ == stun_server_addr)) {
-        LOG_DEBUG("UdpTunnel::init. already init.");
-        return 0;
-    }
-    this->user_token_ = user_token;
-
-    std::string ip;
-    uint16_t port = 0;
-    if (0 != IPv4Utils::getIpAndPort(stun_server_addr, ip, port)) {
-        LOG_ERROR("UdpTunnel::init failed: invalid input. stun_server_addr:" << stun_server_addr);
-        return -1;
-    }
-    if (0 != sockaddr_set_ipport(&stun_server_sock_addr_, ip.c_str(), port)) {
-        LOG_ERROR("UdpTunnel::init failed:invalid stun_server_addr."
-                  << " stun_server_addr:" << stun_server_addr);
-        return -1;
-    }
-    this->stun_server_addr_ = stun_server_addr;
-
-    if (nullptr != channel) {
-        LOG_DEBUG("UdpTunnel::init. channel already init");
-        return 0;
-    }
-
-    if (0 != _initUdpClient(ip, port)) {
-        LOG_ERROR("UdpTunnel::init failed in _initUdpClient.");
-        return -1;
+    if (AppConfig::getUdpFecEnabled() && !fec_.isEnabled()) {
+        if (0 != fec_.init(AppConfig::getUdpFecDataShards(), AppConfig::getUdpFecMaxParityShards(), kcpMaxMtu,
+                           [this](const char *data, int length) { _sendUdpPacket(data, length); })) {
+            LOG_WARN("UdpTunnel::init. fec disabled.");
+        }
     }
 
     return 0;
@@ -78,9 +97,15 @@ int UdpTunnel::fini()
 #ifdef DEBUG_UDP_TUNNEL
     LOG_DEBUG("UdpTunnel::fini");
 #endif  // DEBUG_UDP_TUNNEL
-    _finiUdpClient();
-    _finiKcp();
-    return -1;
+    _resetP2P();
+    if (fec_.isEnabled()) {
+        UdpFec::Stats stats = fec_.getStats();
+        LOG_DEBUG("UdpTunnel::fini. fec data_sent:" << stats.data_sent << " parity_sent:"
+                  << stats.parity_sent << " data_recv:" << stats.data_recv << " parity_recv:" << stats.parity_recv
+                  << " recovered:" << stats.recovered << " unrecoverable:" << stats.unrecoverable);
+        fec_.fini();
+    }
+    return 0;
 }
 
 int UdpTunnel::startP2P(
@@ -92,10 +117,17 @@ int UdpTunnel::startP2P(
                   << " device_public_addr:" << device_public_addr);
         return -1;
     }
-    if ((order_id_ == order_id) && (device_token_ == device_ip_) && (device_addr_ == device_public_addr)) {
+    if ((order_id_ == order_id) && (device_token_ == device_token) && (device_addr_ == device_public_addr)) {
         LOG_DEBUG("UdpTunnel::startP2P. same input.");
         return 0;
     }
+    if (is_ready_ && (device_token_ == device_token) && (device_addr_ == device_public_addr)) {
+        // 同一设备的隧道还在，心跳维持着NAT映射和对端的kcp会话，不用重新打洞
+        LOG_DEBUG("UdpTunnel::startP2P. reuse tunnel. tunnel_id:" << tunnel_id_ << " order_id:" << order_id
+                  << " device_token:" << device_token);
+        order_id_ = order_id;
+        return 0;
+    }
 
     if (!order_id_.empty()) {
         _resetP2P();
@@ -155,7 +187,69 @@ int UdpTunnel::sendKcpPacket(const char *data, int length, ikcpcb *kcp)
 #ifdef DEBUG_UDP_TUNNEL
     LOG_DEBUG("UdpTunnel::sendKcpPacket. tunnel_id:" << tunnel_id_ << " length:" << length);
 #endif  // DEBUG_UDP_TUNNEL
-    this->sendto(data, length, &device_sock_addr_.sa);
+    if (congestion_ && KcpCongestion::hasData(data, length)) {
+        // 数据包按拥塞控制给出的速率发出，ack等控制包不排队
+        int ret = pacer_.send(data, length, gethrtime_us(), [this](const char *packet, int packet_length) {
+            _outputPacedPacket(packet, packet_length);
+        });
+        if (pacer_.queued() > 0) {
+            _schedulePacer(1);
+        }
+        return ret;
+    }
+
+    return _outputKcpPacket(data, length);
+}
+
+int UdpTunnel::_outputKcpPacket(const char *data, int length)
+{
+    if (fec_.isEnabled()) {
+        // 加上fec包头后通过_sendUdpPacket发出
+        return fec_.send(data, length, kcp_->current);
+    }
+
+    return _sendUdpPacket(data, length);
+}
+
+int UdpTunnel::_outputPacedPacket(const char *data, int length)
+{
+    if (congestion_) {
+        congestion_->onPacketSent(gettick_ms(), data, length, (0 == kcp_->nsnd_que));
+    }
+
+    return _outputKcpPacket(data, length);
+}
+
+int UdpTunnel::_sendUdpPacket(const char *data, int length)
+{
+    if ((udp_mtu_ > 0) && (length > udp_mtu_)) {
+        return _sendFragmentable(data, length);
+    }
+
+    // 启用批量收发时先缓存，ikcp_flush结束后由_updateKcp一次发出
+    return mux_->send(data, length, &device_sock_addr_);
+}
+
+int UdpTunnel::_sendFragmentable(const char *data, int length)
+{
+    // 先发出已缓存的包，保持发送顺序
+    mux_->flush();
+
+    int fd = mux_->getFd();
+    int old_value = 0;
+    if ((fd < 0) || (0 != getPmtuDiscover(fd, old_value))) {
+        // 不支持时不会探测，mtu也不会缩小
+        mux_->sendto(data, length, &device_sock_addr_.sa);
+        return 0;
+    }
+#if defined(IP_PMTUDISC_DONT)
+    // DONT：不设置DF，超过路径MTU时由IP分片
+    if (0 != setPmtuDiscover(fd, IP_PMTUDISC_DONT)) {
+        LOG_WARN("UdpTunnel::_sendFragmentable failed in setPmtuDiscover. errno:" << errno);
+    }
+#endif
+    mux_->sendto(data, length, &device_sock_addr_.sa);
+    setPmtuDiscover(fd, old_value);
     return 0;
 }
 
@@ -170,7 +264,7 @@ int UdpTunnel::onProxyData(uint32_t type, uint32_t proxy_id)
         return -1;
     }
 
-    return _kcpSend((char *)&header, sizeof(header));
+    return _sendProxyMsg(header, nullptr, 0);
 }
 
 int UdpTunnel::onProxyData(uint32_t type, uint32_t proxy_id, const std::string &data)
@@ -198,91 +292,170 @@ int UdpTunnel::onProxyData(uint32_t type, uint32_t proxy_id, const char *data, u
         return -1;
     }
 
-    if (0 != _kcpSend((char *)&header, sizeof(header))) {
-        LOG_ERROR("UdpTunnel::onProxyData failed in _kcpSend");
+    if (0 != _sendProxyMsg(header, data, length)) {
+        LOG_ERROR("UdpTunnel::onProxyData failed in _sendProxyMsg");
         return -1;
     }
-    if (0 != _kcpSend(data, length)) {
-        LOG_ERROR("UdpTunnel::onProxyData failed in _kcpSend");
-        return -1;
+    if (kTunnelMsgTypeTcpData == type) {
+        backpressure_.onSent(proxy_id, getSendBacklog());
     }
 
     return 0;
 }
 
-std::string UdpTunnel::getPublicAddr()
+size_t UdpTunnel::getSendBacklog() const
 {
-    return public_addr_;
+    size_t backlog = scheduler_.queued() + pacer_.queued();
+    if (nullptr != kcp_) {
+        // 已发出未确认的段受发送窗口限制，不计入
+        backlog += (size_t)kcp_->nsnd_que * kcp_->mss;
+    }
+    return backlog;
 }
 
-int UdpTunnel::_initUdpClient(const std::string &ip, uint16_t port)
+const TunnelQuality &UdpTunnel::updateQuality()
 {
-#ifdef DEBUG_UDP_TUNNEL
-    LOG_DEBUG("UdpTunnel::_initUdpClient. addr:" << ip << ":" << port);
-#endif  // DEBUG_UDP_TUNNEL
-    if (createsocket(port, ip.c_str()) < 0) {
-        LOG_ERROR("UdpTunnel::_initUdpClient failed in createsocket. ip:" << ip << " port:" << port);
-        return -1;
+    if (!is_ready_ || (nullptr == kcp_)) {
+        quality_.reset();
+        return quality_;
     }
 
-    this->onMessage = [this](const hv::SocketChannelPtr &channel, hv::Buffer *buf) { this->_onMessage(channel, buf); };
+    // 新发出的段和超时重传的段
+    IUINT32 sent = kcp_->snd_nxt - quality_snd_nxt_;
+    IUINT32 retransmitted = kcp_->xmit - quality_xmit_;
+    quality_snd_nxt_ = kcp_->snd_nxt;
+    quality_xmit_ = kcp_->xmit;
+    double loss = ((sent + retransmitted) > 0) ? (double)retransmitted / (sent + retransmitted) : -1;
 
-    const size_t kHeartbeatInterval = 10000;
-    this->loop()->setInterval(kHeartbeatInterval, [this](hv::TimerID timerID) {
-#ifdef DEBUG_UDP_TUNNEL
-        LOG_DEBUG("UdpTunnel::timeout. heartbeat. timer_id:" << timerID);
-#endif  // DEBUG_UDP_TUNNEL
-        _sendHeartbeatMsgToStunServer();
-        _sendHeartbeatMsg();
-    });
+    uint32_t wnd = std::min(kcp_->snd_wnd, kcp_->rmt_wnd);
+    if (0 == kcp_->nocwnd) {
+        wnd = std::min(wnd, kcp_->cwnd);
+    }
+    uint32_t rtt = (kcp_->rx_srtt > 0) ? (uint32_t)kcp_->rx_srtt : 0;
+    uint64_t bandwidth = (rtt > 0) ? ((uint64_t)wnd * kcp_->mss * 1000 / rtt) : 0;
+    quality_.update(rtt, loss, bandwidth);
+    return quality_;
+}
 
-    const size_t kPunchingInterval = 500;
-    this->loop()->setInterval(kPunchingInterval, [this](hv::TimerID timerID) {
+int UdpTunnel::setProxyPriority(uint32_t proxy_id, int priority)
+{
+    LOG_DEBUG("UdpTunnel::setProxyPriority. proxy_id:" << proxy_id << " priority:" << priority);
+    return scheduler_.setPriority(proxy_id, priority);
+}
+
+int UdpTunnel::removeProxy(uint32_t proxy_id)
+{
 #ifdef DEBUG_UDP_TUNNEL
-        LOG_DEBUG("UdpTunnel::timeout. punching. timer_id:" << timerID);
+    LOG_DEBUG("UdpTunnel::removeProxy. proxy_id:" << proxy_id);
 #endif  // DEBUG_UDP_TUNNEL
-        if (!is_ready_) {
-            _sendPunchingMsg();
-        }
-    });
+    return scheduler_.release(proxy_id);
+}
 
-    this->start();
-    _sendHeartbeatMsgToStunServer();
-    _sendHeartbeatMsgToStunServer();
+std::string UdpTunnel::getPublicAddr()
+{
+    return mux_->getPublicAddr();
+}
 
-    return 0;
+uint32_t UdpTunnel::getTunnelId() const
+{
+    return tunnel_id_;
 }
 
-int UdpTunnel::_finiUdpClient()
+const std::string &UdpTunnel::getDeviceToken() const
 {
-#ifdef DEBUG_UDP_TUNNEL
-    LOG_DEBUG("UdpTunnel::_finiUdpClient");
-#endif  // DEBUG_UDP_TUNNEL
-    this->stop();
-    this->closesocket();
-    return 0;
+    return device_token_;
+}
+
+int UdpTunnel::setReceiveRate(uint32_t rate)
+{
+    receive_rate_ = rate;
+    return _applyReceiveRate();
+}
+
+uint64_t UdpTunnel::getRecvBytes() const
+{
+    return recv_bytes_;
+}
+
+bool UdpTunnel::isPeer(const struct sockaddr *addr) const
+{
+    if ((nullptr == addr) || device_addr_.empty() || (addr->sa_family != device_sock_addr_.sa.sa_family)) {
+        return false;
+    }
+    if (AF_INET == addr->sa_family) {
+        auto *sin = (const struct sockaddr_in *)addr;
+        return (sin->sin_port == device_sock_addr_.sin.sin_port)
+               && (sin->sin_addr.s_addr == device_sock_addr_.sin.sin_addr.s_addr);
+    }
+    if (AF_INET6 == addr->sa_family) {
+        auto *sin6 = (const struct sockaddr_in6 *)addr;
+        return (sin6->sin6_port == device_sock_addr_.sin6.sin6_port)
+               && (0 == memcmp(&sin6->sin6_addr, &device_sock_addr_.sin6.sin6_addr, sizeof(sin6->sin6_addr)));
+    }
+    return false;
 }
 
-int UdpTunnel::_onMessage(const hv::SocketChannelPtr &channel, hv::Buffer *buf)
+int UdpTunnel::onBatchRecvDone()
+{
+    if (!kcp_input_pending_) {
+        return 0;
+    }
+
+    kcp_input_pending_ = false;
+    return _onKcpInput();
+}
+
+void UdpTunnel::onHeartbeatTimer()
+{
+    _sendHeartbeatMsg();
+    if (is_ready_ && (INVALID_TIMER_ID == mtu_probe_timer_id_)
+        && ((uint32_t)(gettick_ms() - mtu_probe_time_) >= kMtuProbeInterval)) {
+        // 路径可能已经变化，定期重新探测
+        _startMtuProbe();
+    }
+    if (0 == data_recv_.used()) {
+        // 空闲时释放接收缓存扩充出来的内存
+        data_recv_.shrink();
+    }
+}
+
+void UdpTunnel::onPunchingTimer()
+{
+    if (!is_ready_) {
+        _sendPunchingMsg();
+    }
+}
+
+void UdpTunnel::onPublicAddrChanged()
+{
+    if (is_ready_) {
+        // NAT映射变化，路径可能也变了
+        _startMtuProbe();
+    }
+}
+
+int UdpTunnel::onPacket(hv::Buffer *buf)
 {
     if ((nullptr == buf) || buf->isNull()) {
-        LOG_ERROR("UdpTunnel::_onMessage failed:invalid buf");
+        LOG_ERROR("UdpTunnel::onPacket failed:invalid buf");
         return 0;
     }
     if (buf->size() < kUdpTunnelMsgHeaderLength) {
-        LOG_ERROR("UdpTunnel::_onMessage failed: invalid msg. length:" << buf->size());
+        LOG_ERROR("UdpTunnel::onPacket failed: invalid msg. length:" << buf->size());
         return 0;
     }
 
     auto *header = (UdpTunnelMsgHeader *)buf->data();
+    if (kKcpConvReserved == header->tunnel_id) {
+        return _onFecMessage(buf);
+    }
     if (0 == header->tunnel_id) {
-        // LOG_DEBUG("UdpTunnel::_onMessage. udp. " << buf->size() << " bytes from " << channel->peeraddr());
         if (!header->isValid()) {
-            LOG_ERROR("UdpTunnel::_onMessage failed: invalid msg header." << header->toString());
+            LOG_ERROR("UdpTunnel::onPacket failed: invalid msg header." << header->toString());
             return 0;
         }
         if (buf->size() != (kUdpTunnelMsgHeaderLength + header->length)) {
-            LOG_ERROR("UdpTunnel::_onMessage failed: invalid header. " << header->toString());
+            LOG_ERROR("UdpTunnel::onPacket failed: invalid header. " << header->toString());
             return -1;
         }
 
@@ -298,44 +471,93 @@ int UdpTunnel::_onMessage(const hv::SocketChannelPtr &channel, hv::Buffer *buf)
                 }
             }
 
-            LOG_ERROR("UdpTunnel::_onMessage failed: invalid msg. " << header->toString());
+            LOG_ERROR("UdpTunnel::onPacket failed: invalid msg. " << header->toString());
             return -1;
         } else {
             // 消息头+数据
             std::string data = std::string((char *)buf->data() + kUdpTunnelMsgHeaderLength, header->length);
             switch (header->type) {
-                case kTunnelMsgTypeAddrProbe: {
-                    return _onMessageAddrProbe(*header, data);
-                }
-
                 case kTunnelMsgTypeTunnelInit: {
                     return _onMessageTunnelInit(*header, data);
                 }
+
+                case kTunnelMsgTypeHeartbeat: {
+                    return _onMessageMtuProbe(*header, data);
+                }
             }
 
-            LOG_ERROR("UdpTunnel::_onMessage failed:  invalid msg. " << header->toString());
+            LOG_ERROR("UdpTunnel::onPacket failed:  invalid msg. " << header->toString());
             return -1;
         }
     } else {
 #ifdef DEBUG_UDP_TUNNEL
-        LOG_DEBUG("UdpTunnel::_onMessage. kcp. " << buf->size() << " bytes from " << channel->peeraddr());
+        LOG_DEBUG("UdpTunnel::onPacket. kcp. " << buf->size() << " bytes from " << device_addr_);
 #endif  // DEBUG_UDP_TUNNEL
         // kcp packet
         uint32_t tunnel_id = header->tunnel_id;
         if (nullptr == kcp_) {
-            LOG_WARN("UdpTunnel::_onMessage. kcp connection not found. tunnel_id:" << tunnel_id);
+            LOG_WARN("UdpTunnel::onPacket. kcp connection not found. tunnel_id:" << tunnel_id);
             return -1;
         }
 
+        if (congestion_) {
+            congestion_->onPacketReceived(gettick_ms(), (const char *)buf->data(), (int)buf->size());
+        }
         ikcp_input(kcp_, (const char *)buf->data(), (int)buf->size());
-
-        if (_kcpRecv() <= 0) {
+        if (mux_->isBatchReceiving()) {
+            // 批量接收中，所有包输入kcp后再统一处理
+            kcp_input_pending_ = true;
             return 0;
         }
 
+        return _onKcpInput();
+    }
+}
+
+int UdpTunnel::_onKcpInput()
+{
+    int recv_bytes = _kcpRecv();
+
+    // 立即回ack，ikcp_recv后可能还需要通知对端窗口大小
+    _updateKcp();
+
+    // 接收缓存满时数据会留在kcp中，处理完已有消息后继续接收
+    while (recv_bytes > 0) {
         _onKcpDataRecv();
+        recv_bytes = _kcpRecv();
+    }
+    return 0;
+}
+
+int UdpTunnel::_onFecMessage(hv::Buffer *buf)
+{
+    if (!fec_.isEnabled()) {
+        LOG_WARN("UdpTunnel::_onFecMessage. fec not enabled, dropped. length:" << buf->size());
+        return -1;
+    }
+    if (nullptr == kcp_) {
+        LOG_WARN("UdpTunnel::_onFecMessage. kcp connection not found.");
+        return -1;
+    }
+
+    int inputs = 0;
+    fec_.input((const char *)buf->data(), (int)buf->size(), [this, &inputs](const char *data, int length) {
+        if (congestion_) {
+            congestion_->onPacketReceived(gettick_ms(), data, length);
+        }
+        ikcp_input(kcp_, data, length);
+        inputs++;
+    });
+    if (0 == inputs) {
+        // 校验包没有恢复出数据
+        return 0;
+    }
+    if (mux_->isBatchReceiving()) {
+        kcp_input_pending_ = true;
         return 0;
     }
+
+    return _onKcpInput();
 }
 
 int UdpTunnel::_onMessageTunnelInit(const UdpTunnelMsgHeader &header, const std::string &json)
@@ -362,6 +584,10 @@ int UdpTunnel::_onMessageTunnelInit(const UdpTunnelMsgHeader &header, const std:
         LOG_DEBUG("UdpTunnel is READY. tunnel_id:" << tunnel_id_);
         _initKcp();
         _startKcp();
+        _startMtuProbe();
+        if (onTunnelReady) {
+            onTunnelReady();
+        }
         return 0;
     } else if (tunnel_id_ == tunnel_id) {
         // 重复包，忽略
@@ -381,58 +607,22 @@ int UdpTunnel::_onMessageHeartbeat(const UdpTunnelMsgHeader &header)
     return 0;
 }
 
-int UdpTunnel::_onMessageAddrProbe(const UdpTunnelMsgHeader &header, const std::string &json)
+int UdpTunnel::_onMessageTcpData(uint32_t proxy_id, char *data, size_t length)
 {
-    if (json.empty()) {
-        LOG_ERROR("UdpTunnel::_onMessageAddrProbe failed:invalid input. " << json);
-        return -1;
-    }
-
-    JsonHelper json_helper;
-    if (0 != json_helper.init(json)) {
-        LOG_ERROR("UdpTunnel::_onMessageAddrProbe failed:invalid input. " << json);
-        return -1;
-    }
-
-    std::string peer_addr = json_helper.getJsonValue("peer_addr");
-    if (peer_addr.empty()) {
-        LOG_WARN("UdpTunnel::_onMessageAddrProbe failed:peer_addr not found. " << json);
-        return -1;
-    }
-    if (public_addr_ == peer_addr) {
-        // LOG_DEBUG("UdpTunnel::_onMessageAddrProbe. same addr. addr:" << public_addr_);
-        return 0;
-    }
-
-    // 检查设置是否正确
-    std::string ip;
-    uint16_t port = 0;
-    if (0 != IPv4Utils::getIpAndPort(peer_addr, ip, port)) {
-        LOG_WARN("UdpTunnel::_onMessageAddrProbe failed:peer_addr not found. " << json);
-        return -1;
-    }
-
-    public_addr_ = peer_addr;
-    LOG_INFO("UdpTunnel::_onMessageAddrProbe. public_addr:" << public_addr_);
-    return 0;
-}
-
-int UdpTunnel::_onMessageTcpData(const UdpTunnelMsgHeader &header, char *data)
-{
-    if ((nullptr == data) || (header.length <= 0)) {
-        LOG_ERROR("UdpTunnel::_onMessageTcpData failed:invalid input. length:" << header.length);
+    if ((nullptr == data) || (length <= 0)) {
+        LOG_ERROR("UdpTunnel::_onMessageTcpData failed:invalid input. proxy_id:" << proxy_id << " length:" << length);
         return -1;
     }
 #ifdef DEBUG_UDP_TUNNEL
-    LOG_DEBUG("UdpTunnel::_onMessageTcpData." << header.toString());
+    LOG_DEBUG("UdpTunnel::_onMessageTcpData. proxy_id:" << proxy_id << " length:" << length);
 #endif  // DEBUG_UDP_TUNNEL
 
     ClientNode *client_node = getClientNode();
     if (nullptr == client_node) {
         return -1;
     }
-    if (0 != client_node->getProxyServer().sendDataToProxy(header.proxy_id, data, header.length)) {
-        _sendTcpFinMsg(header.proxy_id);
+    if (0 != client_node->onTunnelData(kUdpTunnel, proxy_id, data, (uint32_t)length)) {
+        _sendTcpFinMsg(proxy_id);
     }
 
     return 0;
@@ -447,40 +637,24 @@ int UdpTunnel::_onMessageTcpFini(const UdpTunnelMsgHeader &header)
     if (nullptr == client_node) {
         return -1;
     }
-    if (0 != client_node->getProxyServer().delProxy(header.proxy_id)) {
-        LOG_ERROR("UdpTunnel::_onMessageTcpFini failed in ProxyServer::delProxy. proxy_id:" << header.proxy_id);
+    if (0 != client_node->onTunnelFini(kUdpTunnel, header.proxy_id)) {
+        LOG_ERROR("UdpTunnel::_onMessageTcpFini failed in ClientNode::onTunnelFini. proxy_id:" << header.proxy_id);
     }
+    // 对端已关闭，排队的数据不再发送
+    scheduler_.remove(header.proxy_id);
 
     return 0;
 }
 
-int UdpTunnel::_sendHeartbeatMsgToStunServer()
+int UdpTunnel::_onMessageTcpMigrate(uint32_t proxy_id, const TunnelStreamMigrate &migrate)
 {
-    if (user_token_.empty()) {
-        LOG_WARN("UdpTunnel::_sendHeartbeatMsgToStunServerg. invalid token.");
+    LOG_DEBUG("UdpTunnel::_onMessageTcpMigrate. proxy_id:" << proxy_id << " offset:" << migrate.offset);
+    ClientNode *client_node = getClientNode();
+    if (nullptr == client_node) {
         return -1;
     }
 
-    std::map<std::string, std::string> str_map;
-    str_map["user_token"] = user_token_;
-    std::string json = JsonMsg::getJsonString(str_map);
-
-    UdpTunnelMsgHeader header;
-    header.tunnel_id = 0;
-    header.type = kTunnelMsgTypeAddrProbe;
-    header.proxy_id = 0;
-    header.length = json.length();
-
-    char data[1024] = {0};
-    memcpy(data, (char *)&header, sizeof(header));
-    memcpy(data + sizeof(header), json.c_str(), json.length());
-    size_t length = sizeof(header) + json.length();
-
-    this->sendto(data, (int)length, &stun_server_sock_addr_.sa);
-#ifdef DEBUG_UDP_TUNNEL
-    LOG_DEBUG("UdpTunnel::_sendHeartbeatMsgToStunServer. length:" << length << " stun_server:" << stun_server_addr_);
-#endif  // DEBUG_UDP_TUNNEL
-    return 0;
+    return client_node->onTunnelMigrate(kUdpTunnel, proxy_id, migrate.offset);
 }
 
 int UdpTunnel::_sendHeartbeatMsg()
@@ -499,7 +673,7 @@ int UdpTunnel::_sendHeartbeatMsg()
     header.proxy_id = tunnel_id_;  // 特例
     header.length = 0;
 
-    this->sendto((void *)&header, sizeof(header), &device_sock_addr_.sa);
+    mux_->sendto((void *)&header, sizeof(header), &device_sock_addr_.sa);
     return 0;
 }
 
@@ -536,7 +710,7 @@ int UdpTunnel::_sendPunchingMsg()
 #ifdef DEBUG_UDP_TUNNEL
     LOG_DEBUG("UdpTunnel::_sendPunchingMsg. addr:" << device_addr_ << json);
 #endif  // #ifdef DEBUG_UDP_TUNNEL
-    this->sendto(data.c_str(), (int)data.length(), &device_sock_addr_.sa);
+    mux_->sendto(data.c_str(), (int)data.length(), &device_sock_addr_.sa);
     return 0;
 }
 
@@ -565,11 +739,30 @@ int UdpTunnel::_initKcp()
     }
 
     kcp_->output = kcp_send_callback;
-    ikcp_wndsize(kcp_, kcpSendWindowSize, kcpRecvWindowSize);
-
-    ikcp_nodelay(kcp_, kcpNodeNoDelay, kcpNodeInterval, kcpNodeResend, kcpNodeNc);
-    kcp_->rx_minrto = kcpRxMinRto;
-    kcp_->fastresend = 1;
+    KcpProfile profile = KcpProfile::getCurrent();
+    if (0 != profile.apply(kcp_)) {
+        LOG_ERROR("UdpTunnel::_initKcp failed in apply profile. " << profile.toString());
+        _finiKcp();
+        return -1;
+    }
+    // profile.mtu只是初始值，之后由路径MTU探测调整
+    kcp_mtu_limit_ = (profile.max_mtu > 0) ? profile.max_mtu : kcpMaxMtu;
+    udp_mtu_ = 0;
+    _setKcpMtu(profile.mtu);
+    LOG_DEBUG("UdpTunnel::_initKcp. " << profile.toString());
+
+    pacer_.reset();
+    pacer_.setRate(0);
+    kcp_send_window_ = profile.send_window;
+    kcp_min_rto_ = profile.min_rto;
+    kcp_recv_window_ = kcp_->rcv_wnd;
+    _applyReceiveRate();
+    congestion_ = KcpCongestion::create(profile.congestion, kcp_->mss);
+    if (congestion_) {
+        // 拥塞窗口通过snd_wnd生效，关闭kcp内置的拥塞控制
+        kcp_->nocwnd = 1;
+        _applyCongestion();
+    }
     kcp_->stream = 1;
 
     return 0;
@@ -577,6 +770,21 @@ int UdpTunnel::_initKcp()
 
 int UdpTunnel::_finiKcp()
 {
+    _stopKcpTimer();
+    _stopPacerTimer();
+    if (AppConfig::getUdpStreamSchedulerEnabled()) {
+        StreamScheduler::Stats stats = scheduler_.getStats();
+        LOG_DEBUG("UdpTunnel::_finiKcp. scheduler direct:" << stats.direct << " scheduled:" << stats.scheduled
+                  << " dropped:" << stats.dropped << " queued:" << scheduler_.queued()
+                  << " max_queued:" << stats.max_queued);
+    }
+    if (congestion_) {
+        UdpPacer::Stats stats = pacer_.getStats();
+        LOG_DEBUG("UdpTunnel::_finiKcp. " << congestion_->toString() << " direct:" << stats.direct
+                  << " paced:" << stats.paced << " dropped:" << stats.dropped << " max_queued:" << stats.max_queued);
+        congestion_.reset();
+    }
+    pacer_.reset();
     if (nullptr != kcp_) {
         LOG_DEBUG("UdpTunnel::_finiKcp");
         ikcp_release(kcp_);
@@ -593,18 +801,185 @@ int UdpTunnel::_startKcp()
         return 0;
     }
 
-    const size_t kKcpTimerInterval = 40;
-    this->loop()->setInterval(kKcpTimerInterval, [this](hv::TimerID timerID) {
-        if (is_ready_) {
-            ikcp_update(kcp_, gettick_ms());
-        } else {
-            hv::killTimer(timerID);
+    // 不再使用固定间隔的定时器，发送、接收后立即flush，其余时间按ikcp_check的结果调度
+    return _updateKcp(false);
+}
+
+int UdpTunnel::_updateKcp(bool force)
+{
+    if (nullptr == kcp_) {
+        return -1;
+    }
+
+    IUINT32 current = gettick_ms();
+    _applyCongestion();
+    _scheduleStreams();
+    if (force && kcp_->updated) {
+        kcp_->current = current;  // ikcp_flush使用current作为时间戳
+        ikcp_flush(kcp_);
+    } else {
+        ikcp_update(kcp_, current);
+    }
+    fec_.flush(current);
+    mux_->flush();
+    if (backpressure_.isPaused()) {
+        backpressure_.onDrained(getSendBacklog());
+    }
+
+    return _scheduleKcp(current);
+}
+
+int UdpTunnel::_scheduleKcp(IUINT32 current)
+{
+    if (!is_ready_ || (nullptr == kcp_)) {
+        return _stopKcpTimer();
+    }
+
+    if ((0 == kcp_->nsnd_que) && (0 == kcp_->nsnd_buf) && (0 == kcp_->ackcount) && (0 == kcp_->probe)) {
+        // 没有待发送、待确认的数据，不需要定时器
+        return _stopKcpTimer();
+    }
+
+    IUINT32 deadline = ikcp_check(kcp_, current);
+    if (INVALID_TIMER_ID != kcp_timer_id_) {
+        if ((IINT32)(deadline - kcp_timer_deadline_) >= 0) {
+            // 已有的定时器不晚于deadline
+            return 0;
+        }
+        _stopKcpTimer();
+    }
+
+    int timeout = (int)(deadline - current);
+    if (timeout <= 0) {
+        timeout = 1;  // htimer不支持0毫秒
+    }
+    kcp_timer_deadline_ = deadline;
+    kcp_timer_id_ = loop_->setTimeout(timeout, [this](hv::TimerID timerID) {
+        if (timerID != kcp_timer_id_) {
+            return;
+        }
+        kcp_timer_id_ = INVALID_TIMER_ID;
+        _updateKcp(false);
+    });
+
+    return 0;
+}
+
+int UdpTunnel::_stopKcpTimer()
+{
+    if (INVALID_TIMER_ID != kcp_timer_id_) {
+        loop_->killTimer(kcp_timer_id_);
+        kcp_timer_id_ = INVALID_TIMER_ID;
+    }
+
+    return 0;
+}
+
+int UdpTunnel::_setKcpMtu(int udp_mtu)
+{
+    if (nullptr == kcp_) {
+        return -1;
+    }
+
+    // 探测结果不超过KcpProfile::max_mtu，例如kMetered的1200
+    if ((kcp_mtu_limit_ > 0) && (udp_mtu > kcp_mtu_limit_)) {
+        udp_mtu = kcp_mtu_limit_;
+    }
+    int mtu = udp_mtu - (fec_.isEnabled() ? (int)UdpFec::kOverhead : 0);
+    if ((int)kcp_->mtu == mtu) {
+        udp_mtu_ = udp_mtu;
+        return 0;
+    }
+
+    LOG_INFO("UdpTunnel::_setKcpMtu. mtu:" << kcp_->mtu << " -> " << mtu
+             << " nsnd_buf:" << kcp_->nsnd_buf << " nsnd_que:" << kcp_->nsnd_que);
+    bool shrink = (mtu < (int)kcp_->mtu);
+    if (0 != ikcp_setmtu(kcp_, mtu)) {
+        LOG_ERROR("UdpTunnel::_setKcpMtu failed in ikcp_setmtu. mtu:" << mtu);
+        return -1;
+    }
+    udp_mtu_ = udp_mtu;
+    if (shrink && (0 != ikcp_resegment(kcp_))) {
+        // 没有切分的段超过udp_mtu_，同snd_buf中的段一样允许分片发出
+        LOG_WARN("UdpTunnel::_setKcpMtu failed in ikcp_resegment. nsnd_que:" << kcp_->nsnd_que);
+    }
+    if (congestion_) {
+        congestion_->setMss(kcp_->mss);
+    }
+
+    return 0;
+}
+
+int UdpTunnel::_applyCongestion()
+{
+    if (!congestion_ || (nullptr == kcp_)) {
+        return 0;
+    }
+
+    kcp_->snd_wnd = std::min<uint32_t>(kcp_send_window_, congestion_->getCwnd());
+    kcp_->rx_minrto = std::max<uint32_t>(kcp_min_rto_, congestion_->getMinRto());
+    pacer_.setRate(congestion_->getPacingRate());
+    return 0;
+}
+
+int UdpTunnel::_applyReceiveRate()
+{
+    if (nullptr == kcp_) {
+        return 0;
+    }
+    if (0 == receive_rate_) {
+        kcp_->rcv_wnd = kcp_recv_window_;
+        return 0;
+    }
+
+    // 窗口 = 速率 * rtt / mss，rtt还没有采样时按kDefaultRtt估算
+    const uint32_t kDefaultRtt = 100;
+    const uint32_t kMinReceiveWindow = 16;
+    uint32_t rtt = (kcp_->rx_srtt > 0) ? (uint32_t)kcp_->rx_srtt : kDefaultRtt;
+    uint64_t wnd = (uint64_t)receive_rate_ * rtt / 1000 / kcp_->mss;
+    wnd = std::max<uint64_t>(wnd, kMinReceiveWindow);
+    kcp_->rcv_wnd = (IUINT32)std::min<uint64_t>(wnd, kcp_recv_window_);
+    return 0;
+}
+
+int UdpTunnel::_schedulePacer(int timeout)
+{
+    if (INVALID_TIMER_ID != pacer_timer_id_) {
+        return 0;
+    }
+
+    pacer_timer_id_ = loop_->setTimeout(std::max(timeout, 1), [this](hv::TimerID timerID) {
+        if (timerID != pacer_timer_id_) {
+            return;
+        }
+        pacer_timer_id_ = INVALID_TIMER_ID;
+        if (nullptr == kcp_) {
+            return;
+        }
+
+        int wait = pacer_.drain(gethrtime_us(), [this](const char *data, int length) {
+            _outputPacedPacket(data, length);
+        });
+        fec_.flush(gettick_ms());
+        mux_->flush();
+        if (wait >= 0) {
+            _schedulePacer(wait);
         }
     });
 
     return 0;
 }
 
+int UdpTunnel::_stopPacerTimer()
+{
+    if (INVALID_TIMER_ID != pacer_timer_id_) {
+        loop_->killTimer(pacer_timer_id_);
+        pacer_timer_id_ = INVALID_TIMER_ID;
+    }
+
+    return 0;
+}
+
 int UdpTunnel::_kcpRecv()
 {
     if (nullptr == kcp_) {
@@ -612,16 +987,26 @@ int UdpTunnel::_kcpRecv()
         return -1;
     }
 
+    // ikcp_recv直接写入接收缓存，不经过临时缓存
     int recv_bytes = 0;
-    const size_t kBufferSize = 1024 * 100;
-    char data[kBufferSize] = {0};
     while (true) {
-        int ret = ikcp_recv(kcp_, data, kBufferSize);  // returns size, returns below zero for EAGAIN
+        int peek_size = ikcp_peeksize(kcp_);
+        if (peek_size <= 0) {
+            break;
+        }
+        if (0 != data_recv_.reserve(peek_size)) {
+            // 接收缓存已满，数据留在kcp中，处理完已有消息后再接收
+            LOG_WARN("UdpTunnel::_kcpRecv. recv buffer full. used:" << data_recv_.used());
+            break;
+        }
+
+        // returns size, returns below zero for EAGAIN
+        int ret = ikcp_recv(kcp_, data_recv_.write_ptr(), (int)data_recv_.available());
         if (ret <= 0) {
             break;
         }
 
-        data_recv_.write(data, ret);
+        data_recv_.commit(ret);
         recv_bytes += ret;
     }
 
@@ -651,69 +1036,175 @@ int UdpTunnel::_kcpSend(const char *data, const size_t length)
         return -1;
     }
 
-    return 0;
+    return _updateKcp();
 }
 
-int UdpTunnel::_onKcpDataRecv()
+int UdpTunnel::_kcpSend(const UdpTunnelMsgHeader &header, const char *data, size_t length)
 {
-    if (nullptr == kcp_) {
-        LOG_ERROR("UdpTunnel::_onKcpDataRecv failed: invalid kcp connection pointer.");
+    if ((nullptr == data) || (length <= 0)) {
+        LOG_ERROR("UdpTunnel::_kcpSend failed:invalid input. length:" << length);
         return -1;
     }
 
-    if (data_recv_.used() < kUdpTunnelMsgHeaderLength) {
-        // 数据量不够
-        return 0;
+    if (nullptr == kcp_) {
+        LOG_ERROR("UdpTunnel::_kcpSend failed:invalid kcp");
+        return -1;
     }
 
-    UdpTunnelMsgHeader header;
-    data_recv_.peek((char *)&header, kUdpTunnelMsgHeaderLength);
 #ifdef DEBUG_UDP_TUNNEL
-    LOG_DEBUG("UdpTunnel::_onKcpDataRecv. kcp. " << header.toString());
+    LOG_DEBUG("UdpTunnel::_kcpSend." << header.toString());
 #endif  // DEBUG_UDP_TUNNEL
+    ikcpiov vec[2];
+    vec[0].base = (const char *)&header;
+    vec[0].len = (int)kUdpTunnelMsgHeaderLength;
+    vec[1].base = data;
+    vec[1].len = (int)length;
+    if (ikcp_sendv(kcp_, vec, 2) < 0) {
+        LOG_ERROR("UdpTunnel::_kcpSend failed in ikcp_sendv");
+        return -1;
+    }
 
-    // 消息长度为0
-    if (header.length <= 0) {
-        data_recv_.advance(kUdpTunnelMsgHeaderLength);
-
-        switch (header.type) {
-            case kTunnelMsgTypeTcpFini: {
-                _onMessageTcpFini(header);
-                break;
-            }
+    return _updateKcp();
+}
 
-            default: {
-                LOG_ERROR("UdpTunnel::_onKcpDataRecv. invalid msg found." << header.toString());
-            }
+int UdpTunnel::_sendProxyMsg(const UdpTunnelMsgHeader &header, const char *data, size_t length)
+{
+    bool last = (kTunnelMsgTypeTcpFini == header.type);
+    if (!AppConfig::getUdpStreamSchedulerEnabled() || (kTunnelMsgTypeWindowUpdate == header.type)
+        || (scheduler_.empty() && (_getSendBudget() >= (kUdpTunnelMsgHeaderLength + length)))) {
+        // 没有排队的消息且kcp发送队列有空间，直接写入；窗口更新不受该连接排队的数据影响
+        int ret = (length > 0) ? _kcpSend(header, data, length) : _kcpSend((char *)&header, sizeof(header));
+        scheduler_.onDirectSend();
+        if (last) {
+            scheduler_.remove(header.proxy_id);
         }
+        return ret;
+    }
 
-        // 递归调用
-        return _onKcpDataRecv();
+    if (0 != scheduler_.push(header.proxy_id, (const char *)&header, sizeof(header), data, length, last)) {
+        LOG_ERROR("UdpTunnel::_sendProxyMsg failed in push." << header.toString());
+        return -1;
     }
 
-    // 消息长度不为0
-    if (data_recv_.used() < (kUdpTunnelMsgHeaderLength + header.length)) {
-        // 数据量不够
+    return _updateKcp();
+}
+
+size_t UdpTunnel::_getSendBudget() const
+{
+    if (nullptr == kcp_) {
+        return 0;
+    }
+
+    // 下次flush能发出的段数，再留一点余量，kcp发送队列中不积压数据
+    uint32_t wnd = std::min(kcp_->snd_wnd, kcp_->rmt_wnd);
+    if (0 == kcp_->nocwnd) {
+        wnd = std::min(wnd, kcp_->cwnd);
+    }
+    uint32_t inflight = kcp_->snd_nxt - kcp_->snd_una;
+    uint32_t segments = ((wnd > inflight) ? (wnd - inflight) : 0) + kSchedulerSlackSegments;
+    if (kcp_->nsnd_que >= segments) {
+        return 0;
+    }
+
+    return (size_t)(segments - kcp_->nsnd_que) * kcp_->mss;
+}
+
+int UdpTunnel::_scheduleStreams()
+{
+    if (scheduler_.empty() || (nullptr == kcp_)) {
+        return 0;
+    }
+
+    size_t budget = _getSendBudget();
+    if (budget <= 0) {
         return 0;
     }
 
-    //
-    char *data = data_recv_.read_ptr() + kUdpTunnelMsgHeaderLength;
-    switch (header.type) {
+    return scheduler_.schedule(budget, [this](const char *data, size_t length) {
+        return (ikcp_send(kcp_, data, (int)length) < 0) ? -1 : 0;
+    });
+}
+
+int UdpTunnel::_onKcpDataRecv()
+{
+    if (nullptr == kcp_) {
+        LOG_ERROR("UdpTunnel::_onKcpDataRecv failed: invalid kcp connection pointer.");
+        return -1;
+    }
 
-        case kTunnelMsgTypeTcpData: {
-            _onMessageTcpData(header, data);
+    // 一次处理接收缓存中所有完整的消息，同一proxy_id的连续数据合并后一次写给ProxyServer
+    const size_t kMaxBatchLength = 256 * 1024;
+    uint32_t batch_proxy_id = 0;
+    char *batch_data = nullptr;  // 只有一条消息时直接指向接收缓存，不拷贝
+    size_t batch_length = 0;
+    proxy_batch_.clear();
+
+    while (data_recv_.used() >= kUdpTunnelMsgHeaderLength) {
+        // 接收缓存在地址上连续，直接在缓存中解析消息
+        const auto *header = (const UdpTunnelMsgHeader *)data_recv_.read_ptr();
+        size_t msg_length = kUdpTunnelMsgHeaderLength + header->length;
+        if (data_recv_.used() < msg_length) {
+            // 数据量不够
             break;
         }
+#ifdef DEBUG_UDP_TUNNEL
+        LOG_DEBUG("UdpTunnel::_onKcpDataRecv. kcp. " << header->toString());
+#endif  // DEBUG_UDP_TUNNEL
+
+        char *data = data_recv_.read_ptr() + kUdpTunnelMsgHeaderLength;
+        if ((kTunnelMsgTypeTcpData == header->type) && (header->length > 0)) {
+            if ((batch_length > 0) &&
+                ((batch_proxy_id != header->proxy_id) || ((batch_length + header->length) > kMaxBatchLength))) {
+                _onMessageTcpData(batch_proxy_id, batch_data, batch_length);
+                batch_length = 0;
+                proxy_batch_.clear();
+            }
+
+            if (0 == batch_length) {
+                batch_proxy_id = header->proxy_id;
+                batch_data = data;
+            } else {
+                if (proxy_batch_.empty()) {
+                    proxy_batch_.append(batch_data, batch_length);
+                }
+                proxy_batch_.append(data, header->length);
+                batch_data = (char *)proxy_batch_.data();
+            }
+            batch_length += header->length;
+            recv_bytes_ += header->length;
 
-        default: {
-            LOG_ERROR("UdpTunnel::_processTunnelInput. invalid msg found." << header.toString());
+            data_recv_.advance(msg_length);
+            continue;
         }
+
+        // 其他消息，先把已合并的数据发出去，保证顺序
+        if (batch_length > 0) {
+            _onMessageTcpData(batch_proxy_id, batch_data, batch_length);
+            batch_length = 0;
+            proxy_batch_.clear();
+        }
+
+        if ((kTunnelMsgTypeTcpFini == header->type) && (0 == header->length)) {
+            _onMessageTcpFini(*header);
+        } else if ((kTunnelMsgTypeTcpMigrate == header->type) && (kTunnelStreamMigrateLength == header->length)) {
+            _onMessageTcpMigrate(header->proxy_id, *(const TunnelStreamMigrate *)data);
+        } else if ((kTunnelMsgTypeWindowUpdate == header->type) && (kTunnelWindowUpdateLength == header->length)) {
+            // 上传方向由ProxyBackpressure按隧道积压控制，对端的窗口更新暂不处理
+#ifdef DEBUG_UDP_TUNNEL
+            LOG_DEBUG("UdpTunnel::_onKcpDataRecv. window update ignored." << header->toString());
+#endif  // DEBUG_UDP_TUNNEL
+        } else {
+            LOG_ERROR("UdpTunnel::_onKcpDataRecv. invalid msg found." << header->toString());
+        }
+        data_recv_.advance(msg_length);
+    }
+
+    if (batch_length > 0) {
+        _onMessageTcpData(batch_proxy_id, batch_data, batch_length);
+        proxy_batch_.clear();
     }
-    data_recv_.advance(kUdpTunnelMsgHeaderLength + header.length);
 
-    // 递归调用
-    return _onKcpDataRecv();
+    return 0;
 }
 
 int UdpTunnel::_resetP2P()
@@ -726,8 +1217,151 @@ int UdpTunnel::_resetP2P()
     device_port_ = 0;
     tunnel_id_ = 0;
     is_ready_ = false;
+    _stopMtuProbe();
+    mtu_probe_time_ = 0;
+    fec_.reset();
     _finiKcp();
     data_recv_.reset();
+    scheduler_.reset();
+    backpressure_.reset();
+    quality_.reset();
+    quality_snd_nxt_ = 0;
+    quality_xmit_ = 0;
+    receive_rate_ = 0;
 
     return 0;
-}
\ No newline at end of file
+}
+int UdpTunnel::_startMtuProbe()
+{
+    if (!AppConfig::getUdpMtuProbeEnabled()) {
+        return 0;
+    }
+
+    _stopMtuProbe();
+    mtu_probe_retries_ = 0;
+    return _sendMtuProbe();
+}
+
+int UdpTunnel::_sendMtuProbe()
+{
+    if (!is_ready_ || device_addr_.empty()) {
+        return -1;
+    }
+
+    int fd = mux_->getFd();
+    int old_value = 0;
+    if ((fd < 0) || (0 != getPmtuDiscover(fd, old_value))) {
+        LOG_DEBUG("UdpTunnel::_sendMtuProbe. not supported on this platform.");
+        return -1;
+    }
+#if defined(IP_PMTUDISC_PROBE)
+    // PROBE：设置DF且忽略内核缓存的路径MTU，超过路径MTU的包被丢弃而不是分片
+    if (0 != setPmtuDiscover(fd, IP_PMTUDISC_PROBE)) {
+        LOG_WARN("UdpTunnel::_sendMtuProbe failed in setPmtuDiscover. errno:" << errno);
+        return -1;
+    }
+#endif
+
+    mtu_probe_id_++;
+    mtu_probe_acked_ = 0;
+    std::string packet(kMtuProbeSizes[0], '\0');
+    for (uint16_t size : kMtuProbeSizes) {
+        auto *header = (UdpTunnelMsgHeader *)&packet[0];
+        header->tunnel_id = 0;
+        header->type = kTunnelMsgTypeHeartbeat;
+        header->proxy_id = tunnel_id_;  // 与心跳一致
+        header->length = size - kUdpTunnelMsgHeaderLength;
+
+        auto *probe = (UdpMtuProbe *)&packet[kUdpTunnelMsgHeaderLength];
+        probe->probe_id = mtu_probe_id_;
+        probe->size = size;
+        probe->reply = 0;
+        mux_->sendto(packet.data(), size, &device_sock_addr_.sa);
+    }
+    setPmtuDiscover(fd, old_value);
+
+    mtu_probe_timer_id_ = loop_->setTimeout(kMtuProbeTimeout, [this](hv::TimerID timerID) {
+        if (timerID != mtu_probe_timer_id_) {
+            return;
+        }
+        mtu_probe_timer_id_ = INVALID_TIMER_ID;
+        _finishMtuProbe();
+    });
+
+    return 0;
+}
+
+int UdpTunnel::_finishMtuProbe()
+{
+    _stopMtuProbe();
+    if (0 == mtu_probe_acked_) {
+        if (++mtu_probe_retries_ < kMtuProbeRetries) {
+            return _sendMtuProbe();
+        }
+        // 对端不支持或者丢包严重，保持原来的mtu，下个周期再探测
+        LOG_WARN("UdpTunnel::_finishMtuProbe. no reply. probe_id:" << mtu_probe_id_);
+        mtu_probe_time_ = gettick_ms();
+        return -1;
+    }
+
+    mtu_probe_time_ = gettick_ms();
+    return _setKcpMtu(mtu_probe_acked_);
+}
+
+int UdpTunnel::_stopMtuProbe()
+{
+    if (INVALID_TIMER_ID != mtu_probe_timer_id_) {
+        loop_->killTimer(mtu_probe_timer_id_);
+        mtu_probe_timer_id_ = INVALID_TIMER_ID;
+    }
+
+    return 0;
+}
+
+int UdpTunnel::_onMessageMtuProbe(const UdpTunnelMsgHeader &header, const std::string &data)
+{
+    if (data.size() < kUdpMtuProbeLength) {
+        LOG_ERROR("UdpTunnel::_onMessageMtuProbe failed:invalid input. " << header.toString());
+        return -1;
+    }
+
+    UdpMtuProbe probe;
+    memcpy(&probe, data.data(), kUdpMtuProbeLength);
+    if (0 == probe.reply) {
+        // 对端的探测，只回复探测头，不补齐
+        if (device_addr_.empty()) {
+            return 0;
+        }
+        if (probe.size != (kUdpTunnelMsgHeaderLength + header.length)) {
+            LOG_ERROR("UdpTunnel::_onMessageMtuProbe failed:invalid size. size:" << probe.size << header.toString());
+            return -1;
+        }
+
+        char packet[kUdpTunnelMsgHeaderLength + kUdpMtuProbeLength];
+        UdpTunnelMsgHeader reply_header(0, kTunnelMsgTypeHeartbeat, tunnel_id_, kUdpMtuProbeLength);
+        probe.reply = 1;
+        memcpy(packet, &reply_header, kUdpTunnelMsgHeaderLength);
+        memcpy(packet + kUdpTunnelMsgHeaderLength, &probe, kUdpMtuProbeLength);
+        mux_->sendto(packet, sizeof(packet), &device_sock_addr_.sa);
+        return 0;
+    }
+
+    if ((INVALID_TIMER_ID == mtu_probe_timer_id_) || (probe.probe_id != mtu_probe_id_)) {
+        // 过期的响应
+        return 0;
+    }
+    if ((probe.size > kMtuProbeSizes[0]) || (probe.size < kMtuProbeSizes[kMtuProbeNum - 1])) {
+        LOG_ERROR("UdpTunnel::_onMessageMtuProbe failed:invalid size. size:" << probe.size);
+        return -1;
+    }
+
+    if (probe.size > mtu_probe_acked_) {
+        mtu_probe_acked_ = probe.size;
+    }
+    if (mtu_probe_acked_ == kMtuProbeSizes[0]) {
+        // 最大的探测包已确认，不需要再等
+        return _finishMtuProbe();
+    }
+
+    return 0;
+}
@@ -2,20 +2,36 @@
 #define SRC_UDP_TUNNEL_H_
 
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
-#include "hv/UdpClient.h"
+#include <vector>
+#include "hv/EventLoop.h"
+#include "hv/Buffer.h"
 #include "hv/hsocket.h"
 #include "TunnelMsgHeader.h"
 #include "kcp/ikcp.h"
-#include "x/DataBuffer.h"
-
-class UdpTunnel : public hv::UdpClient {
+#include "x/RingBuffer.h"
+#include "UdpFec.h"
+#include "UdpPacer.h"
+#include "KcpCongestion.h"
+#include "StreamScheduler.h"
+#include "ProxyBackpressure.h"
+#include "TunnelQuality.h"
+
+class UdpTunnelMux;
+
+/**
+ * @brief 与一台设备的p2p隧道：打洞、kcp会话和代理连接的收发
+ * @note 不占用socket，通过UdpTunnelMux收发，多条隧道共用一个udp socket；仅在loop线程中使用
+ */
+class UdpTunnel {
 public:
-    explicit UdpTunnel(hv::EventLoopPtr loop);
+    UdpTunnel(hv::EventLoopPtr loop, UdpTunnelMux *mux);
 
     ~UdpTunnel();
 
-    int init(const std::string &user_token, const std::string &stun_server_addr);
+    int init();
 
     int fini();
 
@@ -33,31 +49,152 @@ public:
 
     int onProxyData(uint32_t type, uint32_t proxy_id, const char *data, uint32_t length);
 
+    /**
+     * @brief 设置代理连接的发送优先级
+     * @param priority StreamScheduler::Priority
+     * @return 0：成功；-1：失败；
+     */
+    int setProxyPriority(uint32_t proxy_id, int priority);
+
+    /**
+     * @brief 本端代理连接已关闭，排队的数据发完后删除调度状态
+     * @note 隧道在UdpTunnelPool中保温复用，不删除的话调度状态会一直累积
+     */
+    int removeProxy(uint32_t proxy_id);
+
+    /**
+     * @brief 发送积压的字节数：kcp发送队列中未发出的段、调度队列和pacing队列
+     */
+    size_t getSendBacklog() const;
+
+    /**
+     * @brief 用kcp的rx_srtt、超时重传次数和发送窗口采样一次隧道质量，没有READY时清空
+     * @note ClientNode每秒调用一次
+     */
+    const TunnelQuality &updateQuality();
+
     /**
      * @brief 获取UDP出口地址
      * @return
      */
     std::string getPublicAddr();
 
+    /**
+     * @brief 设备分配的tunnel_id，p2p没有建立时为0
+     */
+    uint32_t getTunnelId() const;
+
+    /**
+     * @brief 当前打洞的设备，没有startP2P或已经stopP2P时为空
+     */
+    const std::string &getDeviceToken() const;
+
+    /**
+     * @brief 限制下行速率：按rx_srtt把速率换算成kcp接收窗口，对端按通告的窗口发送
+     * @param rate 字节/秒；0表示恢复KcpProfile中的接收窗口
+     * @note SessionBandwidth分配多设备会话的下行带宽，ClientNode每秒调用一次
+     */
+    int setReceiveRate(uint32_t rate);
+
+    /**
+     * @brief 累计收到的代理数据字节数，不包括消息头
+     */
+    uint64_t getRecvBytes() const;
+
+    /**
+     * @brief 来源地址是否为当前打洞的设备
+     */
+    bool isPeer(const struct sockaddr *addr) const;
+
+    /**
+     * @brief 处理UdpTunnelMux分给该隧道的包
+     */
+    int onPacket(hv::Buffer *buf);
+
+    /**
+     * @brief UdpTunnelMux批量接收结束，处理期间输入kcp的包
+     */
+    int onBatchRecvDone();
+
+    /**
+     * @brief UdpTunnelMux每10秒调用：向设备发心跳维持NAT映射，定期重新探测路径MTU，空闲时释放接收缓存
+     */
+    void onHeartbeatTimer();
+
+    /**
+     * @brief UdpTunnelMux每500毫秒调用，没有READY时发打洞消息
+     */
+    void onPunchingTimer();
+
+    /**
+     * @brief 共用socket的出口地址变化
+     */
+    void onPublicAddrChanged();
+
+    /**
+     * @brief 打洞成功、kcp会话建立后回调，ClientNode用于把中继上的连接迁移过来
+     */
+    std::function<void()> onTunnelReady;
+
 private:
 
-    int _initUdpClient(const std::string &ip, uint16_t port);
+    /**
+     * @brief 发出一个udp包，启用批量收发时先缓存；超过udp_mtu_时由_sendFragmentable发出
+     */
+    int _sendUdpPacket(const char *data, int length);
+
+    /**
+     * @brief 清除DF后直接发出，超过路径MTU的包由IP分片送达
+     * @note 用于mtu缩小前切分、还没有被确认的段，否则重传的包一直被丢弃，连接卡住
+     */
+    int _sendFragmentable(const char *data, int length);
+
+    /**
+     * @brief 发出一个kcp包（经过pacing之后），启用fec时加上fec包头
+     */
+    int _outputKcpPacket(const char *data, int length);
+
+    /**
+     * @brief pacing队列发出一个数据包，此时才计入拥塞控制的在途数据
+     */
+    int _outputPacedPacket(const char *data, int length);
+
+    /**
+     * @brief 按拥塞控制的结果设置kcp发送窗口、最小rto和发送速率
+     */
+    int _applyCongestion();
+
+    /**
+     * @brief 按receive_rate_设置kcp接收窗口
+     */
+    int _applyReceiveRate();
 
-    int _finiUdpClient();
+    /**
+     * @brief 设置pacing定时器，到期后发出排队的包
+     */
+    int _schedulePacer(int timeout);
 
-    int _onMessage(const hv::SocketChannelPtr &channel, hv::Buffer *buf);
+    int _stopPacerTimer();
+
+    /**
+     * @brief ikcp_input之后调用：接收数据、回ack并分发消息
+     */
+    int _onKcpInput();
+
+    /**
+     * @brief 处理fec包：数据包和恢复出的包输入kcp
+     */
+    int _onFecMessage(hv::Buffer *buf);
 
     int _onMessageTunnelInit(const UdpTunnelMsgHeader &header, const std::string &json);
 
     int _onMessageHeartbeat(const UdpTunnelMsgHeader &header);
 
-    int _onMessageAddrProbe(const UdpTunnelMsgHeader &header, const std::string &json);
-
-    int _onMessageTcpData(const UdpTunnelMsgHeader &header, char *data);
+    int _onMessageTcpData(uint32_t proxy_id, char *data, size_t length);
 
     int _onMessageTcpFini(const UdpTunnelMsgHeader &header);
 
-    int _sendHeartbeatMsgToStunServer();
+    int _onMessageTcpMigrate(uint32_t proxy_id, const TunnelStreamMigrate &migrate);
 
     int _sendHeartbeatMsg();
 
@@ -71,19 +208,74 @@ private:
 
     int _startKcp();
 
+    /**
+     * @brief 立即flush kcp，并根据ikcp_check重新设置定时器
+     * @param force 是否强制flush，定时器到期时为false，由ikcp_update决定是否flush
+     */
+    int _updateKcp(bool force = true);
+
+    /**
+     * @brief 按ikcp_check返回的时间设置一次性定时器，无待发送数据时不设置
+     */
+    int _scheduleKcp(IUINT32 current);
+
+    int _stopKcpTimer();
+
+    /**
+     * @brief 按udp载荷长度设置kcp的mtu，启用fec时扣除fec包头
+     * @note 不超过kcp_mtu_limit_；缩小时立即生效，snd_queue中的段按新的mss重新切分，
+     *       snd_buf中已发出的段序号已确定，仍按原长度重传，由_sendUdpPacket允许分片发出
+     */
+    int _setKcpMtu(int udp_mtu);
+
     int _kcpRecv();
 
     int _kcpSend(const char *data,  size_t length);
 
+    /**
+     * @brief 消息头和数据一次写入kcp，避免拆成两个kcp消息
+     */
+    int _kcpSend(const UdpTunnelMsgHeader &header, const char *data, size_t length);
+
+    /**
+     * @brief 发送代理连接的消息：没有排队时直接写入kcp，否则进入StreamScheduler排队
+     */
+    int _sendProxyMsg(const UdpTunnelMsgHeader &header, const char *data, size_t length);
+
+    /**
+     * @brief kcp发送队列还能写入的字节数
+     */
+    size_t _getSendBudget() const;
+
+    /**
+     * @brief 按优先级把排队的消息写入kcp，在每次flush之前调用
+     */
+    int _scheduleStreams();
+
+    /**
+     * @brief 处理接收缓存中所有完整的消息，同一proxy_id的连续数据合并后一次写出
+     */
     int _onKcpDataRecv();
 
     int _resetP2P();
 
+    /**
+     * @brief 开始路径MTU探测：同时发出多个不同长度、不允许分片的心跳包，超时后按对端确认的最大长度设置kcp的mtu
+     * @note 隧道READY、本端出口地址变化后以及每隔kMtuProbeInterval调用
+     */
+    int _startMtuProbe();
+
+    int _sendMtuProbe();
+
+    int _finishMtuProbe();
+
+    int _stopMtuProbe();
+
+    int _onMessageMtuProbe(const UdpTunnelMsgHeader &header, const std::string &data);
+
 private:
-    //
-    std::string user_token_;
-    std::string stun_server_addr_;
-    sockaddr_u stun_server_sock_addr_;
+    hv::EventLoopPtr loop_;
+    UdpTunnelMux *mux_;
 
     //
     std::string order_id_;
@@ -93,16 +285,48 @@ private:
     uint16_t device_port_;
     sockaddr_u device_sock_addr_;
 
-    //
-    std::string public_addr_;
-
     //
     uint32_t tunnel_id_;
     volatile bool is_ready_;
 
     //
     ikcpcb *kcp_;
-    DataBuffer data_recv_;  //接数据缓存，不包括kcp包头
+    hv::TimerID kcp_timer_id_;      // kcp一次性定时器，未设置时为INVALID_TIMER_ID
+    IUINT32 kcp_timer_deadline_;    // kcp定时器到期时间
+    RingBuffer data_recv_;  //接数据缓存，不包括kcp包头，仅在loop线程中使用
+    std::string proxy_batch_;   //合并同一proxy_id的连续数据
+
+    //
+    bool kcp_input_pending_;    //UdpTunnelMux批量接收期间有kcp包输入
+    UdpFec fec_;                        //前向纠错，默认不启用
+    StreamScheduler scheduler_;         //代理连接的发送调度
+    ProxyBackpressure backpressure_;    //发送积压时暂停读取本地连接
+
+    //拥塞控制
+    std::unique_ptr<KcpCongestion> congestion_;     //KcpProfile::congestion为kNone时为空
+    uint32_t kcp_send_window_;                      //KcpProfile中的发送窗口，拥塞窗口的上限
+    uint32_t kcp_min_rto_;                          //KcpProfile中的最小rto
+    uint32_t kcp_recv_window_;                      //KcpProfile中的接收窗口，限速窗口的上限
+    uint32_t receive_rate_;                         //下行限速，字节/秒，0表示不限
+    uint64_t recv_bytes_;                           //累计收到的代理数据字节数
+    UdpPacer pacer_;
+    hv::TimerID pacer_timer_id_;
+
+    //隧道质量
+    TunnelQuality quality_;
+    IUINT32 quality_snd_nxt_;           //上次采样时的snd_nxt
+    IUINT32 quality_xmit_;              //上次采样时的超时重传次数
+
+    //路径MTU探测
+    hv::TimerID mtu_probe_timer_id_;    //探测超时定时器，未探测时为INVALID_TIMER_ID
+    uint32_t mtu_probe_id_;             //当前探测轮次
+    uint16_t mtu_probe_acked_;          //本轮对端确认的最大长度
+    int mtu_probe_retries_;             //本轮没有任何确认时的重试次数
+    uint32_t mtu_probe_time_;           //上次探测完成的时间，gettick_ms
+    int kcp_mtu_limit_;                 //探测结果的上限，KcpProfile::max_mtu，未指定时为kcpMaxMtu
+    int udp_mtu_;                       //当前的udp载荷长度，超过的包是缩小前切分的段，0表示不限
+
+    static const uint32_t kSchedulerSlackSegments = 8;  //kcp发送队列中超出发送窗口的段数
 };
 
 #endif //SRC_UDP_TUNNEL_H_
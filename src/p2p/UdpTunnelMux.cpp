@@ -0,0 +1,359 @@
+#include "UdpTunnelMux.h"
+#include <algorithm>
+#include <map>
+#include "x/IPv4Utils.h"
+#include "x/JsonHelper.h"
+#include "x/Logger.h"
+#include "AppConfig.h"
+#include "JsonMsg.h"
+#include "UdpTunnel.h"
+
+// #define DEBUG_UDP_TUNNEL_MUX
+
+UdpTunnelMux::UdpTunnelMux(hv::EventLoopPtr loop) : hv::UdpClient(loop), batch_recv_(false)
+{}
+
+UdpTunnelMux::~UdpTunnelMux()
+{
+    fini();
+}
+
+int UdpTunnelMux::init(const std::string &user_token, const std::string &stun_server_addr)
+{
+#ifdef DEBUG_UDP_TUNNEL_MUX
+    LOG_DEBUG("UdpTunnelMux::init. user_token:" << user_token << " stun_server_addr:" << stun_server_addr);
+#endif  // DEBUG_UDP_TUNNEL_MUX
+    if (user_token.empty() || stun_server_addr.empty()) {
+        LOG_ERROR("UdpTunnelMux::init failed:invalid user_token."
+                  << "  user_token:" << user_token << " stun_server_addr:" << stun_server_addr);
+        return -1;
+    }
+    if ((user_token_ == user_token) && (stun_server_addr_ == stun_server_addr)) {
+        LOG_DEBUG("UdpTunnelMux::init. already init.");
+        return 0;
+    }
+    this->user_token_ = user_token;
+
+    std::string ip;
+    uint16_t port = 0;
+    if (0 != IPv4Utils::getIpAndPort(stun_server_addr, ip, port)) {
+        LOG_ERROR("UdpTunnelMux::init failed: invalid input. stun_server_addr:" << stun_server_addr);
+        return -1;
+    }
+    if (0 != sockaddr_set_ipport(&stun_server_sock_addr_, ip.c_str(), port)) {
+        LOG_ERROR("UdpTunnelMux::init failed:invalid stun_server_addr."
+                  << " stun_server_addr:" << stun_server_addr);
+        return -1;
+    }
+    this->stun_server_addr_ = stun_server_addr;
+
+    if (nullptr != channel) {
+        LOG_DEBUG("UdpTunnelMux::init. channel already init");
+        return 0;
+    }
+
+    if (0 != _initUdpClient(ip, port)) {
+        LOG_ERROR("UdpTunnelMux::init failed in _initUdpClient.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int UdpTunnelMux::fini()
+{
+#ifdef DEBUG_UDP_TUNNEL_MUX
+    LOG_DEBUG("UdpTunnelMux::fini");
+#endif  // DEBUG_UDP_TUNNEL_MUX
+    _finiUdpClient();
+    user_token_.clear();
+    stun_server_addr_.clear();
+    public_addr_.clear();
+    return 0;
+}
+
+void UdpTunnelMux::attach(UdpTunnel *tunnel)
+{
+    if ((nullptr != tunnel) && (tunnels_.end() == std::find(tunnels_.begin(), tunnels_.end(), tunnel))) {
+        tunnels_.push_back(tunnel);
+    }
+}
+
+void UdpTunnelMux::detach(UdpTunnel *tunnel)
+{
+    tunnels_.erase(std::remove(tunnels_.begin(), tunnels_.end(), tunnel), tunnels_.end());
+}
+
+int UdpTunnelMux::send(const char *data, int length, sockaddr_u *addr)
+{
+    if (batch_io_.isEnabled()) {
+        return batch_io_.append(data, length, &addr->sa, SOCKADDR_LEN(addr));
+    }
+
+    this->sendto(data, length, &addr->sa);
+    return 0;
+}
+
+int UdpTunnelMux::flush()
+{
+    return batch_io_.flush();
+}
+
+bool UdpTunnelMux::isBatchReceiving() const
+{
+    return batch_recv_;
+}
+
+int UdpTunnelMux::getFd()
+{
+    return (nullptr == channel) ? -1 : channel->fd();
+}
+
+const std::string &UdpTunnelMux::getPublicAddr() const
+{
+    return public_addr_;
+}
+
+int UdpTunnelMux::_initUdpClient(const std::string &ip, uint16_t port)
+{
+#ifdef DEBUG_UDP_TUNNEL_MUX
+    LOG_DEBUG("UdpTunnelMux::_initUdpClient. addr:" << ip << ":" << port);
+#endif  // DEBUG_UDP_TUNNEL_MUX
+    if (createsocket(port, ip.c_str()) < 0) {
+        LOG_ERROR("UdpTunnelMux::_initUdpClient failed in createsocket. ip:" << ip << " port:" << port);
+        return -1;
+    }
+
+    if (AppConfig::getUdpBatchIoEnabled() && UdpBatchIo::isSupported()) {
+        if (0 != batch_io_.init(this->channel->fd())) {
+            LOG_WARN("UdpTunnelMux::_initUdpClient. batch io disabled.");
+        } else if (AppConfig::getUdpOffloadEnabled()
+                   && (0 == batch_io_.enableOffload(true, !AppConfig::getUdpFecEnabled()))
+                   && batch_io_.isGroEnabled()) {
+            // libhv读第一个包时也可能收到GRO合并的包，读缓存需要能放下整个合并包，否则会被截断，
+            // 合并包在_onFirstMessage中拆分
+            gro_read_buf_.resize(UdpBatchIo::kGroPacketSize);
+            this->channel->setReadBuf(gro_read_buf_.data(), gro_read_buf_.size());
+        }
+    }
+
+    this->onMessage = [this](const hv::SocketChannelPtr &channel, hv::Buffer *buf) {
+        const struct sockaddr *peer_addr = hio_peeraddr(channel->io());
+        if (!batch_io_.isEnabled()) {
+            this->_onMessage(peer_addr, buf);
+            return;
+        }
+
+        // libhv读到第一个包后，用recvmmsg读完socket中剩余的包，kcp包全部输入后再统一ikcp_recv和flush
+        batch_recv_ = true;
+        this->_onFirstMessage(peer_addr, buf);
+        batch_io_.recv([this](char *data, int length, const struct sockaddr *addr) {
+            hv::Buffer packet(data, length);
+            this->_onMessage(addr, &packet);
+        });
+        batch_recv_ = false;
+
+        for (auto *tunnel : tunnels_) {
+            tunnel->onBatchRecvDone();
+        }
+    };
+
+    // 所有隧道共用一份定时器
+    const size_t kHeartbeatInterval = 10000;
+    this->loop()->setInterval(kHeartbeatInterval, [this](hv::TimerID timerID) {
+#ifdef DEBUG_UDP_TUNNEL_MUX
+        LOG_DEBUG("UdpTunnelMux::timeout. heartbeat. timer_id:" << timerID);
+#endif  // DEBUG_UDP_TUNNEL_MUX
+        _sendHeartbeatMsgToStunServer();
+        for (auto *tunnel : tunnels_) {
+            tunnel->onHeartbeatTimer();
+        }
+    });
+
+    const size_t kPunchingInterval = 500;
+    this->loop()->setInterval(kPunchingInterval, [this](hv::TimerID timerID) {
+#ifdef DEBUG_UDP_TUNNEL_MUX
+        LOG_DEBUG("UdpTunnelMux::timeout. punching. timer_id:" << timerID);
+#endif  // DEBUG_UDP_TUNNEL_MUX
+        for (auto *tunnel : tunnels_) {
+            tunnel->onPunchingTimer();
+        }
+    });
+
+    this->start();
+    _sendHeartbeatMsgToStunServer();
+    _sendHeartbeatMsgToStunServer();
+
+    return 0;
+}
+
+int UdpTunnelMux::_finiUdpClient()
+{
+#ifdef DEBUG_UDP_TUNNEL_MUX
+    LOG_DEBUG("UdpTunnelMux::_finiUdpClient");
+#endif  // DEBUG_UDP_TUNNEL_MUX
+    batch_io_.fini();
+    this->stop();
+    this->closesocket();
+    return 0;
+}
+
+int UdpTunnelMux::_onFirstMessage(const struct sockaddr *addr, hv::Buffer *buf)
+{
+    if (!batch_io_.isGroEnabled() || (nullptr == buf) || buf->isNull()
+        || (buf->size() < kUdpTunnelMsgHeaderLength)) {
+        return _onMessage(addr, buf);
+    }
+
+    auto *header = (const UdpTunnelMsgHeader *)buf->data();
+    size_t segment_size = kUdpTunnelMsgHeaderLength + header->length;
+    if ((0 != header->tunnel_id) || !header->isValid() || (segment_size >= buf->size())) {
+        return _onMessage(addr, buf);
+    }
+
+    // 长度相同的多个tunnel消息，例如成对发出的打洞消息和心跳
+    char *data = (char *)buf->data();
+    size_t length = buf->size();
+    for (size_t offset = 0; offset < length; offset += segment_size) {
+        size_t segment = ((length - offset) < segment_size) ? (length - offset) : segment_size;
+        hv::Buffer packet(data + offset, segment);
+        _onMessage(addr, &packet);
+    }
+    return 0;
+}
+
+int UdpTunnelMux::_onMessage(const struct sockaddr *addr, hv::Buffer *buf)
+{
+    if ((nullptr == buf) || buf->isNull()) {
+        LOG_ERROR("UdpTunnelMux::_onMessage failed:invalid buf");
+        return 0;
+    }
+    if (buf->size() < kUdpTunnelMsgHeaderLength) {
+        LOG_ERROR("UdpTunnelMux::_onMessage failed: invalid msg. length:" << buf->size());
+        return 0;
+    }
+
+    auto *header = (const UdpTunnelMsgHeader *)buf->data();
+    if ((0 == header->tunnel_id) && (kTunnelMsgTypeAddrProbe == header->type)) {
+        // STUN服务器的回复，出口地址属于socket
+        if (!header->isValid() || (buf->size() != (kUdpTunnelMsgHeaderLength + header->length))) {
+            LOG_ERROR("UdpTunnelMux::_onMessage failed: invalid header. " << header->toString());
+            return -1;
+        }
+        return _onMessageAddrProbe(std::string((char *)buf->data() + kUdpTunnelMsgHeaderLength, header->length));
+    }
+
+    UdpTunnel *tunnel = _findTunnel(addr, *header);
+    if (nullptr == tunnel) {
+#ifdef DEBUG_UDP_TUNNEL_MUX
+        LOG_DEBUG("UdpTunnelMux::_onMessage. tunnel not found, dropped. " << header->toString());
+#endif  // DEBUG_UDP_TUNNEL_MUX
+        return -1;
+    }
+
+    return tunnel->onPacket(buf);
+}
+
+UdpTunnel *UdpTunnelMux::_findTunnel(const struct sockaddr *addr, const UdpTunnelMsgHeader &header)
+{
+    for (auto *tunnel : tunnels_) {
+        if (tunnel->isPeer(addr)) {
+            return tunnel;
+        }
+    }
+
+    // 来源地址对不上，按消息中的tunnel_id查找：kcp包的conv，心跳和MTU探测的proxy_id
+    uint32_t tunnel_id = 0;
+    if ((0 != header.tunnel_id) && (kKcpConvReserved != header.tunnel_id)) {
+        tunnel_id = header.tunnel_id;
+    } else if ((0 == header.tunnel_id) && (kTunnelMsgTypeHeartbeat == header.type)) {
+        tunnel_id = header.proxy_id;
+    }
+    if (0 == tunnel_id) {
+        return nullptr;
+    }
+
+    UdpTunnel *found = nullptr;
+    for (auto *tunnel : tunnels_) {
+        if (tunnel_id != tunnel->getTunnelId()) {
+            continue;
+        }
+        if (nullptr != found) {
+            // 不同设备分配了相同的tunnel_id，无法区分
+            LOG_WARN("UdpTunnelMux::_findTunnel. ambiguous tunnel_id:" << tunnel_id);
+            return nullptr;
+        }
+        found = tunnel;
+    }
+    return found;
+}
+
+int UdpTunnelMux::_onMessageAddrProbe(const std::string &json)
+{
+    if (json.empty()) {
+        LOG_ERROR("UdpTunnelMux::_onMessageAddrProbe failed:invalid input. " << json);
+        return -1;
+    }
+
+    JsonHelper json_helper;
+    if (0 != json_helper.init(json)) {
+        LOG_ERROR("UdpTunnelMux::_onMessageAddrProbe failed:invalid input. " << json);
+        return -1;
+    }
+
+    std::string peer_addr = json_helper.getJsonValue("peer_addr");
+    if (peer_addr.empty()) {
+        LOG_WARN("UdpTunnelMux::_onMessageAddrProbe failed:peer_addr not found. " << json);
+        return -1;
+    }
+    if (public_addr_ == peer_addr) {
+        return 0;
+    }
+
+    // 检查设置是否正确
+    std::string ip;
+    uint16_t port = 0;
+    if (0 != IPv4Utils::getIpAndPort(peer_addr, ip, port)) {
+        LOG_WARN("UdpTunnelMux::_onMessageAddrProbe failed:peer_addr not found. " << json);
+        return -1;
+    }
+
+    bool changed = !public_addr_.empty();
+    public_addr_ = peer_addr;
+    LOG_INFO("UdpTunnelMux::_onMessageAddrProbe. public_addr:" << public_addr_);
+    if (changed) {
+        for (auto *tunnel : tunnels_) {
+            tunnel->onPublicAddrChanged();
+        }
+    }
+    return 0;
+}
+
+int UdpTunnelMux::_sendHeartbeatMsgToStunServer()
+{
+    if (user_token_.empty()) {
+        LOG_WARN("UdpTunnelMux::_sendHeartbeatMsgToStunServer. invalid token.");
+        return -1;
+    }
+
+    std::map<std::string, std::string> str_map;
+    str_map["user_token"] = user_token_;
+    std::string json = JsonMsg::getJsonString(str_map);
+
+    UdpTunnelMsgHeader header;
+    header.tunnel_id = 0;
+    header.type = kTunnelMsgTypeAddrProbe;
+    header.proxy_id = 0;
+    header.length = json.length();
+
+    char data[1024] = {0};
+    memcpy(data, (char *)&header, sizeof(header));
+    memcpy(data + sizeof(header), json.c_str(), json.length());
+    size_t length = sizeof(header) + json.length();
+
+    this->sendto(data, (int)length, &stun_server_sock_addr_.sa);
+#ifdef DEBUG_UDP_TUNNEL_MUX
+    LOG_DEBUG("UdpTunnelMux::_sendHeartbeatMsgToStunServer. length:" << length << " stun_server:" << stun_server_addr_);
+#endif  // DEBUG_UDP_TUNNEL_MUX
+    return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef SRC_UDP_TUNNEL_MUX_H_
+#define SRC_UDP_TUNNEL_MUX_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "hv/UdpClient.h"
+#include "hv/hsocket.h"
+#include "TunnelMsgHeader.h"
+#include "UdpBatchIo.h"
+
+class UdpTunnel;
+
+/**
+ * @brief 多条p2p隧道共用的udp socket：一个NAT映射、一个出口地址、一份STUN心跳和批量收发缓存
+ * @note 收到的包按来源地址分给隧道，每台设备的出口地址不同；地址对不上时（如设备的NAT映射变化）
+ *       kcp包按conv、心跳和MTU探测按消息头中的tunnel_id查找。conv即设备分配的tunnel_id，
+ *       不同设备分配的tunnel_id可能相同，因此先按地址区分
+ *       仅在loop线程中使用
+ */
+class UdpTunnelMux : public hv::UdpClient {
+public:
+    explicit UdpTunnelMux(hv::EventLoopPtr loop);
+
+    ~UdpTunnelMux();
+
+    int init(const std::string &user_token, const std::string &stun_server_addr);
+
+    int fini();
+
+    /**
+     * @brief 隧道开始收发，隧道析构前需要detach
+     */
+    void attach(UdpTunnel *tunnel);
+
+    void detach(UdpTunnel *tunnel);
+
+    /**
+     * @brief 发出一个udp包，启用批量收发时先缓存，由flush一次发出
+     */
+    int send(const char *data, int length, sockaddr_u *addr);
+
+    int flush();
+
+    /**
+     * @brief 正在用recvmmsg批量接收，隧道的kcp包全部输入后再统一处理
+     */
+    bool isBatchReceiving() const;
+
+    /**
+     * @return 没有初始化时返回-1
+     */
+    int getFd();
+
+    const std::string &getPublicAddr() const;
+
+private:
+    int _initUdpClient(const std::string &ip, uint16_t port);
+
+    int _finiUdpClient();
+
+    /**
+     * @brief 处理libhv读到的第一个包，启用GRO时可能是多个包合并而成
+     * @note libhv读取时拿不到UDP_GRO给出的段长，GRO只合并长度相同的连续包，因此按第一个包自身的长度拆分：
+     *       tunnel消息按消息头中的长度拆分；kcp包整体输入，ikcp_input按段头依次解析；
+     *       fec包无法从包头得到长度，启用fec时不启用GRO
+     */
+    int _onFirstMessage(const struct sockaddr *addr, hv::Buffer *buf);
+
+    int _onMessage(const struct sockaddr *addr, hv::Buffer *buf);
+
+    int _onMessageAddrProbe(const std::string &json);
+
+    /**
+     * @return 没有对应的隧道时返回nullptr
+     */
+    UdpTunnel *_findTunnel(const struct sockaddr *addr, const UdpTunnelMsgHeader &header);
+
+    int _sendHeartbeatMsgToStunServer();
+
+private:
+    std::string user_token_;
+    std::string stun_server_addr_;
+    sockaddr_u stun_server_sock_addr_;
+    std::string public_addr_;
+
+    std::vector<UdpTunnel *> tunnels_;
+
+    UdpBatchIo batch_io_;               //批量收发，仅Linux上启用
+    bool batch_recv_;                   //正在批量接收
+    std::vector<char> gro_read_buf_;    //启用GRO时libhv的读缓存
+};
+
+#endif  // SRC_UDP_TUNNEL_MUX_H_
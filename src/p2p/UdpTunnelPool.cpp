@@ -0,0 +1,177 @@
+#include "UdpTunnelPool.h"
+#include "hv/htime.h"
+#include "AppConfig.h"
+#include "x/Logger.h"
+
+UdpTunnelPool::UdpTunnelPool(hv::EventLoopPtr loop) : loop_(loop), mux_(loop), inited_(false)
+{
+}
+
+UdpTunnelPool::~UdpTunnelPool()
+{
+    fini();
+}
+
+int UdpTunnelPool::init(const std::string &user_token, const std::string &stun_server_addr)
+{
+    if (0 != mux_.init(user_token, stun_server_addr)) {
+        LOG_ERROR("UdpTunnelPool::init failed in UdpTunnelMux::init.");
+        return -1;
+    }
+
+    for (auto &tunnel : tunnels_) {
+        tunnel->init();
+        mux_.attach(tunnel.get());
+    }
+    inited_ = true;
+    return 0;
+}
+
+int UdpTunnelPool::fini()
+{
+    for (auto &tunnel : tunnels_) {
+        mux_.detach(tunnel.get());
+        tunnel->fini();
+    }
+    mux_.fini();
+    inited_ = false;
+    std::fill(last_used_.begin(), last_used_.end(), 0);
+    std::fill(in_use_.begin(), in_use_.end(), false);
+    return 0;
+}
+
+UdpTunnel *UdpTunnelPool::acquire(const std::string &device_token)
+{
+    if (device_token.empty()) {
+        LOG_ERROR("UdpTunnelPool::acquire failed:invalid device_token.");
+        return nullptr;
+    }
+
+    size_t index = _find(device_token);
+    if (index < tunnels_.size()) {
+        LOG_DEBUG("UdpTunnelPool::acquire. warm tunnel. index:" << index << " device_token:" << device_token
+                  << " ready:" << tunnels_[index]->isReady() << " tunnel_id:" << tunnels_[index]->getTunnelId());
+    } else {
+        // 优先复用断开的隧道，其次新建，隧道数达到上限时才回收其他设备预热的隧道
+        index = _getVictim(false);
+        size_t max_tunnel_num = AppConfig::getMaxSessionNum() + AppConfig::getWarmTunnelNum();
+        if ((index >= tunnels_.size()) && (tunnels_.size() < max_tunnel_num)) {
+            index = _create();
+        }
+        if (index >= tunnels_.size()) {
+            index = _getVictim(true);
+        }
+        if (index >= tunnels_.size()) {
+            LOG_ERROR("UdpTunnelPool::acquire failed:all tunnels in use. device_token:" << device_token);
+            return nullptr;
+        }
+        if (!tunnels_[index]->getDeviceToken().empty()) {
+            LOG_DEBUG("UdpTunnelPool::acquire. evict index:" << index
+                      << " device_token:" << tunnels_[index]->getDeviceToken());
+            tunnels_[index]->stopP2P();
+        }
+    }
+
+    in_use_[index] = true;
+    return tunnels_[index].get();
+}
+
+void UdpTunnelPool::release(UdpTunnel *tunnel)
+{
+    for (size_t i = 0; i < tunnels_.size(); i++) {
+        if (tunnels_[i].get() == tunnel) {
+            in_use_[i] = false;
+            last_used_[i] = gettick_ms();
+            _trim();
+            return;
+        }
+    }
+}
+
+int UdpTunnelPool::expire(uint32_t timeout)
+{
+    uint64_t now = gettick_ms();
+    int count = 0;
+    for (size_t i = 0; i < tunnels_.size(); i++) {
+        if (in_use_[i] || tunnels_[i]->getDeviceToken().empty() || (now - last_used_[i] < timeout)) {
+            continue;
+        }
+
+        LOG_DEBUG("UdpTunnelPool::expire. index:" << i << " device_token:" << tunnels_[i]->getDeviceToken()
+                  << " idle:" << (now - last_used_[i]) << "ms");
+        tunnels_[i]->stopP2P();
+        count++;
+    }
+    return count;
+}
+
+size_t UdpTunnelPool::_find(const std::string &device_token) const
+{
+    for (size_t i = 0; i < tunnels_.size(); i++) {
+        if (!in_use_[i] && (device_token == tunnels_[i]->getDeviceToken())) {
+            return i;
+        }
+    }
+    return tunnels_.size();
+}
+
+size_t UdpTunnelPool::_getVictim(bool warm) const
+{
+    size_t victim = tunnels_.size();
+    for (size_t i = 0; i < tunnels_.size(); i++) {
+        if (in_use_[i]) {
+            continue;
+        }
+        if (!warm) {
+            if (tunnels_[i]->getDeviceToken().empty()) {
+                return i;
+            }
+            continue;
+        }
+        if (tunnels_[i]->getDeviceToken().empty()) {
+            continue;
+        }
+        if ((victim == tunnels_.size()) || (last_used_[i] < last_used_[victim])) {
+            victim = i;
+        }
+    }
+    return victim;
+}
+
+size_t UdpTunnelPool::_create()
+{
+    size_t index = tunnels_.size();
+    std::unique_ptr<UdpTunnel> tunnel(new UdpTunnel(loop_, &mux_));
+    UdpTunnel *raw = tunnel.get();
+    tunnel->onTunnelReady = [this, raw, index]() {
+        // 预热的隧道上没有会话，不需要迁移连接
+        if (in_use_[index] && onTunnelReady) {
+            onTunnelReady(raw);
+        }
+    };
+    if (inited_) {
+        tunnel->init();
+        mux_.attach(raw);
+    }
+    tunnels_.push_back(std::move(tunnel));
+    last_used_.push_back(0);
+    in_use_.push_back(false);
+    LOG_DEBUG("UdpTunnelPool::_create. index:" << index);
+    return index;
+}
+
+void UdpTunnelPool::_trim()
+{
+    size_t warm_num = 0;
+    for (size_t i = 0; i < tunnels_.size(); i++) {
+        if (!in_use_[i] && !tunnels_[i]->getDeviceToken().empty()) {
+            warm_num++;
+        }
+    }
+
+    for (; warm_num > AppConfig::getWarmTunnelNum(); warm_num--) {
+        size_t index = _getVictim(true);
+        LOG_DEBUG("UdpTunnelPool::_trim. index:" << index << " device_token:" << tunnels_[index]->getDeviceToken());
+        tunnels_[index]->stopP2P();
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef SRC_UDP_TUNNEL_POOL_H_
+#define SRC_UDP_TUNNEL_POOL_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "hv/EventLoop.h"
+#include "UdpTunnel.h"
+#include "UdpTunnelMux.h"
+
+/**
+ * @brief p2p隧道池：打开的会话各占用一条隧道，会话关闭后隧道留在池中预热，切回这些设备时不用重新打洞
+ * @note 所有隧道共用UdpTunnelMux的一个udp socket，按设备地址和tunnel_id区分；空闲的隧道靠每10秒的心跳
+ *       维持对端的NAT映射和kcp会话，kcp空闲时没有定时器
+ *       隧道在acquire时按需创建；预热的隧道不超过AppConfig::getWarmTunnelNum()，超出时断开最久没有使用的，
+ *       长时间没有使用的隧道也断开p2p，断开的隧道留给下一个会话复用
+ *       仅在loop线程中使用
+ */
+class UdpTunnelPool {
+public:
+    explicit UdpTunnelPool(hv::EventLoopPtr loop);
+
+    ~UdpTunnelPool();
+
+    int init(const std::string &user_token, const std::string &stun_server_addr);
+
+    int fini();
+
+    /**
+     * @brief 为会话取得一条隧道：device_token已有预热的隧道时直接使用，否则使用断开的隧道，
+     *        都在使用或预热时创建新的隧道，隧道数达到上限时回收最久没有使用的预热隧道
+     * @return 没有可用的隧道时返回nullptr
+     */
+    UdpTunnel *acquire(const std::string &device_token);
+
+    /**
+     * @brief 会话关闭，隧道留在池中预热；预热的隧道超过AppConfig::getWarmTunnelNum()时断开最久没有使用的
+     */
+    void release(UdpTunnel *tunnel);
+
+    /**
+     * @brief 断开超过timeout没有使用的预热隧道
+     * @param timeout 毫秒
+     * @return 断开的隧道数
+     */
+    int expire(uint32_t timeout);
+
+    /**
+     * @brief 会话占用的隧道打洞成功、kcp会话建立后回调
+     */
+    std::function<void(UdpTunnel *tunnel)> onTunnelReady;
+
+private:
+    /**
+     * @return 隧道序号；tunnels_.size()：没有；
+     */
+    size_t _find(const std::string &device_token) const;
+
+    /**
+     * @brief 空闲的隧道
+     * @param warm false：没有绑定设备的隧道；true：最久没有使用的预热隧道
+     * @return 隧道序号；tunnels_.size()：没有；
+     */
+    size_t _getVictim(bool warm) const;
+
+    /**
+     * @brief 创建一条隧道，池已初始化时同时初始化隧道
+     * @return 隧道序号
+     */
+    size_t _create();
+
+    /**
+     * @brief 预热的隧道超过AppConfig::getWarmTunnelNum()时，断开最久没有使用的
+     */
+    void _trim();
+
+private:
+    hv::EventLoopPtr loop_;
+    UdpTunnelMux mux_;
+    bool inited_;                       //mux_已初始化，新建的隧道需要init和attach
+    std::vector<std::unique_ptr<UdpTunnel>> tunnels_;
+    std::vector<uint64_t> last_used_;   //每条隧道最后一次被会话释放的时间，gettick_ms
+    std::vector<bool> in_use_;          //被会话占用
+};
+
+#endif  // SRC_UDP_TUNNEL_POOL_H_
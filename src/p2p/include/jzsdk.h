@@ -23,7 +23,8 @@ int JZSDK_Fini();
  * @brief 启动会话
  * @param device_token
  * @return 0：成功；-1：失败；
- * @note 同一时间只能保持与一台设备的连接，连接调用该函数将会停止之前存在的连接（如有）并重新启动会话
+ * @note 单设备接口：调用该函数将会停止上一台设备的会话（如有）并重新启动会话，同时访问多台设备使用JZSDK_OpenSession；
+ *       最近使用的几台设备的p2p隧道会保留一段时间，切回这些设备时不用重新打洞
  */
 int JZSDK_StartSession(const char *device_token);
 
@@ -41,6 +42,73 @@ int JZSDK_StopSession();
  */
 char* JZSDK_GetUrlPrefix();
 
+/**
+ * @brief 打开与一台设备的会话，可以同时打开多台设备的会话
+ * @param device_token
+ * @return 会话id（>=0）；-1：失败；
+ * @note 每个会话有独立的本地代理端口和url前缀，通过JZSDK_GetSessionUrlPrefix获取；
+ *       设备已有会话时重新启动该会话并返回同一个id；最多同时打开16个会话
+ */
+int JZSDK_OpenSession(const char *device_token);
+
+/**
+ * @brief 关闭会话，会话上的连接都会关闭
+ * @param session_id JZSDK_OpenSession的返回值
+ * @return 0：成功；-1：失败；
+ */
+int JZSDK_CloseSession(int session_id);
+
+/**
+ * @brief 获取会话的url前缀（直连和p2p会返回不同的值）
+ * @param session_id JZSDK_OpenSession的返回值
+ * @return 会话没有打开时返回空指针
+ * @note 返回的指针一直有效，内容在会话关闭或切换路径后变化
+ */
+char* JZSDK_GetSessionUrlPrefix(int session_id);
+
+/**
+ * @brief 设置会话分配下行带宽的权重，默认为1
+ * @param session_id JZSDK_OpenSession的返回值
+ * @param weight 1~100
+ * @return 0：成功；-1：失败；
+ * @note 配置了下行总带宽时生效，多路同时拉流时权重高的会话（如大画面）分到更多带宽；
+ *       只限制p2p隧道，中继隧道不受限制；会话关闭后恢复默认
+ */
+int JZSDK_SetSessionWeight(int session_id, int weight);
+
+/**
+ * @brief kcp调优参数
+ */
+#define JZSDK_KCP_PROFILE_DEFAULT       0   // 默认
+#define JZSDK_KCP_PROFILE_INTERACTIVE   1   // 低时延交互
+#define JZSDK_KCP_PROFILE_BULK_VIDEO    2   // 大流量视频
+#define JZSDK_KCP_PROFILE_METERED       3   // 计费/蜂窝网络
+
+/**
+ * @brief 设置p2p隧道的kcp调优参数
+ * @param profile JZSDK_KCP_PROFILE_*
+ * @return 0：成功；-1：失败；
+ * @note 对之后建立的p2p隧道生效，已建立的隧道不受影响
+ */
+int JZSDK_SetKcpProfile(int profile);
+
+/**
+ * @brief 连接的发送优先级
+ */
+#define JZSDK_PRIORITY_HIGH     0   // 交互请求，如GetDeviceInfo
+#define JZSDK_PRIORITY_NORMAL   1   // 默认
+#define JZSDK_PRIORITY_LOW      2   // 录像下载等大流量
+
+/**
+ * @brief 设置App到本地代理的连接在p2p隧道中的发送优先级
+ * @param local_port App一侧socket的端口（getsockname获得）
+ * @param priority JZSDK_PRIORITY_*
+ * @return 0：成功；-1：失败；
+ * @note 连接建立后即可设置；p2p隧道中各连接按优先级加权轮流发送，大流量下载不会长时间阻塞交互请求；
+ *       中继隧道不区分优先级
+ */
+int JZSDK_SetConnectionPriority(unsigned short local_port, int priority);
+
 
 #ifdef __cplusplus
 }
@@ -6,6 +6,9 @@
 #include <android/log.h>
 #endif
 #include "ClientNode.h"
+#include "KcpAllocator.h"
+#include "KcpProfile.h"
+#include "kcp/KcpConfig.h"
 
 /**
  * @brief SDK初始化
@@ -21,6 +24,12 @@ int JZSDK_Init(const char *user_token) {
         return -1;
     }
 
+    // 必须在创建kcp对象之前安装，路径MTU探测后mtu最大为kcpMaxMtu
+    if (0 != KcpAllocator::install(kcpMaxMtu)) {
+        std::cout << "JZSDK_Init failed in KcpAllocator::install" << std::endl;
+        return -1;
+    }
+
     if (0 != client_node->init(user_token)) {
         std::cout << "JZSDK_Init failed" << std::endl;
         return -1;
@@ -53,6 +62,9 @@ int JZSDK_Fini() {
 
     delClientNode();
 
+    std::cout << "KcpAllocator." << KcpAllocator::statsToString() << std::endl;
+    KcpAllocator::uninstall();
+
     std::cout << "JZSDK_Fini succeed" << std::endl;
     return 0;
 }
@@ -105,3 +117,81 @@ char *JZSDK_GetUrlPrefix() {
 
     return (char *) client_node->getUrlPrefix();
 }
+
+int JZSDK_OpenSession(const char *device_token) {
+    ClientNode *client_node = getClientNode();
+    if ((nullptr == client_node) || (nullptr == device_token)) {
+        return -1;
+    }
+
+    int session_id = client_node->openSession(device_token);
+    if (session_id < 0) {
+        std::cout << "JZSDK_OpenSession failed" << std::endl;
+        return -1;
+    }
+
+    std::cout << "JZSDK_OpenSession succeed. session_id:" << session_id << std::endl;
+    return session_id;
+}
+
+int JZSDK_CloseSession(int session_id) {
+    ClientNode *client_node = getClientNode();
+    if ((nullptr == client_node) || (session_id < 0)) {
+        return -1;
+    }
+
+    if (0 != client_node->closeSession((uint32_t) session_id)) {
+        std::cout << "JZSDK_CloseSession failed. session_id:" << session_id << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+char *JZSDK_GetSessionUrlPrefix(int session_id) {
+    ClientNode *client_node = getClientNode();
+    if ((nullptr == client_node) || (session_id < 0)) {
+        return nullptr;
+    }
+
+    return (char *) client_node->getSessionUrlPrefix((uint32_t) session_id);
+}
+
+int JZSDK_SetSessionWeight(int session_id, int weight) {
+    ClientNode *client_node = getClientNode();
+    if ((nullptr == client_node) || (session_id < 0) || (weight <= 0)) {
+        return -1;
+    }
+
+    if (0 != client_node->setSessionWeight((uint32_t) session_id, (uint32_t) weight)) {
+        std::cout << "JZSDK_SetSessionWeight failed. session_id:" << session_id << " weight:" << weight
+                  << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int JZSDK_SetKcpProfile(int profile) {
+    if (0 != KcpProfile::setCurrent(profile)) {
+        std::cout << "JZSDK_SetKcpProfile failed. profile:" << profile << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int JZSDK_SetConnectionPriority(unsigned short local_port, int priority) {
+    ClientNode *client_node = getClientNode();
+    if (nullptr == client_node) {
+        return -1;
+    }
+
+    if (0 != client_node->setProxyPriority(local_port, priority)) {
+        std::cout << "JZSDK_SetConnectionPriority failed. local_port:" << local_port << " priority:" << priority
+                  << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
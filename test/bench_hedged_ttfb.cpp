@@ -0,0 +1,111 @@
+// StreamHedging基准测试：模拟新连接的首字节时间（TTFB），对比只走p2p隧道和中继+p2p对冲的p50/p99
+//   p2p：刚打通的kcp会话，往返时间短但丢包，丢失的包等rto后重传，rto每次乘1.5
+//   中继：tcp，往返时间长，几乎不丢包
+// 每个连接的请求占request_packets个包，响应的第一个包到达即为首字节
+// 用法：bench_hedged_ttfb [p2p丢包率%] [p2p往返ms] [中继往返ms] [kcp最小rto ms]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "StreamHedging.h"
+
+namespace {
+
+const uint32_t kUdpTunnel = 100;
+const uint32_t kRelayTunnel = 101;
+const int kRequestPackets = 2;
+const size_t kStreams = StreamHedging::kTtfbSamples;
+
+struct PathModel {
+    double rtt;         // 毫秒
+    double jitter;      // 单向时延的抖动，毫秒
+    double loss;        // 每个包的丢包率
+    double rto;         // 首次重传超时，毫秒
+};
+
+class Simulator {
+public:
+    explicit Simulator(uint32_t seed) : rng_(seed), uniform_(0.0, 1.0) {}
+
+    /**
+     * @brief 一个包的单向送达时间，包括重传
+     */
+    double deliver(const PathModel &path)
+    {
+        double elapsed = 0;
+        double rto = path.rto;
+        while (uniform_(rng_) < path.loss) {
+            elapsed += rto;
+            rto *= 1.5;
+        }
+        return elapsed + path.rtt / 2 + uniform_(rng_) * path.jitter;
+    }
+
+    /**
+     * @brief 请求的所有包送达，设备处理后响应的第一个包送达
+     */
+    double firstByte(const PathModel &path)
+    {
+        double request = 0;
+        for (int i = 0; i < kRequestPackets; i++) {
+            request = std::max(request, deliver(path));
+        }
+        return request + kServerTime + deliver(path);
+    }
+
+private:
+    static constexpr double kServerTime = 5;
+
+    std::mt19937 rng_;
+    std::uniform_real_distribution<double> uniform_;
+};
+
+void run(const char *name, bool hedged, const PathModel &p2p, const PathModel &relay)
+{
+    StreamHedging hedging;
+    Simulator sim(12345);
+    uint64_t won_relay = 0;
+    for (uint32_t proxy_id = 1; proxy_id <= kStreams; proxy_id++) {
+        hedging.onStreamStart(proxy_id, hedged, kUdpTunnel, kRelayTunnel, 0);
+        double p2p_time = sim.firstByte(p2p);
+        double relay_time = sim.firstByte(relay);
+
+        uint32_t winner = 0;
+        if (!hedged) {
+            hedging.onData(proxy_id, kUdpTunnel, (uint64_t)p2p_time, winner);
+        } else {
+            // 按到达顺序交给StreamHedging，后到的隧道应被丢弃
+            bool relay_first = relay_time < p2p_time;
+            uint32_t first = relay_first ? kRelayTunnel : kUdpTunnel;
+            uint32_t second = relay_first ? kUdpTunnel : kRelayTunnel;
+            hedging.onData(proxy_id, first, (uint64_t)std::min(p2p_time, relay_time), winner);
+            hedging.commit(proxy_id, winner);
+            if (StreamHedging::kDrop != hedging.onData(proxy_id, second, (uint64_t)std::max(p2p_time, relay_time), winner)) {
+                printf("duplicate delivered. proxy_id:%u\n", proxy_id);
+            }
+            won_relay += relay_first ? 1 : 0;
+        }
+        hedging.remove(proxy_id);
+    }
+
+    printf("%-8s p50:%5u ms  p99:%5u ms  relay_won:%5.1f%%\n", name, hedging.getTtfbPercentile(hedged, 50),
+           hedging.getTtfbPercentile(hedged, 99), 100.0 * won_relay / kStreams);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    double loss = ((argc > 1) ? atof(argv[1]) : 10) / 100.0;
+    double p2p_rtt = (argc > 2) ? atof(argv[2]) : 40;
+    double relay_rtt = (argc > 3) ? atof(argv[3]) : 120;
+    double rto = (argc > 4) ? atof(argv[4]) : 100;
+
+    PathModel p2p = {p2p_rtt, p2p_rtt / 4, loss, rto};
+    PathModel relay = {relay_rtt, relay_rtt / 4, 0.001, 200};
+    printf("streams:%zu p2p rtt:%.0fms loss:%.1f%% rto:%.0fms, relay rtt:%.0fms\n", kStreams, p2p_rtt, loss * 100,
+           rto, relay_rtt);
+    run("p2p", false, p2p, relay);
+    run("hedged", true, p2p, relay);
+    return 0;
+}
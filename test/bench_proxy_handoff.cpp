@@ -0,0 +1,169 @@
+// 本地代理吞吐基准测试：在本机回环上启动ProxyServer，N个本地连接持续写入，
+// 隧道loop中的ProxySink只统计收到的字节数（代替ClientNode），对比不同I/O线程数下的总吞吐
+//   threads:0  连接在隧道loop中读取，直接回调
+//   threads:N  连接分散到N个共用的worker loop，数据经MpscQueue交给隧道loop（AppConfig::getProxyThreadNum()）
+// 用法：bench_proxy_handoff [每次运行的秒数] [本地连接数] [最多I/O线程数] [每次写入长度]
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include "hv/EventLoopThread.h"
+#include "hv/EventLoopThreadPool.h"
+#include "ProxyServer.h"
+
+namespace {
+
+/**
+ * @brief 只统计字节数，在隧道loop线程中回调，主线程读取
+ */
+class CountingSink : public ProxySink {
+public:
+    CountingSink() : connected(0), closed(0), bytes(0) {}
+
+    int onProxyConnected(uint32_t, uint32_t) override {
+        connected++;
+        return 0;
+    }
+
+    int onProxyData(uint32_t, char *, uint32_t length) override {
+        bytes += length;
+        return 0;
+    }
+
+    int onProxyWindowUpdate(uint32_t, uint32_t) override {
+        return 0;
+    }
+
+    int onProxyClosed(uint32_t) override {
+        closed++;
+        return 0;
+    }
+
+    std::atomic<int> connected;
+    std::atomic<int> closed;
+    std::atomic<uint64_t> bytes;
+};
+
+int connectLocal(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (0 != connect(fd, (sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief 在隧道loop线程中执行并等待结果，ProxyServer的init/fini要求在隧道loop中调用
+ */
+int runInTunnel(const hv::EventLoopPtr &loop, const std::function<int()> &fn)
+{
+    std::promise<int> result;
+    loop->runInLoop([&result, &fn]() {
+        result.set_value(fn());
+    });
+    return result.get_future().get();
+}
+
+/**
+ * @return MB/s，失败时返回负数
+ */
+double runProxy(double seconds, int conn_num, int thread_num, size_t write_size)
+{
+    hv::EventLoopThread tunnel_thread;
+    tunnel_thread.start(true);
+    hv::EventLoopPtr tunnel_loop = tunnel_thread.loop();
+    hv::EventLoopThreadPool workers(thread_num);
+    workers.start(true);
+    std::vector<hv::EventLoopPtr> worker_loops;
+    for (int i = 0; i < thread_num; i++) {
+        worker_loops.push_back(workers.loop(i));
+    }
+
+    // 端口为0时由系统分配
+    CountingSink sink;
+    ProxyServer server(tunnel_loop);
+    server.setSink(&sink);
+    if (0 != runInTunnel(tunnel_loop, [&server, &worker_loops]() { return server.init(0, worker_loops); })) {
+        fprintf(stderr, "ProxyServer::init failed\n");
+        return -1;
+    }
+    sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(server.listenfd, (sockaddr *)&addr, &len);
+    uint16_t port = ntohs(addr.sin_port);
+
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> clients;
+    for (int i = 0; i < conn_num; i++) {
+        clients.emplace_back([&stop, port, write_size]() {
+            int fd = connectLocal(port);
+            if (fd < 0) {
+                return;
+            }
+            std::string data(write_size, 'x');
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (send(fd, data.data(), data.length(), 0) <= 0) {
+                    break;
+                }
+            }
+            close(fd);
+        });
+    }
+    for (int i = 0; (i < 1000) && (sink.connected < conn_num); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    uint64_t begin_bytes = sink.bytes;
+    auto begin = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    uint64_t bytes = sink.bytes - begin_bytes;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    stop = true;
+    for (auto &client : clients) {
+        client.join();
+    }
+    runInTunnel(tunnel_loop, [&server]() { return server.fini(); });
+    workers.stop(true);
+    tunnel_thread.stop(true);
+    if (sink.connected < conn_num) {
+        fprintf(stderr, "only %d of %d connections accepted\n", sink.connected.load(), conn_num);
+    }
+    return bytes / elapsed / (1024 * 1024);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    double seconds = (argc > 1) ? strtod(argv[1], nullptr) : 2;
+    int conn_num = (argc > 2) ? atoi(argv[2]) : 8;
+    int max_threads = (argc > 3) ? atoi(argv[3]) : (int)std::thread::hardware_concurrency();
+    size_t write_size = (argc > 4) ? strtoul(argv[4], nullptr, 10) : 64 * 1024;
+
+    printf("connections:%d write:%zu bytes, %.1f seconds per run\n", conn_num, write_size, seconds);
+    double base = runProxy(seconds, conn_num, 0, write_size);
+    printf("threads:%-3d %10.1f MB/s\n", 0, base);
+    for (int n = 1; n <= max_threads; n *= 2) {
+        double mbps = runProxy(seconds, conn_num, n, write_size);
+        printf("threads:%-3d %10.1f MB/s  x%.2f\n", n, mbps, (base > 0) ? mbps / base : 0);
+    }
+    return 0;
+}
@@ -0,0 +1,169 @@
+// TcpFrameBatch基准测试：本机回环tcp连接上发送同样的中继帧，对比每MB的写系统调用次数和tcp分段数
+//   two_writes：消息头和数据分两次写（原RelayTunnel::onProxyData）
+//   writev：    消息头和数据一次writev
+//   batch：     每轮事件循环的多帧合并后一次写（TcpFrameBatch）
+// 用法：bench_relay_frame_batch [MB] [每帧数据长度] [每轮帧数]
+#include <arpa/inet.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "TcpFrameBatch.h"
+#include "TunnelMsgHeader.h"
+
+namespace {
+
+struct Connection {
+    int send_fd;
+    int recv_fd;
+};
+
+Connection connectLoopback()
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd, (sockaddr *)&addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, (sockaddr *)&addr, &len);
+    listen(listen_fd, 1);
+
+    Connection conn;
+    conn.send_fd = socket(AF_INET, SOCK_STREAM, 0);
+    connect(conn.send_fd, (sockaddr *)&addr, sizeof(addr));
+    conn.recv_fd = accept(listen_fd, nullptr, nullptr);
+    close(listen_fd);
+
+    // libhv的tcp连接默认关闭Nagle
+    int on = 1;
+    setsockopt(conn.send_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    int buf_size = 8 * 1024 * 1024;
+    setsockopt(conn.send_fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+    setsockopt(conn.recv_fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+    return conn;
+}
+
+uint32_t getSegmentsOut(int fd)
+{
+    struct tcp_info info;
+    memset(&info, 0, sizeof(info));
+    socklen_t len = sizeof(info);
+    getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+    return info.tcpi_segs_out;
+}
+
+/**
+ * @brief 读完接收端已到达的数据
+ */
+size_t drain(int fd, size_t expected)
+{
+    static char buffer[256 * 1024];
+    size_t total = 0;
+    while (total < expected) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+void report(const char *name, uint64_t calls, uint32_t segments, uint64_t bytes, double seconds)
+{
+    double mb = bytes / (1024.0 * 1024.0);
+    printf("%-10s %8.1f MB %10.1f syscalls/MB %10.1f segments/MB %8.1f MB/s\n", name, mb, calls / mb,
+           segments / mb, mb / seconds);
+}
+
+enum Mode {
+    kTwoWrites,
+    kWritev,
+    kBatch,
+};
+
+void run(Mode mode, size_t total_frames, size_t payload_size, size_t frames_per_round)
+{
+    Connection conn = connectLoopback();
+    std::vector<char> payload(payload_size, 'x');
+    TcpTunnelMsgHeader header(kTunnelMsgTypeTcpData, 1, (uint32_t)payload_size);
+    TcpFrameBatch batch;
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    size_t frame_size = sizeof(header) + payload_size;
+
+    uint32_t segments_begin = getSegmentsOut(conn.send_fd);
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t sent = 0; sent < total_frames; sent += frames_per_round) {
+        for (size_t i = 0; i < frames_per_round; i++) {
+            switch (mode) {
+                case kTwoWrites: {
+                    send(conn.send_fd, &header, sizeof(header), 0);
+                    send(conn.send_fd, payload.data(), payload_size, 0);
+                    calls += 2;
+                    break;
+                }
+
+                case kWritev: {
+                    struct iovec iov[2];
+                    iov[0].iov_base = &header;
+                    iov[0].iov_len = sizeof(header);
+                    iov[1].iov_base = payload.data();
+                    iov[1].iov_len = payload_size;
+                    writev(conn.send_fd, iov, 2);
+                    calls++;
+                    break;
+                }
+
+                case kBatch: {
+                    if (batch.append((const char *)&header, sizeof(header), payload.data(), payload_size)) {
+                        batch.flush([&](const char *data, size_t length) {
+                            send(conn.send_fd, data, length, 0);
+                            calls++;
+                            return 0;
+                        });
+                    }
+                    break;
+                }
+            }
+        }
+        // 一轮事件循环结束
+        batch.flush([&](const char *data, size_t length) {
+            send(conn.send_fd, data, length, 0);
+            calls++;
+            return 0;
+        });
+        bytes += drain(conn.recv_fd, frames_per_round * frame_size);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    uint32_t segments = getSegmentsOut(conn.send_fd) - segments_begin;
+
+    static const char *kNames[] = {"two_writes", "writev", "batch"};
+    report(kNames[mode], calls, segments, bytes, seconds);
+    close(conn.send_fd);
+    close(conn.recv_fd);
+}
+
+}  // namespace
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = (argc > 1) ? strtoul(argv[1], nullptr, 10) : 256;
+    size_t payload_size = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 1024;
+    size_t frames_per_round = (argc > 3) ? strtoul(argv[3], nullptr, 10) : 8;
+    size_t total_frames = megabytes * 1024 * 1024 / (payload_size + TCP_TUNNEL_MSG_HEADER_LENGTH);
+
+    printf("payload:%zu bytes, %zu frames per round\n", payload_size, frames_per_round);
+    run(kTwoWrites, total_frames, payload_size, frames_per_round);
+    run(kWritev, total_frames, payload_size, frames_per_round);
+    run(kBatch, total_frames, payload_size, frames_per_round);
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "ReedSolomon.h"
+
+namespace {
+
+const char *const kKernels[] = {"scalar", "ssse3", "avx2", "neon"};
+
+/**
+ * @brief 依次切换到当前CPU支持的mulAdd实现，结束时恢复默认实现
+ */
+class KernelGuard {
+public:
+    KernelGuard() : default_kernel_(ReedSolomon::getKernelName()) {}
+
+    ~KernelGuard() {
+        ReedSolomon::setKernel(default_kernel_.c_str());
+    }
+
+    std::vector<std::string> getSupported() const {
+        std::vector<std::string> kernels;
+        for (const char *kernel : kKernels) {
+            if (0 == ReedSolomon::setKernel(kernel)) {
+                kernels.push_back(kernel);
+            }
+        }
+        ReedSolomon::setKernel(default_kernel_.c_str());
+        return kernels;
+    }
+
+private:
+    std::string default_kernel_;
+};
+
+std::vector<std::vector<uint8_t>> makeShards(size_t count, size_t length, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<std::vector<uint8_t>> shards(count, std::vector<uint8_t>(length));
+    for (auto &shard : shards) {
+        for (auto &byte : shard) {
+            byte = (uint8_t)rng();
+        }
+    }
+    return shards;
+}
+
+/**
+ * @brief 编码后去掉erased中的分片再恢复，检查恢复出的数据分片
+ */
+void checkReconstruct(size_t n, size_t m, size_t length, const std::vector<size_t> &erased)
+{
+    std::vector<std::vector<uint8_t>> data = makeShards(n, length, (uint32_t)(n * 131 + m * 17 + length));
+    std::vector<std::vector<uint8_t>> shards = data;
+    shards.resize(n + m, std::vector<uint8_t>(length));
+
+    std::vector<const uint8_t *> data_ptrs;
+    std::vector<uint8_t *> shard_ptrs;
+    for (size_t i = 0; i < n; i++) {
+        data_ptrs.push_back(data[i].data());
+    }
+    for (auto &shard : shards) {
+        shard_ptrs.push_back(shard.data());
+    }
+    ASSERT_EQ(0, ReedSolomon::encode(data_ptrs.data(), n, shard_ptrs.data() + n, m, length));
+
+    bool present[ReedSolomon::kMaxDataShards + ReedSolomon::kMaxParityShards];
+    std::fill(present, present + n + m, true);
+    for (size_t index : erased) {
+        present[index] = false;
+        memset(shard_ptrs[index], 0xa5, length);
+    }
+
+    int ret = ReedSolomon::reconstruct(shard_ptrs.data(), present, n, m, length);
+    if (erased.size() > m) {
+        EXPECT_EQ(-1, ret);
+        return;
+    }
+    ASSERT_EQ(0, ret) << "n:" << n << " m:" << m << " erased:" << erased.size();
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_EQ(data[i], shards[i]) << "kernel:" << ReedSolomon::getKernelName() << " shard:" << i;
+    }
+}
+
+}  // namespace
+
+TEST(ReedSolomon, MulAddMatchesScalar) {
+    KernelGuard guard;
+    // 覆盖16/32字节的向量部分和剩余的尾部
+    const size_t lengths[] = {1, 15, 16, 17, 31, 32, 33, 100};
+    const uint8_t coefficients[] = {0, 1, 2, 0x1d, 0x80, 0xff};
+    std::vector<std::vector<uint8_t>> src = makeShards(1, 100, 1);
+
+    for (const std::string &kernel : guard.getSupported()) {
+        for (size_t length : lengths) {
+            for (uint8_t c : coefficients) {
+                std::vector<std::vector<uint8_t>> expected = makeShards(1, length, 2);
+                std::vector<std::vector<uint8_t>> actual = expected;
+                ASSERT_EQ(0, ReedSolomon::setKernel("scalar"));
+                ReedSolomon::mulAdd(expected[0].data(), src[0].data(), c, length);
+                ASSERT_EQ(0, ReedSolomon::setKernel(kernel.c_str()));
+                ReedSolomon::mulAdd(actual[0].data(), src[0].data(), c, length);
+                EXPECT_EQ(expected[0], actual[0]) << "kernel:" << kernel << " length:" << length << " c:" << (int)c;
+            }
+        }
+    }
+}
+
+TEST(ReedSolomon, ReconstructUpToParityErasures) {
+    KernelGuard guard;
+    const size_t n = 8;
+    const size_t m = 4;
+    const size_t length = 67;
+
+    for (const std::string &kernel : guard.getSupported()) {
+        ASSERT_EQ(0, ReedSolomon::setKernel(kernel.c_str()));
+        for (size_t count = 0; count <= m; count++) {
+            // 缺失开头、结尾的数据分片，以及数据分片和校验分片各缺一部分
+            std::vector<size_t> head;
+            std::vector<size_t> tail;
+            std::vector<size_t> mixed;
+            for (size_t i = 0; i < count; i++) {
+                head.push_back(i);
+                tail.push_back(n - 1 - i);
+                mixed.push_back((0 == i % 2) ? (i * 2) : (n + i));
+            }
+            checkReconstruct(n, m, length, head);
+            checkReconstruct(n, m, length, tail);
+            checkReconstruct(n, m, length, mixed);
+        }
+    }
+}
+
+TEST(ReedSolomon, ReconstructMaxShards) {
+    KernelGuard guard;
+    const size_t n = ReedSolomon::kMaxDataShards;
+    const size_t m = ReedSolomon::kMaxParityShards;
+
+    for (const std::string &kernel : guard.getSupported()) {
+        ASSERT_EQ(0, ReedSolomon::setKernel(kernel.c_str()));
+        std::vector<size_t> erased;
+        for (size_t i = 0; i < m; i++) {
+            erased.push_back(i * 2);
+        }
+        checkReconstruct(n, m, 1400, erased);
+    }
+}
+
+TEST(ReedSolomon, ReconstructFailsBeyondParity) {
+    checkReconstruct(8, 2, 64, {0, 1, 2});
+    checkReconstruct(4, 0, 64, {3});
+}
+
+TEST(ReedSolomon, InvalidInput) {
+    KernelGuard guard;
+    EXPECT_EQ(-1, ReedSolomon::setKernel("unknown"));
+    EXPECT_EQ(-1, ReedSolomon::setKernel(nullptr));
+    EXPECT_EQ(0, ReedSolomon::setKernel("scalar"));
+    EXPECT_STREQ("scalar", ReedSolomon::getKernelName());
+}
@@ -0,0 +1,137 @@
+#include <cstring>
+#include <random>
+#include <string>
+#include "gtest/gtest.h"
+#include "x/RingBuffer.h"
+
+namespace {
+
+std::string makeData(std::size_t length, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::string data(length, '\0');
+    for (auto &c : data) {
+        c = (char)rng();
+    }
+    return data;
+}
+
+/**
+ * @brief 参数：是否使用内存镜像；不使用时由commit拷贝到镜像区
+ */
+class RingBufferTest : public testing::TestWithParam<bool> {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(0, buffer_.init(RingBuffer::kMinSize, RingBuffer::kMinSize * 4, GetParam()));
+        if (!GetParam()) {
+            ASSERT_FALSE(buffer_.mirrored());
+        }
+    }
+
+    std::string readAll() {
+        std::string data(buffer_.read_ptr(), buffer_.used());
+        buffer_.advance(buffer_.used());
+        return data;
+    }
+
+    RingBuffer buffer_;
+};
+
+}  // namespace
+
+TEST_P(RingBufferTest, WriteWraparound) {
+    const std::size_t size = buffer_.size();
+    std::string head = makeData(size / 2, 1);
+    std::string tail = makeData(size * 3 / 4, 2);
+
+    // 读走一部分后写入，写入的数据跨过缓存末尾
+    ASSERT_EQ(0, buffer_.write(head));
+    std::string out(size / 4, '\0');
+    ASSERT_EQ(out.length(), buffer_.read(&out[0], out.length()));
+    EXPECT_EQ(head.substr(0, size / 4), out);
+    ASSERT_EQ(0, buffer_.write(tail));
+    EXPECT_EQ(size, buffer_.size());
+    EXPECT_EQ(size, buffer_.used());
+
+    // 跨过末尾的数据从read_ptr开始连续可读
+    EXPECT_EQ(head.substr(size / 4) + tail, std::string(buffer_.read_ptr(), buffer_.used()));
+    buffer_.advance(size / 2);
+    EXPECT_EQ(tail.substr(size / 4), readAll());
+    EXPECT_EQ(0u, buffer_.used());
+}
+
+TEST_P(RingBufferTest, CommitWraparound) {
+    const std::size_t size = buffer_.size();
+    std::string head = makeData(size - 100, 3);
+    ASSERT_EQ(0, buffer_.write(head));
+    buffer_.advance(size - 200);
+
+    // 通过write_ptr写入，写入位置离末尾只有100字节，之后的空间在地址上连续
+    std::string data = makeData(1000, 4);
+    ASSERT_GE(buffer_.available(), data.length());
+    memcpy(buffer_.write_ptr(), data.data(), data.length());
+    buffer_.commit(data.length());
+    EXPECT_EQ(100 + data.length(), buffer_.used());
+
+    // 读到末尾之后，从缓存开头读到的是绕回的数据
+    buffer_.advance(200);
+    EXPECT_EQ(data.substr(100), std::string(buffer_.read_ptr(), buffer_.used()));
+
+    // 超过可写空间的commit被忽略
+    std::size_t used = buffer_.used();
+    buffer_.commit(buffer_.available() + 1);
+    EXPECT_EQ(used, buffer_.used());
+}
+
+TEST_P(RingBufferTest, RandomReadWrite) {
+    std::mt19937 rng(5);
+    std::string expected;
+    uint32_t seed = 100;
+    for (int i = 0; i < 2000; i++) {
+        std::size_t length = rng() % 20000 + 1;
+        if ((rng() % 2) && (expected.length() + length <= buffer_.size())) {
+            std::string data = makeData(length, seed++);
+            ASSERT_EQ(0, buffer_.reserve(length));
+            memcpy(buffer_.write_ptr(), data.data(), length);
+            buffer_.commit(length);
+            expected += data;
+        } else {
+            std::string out(length, '\0');
+            out.resize(buffer_.read(&out[0], length));
+            ASSERT_EQ(expected.substr(0, out.length()), out) << "iteration:" << i;
+            expected.erase(0, out.length());
+        }
+        ASSERT_EQ(expected.length(), buffer_.used());
+        ASSERT_EQ(0, memcmp(expected.data(), buffer_.read_ptr(), expected.length())) << "iteration:" << i;
+    }
+    EXPECT_EQ((std::size_t)RingBuffer::kMinSize, buffer_.size());
+}
+
+TEST_P(RingBufferTest, ReserveKeepsWrappedData) {
+    const std::size_t size = buffer_.size();
+    std::string head = makeData(size, 6);
+    ASSERT_EQ(0, buffer_.write(head));
+    buffer_.advance(size / 2);
+    std::string tail = makeData(size / 4, 7);
+    ASSERT_EQ(0, buffer_.write(tail));
+
+    // 数据跨过末尾时扩充，扩充后顺序不变
+    std::string more = makeData(size, 8);
+    ASSERT_EQ(0, buffer_.write(more));
+    EXPECT_EQ(size * 2, buffer_.size());
+    EXPECT_EQ(head.substr(size / 2) + tail + more, readAll());
+
+    // 不能超过最大大小
+    EXPECT_EQ(-1, buffer_.reserve(buffer_.max_size() + 1));
+
+    // 为空时恢复到初始大小
+    ASSERT_EQ(0, buffer_.write(head));
+    EXPECT_EQ(-1, buffer_.shrink());
+    buffer_.advance(buffer_.used());
+    EXPECT_EQ(0, buffer_.shrink());
+    EXPECT_EQ(size, buffer_.size());
+    ASSERT_EQ(0, buffer_.write(tail));
+    EXPECT_EQ(tail, readAll());
+}
+
+INSTANTIATE_TEST_SUITE_P(Mirror, RingBufferTest, testing::Values(true, false));
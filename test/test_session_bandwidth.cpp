@@ -0,0 +1,122 @@
+#include <map>
+#include "gtest/gtest.h"
+#include "SessionBandwidth.h"
+
+namespace {
+
+const uint32_t kLimit = 1000000;
+const uint32_t kMinRate = SessionBandwidth::kMinRate;
+
+/**
+ * @brief 按每秒rate字节累计收到的字节数
+ */
+class Receiver {
+public:
+    explicit Receiver(SessionBandwidth &bandwidth) : bandwidth_(bandwidth) {}
+
+    void receive(uint32_t session_id, uint32_t rate) {
+        recv_bytes_[session_id] += rate;
+        bandwidth_.update(session_id, recv_bytes_[session_id], 1000);
+    }
+
+private:
+    SessionBandwidth &bandwidth_;
+    std::map<uint32_t, uint64_t> recv_bytes_;
+};
+
+}  // namespace
+
+TEST(SessionBandwidth, Disabled) {
+    SessionBandwidth bandwidth(0);
+    Receiver receiver(bandwidth);
+    receiver.receive(0, 100000);
+    EXPECT_FALSE(bandwidth.isEnabled());
+    EXPECT_TRUE(bandwidth.allocate().empty());
+}
+
+TEST(SessionBandwidth, SplitByWeight) {
+    SessionBandwidth bandwidth(kLimit);
+    Receiver receiver(bandwidth);
+    ASSERT_EQ(0, bandwidth.setWeight(1, 3));
+    receiver.receive(0, 100000);
+    receiver.receive(1, 100000);
+
+    // 第一次分配时需求不限
+    std::map<uint32_t, uint32_t> limits = bandwidth.allocate();
+    ASSERT_EQ(2u, limits.size());
+    EXPECT_EQ(kLimit / 4, limits[0]);
+    EXPECT_EQ(kLimit * 3 / 4, limits[1]);
+}
+
+TEST(SessionBandwidth, OnlyUpdatedSessions) {
+    SessionBandwidth bandwidth(kLimit);
+    Receiver receiver(bandwidth);
+    receiver.receive(0, 100000);
+    receiver.receive(1, 100000);
+    EXPECT_EQ(2u, bandwidth.allocate().size());
+
+    // 会话0本周期没有记录，不参与分配
+    receiver.receive(1, kLimit / 2);
+    std::map<uint32_t, uint32_t> limits = bandwidth.allocate();
+    ASSERT_EQ(1u, limits.size());
+    EXPECT_EQ(kLimit, limits[1]);
+}
+
+TEST(SessionBandwidth, UnusedShareGoesToOthers) {
+    SessionBandwidth bandwidth(kLimit);
+    Receiver receiver(bandwidth);
+    receiver.receive(0, kLimit / 2);
+    receiver.receive(1, kLimit / 2);
+    std::map<uint32_t, uint32_t> limits = bandwidth.allocate();
+    EXPECT_EQ(kLimit / 2, limits[0]);
+    EXPECT_EQ(kLimit / 2, limits[1]);
+
+    // 会话0用不满，只分到用量的1.25倍，会话1用满了份额，分到剩下的
+    receiver.receive(0, 100000);
+    receiver.receive(1, kLimit / 2);
+    limits = bandwidth.allocate();
+    EXPECT_EQ(125000u, limits[0]);
+    EXPECT_EQ(kLimit - 125000, limits[1]);
+
+    // 会话0的用量接近限额，需求恢复为不限，按权重重新平分
+    receiver.receive(0, 120000);
+    receiver.receive(1, kLimit - 125000);
+    limits = bandwidth.allocate();
+    EXPECT_EQ(kLimit / 2, limits[0]);
+    EXPECT_EQ(kLimit / 2, limits[1]);
+}
+
+TEST(SessionBandwidth, MinRate) {
+    SessionBandwidth bandwidth(kLimit);
+    Receiver receiver(bandwidth);
+    receiver.receive(0, kLimit / 2);
+    receiver.receive(1, kLimit / 2);
+    bandwidth.allocate();
+
+    // 几乎没有用量的会话也保留最低限额
+    receiver.receive(0, 1000);
+    receiver.receive(1, kLimit / 2);
+    std::map<uint32_t, uint32_t> limits = bandwidth.allocate();
+    EXPECT_EQ(kMinRate, limits[0]);
+    EXPECT_EQ(kLimit - kMinRate, limits[1]);
+
+    // 总限额不够时每个会话仍不低于最低限额
+    SessionBandwidth small(kMinRate);
+    Receiver small_receiver(small);
+    small_receiver.receive(0, 100000);
+    small_receiver.receive(1, 100000);
+    limits = small.allocate();
+    EXPECT_EQ(kMinRate, limits[0]);
+    EXPECT_EQ(kMinRate, limits[1]);
+}
+
+TEST(SessionBandwidth, Weight) {
+    SessionBandwidth bandwidth(kLimit);
+    EXPECT_EQ(-1, bandwidth.setWeight(0, 0));
+    EXPECT_EQ(-1, bandwidth.setWeight(0, SessionBandwidth::kMaxWeight + 1));
+    EXPECT_EQ(0, bandwidth.setWeight(0, 5));
+    EXPECT_EQ(5u, bandwidth.getWeight(0));
+
+    bandwidth.remove(0);
+    EXPECT_EQ(1u, bandwidth.getWeight(0));
+}
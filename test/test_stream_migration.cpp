@@ -0,0 +1,161 @@
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "StreamMigration.h"
+
+namespace {
+
+const uint32_t kProxyId = 1;
+const uint32_t kSource = 101;   // 旧隧道
+const uint32_t kTarget = 100;   // 新隧道
+
+/**
+ * @brief 收集交付给本地连接的数据
+ */
+class Receiver {
+public:
+    Receiver() : callback_([this](uint32_t, char *data, uint32_t length) {
+        delivered.append(data, length);
+        return 0;
+    }) {}
+
+    int onData(StreamMigration &migration, uint32_t tunnel_id, std::string data) {
+        return migration.onData(kProxyId, tunnel_id, &data[0], (uint32_t)data.length(), callback_);
+    }
+
+    int onPeerMigrate(StreamMigration &migration, uint32_t tunnel_id, uint64_t offset) {
+        return migration.onPeerMigrate(kProxyId, tunnel_id, offset, callback_);
+    }
+
+    std::string delivered;
+
+private:
+    StreamMigration::DeliverCallback callback_;
+};
+
+}  // namespace
+
+TEST(StreamMigration, DeliverWithoutMigration) {
+    StreamMigration migration;
+    Receiver receiver;
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kSource, "abc"));
+    EXPECT_EQ("abc", receiver.delivered);
+    EXPECT_FALSE(migration.isMigrating(kProxyId));
+
+    migration.onSent(kProxyId, 10);
+    migration.onSent(kProxyId, 5);
+    EXPECT_EQ(15u, migration.getSentOffset(kProxyId));
+}
+
+TEST(StreamMigration, PeerMigratesFirst) {
+    StreamMigration migration;
+    Receiver receiver;
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kSource, "0123"));
+
+    // 对端先切换：本端收到迁移消息时才开始迁移，旧隧道上还有6个字节没有到达
+    ASSERT_EQ(0, migration.start(kProxyId, kSource, kTarget, 0));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onPeerMigrate(migration, kTarget, 10));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kTarget, "new"));
+    EXPECT_EQ("0123", receiver.delivered);
+
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kSource, "456"));
+    EXPECT_TRUE(migration.isMigrating(kProxyId));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kSource, "789"));
+    EXPECT_EQ("0123456789new", receiver.delivered);
+    EXPECT_FALSE(migration.isMigrating(kProxyId));
+
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kTarget, "!"));
+    EXPECT_EQ("0123456789new!", receiver.delivered);
+    StreamMigration::Stats stats = migration.getStats();
+    EXPECT_EQ(1u, stats.started);
+    EXPECT_EQ(1u, stats.completed);
+    EXPECT_EQ(0u, stats.failed);
+    EXPECT_EQ(3u, stats.max_buffered);
+}
+
+TEST(StreamMigration, LocalMigratesFirst) {
+    StreamMigration migration;
+    Receiver receiver;
+    ASSERT_EQ(0, migration.start(kProxyId, kSource, kTarget, 0));
+    EXPECT_EQ(-1, migration.start(kProxyId, kSource, kTarget, 0));
+
+    // 对端切换前旧隧道上的数据照常交付
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kSource, "abc"));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onPeerMigrate(migration, kTarget, 3));
+    EXPECT_FALSE(migration.isMigrating(kProxyId));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kTarget, "def"));
+    EXPECT_EQ("abcdef", receiver.delivered);
+}
+
+TEST(StreamMigration, OldTunnelDataPastOffset) {
+    StreamMigration migration;
+    Receiver receiver;
+    ASSERT_EQ(0, migration.start(kProxyId, kSource, kTarget, 0));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onPeerMigrate(migration, kTarget, 4));
+    EXPECT_EQ(StreamMigration::kFailed, receiver.onData(migration, kSource, "01234"));
+    EXPECT_EQ("", receiver.delivered);
+    EXPECT_EQ(1u, migration.getStats().failed);
+}
+
+TEST(StreamMigration, OffsetBehindReceived) {
+    StreamMigration migration;
+    Receiver receiver;
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kSource, "01234"));
+    ASSERT_EQ(0, migration.start(kProxyId, kSource, kTarget, 0));
+    EXPECT_EQ(StreamMigration::kFailed, receiver.onPeerMigrate(migration, kTarget, 4));
+}
+
+TEST(StreamMigration, UnexpectedMigration) {
+    StreamMigration migration;
+    Receiver receiver;
+    EXPECT_EQ(StreamMigration::kFailed, receiver.onPeerMigrate(migration, kTarget, 0));
+    ASSERT_EQ(0, migration.start(kProxyId, kSource, kTarget, 0));
+    EXPECT_EQ(StreamMigration::kFailed, receiver.onPeerMigrate(migration, kSource, 0));
+}
+
+TEST(StreamMigration, DeferredFini) {
+    StreamMigration migration;
+    Receiver receiver;
+    EXPECT_EQ(StreamMigration::kClosed, migration.onFini(kProxyId, kSource));
+
+    ASSERT_EQ(0, migration.start(kProxyId, kSource, kTarget, 0));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onPeerMigrate(migration, kTarget, 6));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kTarget, "tail"));
+
+    // 新隧道上的关闭早于旧隧道的数据，收完旧隧道的数据并交付缓存后才关闭
+    EXPECT_EQ(StreamMigration::kDeferred, migration.onFini(kProxyId, kTarget));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kSource, "abc"));
+    EXPECT_EQ(StreamMigration::kClosed, receiver.onData(migration, kSource, "def"));
+    EXPECT_EQ("abcdeftail", receiver.delivered);
+}
+
+TEST(StreamMigration, BufferOverflow) {
+    StreamMigration migration;
+    Receiver receiver;
+    ASSERT_EQ(0, migration.start(kProxyId, kSource, kTarget, 0));
+    EXPECT_EQ(StreamMigration::kOk, receiver.onPeerMigrate(migration, kTarget, 1));
+
+    std::string chunk(StreamMigration::kMaxBufferLength / 4, 'x');
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(StreamMigration::kOk, receiver.onData(migration, kTarget, chunk));
+    }
+    EXPECT_EQ(StreamMigration::kFailed, receiver.onData(migration, kTarget, "y"));
+    EXPECT_EQ("", receiver.delivered);
+    EXPECT_EQ(1u, migration.getStats().failed);
+    EXPECT_EQ(StreamMigration::kMaxBufferLength + 1, migration.getStats().max_buffered);
+}
+
+TEST(StreamMigration, Expire) {
+    StreamMigration migration;
+    ASSERT_EQ(0, migration.start(kProxyId, kSource, kTarget, 1000));
+    ASSERT_EQ(0, migration.start(kProxyId + 1, kSource, kTarget, 1500));
+
+    EXPECT_TRUE(migration.expire(1999, 1000).empty());
+    std::vector<uint32_t> expired = migration.expire(2000, 1000);
+    ASSERT_EQ(1u, expired.size());
+    EXPECT_EQ(kProxyId, expired[0]);
+
+    migration.remove(kProxyId);
+    EXPECT_FALSE(migration.isMigrating(kProxyId));
+    EXPECT_TRUE(migration.isMigrating(kProxyId + 1));
+}
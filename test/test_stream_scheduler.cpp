@@ -0,0 +1,98 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "StreamScheduler.h"
+
+namespace {
+
+const char kHeader[] = "h";
+
+int push(StreamScheduler &scheduler, uint32_t proxy_id, const std::string &data, bool last = false)
+{
+    return scheduler.push(proxy_id, kHeader, 1, data.data(), data.length(), last);
+}
+
+/**
+ * @brief 发出所有排队的消息，返回去掉消息头后的数据
+ */
+std::vector<std::string> drain(StreamScheduler &scheduler)
+{
+    std::vector<std::string> sent;
+    scheduler.schedule(SIZE_MAX, [&sent](const char *data, size_t length) {
+        sent.push_back(std::string(data + 1, length - 1));
+        return 0;
+    });
+    return sent;
+}
+
+}  // namespace
+
+TEST(StreamScheduler, HighPriorityNotBlocked) {
+    StreamScheduler scheduler;
+    ASSERT_EQ(0, scheduler.setPriority(1, StreamScheduler::kLow));
+    ASSERT_EQ(0, scheduler.setPriority(2, StreamScheduler::kHigh));
+    std::string bulk(StreamScheduler::kBaseQuantum - 1, 'b');
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(0, push(scheduler, 1, bulk));
+    }
+    ASSERT_EQ(0, push(scheduler, 2, "api"));
+
+    // 低优先级每轮只发出一个quantum，之后轮到后排队的高优先级连接
+    std::vector<std::string> sent = drain(scheduler);
+    ASSERT_EQ(4u, sent.size());
+    EXPECT_EQ(bulk, sent[0]);
+    EXPECT_EQ("api", sent[1]);
+    EXPECT_TRUE(scheduler.empty());
+    EXPECT_EQ(0u, scheduler.queued());
+}
+
+TEST(StreamScheduler, DefaultPriorityNotKept) {
+    StreamScheduler scheduler;
+    ASSERT_EQ(0, scheduler.setPriority(1, StreamScheduler::kNormal));
+    EXPECT_EQ(0u, scheduler.size());
+
+    // 队列发空后不保存默认优先级连接的状态
+    ASSERT_EQ(0, push(scheduler, 1, "abc"));
+    EXPECT_EQ(1u, scheduler.size());
+    drain(scheduler);
+    EXPECT_EQ(0u, scheduler.size());
+
+    // 非默认优先级保留到连接关闭
+    ASSERT_EQ(0, scheduler.setPriority(2, StreamScheduler::kLow));
+    ASSERT_EQ(0, push(scheduler, 2, "abc"));
+    drain(scheduler);
+    EXPECT_EQ(StreamScheduler::kLow, scheduler.getPriority(2));
+    ASSERT_EQ(0, scheduler.setPriority(2, StreamScheduler::kNormal));
+    EXPECT_EQ(0u, scheduler.size());
+}
+
+TEST(StreamScheduler, ReleaseAfterDrain) {
+    StreamScheduler scheduler;
+    ASSERT_EQ(0, scheduler.setPriority(1, StreamScheduler::kHigh));
+    ASSERT_EQ(0, scheduler.setPriority(2, StreamScheduler::kHigh));
+    ASSERT_EQ(0, push(scheduler, 2, "tail"));
+
+    // 没有排队的消息立即删除，有排队的消息发完后删除
+    EXPECT_EQ(0, scheduler.release(1));
+    EXPECT_EQ(0, scheduler.release(2));
+    EXPECT_EQ(1u, scheduler.size());
+    EXPECT_EQ(-1, push(scheduler, 2, "late"));
+
+    std::vector<std::string> sent = drain(scheduler);
+    ASSERT_EQ(1u, sent.size());
+    EXPECT_EQ("tail", sent[0]);
+    EXPECT_EQ(0u, scheduler.size());
+    EXPECT_EQ(1u, scheduler.getStats().dropped);
+}
+
+TEST(StreamScheduler, RemoveDropsQueued) {
+    StreamScheduler scheduler;
+    ASSERT_EQ(0, push(scheduler, 1, "abc"));
+    ASSERT_EQ(0, push(scheduler, 1, "def", true));
+    EXPECT_EQ(0, scheduler.remove(1));
+    EXPECT_TRUE(scheduler.empty());
+    EXPECT_EQ(0u, scheduler.queued());
+    EXPECT_EQ(0u, scheduler.size());
+    EXPECT_EQ(2u, scheduler.getStats().dropped);
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "TunnelMsgHeader.h"
+#include "UdpFec.h"
+
+namespace {
+
+const size_t kDataShards = 4;
+const size_t kMaxParityShards = 4;
+const size_t kMaxPacketSize = 1400;
+
+/**
+ * @brief 对端发来的fec包头中带上其测得的丢包率，发送端按此决定校验包数
+ */
+void setPeerLoss(UdpFec &fec, uint8_t loss)
+{
+    char packet[UdpFec::kHeaderLength + 1] = {0};
+    uint32_t marker = kKcpConvReserved;
+    uint32_t group_id = 0x7fffffff;
+    memcpy(packet, &marker, sizeof(marker));
+    memcpy(packet + 4, &group_id, sizeof(group_id));
+    packet[UdpFec::kHeaderLength - 1] = (char)loss;
+    fec.input(packet, (int)sizeof(packet), [](const char *, int) {});
+}
+
+/**
+ * @brief 发出一组长度不同的包，丢掉erased中的fec包后交给接收端，返回接收端交付的包
+ * @param erased 分片序号，数据分片在前，校验分片在后
+ */
+std::set<std::string> sendGroup(const std::vector<std::string> &packets, const std::vector<size_t> &erased,
+                                UdpFec::Stats &recv_stats)
+{
+    std::vector<std::string> output;
+    UdpFec sender;
+    UdpFec receiver;
+    EXPECT_EQ(0, sender.init(kDataShards, kMaxParityShards, kMaxPacketSize, [&output](const char *data, int length) {
+        output.push_back(std::string(data, length));
+    }));
+    EXPECT_EQ(0, receiver.init(kDataShards, kMaxParityShards, kMaxPacketSize, [](const char *, int) {}));
+    setPeerLoss(sender, 255);
+
+    for (const std::string &packet : packets) {
+        EXPECT_EQ(0, sender.send(packet.data(), (int)packet.length(), 0));
+    }
+    EXPECT_EQ(kDataShards + kMaxParityShards, output.size());
+
+    std::set<std::string> delivered;
+    UdpFec::PacketCallback deliver = [&delivered](const char *data, int length) {
+        delivered.insert(std::string(data, length));
+    };
+    for (size_t i = 0; i < output.size(); i++) {
+        if (erased.end() != std::find(erased.begin(), erased.end(), i)) {
+            continue;
+        }
+        EXPECT_EQ(0, receiver.input(output[i].data(), (int)output[i].length(), deliver));
+    }
+    recv_stats = receiver.getStats();
+    return delivered;
+}
+
+std::vector<std::string> makePackets()
+{
+    std::vector<std::string> packets;
+    for (size_t i = 0; i < kDataShards; i++) {
+        std::string packet(24 + i * 100, '\0');
+        for (size_t j = 0; j < packet.length(); j++) {
+            packet[j] = (char)(i * 31 + j);
+        }
+        packets.push_back(packet);
+    }
+    return packets;
+}
+
+}  // namespace
+
+TEST(UdpFec, NoParityWithoutLoss) {
+    std::vector<std::string> output;
+    UdpFec fec;
+    ASSERT_EQ(0, fec.init(kDataShards, kMaxParityShards, kMaxPacketSize, [&output](const char *data, int length) {
+        output.push_back(std::string(data, length));
+    }));
+    for (const std::string &packet : makePackets()) {
+        ASSERT_EQ(0, fec.send(packet.data(), (int)packet.length(), 0));
+    }
+    EXPECT_EQ(kDataShards, output.size());
+    EXPECT_EQ(0u, fec.getStats().parity_sent);
+}
+
+TEST(UdpFec, RecoverUpToParityErasures) {
+    std::vector<std::string> packets = makePackets();
+    std::set<std::string> expected(packets.begin(), packets.end());
+
+    // 丢count个数据包，其余的丢失落在校验包上，共丢kMaxParityShards个
+    for (size_t count = 0; count <= kDataShards; count++) {
+        std::vector<size_t> erased;
+        for (size_t i = 0; i < count; i++) {
+            erased.push_back(kDataShards - 1 - i);
+        }
+        for (size_t i = count; i < kMaxParityShards; i++) {
+            erased.push_back(kDataShards + i);
+        }
+
+        UdpFec::Stats stats;
+        EXPECT_EQ(expected, sendGroup(packets, erased, stats)) << "erased data:" << count;
+        EXPECT_EQ(count, stats.recovered);
+    }
+}
+
+TEST(UdpFec, UnrecoverableBeyondParity) {
+    std::vector<std::string> packets = makePackets();
+    // 收到1个数据包和2个校验包，不足4个分片
+    std::vector<size_t> erased = {0, 1, 2, kDataShards, kDataShards + 1};
+
+    UdpFec::Stats stats;
+    std::set<std::string> delivered = sendGroup(packets, erased, stats);
+    EXPECT_EQ(1u, delivered.size());
+    EXPECT_EQ(1u, delivered.count(packets[3]));
+    EXPECT_EQ(0u, stats.recovered);
+}
@@ -16,5 +16,8 @@
 #define kcpNodeResend       2           // ikcp_nodelay中使用，快速重传模式，默认0关闭，可以设置2（2次ACK跨越将会直接重传）
 #define kcpNodeNc           1           // ikcp_nodelay中使用，是否关闭流控，默认是0代表不关闭，1代表关闭。
 #define kcpRxMinRto         5           // 最小RTO，默认100ms，快速模式下为30ms，该值可修改
+#define kcpMtu              1400        // ikcp_setmtu中使用，kcp默认mtu为1400
+#define kcpMaxMtu           1472        // 路径MTU探测的上限，以太网上udp载荷的最大值
+#define kcpOverhead         24          // kcp包头长度，mss = mtu - kcpOverhead
 
 #endif //KCP_CONFIG_H
@@ -544,6 +544,109 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 }
 
 
+//---------------------------------------------------------------------
+// gather 'size' bytes from vec[*index] + *offset into dst
+//---------------------------------------------------------------------
+static void ikcp_iov_copy(char *dst, const ikcpiov *vec, int *index, 
+	int *offset, int size)
+{
+	while (size > 0) {
+		const ikcpiov *iov = &vec[*index];
+		int avail = iov->len - *offset;
+		int chunk = (size < avail)? size : avail;
+		if (chunk > 0) {
+			memcpy(dst, iov->base + *offset, chunk);
+			dst += chunk;
+			size -= chunk;
+			*offset += chunk;
+		}
+		if (*offset >= iov->len) {
+			(*index)++;
+			*offset = 0;
+		}
+	}
+}
+
+
+//---------------------------------------------------------------------
+// user/upper level gather send, returns below zero for error
+//---------------------------------------------------------------------
+int ikcp_sendv(ikcpcb *kcp, const ikcpiov *vec, int count)
+{
+	IKCPSEG *seg;
+	IKCPSEG *old = NULL;
+	int index = 0, offset = 0;
+	int len = 0, extend = 0, sent = 0;
+	int nseg, i;
+
+	assert(kcp->mss > 0);
+	if (vec == NULL || count <= 0) return -1;
+
+	for (i = 0; i < count; i++) {
+		if (vec[i].len < 0) return -1;
+		if (vec[i].len > 0 && vec[i].base == NULL) return -1;
+		len += vec[i].len;
+	}
+	if (len <= 0) return -1;
+
+	// room left in the tail segment in streaming mode
+	if (kcp->stream != 0 && !iqueue_is_empty(&kcp->snd_queue)) {
+		old = iqueue_entry(kcp->snd_queue.prev, IKCPSEG, node);
+		if (old->len < kcp->mss) {
+			int capacity = kcp->mss - old->len;
+			extend = (len < capacity)? len : capacity;
+		}	else {
+			old = NULL;
+		}
+	}
+
+	// check fragment count before touching the queue, so that a
+	// message is either queued completely or not at all
+	if (len - extend <= 0) nseg = 0;
+	else if (len - extend <= (int)kcp->mss) nseg = 1;
+	else nseg = (len - extend + kcp->mss - 1) / kcp->mss;
+
+	if (nseg >= (int)IKCP_WND_RCV) return -2;
+
+	if (old != NULL && extend > 0) {
+		seg = ikcp_segment_new(kcp, old->len + extend);
+		assert(seg);
+		if (seg == NULL) {
+			return -2;
+		}
+		iqueue_add_tail(&seg->node, &kcp->snd_queue);
+		memcpy(seg->data, old->data, old->len);
+		ikcp_iov_copy(seg->data + old->len, vec, &index, &offset, extend);
+		seg->len = old->len + extend;
+		seg->frg = 0;
+		len -= extend;
+		iqueue_del_init(&old->node);
+		ikcp_segment_delete(kcp, old);
+		sent = extend;
+	}
+
+	// fragment
+	for (i = 0; i < nseg; i++) {
+		int size = len > (int)kcp->mss ? (int)kcp->mss : len;
+		seg = ikcp_segment_new(kcp, size);
+		assert(seg);
+		if (seg == NULL) {
+			return -2;
+		}
+		ikcp_iov_copy(seg->data, vec, &index, &offset, size);
+		seg->len = size;
+		seg->frg = (kcp->stream == 0)? (nseg - i - 1) : 0;
+		iqueue_init(&seg->node);
+		iqueue_add_tail(&seg->node, &kcp->snd_queue);
+		kcp->nsnd_que++;
+		len -= size;
+		sent += size;
+	}
+
+	return sent;
+}
+
+
 //---------------------------------------------------------------------
 // parse ack
 //---------------------------------------------------------------------
@@ -1242,6 +1345,58 @@ int ikcp_setmtu(ikcpcb *kcp, int mtu)
 	return 0;
 }
 
+//---------------------------------------------------------------------
+// split queued segments longer than mss after the mtu shrinks, so that
+// they are sent with the new size. stream mode only: segments in
+// snd_buf already have a sn and keep their length.
+//---------------------------------------------------------------------
+int ikcp_resegment(ikcpcb *kcp)
+{
+	struct IQUEUEHEAD *p, *next;
+
+	if (kcp->stream == 0) return -1;
+
+	for (p = kcp->snd_queue.next; p != &kcp->snd_queue; p = next) {
+		IKCPSEG *seg = iqueue_entry(p, IKCPSEG, node);
+		struct IQUEUEHEAD parts;
+		int offset, count = 0;
+
+		next = p->next;
+		if (seg->len <= kcp->mss) continue;
+
+		// allocate every part first, the queue is unchanged on failure
+		iqueue_init(&parts);
+		for (offset = 0; offset < (int)seg->len; offset += kcp->mss) {
+			int size = _imin_(seg->len - offset, kcp->mss);
+			IKCPSEG *part = ikcp_segment_new(kcp, size);
+			if (part == NULL) {
+				while (!iqueue_is_empty(&parts)) {
+					part = iqueue_entry(parts.next, IKCPSEG, node);
+					iqueue_del(&part->node);
+					ikcp_segment_delete(kcp, part);
+				}
+				return -2;
+			}
+			memcpy(part->data, seg->data + offset, size);
+			part->len = size;
+			part->frg = 0;
+			iqueue_add_tail(&part->node, &parts);
+			count++;
+		}
+
+		while (!iqueue_is_empty(&parts)) {
+			IKCPSEG *part = iqueue_entry(parts.next, IKCPSEG, node);
+			iqueue_del(&part->node);
+			iqueue_add_tail(&part->node, next);
+		}
+		iqueue_del(&seg->node);
+		ikcp_segment_delete(kcp, seg);
+		kcp->nsnd_que += count - 1;
+	}
+
+	return 0;
+}
+
 int ikcp_interval(ikcpcb *kcp, int interval)
 {
 	if (interval > 5000) interval = 5000;
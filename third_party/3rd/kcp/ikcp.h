@@ -319,6 +319,18 @@ struct IKCPCB
 
 typedef struct IKCPCB ikcpcb;
 
+
+//---------------------------------------------------------------------
+// IKCPIOV: scatter/gather buffer for ikcp_sendv
+//---------------------------------------------------------------------
+struct IKCPIOV
+{
+	const char *base;
+	int len;
+};
+
+typedef struct IKCPIOV ikcpiov;
+
 #define IKCP_LOG_OUTPUT			1
 #define IKCP_LOG_INPUT			2
 #define IKCP_LOG_SEND			4
@@ -358,6 +370,11 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len);
 // user/upper level send, returns below zero for error
 int ikcp_send(ikcpcb *kcp, const char *buffer, int len);
 
+// user/upper level gather send: 'count' buffers are sent as one message,
+// copied straight into the outgoing segments. returns bytes queued, or
+// below zero for error (nothing is queued on error)
+int ikcp_sendv(ikcpcb *kcp, const ikcpiov *vec, int count);
+
 // update state (call it repeatedly, every 10ms-100ms), or you can ask 
 // ikcp_check when to call it again (without ikcp_input/_send calling).
 // 'current' - current timestamp in millisec. 
@@ -384,6 +401,10 @@ int ikcp_peeksize(const ikcpcb *kcp);
 // change MTU size, default is 1400
 int ikcp_setmtu(ikcpcb *kcp, int mtu);
 
+// split queued segments to the current mss (stream mode), call after
+// ikcp_setmtu shrinks the mtu. returns -1 in message mode
+int ikcp_resegment(ikcpcb *kcp);
+
 // set maximum window size: sndwnd=32, rcvwnd=32 by default
 int ikcp_wndsize(ikcpcb *kcp, int sndwnd, int rcvwnd);
 
@@ -0,0 +1,398 @@
+#ifndef X_RING_BUFFER_H
+#define X_RING_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief 环形缓存，容量为2的整数次幂，仅供单线程使用，不加锁
+ * @note 缓存区映射两次（后半部分是前半部分的镜像），因此任意位置开始的已用数据和可写空间在地址上都是连续的，
+ *       读写都不需要整理内存；不支持内存镜像的平台上，commit时把写入的数据拷贝到镜像区，效果相同
+ */
+class RingBuffer {
+public:
+    RingBuffer() : buffer_(nullptr), size_(0), mask_(0), begin_(0), used_(0),
+                   init_size_(0), max_size_(0), mirror_(true), mirrored_(false) {
+    }
+
+    ~RingBuffer() {
+        fini();
+    }
+
+    /**
+     * @brief 初始化
+     * @param size 初始大小，会向上取整为2的整数次幂，且不小于kMinSize
+     * @param max_size 可扩充的最大大小，同样会向上取整
+     * @param mirror false：不使用内存镜像，总是由commit拷贝，用于测试
+     * @return 0：成功；-1：失败；
+     */
+    int init(std::size_t size = kMinSize, std::size_t max_size = kDefaultMaxSize, bool mirror = true) {
+        fini();
+        mirror_ = mirror;
+
+        size = roundUp(size);
+        max_size = roundUp(max_size);
+        if (max_size < size) {
+            max_size = size;
+        }
+        if (0 != allocate(size)) {
+            return -1;
+        }
+        init_size_ = size;
+        max_size_ = max_size;
+
+        return 0;
+    }
+
+    /**
+     * @brief 释放资源
+     * @return
+     */
+    int fini() {
+        release(buffer_, size_, mirrored_);
+        buffer_ = nullptr;
+        size_ = 0;
+        mask_ = 0;
+        begin_ = 0;
+        used_ = 0;
+        mirrored_ = false;
+        return 0;
+    }
+
+    /**
+     * @brief 是否为内存镜像映射
+     */
+    bool mirrored() const {
+        return mirrored_;
+    }
+
+    /**
+     * @brief 缓存大小
+     */
+    std::size_t size() const {
+        return size_;
+    }
+
+    /**
+     * @brief 可扩充的最大大小
+     */
+    std::size_t max_size() const {
+        return max_size_;
+    }
+
+    /**
+     * @brief 已用缓存大小
+     */
+    std::size_t used() const {
+        return used_;
+    }
+
+    /**
+     * @brief 可用缓存大小（不扩充）
+     */
+    std::size_t available() const {
+        return size_ - used_;
+    }
+
+    /**
+     * @brief 获取读指针，其后used()字节连续可读
+     */
+    char *read_ptr() const {
+        return buffer_ + begin_;
+    }
+
+    /**
+     * @brief 获取写指针，其后available()字节连续可写，写完后调用commit
+     */
+    char *write_ptr() const {
+        return buffer_ + ((begin_ + used_) & mask_);
+    }
+
+    /**
+     * @brief 保证至少有length字节的可写空间，不够时按2倍扩充，不超过max_size
+     * @return 0：成功；-1：超过最大大小或内存不足；
+     */
+    int reserve(std::size_t length) {
+        if (nullptr == buffer_) {
+            return -1;
+        }
+        if (available() >= length) {
+            return 0;
+        }
+
+        std::size_t new_size = size_;
+        while ((new_size - used_) < length) {
+            new_size <<= 1;
+            if (new_size > max_size_) {
+                return -1;
+            }
+        }
+
+        return resize(new_size);
+    }
+
+    /**
+     * @brief 提交通过write_ptr写入的length字节
+     */
+    void commit(std::size_t length) {
+        if (length > available()) {
+            return;
+        }
+
+        if (!mirrored_) {
+            // 把写入的数据同步到另一半
+            std::size_t pos = (begin_ + used_) & mask_;
+            std::size_t lower = (pos + length > size_) ? (size_ - pos) : length;
+            memcpy(buffer_ + size_ + pos, buffer_ + pos, lower);
+            if (lower < length) {
+                memcpy(buffer_, buffer_ + size_, length - lower);
+            }
+        }
+        used_ += length;
+    }
+
+    /**
+     * @brief 写入数据，空间不够时自动扩充
+     * @return 0：成功；-1：失败；
+     */
+    int write(const char *buffer, std::size_t length) {
+        if ((nullptr == buffer) || (length <= 0)) {
+            return -1;
+        }
+        if (0 != reserve(length)) {
+            return -1;
+        }
+
+        memcpy(write_ptr(), buffer, length);
+        commit(length);
+        return 0;
+    }
+
+    int write(const std::string &data) {
+        return this->write(data.c_str(), data.length());
+    }
+
+    /**
+     * @brief 读取数据，但不修改缓存状态
+     */
+    std::size_t peek(char *buffer, std::size_t length) const {
+        if ((nullptr == buffer) || (length <= 0)) {
+            return 0;
+        }
+
+        if (length > used_) {
+            length = used_;
+        }
+        memcpy(buffer, read_ptr(), length);
+        return length;
+    }
+
+    /**
+     * @brief 读取数据，同时修改缓存状态
+     */
+    std::size_t read(char *buffer, std::size_t length) {
+        length = peek(buffer, length);
+        advance(length);
+        return length;
+    }
+
+    /**
+     * @brief 更新缓存状态，与read_ptr/peek配合使用
+     */
+    void advance(std::size_t length) {
+        if (length > used_) {
+            return;
+        }
+
+        used_ -= length;
+        begin_ = (begin_ + length) & mask_;
+        if (0 == used_) {
+            begin_ = 0;
+        }
+    }
+
+    /**
+     * @brief 清空数据，重置
+     */
+    int reset() {
+        begin_ = 0;
+        used_ = 0;
+
+        return 0;
+    }
+
+    /**
+     * @brief 缓存为空时恢复到初始大小，释放扩充出来的内存
+     * @return 0：成功；-1：缓存不为空或失败；
+     */
+    int shrink() {
+        if (0 != used_) {
+            return -1;
+        }
+        if (size_ <= init_size_) {
+            return 0;
+        }
+
+        return resize(init_size_);
+    }
+
+    static const std::size_t kMinSize = 64 * 1024;
+    static const std::size_t kDefaultMaxSize = 16 * 1024 * 1024;
+
+private:
+    static std::size_t roundUp(std::size_t size) {
+        std::size_t n = kMinSize;
+        while (n < size) {
+            n <<= 1;
+        }
+        return n;
+    }
+
+    int allocate(std::size_t size) {
+        buffer_ = mirror_ ? mapMirrored(size) : nullptr;
+        mirrored_ = (nullptr != buffer_);
+        if (nullptr == buffer_) {
+            buffer_ = new(std::nothrow) char[size * 2];
+            if (nullptr == buffer_) {
+                return -1;
+            }
+        }
+        size_ = size;
+        mask_ = size - 1;
+        begin_ = 0;
+        used_ = 0;
+
+        return 0;
+    }
+
+    int resize(std::size_t new_size) {
+        char *old_buffer = buffer_;
+        std::size_t old_size = size_;
+        bool old_mirrored = mirrored_;
+        std::size_t old_begin = begin_;
+        std::size_t used = used_;
+
+        if (0 != allocate(new_size)) {
+            buffer_ = old_buffer;
+            size_ = old_size;
+            mask_ = old_size - 1;
+            begin_ = old_begin;
+            used_ = used;
+            mirrored_ = old_mirrored;
+            return -1;
+        }
+
+        if (used > 0) {
+            memcpy(buffer_, old_buffer + old_begin, used);
+            if (!mirrored_) {
+                memcpy(buffer_ + size_, buffer_, used);
+            }
+        }
+        used_ = used;
+        release(old_buffer, old_size, old_mirrored);
+
+        return 0;
+    }
+
+    static void release(char *buffer, std::size_t size, bool mirrored) {
+        if (nullptr == buffer) {
+            return;
+        }
+#if defined(__linux__)
+        if (mirrored) {
+            munmap(buffer, size * 2);
+            return;
+        }
+#endif
+        delete[] buffer;
+    }
+
+    /**
+     * @brief 同一块共享内存连续映射两次
+     * @return 失败返回nullptr，由调用方改用普通内存
+     */
+    static char *mapMirrored(std::size_t size) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+        if (0 != (size % (std::size_t)sysconf(_SC_PAGESIZE))) {
+            return nullptr;
+        }
+
+        int fd = (int)syscall(SYS_memfd_create, "x_ring_buffer", 0);
+        if (fd < 0) {
+            return nullptr;
+        }
+        if (0 != ftruncate(fd, (off_t)size)) {
+            close(fd);
+            return nullptr;
+        }
+
+        void *addr = mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == addr) {
+            close(fd);
+            return nullptr;
+        }
+
+        char *base = (char *)addr;
+        void *lower = mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        void *upper = mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        close(fd);
+        if ((MAP_FAILED == lower) || (MAP_FAILED == upper)) {
+            munmap(addr, size * 2);
+            return nullptr;
+        }
+
+        return base;
+#else
+        (void)size;
+        return nullptr;
+#endif
+    }
+
+private:
+    /**
+     * @brief 缓存指针，实际大小为size_的2倍，后一半是前一半的镜像
+     */
+    char *buffer_;
+
+    /**
+     * @brief 缓存大小，2的整数次幂
+     */
+    std::size_t size_;
+    std::size_t mask_;
+
+    /**
+     * @brief 起始位置，始终小于size_
+     */
+    std::size_t begin_;
+
+    /**
+     * @brief 已使用大小
+     */
+    std::size_t used_;
+
+    /**
+     * @brief 初始大小和最大大小
+     */
+    std::size_t init_size_;
+    std::size_t max_size_;
+
+    /**
+     * @brief 是否尝试内存镜像映射
+     */
+    bool mirror_;
+
+    /**
+     * @brief 是否为内存镜像映射，否则commit时需要拷贝
+     */
+    bool mirrored_;
+};
+
+#endif //X_RING_BUFFER_H